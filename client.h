@@ -37,6 +37,45 @@ static char Sccsid_client_h[]= "@(#)client.h 0.7 06/20/2005 13:59:36";
 
 #define DISCARD_PORT	9
 
+/* most file data to hand sendfile at once (one timeout interval) */
+#define SENDFILE_BLK_SIZE	(1024*1024)
+
+/* io_uring input (client_uring.c): entries stat'ed per submission, and
+   queued files opened and read ahead */
+#define URING_STAT_BATCH	64
+#define URING_PREFETCH		8
+
+/* most directory scanner threads (client_scan.c) */
+#define MAX_SCAN_THREADS	32
+
+/* send order policies (ClientOpt.sched, see q_key in client_queue.c) */
+#define SCHED_PRIO		0		/* directory priority, then oldest */
+#define SCHED_WFQ		1		/* weighted fair queuing across directories */
+#define SCHED_EDF		2		/* earliest deadline (mtime + queue_ttl) */
+#define SCHED_SJF		3		/* oldest, with a byte of size as a usec of age */
+#define SCHED_NAMES		{"prio", "wfq", "edf", "sjf", NULL}
+
+/* nsecs of a file's mtime, the queue time sent with protocol 2 */
+#ifdef __linux__
+#define ST_MTIME_NSEC(p_st)	((p_st)->st_mtim.tv_nsec)
+#else
+#define ST_MTIME_NSEC(p_st)	0L
+#endif
+
+/* get_next_file result: the next item may not use a reserved slot (-R) */
+#define NEXT_HELD		(-2)
+
+/* events to wait for on a descriptor (client_event.c) */
+#define EVENT_READ		1
+#define EVENT_WRITE		2
+
+/* what a timer is for (client_timer.c) */
+#define TIMER_ACK		1		/* ack deadline of a sent product */
+#define TIMER_TTL		2		/* queue_ttl of a product waiting to be sent */
+#define TIMER_INPUT		3		/* next input poll */
+#define TIMER_CONNECT	4		/* reconnect, or connect timeout */
+#define TIMER_SEND		5		/* send made no progress for the timeout */
+
 #define INPUT_SUBDIR_NAME	"input"
 #define SENT_SUBDIR_NAME	"sent"
 #define FAIL_SUBDIR_NAME	"fail"
@@ -62,18 +101,50 @@ struct {
 	char			strip_ccb;		/* strip ccb headers (1 or 0) */
 	time_t			refresh_interval;/* queue refresh/resort interval */
 	int				max_queue_len;	/* maximum number of items to poll/sort */
+	char			oldest_first;	/* queue the oldest of a whole directory */
 	int				sent_count;		/* maximum number of files in sent dir */
 	char *			connect_wmo;	/* send a connection msg with this wmo */
 	char *			source;			/* string identifying this data source */
 	int				shm_region;		/* shared memory region for acq_stats */
 	int				host_id;		/* host_id for this datastream */
 	int				link_id;		/* link_id for this datastream */
+	size_t			sendfile_min;	/* sendfile prods this big (0=never) */
+	char			io_uring;		/* batch stat and read ahead with io_uring */
+	char			inotify;		/* watch input dirs with inotify */
+	int				scan_threads;	/* directory scanner threads */
+	char			sched;			/* send order policy, SCHED_* */
+	int *			sched_weights;	/* SCHED_WFQ weight of each input dir */
+	int				reserved;		/* window slots kept for the first dir */
+	int				protocol;		/* protocol to ask for (connect msg) */
 } ClientOpt;
 
+extern char *SchedName[];		/* ClientOpt.sched names (client_queue.c) */
+
+/* hash index of the products in the ack and retr lists, keyed by device
+   and inode, or by filename if the inode is not known */
 typedef struct {
+	prod_info_t **slot;			/* open addressing, linear probing */
+	unsigned size;				/* a power of 2 */
 	int count;
+	int by_name;				/* entries keyed by filename */
+} prod_index_t;
+
+/* timer in the client timer wheel */
+typedef struct wtimer_struct {
+	struct wtimer_struct *p_next;	/* NULL if not set */
+	struct wtimer_struct *p_prev;
+	long long	expire;				/* event_now msecs */
+	int			slot;				/* wheel slot, -1 if expired */
+	int			type;				/* TIMER_* */
+	void *		p_arg;				/* what it is for (product) */
+} wtimer_t;
+
+typedef struct {
+	int count;
+	int bulk;					/* products below the top priority */
 	prod_info_t *p_head;
 	prod_info_t *p_tail;
+	prod_index_t *p_index;		/* index of the list items, or NULL */
 } prod_list_t;
 
 typedef struct {
@@ -81,15 +152,47 @@ typedef struct {
 	prod_list_t	free_list;
 	prod_list_t	ack_list;
 	prod_list_t	retr_list;
+	prod_index_t window;		/* ack_list and retr_list items */
+	wtimer_t	*timer;			/* ack deadline or TTL of each prod */
 } prod_tbl_t;
 
 /* prototypes */
 int poll_and_send(void);
-int get_next_file(prod_tbl_t *p_tbl, prod_info_t *p_prod);
+int get_next_file(prod_tbl_t *p_tbl, prod_info_t *p_prod, int reserved,
+			int above);
+void sched_stats(void);
+prod_info_t *find_prod(prod_index_t *p_index, char *filename, dev_t dev,
+			ino_t ino);
 void retry_send(prod_info_t *p_prod);
 void abort_send(prod_info_t *p_prod);
 void finish_send(prod_info_t *p_prod);
 int client_init(void);
 int client_close(void);
+int event_init(void);
+int event_watch(int fd, int events);
+int event_wait(long long deadline);
+int event_ready(int fd);
+long long event_now(void);
+void timer_init(long long now);
+void timer_set(wtimer_t *p_timer, int type, long long expire);
+void timer_cancel(wtimer_t *p_timer);
+wtimer_t *timer_expired(long long now);
+long long timer_next(void);
+#ifdef __linux__
+int notify_init(void);
+int notify_watch(void);
+int notify_next(char *pathbuf, int *p_dir, int *p_closed);
+int notify_fd(void);
+int scan_pool_init(void);
+void scan_pool_run(void (*func)(int job), int count);
+#endif
+#ifdef INCLUDE_IO_URING
+struct stat;
+int uring_input_init(void);
+int uring_stat_batch(int dir_fd, char *names[], int count,
+			struct stat *p_stats, int *p_errs);
+void uring_prefetch(prod_info_t *p_items, int count);
+int uring_take_file(char *filename, char *buf, size_t bufsiz, int *p_nread);
+#endif
 
 #endif
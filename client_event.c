@@ -0,0 +1,382 @@
+/*******************************************************************************
+FILE NAME
+	client_event.c
+
+FILE DESCRIPTION
+	Event waiting for the client send loop.  poll_and_send sets which of
+	a few descriptors it wants to read or write and a deadline, and waits
+	for whichever comes first in one call.  On Linux this is an epoll set
+	with a timerfd for the deadline, elsewhere poll() with a timeout.
+	Deadlines are in milliseconds on the event_now clock.
+
+FUNCTIONS
+	event_init		- set up the event set
+	event_watch		- set the events wanted on a descriptor
+	event_wait		- wait for events or a deadline
+	event_ready		- events on a descriptor from the last wait
+	event_now		- current time in milliseconds
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_client_event_c[]= "@(#)client_event.c 0.1 10/16/2026 12:00:00";
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "share.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+#define EVENT_MAX_FDS	4		/* descriptors watched at once */
+
+/* descriptors watched, and what the last wait found on them */
+typedef struct {
+	int				fd;				/* -1 if the slot is free */
+	int				events;			/* EVENT_* wanted */
+	int				ready;			/* EVENT_* from the last wait */
+} event_fd_t;
+
+static event_fd_t EventFds[EVENT_MAX_FDS];
+
+#ifdef __linux__
+static int EpollFd = -1;
+static int TimerFd = -1;
+static long long TimerArmed = -1;	/* deadline the timerfd is set to */
+#endif
+
+/*******************************************************************************
+FUNCTION NAME
+	int event_init(void)
+
+FUNCTION DESCRIPTION
+	Set up the event set.  On Linux, create the epoll set and the timerfd
+	that wakes it at a deadline.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+int event_init(void)
+{
+	int i;
+#ifdef __linux__
+	struct epoll_event ev;
+#endif
+
+	for (i = 0; i < EVENT_MAX_FDS; i++) {
+		EventFds[i].fd = -1;
+		EventFds[i].events = EventFds[i].ready = 0;
+	}
+
+#ifdef __linux__
+	if (EpollFd >= 0) {
+		return 0;
+	}
+	if ((EpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_create1, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+	if ((TimerFd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL timerfd_create, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = TimerFd;
+	if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, TimerFd, &ev) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_ctl timerfd, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+#endif
+
+	return 0;
+} /* end event_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	int event_watch(int fd, int events)
+
+FUNCTION DESCRIPTION
+	Set the events (EVENT_READ, EVENT_WRITE) wanted on a descriptor.  0
+	stops watching it; do that before it is closed.  The epoll set is
+	only changed when the events wanted change, so this can be called
+	on every pass of the send loop.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				fd				I	descriptor
+	int				events			I	EVENT_* wanted, or 0
+
+RETURNS
+	 0	Normal return
+	-1	Error (too many descriptors, or epoll_ctl failed)
+*******************************************************************************/
+int event_watch(int fd, int events)
+{
+	event_fd_t *p_slot;
+	int i;
+#ifdef __linux__
+	struct epoll_event ev;
+	int op;
+#endif
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	for (p_slot = NULL, i = 0; i < EVENT_MAX_FDS; i++) {
+		if (EventFds[i].fd == fd) {
+			p_slot = &EventFds[i];
+			break;
+		}
+		if (EventFds[i].fd < 0 && !p_slot) {
+			p_slot = &EventFds[i];
+		}
+	}
+	if (!p_slot) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR more than %d event descriptors\n",
+				LOG_PREFIX, EVENT_MAX_FDS);
+		return -1;
+	}
+	if (p_slot->fd == fd && p_slot->events == events) {
+		return 0;
+	}
+	if (p_slot->fd < 0 && !events) {
+		return 0;
+	}
+
+#ifdef __linux__
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((events & EVENT_READ) ? EPOLLIN|EPOLLRDHUP : 0)
+			| ((events & EVENT_WRITE) ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+	op = !events ? EPOLL_CTL_DEL
+			: p_slot->fd < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	if (epoll_ctl(EpollFd, op, fd, &ev) < 0 && events) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_ctl %d, %s\n",
+				LOG_PREFIX, fd, strerror(errno));
+		return -1;
+	}
+#endif
+
+	if (events) {
+		p_slot->fd = fd;
+		p_slot->events = events;
+	} else {
+		p_slot->fd = -1;
+		p_slot->events = 0;
+	}
+	p_slot->ready = 0;
+
+	return 0;
+} /* end event_watch */
+
+/*******************************************************************************
+FUNCTION NAME
+	int event_wait(long long deadline)
+
+FUNCTION DESCRIPTION
+	Wait until a watched descriptor is ready or the deadline (event_now
+	milliseconds, < 0 for none) has passed.  What was found is returned
+	by event_ready until the next wait.  A signal ends the wait early.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long long		deadline		I	when to stop waiting, or < 0
+
+RETURNS
+	>0	Number of descriptors ready
+	 0	Deadline passed (or interrupted)
+	-1	Error
+*******************************************************************************/
+int event_wait(long long deadline)
+{
+	int nready;
+	int i;
+	int j;
+#ifdef __linux__
+	struct epoll_event events[EVENT_MAX_FDS+1];
+	struct itimerspec its;
+	unsigned long long expirations;
+	int nevents;
+#else
+	struct pollfd pfds[EVENT_MAX_FDS];
+	int timeout;
+	int npfds;
+#endif
+
+	for (i = 0; i < EVENT_MAX_FDS; i++) {
+		EventFds[i].ready = 0;
+	}
+
+#ifdef __linux__
+	if (deadline != TimerArmed) {
+		/* an absolute time of 0 would disarm it */
+		memset(&its, 0, sizeof(its));
+		if (deadline >= 0) {
+			its.it_value.tv_sec = MAX(deadline, 1) / 1000;
+			its.it_value.tv_nsec = (MAX(deadline, 1) % 1000) * 1000000L;
+		}
+		if (timerfd_settime(TimerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL timerfd_settime, %s\n",
+					LOG_PREFIX, strerror(errno));
+			return -1;
+		}
+		TimerArmed = deadline;
+	}
+
+	if ((nevents = epoll_wait(EpollFd, events, EVENT_MAX_FDS+1, -1)) < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_wait, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+
+	for (nready = 0, i = 0; i < nevents; i++) {
+		if (events[i].data.fd == TimerFd) {
+			/* the deadline passed, it must be set again to fire again */
+			if (read(TimerFd, &expirations, sizeof(expirations)) > 0) {
+				TimerArmed = -1;
+			}
+			continue;
+		}
+		for (j = 0; j < EVENT_MAX_FDS; j++) {
+			if (EventFds[j].fd != events[i].data.fd) {
+				continue;
+			}
+			if (events[i].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) {
+				EventFds[j].ready |= EVENT_READ;
+			}
+			if (events[i].events & (EPOLLOUT|EPOLLHUP|EPOLLERR)) {
+				EventFds[j].ready |= EVENT_WRITE;
+			}
+			nready++;
+		}
+	}
+#else
+	for (npfds = 0, i = 0; i < EVENT_MAX_FDS; i++) {
+		if (EventFds[i].fd < 0) {
+			continue;
+		}
+		pfds[npfds].fd = EventFds[i].fd;
+		pfds[npfds].events = ((EventFds[i].events & EVENT_READ) ? POLLIN : 0)
+				| ((EventFds[i].events & EVENT_WRITE) ? POLLOUT : 0);
+		pfds[npfds].revents = 0;
+		npfds++;
+	}
+	if (deadline < 0) {
+		timeout = -1;
+	} else if ((timeout = deadline - event_now()) < 0) {
+		timeout = 0;
+	}
+
+	if ((nready = poll(pfds, npfds, timeout)) < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL poll, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < npfds; i++) {
+		for (j = 0; j < EVENT_MAX_FDS; j++) {
+			if (EventFds[j].fd != pfds[i].fd) {
+				continue;
+			}
+			if (pfds[i].revents & (POLLIN|POLLHUP|POLLERR)) {
+				EventFds[j].ready |= EVENT_READ;
+			}
+			if (pfds[i].revents & (POLLOUT|POLLHUP|POLLERR)) {
+				EventFds[j].ready |= EVENT_WRITE;
+			}
+		}
+	}
+#endif
+
+	return nready;
+} /* end event_wait */
+
+/*******************************************************************************
+FUNCTION NAME
+	int event_ready(int fd)
+
+FUNCTION DESCRIPTION
+	Get the events found on a descriptor by the last event_wait.  Errors
+	and hangups are reported as both readable and writable, so the next
+	read or write finds out what happened.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				fd				I	descriptor
+
+RETURNS
+	EVENT_* found, 0 if none (or the descriptor is not watched)
+*******************************************************************************/
+int event_ready(int fd)
+{
+	int i;
+
+	for (i = 0; i < EVENT_MAX_FDS; i++) {
+		if (EventFds[i].fd == fd && fd >= 0) {
+			return EventFds[i].ready;
+		}
+	}
+
+	return 0;
+} /* end event_ready */
+
+/*******************************************************************************
+FUNCTION NAME
+	long long event_now(void)
+
+FUNCTION DESCRIPTION
+	Get the time in milliseconds on a clock that is not changed by setting
+	the system time.  Deadlines for event_wait are on this clock.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	milliseconds
+*******************************************************************************/
+long long event_now(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+#endif
+	return (long long)time(NULL) * 1000;
+} /* end event_now */
@@ -54,6 +54,21 @@ int client_init(void)
 		}
 #	endif
 
+#	ifdef __linux__
+		if (notify_init() < 0) {
+			return -1;
+		}
+		if (scan_pool_init() < 0) {
+			return -1;
+		}
+#	endif
+
+#	ifdef INCLUDE_IO_URING
+		if (uring_input_init() < 0) {
+			return -1;
+		}
+#	endif
+
 	return 0;
 }
 
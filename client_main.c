@@ -13,7 +13,6 @@ FUNCTIONS
 	setup_sig_handler	- register signal handlers
 	stop_sighandler		- handles shutdown signals SIGTERM, SIGINT, etc.
 	pipe_sighandler		- handles SIGPIPE (remote socket close)
-	alarm_sighandler	- handle SIGALRM (timeouts)
 
 HISTORY
 	Last delta date and time:  %G% %U%
@@ -49,7 +48,6 @@ static void usage(void);
 static void setup_sig_handler(void);
 void stop_sighandler(int signum);
 void pipe_sighandler(int signum);
-void alarm_sighandler(int signum);
 
 /*******************************************************************************
 FUNCTION NAME
@@ -122,6 +120,7 @@ int main (int argc, char *argv[])
 		status = 0;
 	}
 
+	sched_stats();
 	CS_LOG_PROD(PRODUCT_FP,
 		"STATUS EXIT %d [%s] pid(%d) %s to=%s/%d dir(%s%s)\n",
 			status, Program, getpid(),
@@ -167,6 +166,15 @@ GLOBAL VARIABLES (from ClientOpt structure)
 	char			wait_last_file	O	don't send the last file
 	time_t			refresh_interval O	queue refresh/resort interval
 	int 			max_queue_len	O	max number of items to poll and sort
+	char			oldest_first	O	queue the oldest of a whole directory
+	size_t			sendfile_min	O	sendfile prods this big (0=never)
+	char			io_uring		O	batch stat and read ahead with io_uring
+	char			inotify			O	watch input dirs with inotify
+	int				scan_threads	O	directory scanner threads
+	char			sched			O	send order policy
+	int *			sched_weights	O	wfq weight of each input dir
+	int				reserved		O	window slots kept for the first dir
+	int				protocol		O	protocol to ask for
 	int				LogFile.flags	O	logging options flags
 
 RETURNS
@@ -182,6 +190,8 @@ static void process_args(int argc, char *argv[])
 	size_t	pathlen;
 	char	currdir[FILENAME_LEN];
 	char *	p_units;
+	char *	p_weights = NULL;
+	int		i;
 
 	/* default options */
 	ClientOpt.port = DFLT_LISTEN_PORT;
@@ -199,9 +209,14 @@ static void process_args(int argc, char *argv[])
 	ClientOpt.sent_dir = NULL;
 	ClientOpt.fail_dir = NULL;
 	ClientOpt.max_queue_len = DFLT_MAX_QUEUE;
+	ClientOpt.oldest_first = 0;
+	ClientOpt.sched = SCHED_PRIO;
+	ClientOpt.sched_weights = NULL;
+	ClientOpt.reserved = 0;
+	ClientOpt.protocol = PROTOCOL_1;
 	ClientOpt.sent_count = DFLT_SENT_COUNT;
 
-	while ((c = getopt(argc, argv, "dv:ap:n:t:i:l:w:r:b:c:s:m:h:k:xD:P:S:F:LI:Q:N:")) != -1) {
+	while ((c = getopt(argc, argv, "dv:ap:n:t:i:l:w:r:b:c:s:m:h:k:xD:P:S:F:LI:Q:ON:z:UWT:o:R:V:")) != -1) {
 		switch (c) {
 			case 'd':
 				fprintf(stdout, "%s: Setting debug option\n", Program);
@@ -340,6 +355,29 @@ static void process_args(int argc, char *argv[])
 				fprintf(stdout, "%s: Setting ack window size to %d\n",
 						Program, ClientOpt.window_size);
 				break;
+			case 'R':
+				ClientOpt.reserved = atoi(optarg);
+				if (ClientOpt.reserved < 0) {
+					fprintf(stderr,
+						"%s: Invalid reserved slots %d! (must be >= 0)\n",
+						Program, ClientOpt.reserved);
+					exit(1);
+				}
+				fprintf(stdout, "%s: Setting reserved window slots to %d\n",
+						Program, ClientOpt.reserved);
+				break;
+			case 'V':
+				ClientOpt.protocol = atoi(optarg);
+				if (ClientOpt.protocol < PROTOCOL_1
+						|| ClientOpt.protocol > PROTOCOL_3) {
+					fprintf(stderr,
+						"%s: Invalid protocol %s! (must be [%d-%d])\n",
+						Program, optarg, PROTOCOL_1, PROTOCOL_3);
+					exit(1);
+				}
+				fprintf(stdout, "%s: Setting protocol to %d\n",
+						Program, ClientOpt.protocol);
+				break;
 			case 'r':
 				ClientOpt.max_retry = atoi(optarg);
 				if (ClientOpt.max_retry < -1 || ClientOpt.max_retry > 99 || 
@@ -485,6 +523,11 @@ static void process_args(int argc, char *argv[])
 				fprintf(stdout, "%s: Setting max queue len to %d\n",
 						Program, ClientOpt.max_queue_len);
 				break;
+			case 'O':
+				ClientOpt.oldest_first = 1;
+				fprintf(stdout, "%s: Setting oldest of whole dirs option ON\n",
+						Program);
+				break;
 			case 'N':
 				ClientOpt.sent_count = atoi(optarg);
 				if (ClientOpt.sent_count <= 0
@@ -497,6 +540,73 @@ static void process_args(int argc, char *argv[])
 				fprintf(stdout, "%s: Setting sent count to %d\n",
 						Program, ClientOpt.sent_count);
 				break;
+			case 'z':
+				ClientOpt.sendfile_min = atoi(optarg);
+#ifndef __linux__
+				if (ClientOpt.sendfile_min > 0) {
+					fprintf(stderr,
+						"%s: sendfile transmit is not available in this build\n",
+						Program);
+					exit(1);
+				}
+#endif
+				fprintf(stdout, "%s: Setting sendfile min size to %lu\n",
+						Program, (unsigned long)ClientOpt.sendfile_min);
+				break;
+			case 'U':
+#ifndef INCLUDE_IO_URING
+				fprintf(stderr,
+					"%s: io_uring is not available in this build\n", Program);
+				exit(1);
+#endif
+				fprintf(stdout, "%s: Setting input to io_uring\n", Program);
+				ClientOpt.io_uring = 1;
+				break;
+			case 'W':
+#ifndef __linux__
+				fprintf(stderr,
+					"%s: inotify input is not available in this build\n",
+					Program);
+				exit(1);
+#endif
+				fprintf(stdout, "%s: Setting input to inotify\n", Program);
+				ClientOpt.inotify = 1;
+				break;
+			case 'T':
+				ClientOpt.scan_threads = atoi(optarg);
+#ifndef __linux__
+				if (ClientOpt.scan_threads > 0) {
+					fprintf(stderr,
+						"%s: scanner threads are not available in this build\n",
+						Program);
+					exit(1);
+				}
+#endif
+				if (ClientOpt.scan_threads < 0
+						|| ClientOpt.scan_threads > MAX_SCAN_THREADS) {
+					fprintf(stderr,
+						"%s: Invalid scanner threads %d! (must be 0-%d)\n",
+						Program, ClientOpt.scan_threads, MAX_SCAN_THREADS);
+					exit(1);
+				}
+				fprintf(stdout, "%s: Setting scanner threads to %d\n",
+						Program, ClientOpt.scan_threads);
+				break;
+			case 'o':
+				if ((p_weights = strchr(optarg, ':'))) {
+					*p_weights++ = '\0';
+				}
+				for (i = 0; SchedName[i] && strcmp(optarg, SchedName[i]); i++);
+				if (!SchedName[i] || (p_weights && i != SCHED_WFQ)) {
+					fprintf(stderr,
+						"%s: Invalid send order %s! (prio, wfq[:w1,w2...], edf or sjf)\n",
+						Program, optarg);
+					exit(1);
+				}
+				ClientOpt.sched = i;
+				fprintf(stdout, "%s: Setting send order to %s\n",
+						Program, SchedName[i]);
+				break;
 			case '?':
 				/* invalid option */
 				usage();
@@ -520,6 +630,27 @@ static void process_args(int argc, char *argv[])
 			LOG_PREFIX, ClientOpt.refresh_interval, ClientOpt.poll_interval);
 		exit(1);
 	}
+	if (ClientOpt.reserved >= ClientOpt.window_size) {
+		fprintf(stderr,
+			"%s: ERROR reserved slots %d must be < window size %d\n",
+			LOG_PREFIX, ClientOpt.reserved, ClientOpt.window_size);
+		exit(1);
+	}
+	if (ClientOpt.protocol > PROTOCOL_1 && !ClientOpt.connect_wmo) {
+		fprintf(stderr,
+			"%s: ERROR protocol %d is asked for in the connect msg (-c)\n",
+			LOG_PREFIX, ClientOpt.protocol);
+		exit(1);
+	}
+	if (ClientOpt.protocol > PROTOCOL_2 && ClientOpt.bufsize
+			< MSG2_HDR_LEN + CCB_MAX_HDR_LEN + FIRST_BLK_SIZE) {
+		/* a first chunk must hold the WMO heading after any CCB */
+		fprintf(stderr,
+			"%s: ERROR buffer size %lu too small for protocol %d, min %d\n",
+			LOG_PREFIX, (unsigned long)ClientOpt.bufsize, ClientOpt.protocol,
+			MSG2_HDR_LEN + CCB_MAX_HDR_LEN + FIRST_BLK_SIZE);
+		exit(1);
+	}
 	if (ClientOpt.host_list == NULL) {
 		if (!(ClientOpt.host_list = malloc(2*sizeof(char *)))) {
 			fprintf(stderr, "%s: FAIL malloc 2 host strings, %s\n",
@@ -560,6 +691,33 @@ static void process_args(int argc, char *argv[])
 		ClientOpt.indir_list[1] = NULL;
 	}
 
+	if (ClientOpt.sched == SCHED_WFQ) {
+		/* default weights follow the directory priorities */
+		for (indir_count = 0; ClientOpt.indir_list[indir_count]; indir_count++);
+		if (!(ClientOpt.sched_weights = malloc(indir_count * sizeof(int)))) {
+			fprintf(stderr, "%s: FAIL malloc %d wfq weights, %s\n",
+						LOG_PREFIX, indir_count, strerror(errno));
+			exit(1);
+		}
+		for (i = 0; i < indir_count; i++) {
+			ClientOpt.sched_weights[i] = indir_count - i;
+		}
+		for (i = 0; p_weights && *p_weights; i++) {
+			if (i == indir_count
+					|| (ClientOpt.sched_weights[i] = strtol(p_weights,
+						&p_weights, 10)) < 1
+					|| (*p_weights && *p_weights++ != ',')) {
+				break;
+			}
+		}
+		if (p_weights && (*p_weights || i < indir_count)) {
+			fprintf(stderr,
+				"%s: ERROR wfq weights must be > 0, one per input dir\n",
+				LOG_PREFIX);
+			exit(1);
+		}
+	}
+
 	if (ClientOpt.sent_dir == NULL) {
 		if ((p_subdir = strrchr(ClientOpt.indir_list[0], '/'))) {
 			pathlen = p_subdir-ClientOpt.indir_list[0] + 1
@@ -670,6 +828,8 @@ static void usage(void)
 	fprintf(stderr,
 		"         [-w window_size] (ack window size, default=%d prods)\n",
 		DFLT_WINSIZE);
+	fprintf(stderr,
+		"         [-R reserved]    (window slots kept for the first dir, default=0)\n");
 	fprintf(stderr,
 		"         [-r retries]     (max send retries, -1=infinite, default=%d)\n",
 		DFLT_RETRY);
@@ -680,6 +840,8 @@ static void usage(void)
 		"         [-c ttaaii_cccc] (send connect msg with wmo heading ttaaii_cccc)\n");
 	fprintf(stderr,
 		"         [-s source]      (set source id connection string to <source>\n");
+	fprintf(stderr,
+		"         [-V protocol]    (ask for protocol 2 or 3 in the connect msg, default=1)\n");
 	fprintf(stderr,
 		"         [-d]             (debug mode, default NO)\n");
 	fprintf(stderr,
@@ -698,6 +860,11 @@ static void usage(void)
 	fprintf(stderr,
 		"         [-Q queue_len]   (max queue length, default=%d prods)\n",
 		DFLT_MAX_QUEUE);
+	fprintf(stderr,
+		"         [-O]             (queue the oldest of whole dirs, default NO)\n");
+	fprintf(stderr,
+		"         [-o order]       (send order prio, wfq[:w1,w2...], edf or sjf,\n"
+		"                           default=prio)\n");
 	fprintf(stderr,
 		"         [-S sent_dir]    (sent dir, default=<input dir>/../sent)\n");
 	fprintf(stderr,
@@ -707,6 +874,18 @@ static void usage(void)
 		"         [-F fail_dir]    (fail dir, default=<input dir>/../fail)\n");
 	fprintf(stderr,
 		"         [-P log_dir]     (path for log files, default=%s)\n", LOG_DIR_PATH);
+#ifdef __linux__
+	fprintf(stderr,
+		"         [-z min_size]    (sendfile prods this big, default=0 (off))\n");
+	fprintf(stderr,
+		"         [-W]             (watch input dirs with inotify, not polling)\n");
+	fprintf(stderr,
+		"         [-T threads]     (read input dirs at once, default=0 (in turn))\n");
+#endif
+#ifdef INCLUDE_IO_URING
+	fprintf(stderr,
+		"         [-U]             (stat and read ahead input with io_uring)\n");
+#endif
 #ifdef INCLUDE_ACQ_STATS
 	fprintf(stderr,
 		"         [-m region]      (set shared mem to region for acq_stats\n");
@@ -725,7 +904,6 @@ FUNCTION DESCRIPTION
 	Set-up handler functions for signals
 		SIGINT, SIGTERM	-	shutdown signal handler
 		SIGPIPE			-	socket disconnection handler
-		SIGALRM			-	timeout handler
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -765,15 +943,6 @@ static void setup_sig_handler(void)
 				LOG_PREFIX, SIGPIPE, strerror(errno));
 	}
 
-	sigemptyset (&act.sa_mask);
-	act.sa_handler = alarm_sighandler;
-	act.sa_flags=0;
-	if (sigaction (SIGALRM, &act, 0) == -1) {
-		CS_LOG_ERR(ERROR_FP, 
-				"%s: Sigaction failed for sig=%d, act=alarm_sighandler, %s\n",
-				LOG_PREFIX, SIGALRM, strerror(errno));
-	}
-
 	return;
 } /* end setup_sig_handler */
 
@@ -838,32 +1007,3 @@ void pipe_sighandler(int signum)
 
 	return;
 } /* end pipe_sighandler */
-
-/*******************************************************************************
-FUNCTION NAME
-	void alarm_sighandler(int signum)
-
-FUNCTION DESCRIPTION
-	Set disconnect flag.
-
-PARAMETERS
-	Type			Name			I/O	Description
-	int				signum			I	signal number received
-
-GLOBAL VARIABLES (from ClientOpt structure)
-	Type			Name			I/O	Description
-	int				Flags			O	Control Flags
-
-RETURNS
-	void 
-*******************************************************************************/
-void alarm_sighandler(int signum)
-{
-	CS_LOG_ERR(ERROR_FP,
-			"%s: Received alarm signal %d, set disconnect flag\n",
-			LOG_PREFIX, signum);
-
-	Flags |= DISCONNECT_FLAG;
-
-	return;
-} /* end alarm_sighandler */
@@ -0,0 +1,261 @@
+/*******************************************************************************
+FILE NAME
+	client_notify.c
+
+FILE DESCRIPTION
+	inotify input routines for the client (Linux, -W option).  Each input
+	directory is watched for files being closed after writing, moved in,
+	or having their mode changed, so get_next_file can queue new files as
+	they arrive instead of rescanning the directories, and poll_and_send
+	can wake up as soon as a file arrives instead of waiting to poll.
+
+FUNCTIONS
+	notify_init			- set up the inotify instance and watches
+	notify_watch		- add watches for input directories without one
+	notify_next			- get the next file event
+	notify_fd			- descriptor to wait on for file events
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_client_notify_c[]= "@(#)client_notify.c 0.1 10/15/2026 12:00:00";
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "share.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+
+#define NOTIFY_MASK		(IN_CLOSE_WRITE|IN_MOVED_TO|IN_ATTRIB|IN_ONLYDIR)
+
+static int NotifyFd = -1;
+static int *DirWd;			/* watch descriptor of each input dir */
+static int DirCount;
+
+/* events read but not yet returned */
+static char EventBuf[64*1024]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+static ssize_t EventLen;
+static ssize_t EventPos;
+
+/*******************************************************************************
+FUNCTION NAME
+	int notify_init(void)
+
+FUNCTION DESCRIPTION
+	Create the inotify instance and watch the input directories.  If
+	inotify is not available, ClientOpt.inotify is turned off so the
+	directories are polled as usual.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char			inotify			I/O	watch input dirs with inotify
+	char **			indir_list		I	null-terminated list of input dirs
+
+RETURNS
+	 0	Normal return (inotify may have been turned off)
+	-1	Error
+*******************************************************************************/
+int notify_init(void)
+{
+	int i;
+
+	if (!ClientOpt.inotify || NotifyFd >= 0) {
+		return 0;
+	}
+
+	for (DirCount = 0; ClientOpt.indir_list[DirCount]; DirCount++);
+
+	if (!(DirWd = malloc(DirCount * sizeof(int)))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d watch descriptors, %s\n",
+				LOG_PREFIX, DirCount, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < DirCount; i++) {
+		DirWd[i] = -1;
+	}
+
+	if ((NotifyFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL inotify_init, %s, polling input\n",
+				LOG_PREFIX, strerror(errno));
+		ClientOpt.inotify = 0;
+		return 0;
+	}
+
+	notify_watch();
+
+	return 0;
+} /* end notify_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	int notify_watch(void)
+
+FUNCTION DESCRIPTION
+	Add a watch for each input directory that does not have one (it did
+	not exist yet, or was removed).  Called before each full rescan.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char **			indir_list		I	null-terminated list of input dirs
+
+RETURNS
+	number of input directories that could not be watched
+*******************************************************************************/
+int notify_watch(void)
+{
+	int unwatched;
+	int i;
+
+	for (unwatched = 0, i = 0; i < DirCount; i++) {
+		if (DirWd[i] >= 0) {
+			continue;
+		}
+		if ((DirWd[i] = inotify_add_watch(NotifyFd, ClientOpt.indir_list[i],
+				NOTIFY_MASK)) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL watch directory %s, %s\n",
+					LOG_PREFIX, ClientOpt.indir_list[i], strerror(errno));
+			unwatched++;
+		}
+	}
+
+	return unwatched;
+} /* end notify_watch */
+
+/*******************************************************************************
+FUNCTION NAME
+	int notify_next(char *pathbuf, int *p_dir, int *p_closed)
+
+FUNCTION DESCRIPTION
+	Get the next file event without waiting.  If the kernel dropped events
+	(IN_Q_OVERFLOW) or a directory watch went away, the rest of the events
+	are discarded and -1 is returned: the caller must rescan the input
+	directories.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			pathbuf			O	path of the file
+	int *			p_dir			O	index of its input directory
+	int *			p_closed		O	1 if the writer closed it or it was
+										moved in, 0 if only its mode changed
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char **			indir_list		I	null-terminated list of input dirs
+
+RETURNS
+	 1	Event returned
+	 0	No more events
+	-1	Events lost, rescan needed
+*******************************************************************************/
+int notify_next(char *pathbuf, int *p_dir, int *p_closed)
+{
+	struct inotify_event *p_event;
+	int lost;
+	int i;
+
+	for (;;) {
+		if (EventPos >= EventLen) {
+			EventPos = EventLen = 0;
+			if ((EventLen = read(NotifyFd, EventBuf, sizeof(EventBuf))) < 0) {
+				EventLen = 0;
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno != EAGAIN) {
+					CS_LOG_ERR(ERROR_FP, "%s: FAIL read inotify, %s\n",
+							LOG_PREFIX, strerror(errno));
+				}
+				return 0;
+			}
+		}
+
+		p_event = (struct inotify_event *)&EventBuf[EventPos];
+		EventPos += sizeof(struct inotify_event) + p_event->len;
+
+		lost = 0;
+		if (p_event->mask & IN_Q_OVERFLOW) {
+			CS_LOG_ERR(ERROR_FP, "%s: inotify queue overflow, rescanning\n",
+					LOG_PREFIX);
+			lost = 1;
+		}
+		if (p_event->mask & IN_IGNORED) {
+			/* directory was removed, watch it again at the rescan */
+			for (i = 0; i < DirCount; i++) {
+				if (DirWd[i] == p_event->wd) {
+					DirWd[i] = -1;
+				}
+			}
+			lost = 1;
+		}
+		if (lost) {
+			/* discard the rest, the rescan will see those files */
+			while (read(NotifyFd, EventBuf, sizeof(EventBuf)) > 0
+					|| errno == EINTR);
+			EventPos = EventLen = 0;
+			return -1;
+		}
+
+		/* skip events on the directory itself, and .dot files */
+		if (p_event->len == 0 || p_event->name[0] == '.') {
+			continue;
+		}
+
+		for (i = 0; i < DirCount && DirWd[i] != p_event->wd; i++);
+		if (i == DirCount) {
+			/* event queued before the watch was removed */
+			continue;
+		}
+
+		sprintf(pathbuf, "%s/%s", ClientOpt.indir_list[i], p_event->name);
+		*p_dir = i;
+		*p_closed = (p_event->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)) ? 1 : 0;
+		return 1;
+	}
+} /* end notify_next */
+
+/*******************************************************************************
+FUNCTION NAME
+	int notify_fd(void)
+
+FUNCTION DESCRIPTION
+	Get the inotify descriptor, for poll_and_send to wait on when there
+	is nothing to send.  It is readable when there are file events that
+	get_next_file has not read yet.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	inotify descriptor, -1 if not watching
+*******************************************************************************/
+int notify_fd(void)
+{
+	return NotifyFd;
+} /* end notify_fd */
+
+#endif /* __linux__ */
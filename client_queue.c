@@ -7,6 +7,22 @@ FILE DESCRIPTION
 
 FUNCTIONS
 	get_next_file - returns path of next item to send
+	scan_dirs -		used internally by get_next_file to read directories
+	scan_job, scan_read, scan_merge -	read a directory, queue what was found
+	scan_add, scan_compact, cand_newer, cand_sift_up, cand_sift_down -
+					files found by scan_read
+	dir_open, dir_read, dir_close, dir_reset -	input directory reading
+	stat_entry -	stat a directory entry relative to its directory
+	queue_entry -	used internally by scan_merge to queue a stat'ed entry
+	queue_item - used internally by get_next_file to add a queue item
+	notify_queue - used internally by get_next_file to add inotify events
+	q_alloc, q_free, q_prod -	queue items and their filename arena
+	q_key, q_insert, q_pop, q_update, q_remove_unseen, q_peek, q_sift_up,
+	q_sift_down -	queue heap, used internally by get_next_file
+	q_find, q_index_add, q_index_del - queue filename index
+	sched_taken -	count an item taken off the queue
+	sched_stats -	log the send order and window reservation counters
+	compare_cand -	used internally by scan_merge to sort files by mtime
 	compare_items - used internally by get_next_file to sort queue
 	finish_send -	marks file as sent successfully 
 	abort_send -	marks file as un-sendable
@@ -26,275 +42,2407 @@ NOTICE
 *******************************************************************************/
 static char Sccsid_client_queue_c[]= "@(#)client_queue.c 0.9 07/12/2005 15:37:37";
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* statx */
+#endif
+
 #include "client.h"
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <errno.h>
-#include <time.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+/* queue item: what is needed to order and find a queued file, with its
+   name in the Names arena.  Its prod_info_t is made by q_prod when it is
+   taken off the queue. */
+typedef struct {
+	unsigned		name_off;		/* offset of its filename in Names */
+	int				heap_idx;		/* index in Heap, or next free item */
+	unsigned		scan_gen;		/* last directory read that saw it */
+	int				priority;
+	time_t			queue_time;
+	long			queue_nsec;		/* nsecs of its mtime (protocol 2) */
+	off_t			size;
+	dev_t			dev;
+	ino_t			ino;
+	char			closed;			/* writer closed the file (inotify) */
+} qitem_t;
+
+/* queue heap entry: the item's sort key (see q_key), so the heap is
+   ordered without touching the items */
+typedef struct {
+	unsigned long long	key;
+	int					item;		/* index in Items */
+} qkey_t;
+
+/* file found by scan_read, for scan_merge to queue */
+typedef struct {
+	int				name_off;		/* offset of its name in names */
+	mode_t			mode;
+	off_t			size;
+	time_t			mtime;
+	long			mtime_nsec;
+	dev_t			dev;
+	ino_t			ino;
+	int				queued;			/* already queued, only its status is new */
+} cand_t;
+
+/* input directory read state */
+typedef struct {
+	time_t			scan_time;		/* when it was last read */
+	time_t			check_time;		/* when its mtime was last checked */
+	time_t			mtime;			/* its mtime when it was last read */
+	int				dirty;			/* files were left, read it again */
+	unsigned		scan_gen;		/* reads so far, queued items seen get it */
+	dev_t			dev;			/* device and inode of the directory */
+	ino_t			ino;
+#ifdef __linux__
+	int				fd;				/* kept open between reads, or -1 */
+	char *			dent_buf;		/* entries read by getdents64 */
+	long			dent_len;
+	long			dent_pos;
+#else
+	DIR *			p_dir;			/* open while it is read */
+#endif
+	/* result of the last scan_read */
+	int				in_pass;		/* -O read not finished, resume it */
+	int				complete;		/* whole directory was read */
+	int				fresh;			/* -O files kept that are not queued */
+	int				dropped;		/* -O files left out for older ones */
+	int				entries;		/* entries read */
+	int				stats;			/* entries stat'ed */
+	struct timeval	start_tv;		/* when the read started */
+	cand_t *		p_cand;			/* files to queue */
+	int				cand_cnt;
+	int				cand_max;
+	char *			names;			/* their names */
+	size_t			names_len;
+	size_t			names_max;
+	/* send order state and counters (see q_key and sched_taken) */
+	unsigned long long	wfq_tag;	/* SCHED_WFQ tag of its last item */
+	unsigned long	taken;			/* items taken off the queue */
+	unsigned long long	taken_bytes;
+	unsigned long long	wait_sum;	/* secs from mtime to taken */
+	time_t			wait_max;
+	unsigned long	late;			/* taken after queue_ttl had passed */
+} dirstate_t;
+
+/* dir_read entry types */
+#define ENTRY_UNKNOWN	0		/* stat it to find out */
+#define ENTRY_FILE		1		/* regular file or link */
+#define ENTRY_OTHER		2		/* directory, device, etc., skip it */
+
+#ifdef __linux__
+#define DENT_BUF_SIZE	(128*1024)	/* bytes of entries read at once */
+
+/* kernel struct linux_dirent64, as returned by getdents64 */
+typedef struct {
+	unsigned long long	d_ino;
+	long long			d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char				d_name[1];
+} dent64_t;
+
+static int StatxOff;			/* statx not supported, use fstatat */
+#endif
+
+#define DIR_CHECK_INTERVAL	1		/* secs between directory mtime checks */
+#define INDEX_MIN_SIZE		1024	/* first size of the filename index */
+#define INDEX_DELETED		(-1)	/* Index slot of a deleted item */
+#define Q_TIME_BITS			40		/* queue_time bits of a heap key */
+#define Q_TIME_MAX			((1ULL << Q_TIME_BITS) - 1)
+#define Q_PRIORITY_MAX		((1 << (64 - Q_TIME_BITS)) - 1)
+#define Q_NAME(p_item)		(Names + (p_item)->name_off)
+#define SCAN_SLICE			65536	/* -O entries read per poll if items wait */
+#define SCAN_KEEP_CAND		4096	/* scan_read entries kept between reads */
+#define WFQ_PROD_BYTES		4096	/* SCHED_WFQ cost of a product besides its size */
+#define WFQ_SCALE			1024	/* SCHED_WFQ tag units per byte at weight 1 */
+#define SJF_BYTES_PER_SEC	1000000	/* SCHED_SJF bytes worth a second of age */
+#define SCHED_STATS_COUNT	1000	/* items taken between sched_stats logs */
+
+static int scan_dirs(prod_tbl_t *p_tbl, int *p_dirs, int count);
+static void scan_job(int job);
+static void scan_read(prod_tbl_t *p_tbl, int i_dir, int use_uring);
+static int scan_merge(prod_tbl_t *p_tbl, int i_dir);
+static int scan_add(dirstate_t *p_state, char *name, struct stat *p_stat,
+			int queued);
+static int scan_compact(dirstate_t *p_state, size_t len);
+static int cand_newer(dirstate_t *p_state, int i1, int i2);
+static void cand_sift_up(dirstate_t *p_state, int idx);
+static void cand_sift_down(dirstate_t *p_state, int idx);
+static int dir_open(dirstate_t *p_state, char *dir);
+static int dir_read(dirstate_t *p_state, char **p_name, int *p_type,
+			ino_t *p_ino);
+static void dir_close(dirstate_t *p_state, char *dir);
+static void dir_reset(dirstate_t *p_state);
+static int stat_entry(dirstate_t *p_state, char *name, char *pathbuf,
+			struct stat *p_stat, int sync);
+static int queue_entry(prod_tbl_t *p_tbl, dirstate_t *p_state, char *name,
+			char *pathbuf, struct stat *p_stat, int priority);
+static int queue_item(prod_tbl_t *p_tbl, char *pathbuf, struct stat *p_stat,
+			int priority, int closed);
+static qitem_t *q_alloc(char *filename);
+static void q_free(qitem_t *p_item);
+static void q_prod(qitem_t *p_item, prod_info_t *p_prod);
+static unsigned long long q_key(qitem_t *p_item);
+static int q_insert(qitem_t *p_item);
+static void q_pop(prod_info_t *p_prod);
+static void q_update(qitem_t *p_item);
+static void q_remove_unseen(int priority, unsigned scan_gen);
+static qitem_t *q_find(char *filename);
+static int q_index_add(qitem_t *p_item);
+static void q_index_del(qitem_t *p_item);
+static void q_sift_up(int idx);
+static void q_sift_down(int idx);
+#ifdef INCLUDE_IO_URING
+static int q_peek(qitem_t **p_next, int count);
+#endif
+static void sched_taken(qitem_t *p_item, unsigned long long key);
+static int compare_cand(const void *p_v1, const void *p_v2);
+int compare_items(const void *p_v1, const void *p_v2);
+int check_window(prod_tbl_t *p_tbl, char *filename, struct stat *p_stat);
+
+#define PERM_MASK S_IRUSR|S_IRGRP|S_IROTH  /* permissions for read */
+#define A_FEW_SECONDS 3
+
+/* queue_item results */
+#define QUEUE_SKIP		0		/* not a file to send */
+#define QUEUE_ADD		1		/* added or updated */
+#define QUEUE_WAIT		2		/* may be sent later, not ready yet */
+
+/* the queue is a binary heap of items in compare_items order, indexed
+   by filename so a file found again is updated in place */
+static qkey_t *Heap;			/* Heap[0] is sent next */
+static int HeapCnt;
+static int HeapMax;
+static qitem_t *Items;			/* queued and free items */
+static int ItemCnt;
+static int ItemMax;
+static int ItemFree = -1;		/* first free item, linked by heap_idx */
+static char *Names;				/* filenames of the items */
+static size_t NamesLen;
+static size_t NamesMax;
+static size_t NamesDead;		/* bytes of names of freed items */
+static int *Index;				/* item+1, 0 or INDEX_DELETED; linear probing */
+static unsigned IndexSize;		/* 0 or a power of 2 */
+static unsigned IndexUsed;		/* live and deleted slots */
+static time_t NewestTime;		/* newest queue_time in the queue */
+static unsigned long long WfqTime;	/* SCHED_WFQ tag of the last item taken */
+static unsigned long ReserveHeld;	/* times items were held back (-R) */
+static unsigned long ReserveUsed;	/* top items taken while they were */
+static int ReserveWasHeld;			/* last call held an item back */
+char *SchedName[] = SCHED_NAMES;
+
+static dirstate_t *DirState;
+static int DirCount;
+static int *ScanList;			/* directories to read */
+
+/* what scan_job reads, while the pool runs */
+static prod_tbl_t *JobTbl;
+static int *JobDirs;
+
+#ifdef __linux__
+static int notify_queue(prod_tbl_t *p_tbl);
+
+static int NotifyRescan = 1;	/* full rescan needed (inotify) */
+static int ScanFull;			/* files were left out of a full queue */
+static time_t RescanTime;		/* rescan for files that were not ready */
+#endif
+
+/*******************************************************************************
+FUNCTION NAME
+	int get_next_file (prod_tbl_t *p_tbl, prod_info_t *p_prod, int reserved,
+				int above)
+
+FUNCTION DESCRIPTION
+	Gets the path, timestamp, size, and priority attributes of the next
+	file in the input queue and returns them via the p_prod argument.
+
+	Files are polled from those listed in ClientOpt.indir_list.  The last
+	path in indir_list must be NULL.  The list of directories is assumed to
+	be in order of decreasing priority.  I.e. products will be taken from
+	the first directory before being taken from the other directories.  Files
+	polled from the indir_list are checked against files in the table to
+	determine whether they are already in progress.  If they are found
+	in the prod_tbl they are ignored, otherwise they are added to the queue.
+
+	The queue is kept between polls as a heap, so the next item is taken
+	in O(log n) and new files are added without re-sorting the others.
+	The heap holds only a packed sort key per item (see q_key), the items
+	hold only what is needed to order and find them, with the filenames
+	in one arena, and the prod_info_t is made when an item is taken.
+	A directory is read again only when its mtime has changed or files in
+	it were not ready (or left out) the last time, and then only the
+	changes are applied: new files are added and files that are gone are
+	dropped.  Files already queued are not stat'ed again unless
+	wait_last_file is set, since they may still be growing then.
+
+	The ClientOpt.refresh_interval is how often each directory is checked
+	for changes.  A higher refresh_interval increases throughput by
+	decreasing the number of times the directories are polled for new
+	items.  A directory of higher priority than the next item is checked
+	every DIR_CHECK_INTERVAL instead, so new high priority items do not
+	wait for the refresh interval behind a backlog.  With a send order
+	other than SCHED_PRIO any directory may have the next item, so all of
+	them are checked every DIR_CHECK_INTERVAL.  All directories are
+	polled whenever the queue is empty.  With a refresh_interval of -1,
+	directories are polled only when the queue is empty.
+
+	The ClientOpt.max_queue_len is the maximum number of new items to add
+	from a directory each time it is read.  This increases throughput in
+	severe backlogged conditions by decreasing the amount of time required
+	to poll the input directories.  The rest are added on later polls.
+
+	With the ClientOpt.oldest_first option, the rest are not taken in
+	directory order instead: each read of a directory is a pass over all
+	of it, and only the max_queue_len oldest new files found are kept (in
+	a bounded heap, so memory does not grow with the backlog) and queued
+	when the pass ends.  While there are items to send, a pass reads
+	SCAN_SLICE entries per poll and continues where it left off at the
+	next DIR_CHECK_INTERVAL, so a directory of a million files does not
+	stall sending.  When the queue is empty, the pass is read to its end.
+
+	With the ClientOpt.inotify option, the input directories are only
+	rescanned at startup, when inotify events were lost, when files were
+	left out of a full queue and the queue has drained, and when a
+	zero-length file has had A_FEW_SECONDS to grow.  Otherwise files are
+	added to the queue as notify_next reports them, and the
+	refresh_interval is not used.
+
+	The order of files returned is set by ClientOpt.sched (see q_key):
+	SCHED_PRIO takes them by priority then timestamp (st_mtime), SCHED_WFQ
+	shares the sends between the directories by their sched_weights (so a
+	busy directory cannot starve the others), SCHED_EDF takes the earliest
+	st_mtime + queue_ttl whatever the directory, and SCHED_SJF takes the
+	oldest with each SJF_BYTES_PER_SEC of size counted as a second younger,
+	so small files go ahead of big ones that arrived at about the same
+	time.  The items taken from each directory are counted and logged by
+	sched_stats every SCHED_STATS_COUNT items and at exit.
+
+	If reserved is set, poll_and_send has only slots reserved for the top
+	priority (ClientOpt.reserved) left in its window, so the next item is
+	only returned if it is from the first input directory.  Otherwise it
+	stays first in the queue and NEXT_HELD is returned.  Under a send
+	order other than SCHED_PRIO, a top priority item behind it waits too,
+	so the order is kept.  If a file does not have read permission, it is assumed
+	to be in-progress and is not returned.  If a file has a size of 0,
+	it is assumed to be in-progress and is not returned unless it is more
+	than A_FEW_SECONDS old.
+
+	If above is not -1, poll_and_send is sending a product of that
+	priority in chunks (protocol 3), and the next item is only returned if
+	it has a higher priority, to go ahead of the rest of that product.
+	Otherwise NEXT_HELD is returned.
+	
+	If the ClientOpt.wait_last_file option is set, the most recent item to
+	arrive in the queue is not sent until another item arrives.  This option
+	is used when there is no method to determine whether a file in the input
+	queue is complete and ready to send.  This option can affect timeliness
+	of products so it should only be used when the files can not be 
+	atomically moved into the input directory, or have their mode toggled
+	to indicate that the file is complete.  With the ClientOpt.inotify
+	option, files the kernel reports closed by their writer or moved into
+	the directory are sent without waiting.
+
+	On Linux the input directories are kept open and their entries read
+	DENT_BUF_SIZE bytes at a time with getdents64.  Entries that d_type
+	shows are not files, and files in the window, are skipped without a
+	stat.  New files are stat'ed relative to the open directory with
+	AT_STATX_DONT_SYNC, so on NFS attributes already cached are used
+	instead of a round trip to the server for each file.
+
+	With the ClientOpt.io_uring option, directory entries are stat'ed
+	URING_STAT_BATCH at a time, and the returned item and the next few
+	after it are read ahead for send_prod (see client_uring.c).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			O	address of prod table 
+	prod_info_t *	p_prod			O	address of prod info stucture 
+	int				reserved		I	only a top priority item may be taken
+	int				above			I	only an item of higher priority may
+										be taken, -1 for any
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char **			indir_list		I	null-terminated list of input dirs
+	char *			sent_dir		I	holding directory for queued files
+	time_t			refresh_interval I	queue resort/refresh interval
+	int 			max_queue_len	I	max number of items to add per poll
+	char			oldest_first	I	queue the oldest of a whole directory
+	int				wait_last_file	I	don't send the last file
+	char			io_uring		I	read ahead the next items
+	char			inotify			I	watch input dirs with inotify
+	char			sched			I	send order policy
+	time_t			poll_interval	I	input polling interval (when idle)
+	char			verbosity		I	verbosity level
+
+RETURNS
+	 Length of queue INCLUDING the returned product
+	 0 indicates an empty queue, and no product is returned
+	NEXT_HELD indicates the next item is not of the top priority, and
+		reserved is set, or not above the priority given
+	-1 indicates an error
+	(If queue length is >= 0, the p_prod argument is not modified.)
+*******************************************************************************/
+int get_next_file(prod_tbl_t *p_tbl, prod_info_t *p_prod, int reserved,
+			int above)
+{
+	static time_t check_time;
+	struct stat stat_struct;
+	qitem_t *p_item;
+	time_t now;
+	int priority;
+	int i_dir;
+	int n_scan;
+#ifdef __linux__
+	int rc;
+#endif
+#ifdef INCLUDE_IO_URING
+	static prod_info_t ahead[URING_PREFETCH];
+	qitem_t *p_next[URING_PREFETCH];
+	int n_next;
+	int i;
+#endif
+
+	if (!DirState) {
+		for (DirCount = 0; ClientOpt.indir_list[DirCount]; DirCount++);
+		if (!(DirState = calloc(DirCount, sizeof(dirstate_t)))
+				|| !(ScanList = calloc(DirCount, sizeof(int)))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc %d directory states, %s\n",
+						LOG_PREFIX, DirCount, strerror(errno));
+			return -1;
+		}
+#ifdef __linux__
+		for (i_dir = 0; i_dir < DirCount; i_dir++) {
+			DirState[i_dir].fd = -1;
+		}
+#endif
+	}
+
+	if (ClientOpt.verbosity > 2) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: qlen = %d\n", LOG_PREFIX, HeapCnt);
+	}
+
+	/* Assume Poll Directories are in prioritized order.  Count
+	   directories and assign a relative priority to items found
+	   in each directory.  Higher priority value items are taken 
+	   before lower priority items (see compare_items).
+	*/
+
+	now = time(NULL);
+#ifdef __linux__
+	if (ClientOpt.inotify) {
+		if ((rc = notify_queue(p_tbl)) < 0) {
+			return -1;
+		}
+		if (rc > 0) {
+			/* watch before reading so no new file is missed */
+			NotifyRescan = 0;
+			RescanTime = 0;
+			if (notify_watch() > 0) {
+				/* try the missing directories again later */
+				RescanTime = now + ClientOpt.poll_interval;
+			}
+			for (i_dir = 0; i_dir < DirCount; i_dir++) {
+				ScanList[i_dir] = i_dir;
+			}
+			if ((rc = scan_dirs(p_tbl, ScanList, DirCount)) < 0) {
+				return -1;
+			}
+			ScanFull = rc < DirCount;
+		}
+	} else
+#endif
+	if (HeapCnt == 0) {
+		/* always poll when there is nothing to send */
+		for (i_dir = 0; i_dir < DirCount; i_dir++) {
+			ScanList[i_dir] = i_dir;
+		}
+		if (scan_dirs(p_tbl, ScanList, DirCount) < 0) {
+			return -1;
+		}
+		check_time = now;
+	} else if (ClientOpt.refresh_interval > 0
+			&& now >= check_time + DIR_CHECK_INTERVAL) {
+		/* poll directories that changed, if their refresh is due or
+		   they may have something to send before the next item */
+		n_scan = 0;
+		for (i_dir = 0; i_dir < DirCount; i_dir++) {
+			priority = DirCount-1 - i_dir;
+			if (now < DirState[i_dir].check_time + ClientOpt.refresh_interval
+					&& ClientOpt.sched == SCHED_PRIO
+					&& priority <= Items[Heap[0].item].priority
+					&& !DirState[i_dir].in_pass) {
+				continue;
+			}
+			DirState[i_dir].check_time = now;
+			if (stat(ClientOpt.indir_list[i_dir], &stat_struct) == 0) {
+				if (stat_struct.st_ino != DirState[i_dir].ino
+						|| stat_struct.st_dev != DirState[i_dir].dev) {
+					/* replaced since it was read, open the new one */
+					dir_reset(&DirState[i_dir]);
+				} else if (!DirState[i_dir].dirty
+						&& stat_struct.st_mtime == DirState[i_dir].mtime
+						&& DirState[i_dir].mtime < DirState[i_dir].scan_time) {
+					/* unchanged since it was read (and not in that second) */
+					continue;
+				}
+			}
+			ScanList[n_scan++] = i_dir;
+		}
+		if (n_scan > 0 && scan_dirs(p_tbl, ScanList, n_scan) < 0) {
+			return -1;
+		}
+		check_time = now;
+	}
+
+	/* if there is a next entry */
+	if (HeapCnt > 0) {
+		p_item = &Items[Heap[0].item];
+
+		/* if wait_last_file option is on, check if item is the last one */
+		if (!ClientOpt.wait_last_file || p_item->closed
+				|| p_item->queue_time < NewestTime) {
+
+			if (p_item->priority <= above) {
+				/* the product being sent goes on first */
+				return NEXT_HELD;
+			}
+			if (reserved && p_item->priority < DirCount-1) {
+				/* leave the reserved slots for the top priority */
+				if (!ReserveWasHeld) {
+					ReserveWasHeld = 1;
+					ReserveHeld++;
+				}
+				if (ClientOpt.verbosity > 1) {
+					CS_LOG_DBUG(DEBUG_FP, "%s: Holding %s for reserved slots\n",
+							LOG_PREFIX, Q_NAME(p_item));
+				}
+				return NEXT_HELD;
+			}
+			if (reserved) {
+				ReserveUsed++;
+			} else {
+				ReserveWasHeld = 0;
+			}
+
+			if (ClientOpt.verbosity > 1) {
+				CS_LOG_DBUG(DEBUG_FP, "%s: Next item is %s, p=%d, t=%s",
+						LOG_PREFIX,
+						Q_NAME(p_item),
+						p_item->priority,
+						ctime(&p_item->queue_time));
+			}
+
+			q_pop(p_prod);
+
+#ifdef INCLUDE_IO_URING
+			if (ClientOpt.io_uring) {
+				/* read ahead this item and the next ones that can be sent */
+				memcpy(&ahead[0], p_prod, sizeof(prod_info_t));
+				n_next = q_peek(p_next, URING_PREFETCH - 1);
+				for (i = 0; i < n_next; i++) {
+					if (ClientOpt.wait_last_file && !p_next[i]->closed
+							&& p_next[i]->queue_time >= NewestTime) {
+						break;
+					}
+					q_prod(p_next[i], &ahead[i+1]);
+				}
+				uring_prefetch(ahead, i + 1);
+			}
+#endif
+			return HeapCnt + 1;
+		}
+	}
+
+	if (ClientOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: No items to send\n", LOG_PREFIX);
+	}
+	return 0;
+
+} /* end get_next_file */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int scan_dirs(prod_tbl_t *p_tbl, int *p_dirs, int count)
+
+FUNCTION DESCRIPTION
+	Used internally by get_next_file to read input directories p_dirs[0]
+	through p_dirs[count-1] into the queue.  With ClientOpt.scan_threads,
+	the directories are read at the same time by the scanner threads (see
+	client_scan.c), so a poll takes as long as the slowest directory
+	instead of all of them in turn.  Each directory's files are then
+	queued by this thread in priority order.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I	address of product table
+	int *			p_dirs			I	indexes in indir_list
+	int				count			I	number of directories
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	int				scan_threads	I	directory scanner threads
+	char			io_uring		I	batch stat
+
+RETURNS
+	>=0	Number of directories read completely
+	-1	Error
+*******************************************************************************/
+static int scan_dirs(prod_tbl_t *p_tbl, int *p_dirs, int count)
+{
+	int complete;
+	int rc;
+	int i;
+
+#ifdef __linux__
+	if (ClientOpt.scan_threads > 0 && count > 1) {
+		/* the queue is not touched until all the reads are done */
+		JobTbl = p_tbl;
+		JobDirs = p_dirs;
+		scan_pool_run(scan_job, count);
+	} else
+#endif
+	for (i = 0; i < count; i++) {
+		scan_read(p_tbl, p_dirs[i], ClientOpt.io_uring);
+	}
+
+	for (complete = 0, i = 0; i < count; i++) {
+		if ((rc = scan_merge(p_tbl, p_dirs[i])) < 0) {
+			return -1;
+		}
+		complete += rc;
+	}
+
+	return complete;
+} /* end scan_dirs */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void scan_job(int job)
+
+FUNCTION DESCRIPTION
+	Scanner pool job: read the job'th directory of the scan_dirs list.
+	Runs on a scanner thread (or the calling thread).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				job				I	index in the scan_dirs list
+
+RETURNS
+	void
+*******************************************************************************/
+static void scan_job(int job)
+{
+	/* the io_uring belongs to the main thread */
+	scan_read(JobTbl, JobDirs[job], 0);
+} /* end scan_job */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void scan_read(prod_tbl_t *p_tbl, int i_dir, int use_uring)
+
+FUNCTION DESCRIPTION
+	First half of reading input directory i_dir: read its entries and stat
+	the ones that may be queued.  The files found are kept in its
+	dirstate_t for scan_merge.  Up to ClientOpt.max_queue_len files that
+	are not queued yet are kept.
+
+	With ClientOpt.oldest_first, the read is a pass over the whole
+	directory that keeps the max_queue_len oldest of those files.  If
+	there are items to send, it stops after SCAN_SLICE entries and the
+	next scan_read continues the pass from there.
+
+	Nothing is stat'ed for entries that are .dot files, that d_type shows
+	are not files, that are already queued, or that are in the window.
+
+	Several scan_reads of different directories may run at once, while
+	the queue and window are not changed.  Only this directory's
+	dirstate_t and queue items are written.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I	address of product table
+	int				i_dir			I	index in indir_list
+	int				use_uring		I	stat on the io_uring
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char **			indir_list		I	null-terminated list of input dirs
+	int 			max_queue_len	I	max number of items to add per poll
+	char			oldest_first	I	keep the oldest of a whole pass
+	int				wait_last_file	I	stat queued files again
+	char			io_uring		I/O	batch stat
+	char			verbosity		I	verbosity level
+
+RETURNS
+	void
+*******************************************************************************/
+static void scan_read(prod_tbl_t *p_tbl, int i_dir, int use_uring)
+{
+	dirstate_t *p_state;
+	struct stat stat_struct;
+	qitem_t *p_item;
+	prod_info_t *p_sent;
+	char *poll_dir;
+	char *name;
+	char pathbuf[FILENAME_LEN];
+	ino_t ino;
+	int type;
+	int got;
+	int fresh;
+	int nbatch;
+	int entries;
+	int slice;
+#ifdef INCLUDE_IO_URING
+	static char batch[URING_STAT_BATCH][FILENAME_LEN];
+	char *batch_name[URING_STAT_BATCH];
+	struct stat batch_stat[URING_STAT_BATCH];
+	int batch_err[URING_STAT_BATCH];
+	int batch_queued[URING_STAT_BATCH];
+	int i;
+#endif
+
+	poll_dir = ClientOpt.indir_list[i_dir];
+	p_state = &DirState[i_dir];
+
+	/* a pass can only be sliced while there is something to send */
+	slice = ClientOpt.oldest_first && HeapCnt > 0 ? SCAN_SLICE : 0;
+
+	if (!p_state->in_pass) {
+		p_state->scan_gen++;
+		p_state->complete = 0;
+		p_state->entries = 0;
+		p_state->stats = 0;
+		p_state->cand_cnt = 0;
+		p_state->names_len = 0;
+		p_state->fresh = 0;
+		p_state->dropped = 0;
+		if (ClientOpt.verbosity > 1) {
+			gettimeofday(&p_state->start_tv, NULL);
+		}
+
+		/* read all directory entries in from input directories */
+		if (dir_open(p_state, poll_dir) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: Fail open directory %s, %s\n", 
+						LOG_PREFIX, poll_dir, strerror(errno));
+			/* Perhaps directory was removed?
+			   Continue with next dir
+			   Poll Interval should keep us from spinning
+			 */
+			return;
+		}
+	}
+	p_state->scan_time = p_state->check_time = time(NULL);
+
+	p_state->in_pass = 0;
+	p_state->complete = 1;
+	fresh = 0;
+	nbatch = 0;
+	entries = 0;
+	while ((got = dir_read(p_state, &name, &type, &ino)) > 0 || nbatch > 0) {
+
+		if (got > 0) {
+			p_state->entries++;
+			entries++;
+			/* skip .dot files */
+			if (!strncmp(name, ".", 1)) {
+				continue;
+			}
+			if (type == ENTRY_OTHER) {
+				/* d_type says it is not a file */
+				continue;
+			}
+			sprintf (pathbuf, "%s/%s", poll_dir, name);
+
+			if ((p_item = q_find(pathbuf))) {
+				/* already queued */
+				p_item->scan_gen = p_state->scan_gen;
+				if (!ClientOpt.wait_last_file) {
+					/* and was complete then */
+					continue;
+				}
+			} else if ((p_sent = find_prod(&p_tbl->window, pathbuf,
+					p_state->dev, ino)) && !strcmp(p_sent->filename, pathbuf)) {
+				/* in the window, no need to stat it */
+				continue;
+			} else {
+				fresh++;
+			}
+		}
+
+#ifdef INCLUDE_IO_URING
+		if (use_uring && ClientOpt.io_uring) {
+			/* stat entries a batch at a time */
+			if (got > 0) {
+				strcpy(batch[nbatch], pathbuf);
+				batch_name[nbatch] = batch[nbatch] + strlen(poll_dir) + 1;
+				batch_queued[nbatch] = p_item != NULL;
+				nbatch++;
+				if (nbatch < URING_STAT_BATCH) {
+					continue;
+				}
+			}
+			p_state->stats += nbatch;
+			if (uring_stat_batch(p_state->fd, batch_name, nbatch,
+					batch_stat, batch_err) < 0) {
+				/* use stat from now on */
+				ClientOpt.io_uring = 0;
+				for (i = 0; i < nbatch; i++) {
+					batch_err[i] = stat_entry(p_state, batch_name[i], batch[i],
+							&batch_stat[i], 0) < 0 ? errno : 0;
+				}
+			}
+			for (i = 0; i < nbatch; i++) {
+				if (batch_err[i]) {
+					CS_LOG_ERR(ERROR_FP, "%s: Fail stat file %s, %s\n", 
+								LOG_PREFIX, batch[i], strerror(batch_err[i]));
+				} else if (scan_add(p_state, batch_name[i], &batch_stat[i],
+						batch_queued[i]) < 0) {
+					p_state->complete = 0;
+					break;
+				}
+			}
+			nbatch = 0;
+		} else
+#endif
+		if (got > 0) {
+			p_state->stats++;
+			/* files already queued may be growing, get their real size */
+			if (stat_entry(p_state, name, pathbuf, &stat_struct,
+					p_item != NULL) < 0) {
+				CS_LOG_ERR(ERROR_FP, "%s: Fail stat file %s, %s\n", 
+							LOG_PREFIX, pathbuf, strerror(errno));
+			} else if (scan_add(p_state, name, &stat_struct,
+					p_item != NULL) < 0) {
+				p_state->complete = 0;
+			}
+		}
+
+		if (got > 0 && slice > 0 && entries >= slice && p_state->complete) {
+			/* continue this pass at the next poll */
+			p_state->in_pass = 1;
+			p_state->complete = 0;
+			break;
+		}
+		if (got <= 0 || !p_state->complete || (ClientOpt.max_queue_len > 0
+				&& !ClientOpt.oldest_first
+				&& fresh >= ClientOpt.max_queue_len)) {
+			/* If we have found ClientOpt.max_queue_len new files in the
+			 * directory quit and start sending them so that we don't
+			 * spend all our time polling and no time processing.
+			 */
+			if (got > 0) {
+				p_state->complete = 0;
+			}
+			break;
+		}
+	}
+
+	if (got < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: Fail read directory %s, %s\n", 
+					LOG_PREFIX, poll_dir, strerror(errno));
+		p_state->complete = 0;
+	}
+
+	if (!p_state->in_pass) {
+		dir_close(p_state, poll_dir);
+	}
+} /* end scan_read */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int scan_merge(prod_tbl_t *p_tbl, int i_dir)
+
+FUNCTION DESCRIPTION
+	Second half of reading input directory i_dir: queue the files
+	scan_read found, and if the whole directory was read, drop queued
+	files that are no longer in it.  Nothing is queued until a pass
+	(ClientOpt.oldest_first) is finished.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I	address of product table
+	int				i_dir			I	index in indir_list
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char **			indir_list		I	null-terminated list of input dirs
+	char			verbosity		I	verbosity level
+
+RETURNS
+	 1	Directory read
+	 0	Directory partly read (queue limit, pass not finished, or could
+		not open it)
+	-1	Error
+*******************************************************************************/
+static int scan_merge(prod_tbl_t *p_tbl, int i_dir)
+{
+	dirstate_t *p_state;
+	struct stat stat_struct;
+	struct timeval end_tv;
+	cand_t *p_cand;
+	char *poll_dir;
+	char *name;
+	char pathbuf[FILENAME_LEN];
+	int heap_start;
+	int priority;
+	int waiting;
+	int rc;
+	int i;
+
+	poll_dir = ClientOpt.indir_list[i_dir];
+	p_state = &DirState[i_dir];
+	priority = DirCount-1 - i_dir;
+
+	if (p_state->in_pass) {
+		/* read it again at the next check */
+		p_state->dirty = 1;
+		return 0;
+	}
+
+	if (ClientOpt.sched == SCHED_WFQ && p_state->cand_cnt > 1) {
+		/* tags are given in queueing order, make that mtime order */
+		qsort(p_state->p_cand, p_state->cand_cnt, sizeof(cand_t),
+				compare_cand);
+	}
+
+	heap_start = HeapCnt;
+	waiting = 0;
+	memset(&stat_struct, '\0', sizeof(stat_struct));
+	for (i = 0; i < p_state->cand_cnt; i++) {
+		p_cand = &p_state->p_cand[i];
+		name = p_state->names + p_cand->name_off;
+		sprintf (pathbuf, "%s/%s", poll_dir, name);
+		stat_struct.st_mode = p_cand->mode;
+		stat_struct.st_size = p_cand->size;
+		stat_struct.st_mtime = p_cand->mtime;
+#ifdef __linux__
+		stat_struct.st_mtim.tv_nsec = p_cand->mtime_nsec;
+#endif
+		stat_struct.st_dev = p_cand->dev;
+		stat_struct.st_ino = p_cand->ino;
+		if ((rc = queue_entry(p_tbl, p_state, name, pathbuf, &stat_struct,
+				priority)) < 0) {
+			p_state->cand_cnt = 0;
+			return -1;
+		} else if (rc == QUEUE_WAIT) {
+			waiting++;
+		}
+	}
+	p_state->cand_cnt = 0;
+	if (p_state->cand_max > SCAN_KEEP_CAND) {
+		/* a big backlog was found, do not hold on to the room for it */
+		free(p_state->p_cand);
+		free(p_state->names);
+		p_state->p_cand = NULL;
+		p_state->names = NULL;
+		p_state->cand_max = 0;
+		p_state->names_max = 0;
+	}
+
+	if (p_state->complete) {
+		q_remove_unseen(priority, p_state->scan_gen);
+	}
+	p_state->dirty = !p_state->complete || p_state->dropped > 0
+			|| waiting > 0;
+
+	if (ClientOpt.verbosity > 1) {
+		gettimeofday(&end_tv, NULL);
+		CS_LOG_DBUG(DEBUG_FP,
+				"%s: Read %s, %d entries, %d stat'ed, %d new, %ld ms\n",
+				LOG_PREFIX, poll_dir, p_state->entries, p_state->stats,
+				HeapCnt - heap_start,
+				(end_tv.tv_sec - p_state->start_tv.tv_sec) * 1000L
+				+ (end_tv.tv_usec - p_state->start_tv.tv_usec) / 1000);
+	}
+
+	return p_state->complete && !p_state->dropped;
+} /* end scan_merge */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int scan_add(dirstate_t *p_state, char *name, struct stat *p_stat,
+				int queued)
+
+FUNCTION DESCRIPTION
+	Used internally by scan_read to keep a file for scan_merge to queue.
+	Files that are not regular files or links are dropped here.
+
+	With ClientOpt.oldest_first, p_cand is a heap with the newest file
+	that is not queued on top (see cand_newer).  Once max_queue_len such
+	files are kept, a file only gets in by taking the place of the top
+	one, so a pass over any number of files keeps the oldest of them in
+	the same space.  Queued files (wait_last_file) are always kept.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+	char *			name			I	entry name
+	struct stat *	p_stat			I	its status
+	int				queued			I	it is already queued
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	int 			max_queue_len	I	max number of items to add per poll
+	char			oldest_first	I	keep the oldest of a whole pass
+
+RETURNS
+	 0	Normal return
+	-1	Error (out of memory)
+*******************************************************************************/
+static int scan_add(dirstate_t *p_state, char *name, struct stat *p_stat,
+			int queued)
+{
+	cand_t *p_cand;
+	char *p_names;
+	size_t len;
+	int idx;
+	int max;
+
+	if (!(p_stat->st_mode & (S_IFREG|S_IFLNK))) {
+		/* not a regular file or link, queue_item would skip it */
+		return 0;
+	}
+
+	idx = p_state->cand_cnt;
+	if (ClientOpt.oldest_first && !queued && ClientOpt.max_queue_len > 0
+			&& p_state->fresh >= ClientOpt.max_queue_len) {
+		/* full, take the place of the newest if this one is older */
+		p_state->dropped++;
+		if (p_stat->st_mtime >= p_state->p_cand[0].mtime) {
+			return 0;
+		}
+		idx = 0;
+	} else if (p_state->cand_cnt >= p_state->cand_max) {
+		max = p_state->cand_max ? 2 * p_state->cand_max : 256;
+		if (!(p_cand = realloc(p_state->p_cand, max * sizeof(cand_t)))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL realloc %d scan entries, %s\n",
+						LOG_PREFIX, max, strerror(errno));
+			return -1;
+		}
+		p_state->p_cand = p_cand;
+		p_state->cand_max = max;
+	}
+
+	len = strlen(name) + 1;
+	if (p_state->names_len + len > p_state->names_max
+			&& (!ClientOpt.oldest_first || scan_compact(p_state, len) < 0)) {
+		max = p_state->names_max ? 2 * p_state->names_max : 16*1024;
+		if (!(p_names = realloc(p_state->names, max))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL realloc %d bytes of names, %s\n",
+						LOG_PREFIX, max, strerror(errno));
+			return -1;
+		}
+		p_state->names = p_names;
+		p_state->names_max = max;
+	}
+
+	p_cand = &p_state->p_cand[idx];
+	p_cand->name_off = p_state->names_len;
+	memcpy(p_state->names + p_state->names_len, name, len);
+	p_state->names_len += len;
+
+	p_cand->mode = p_stat->st_mode;
+	p_cand->size = p_stat->st_size;
+	p_cand->mtime = p_stat->st_mtime;
+	p_cand->mtime_nsec = ST_MTIME_NSEC(p_stat);
+	p_cand->dev = p_stat->st_dev;
+	p_cand->ino = p_stat->st_ino;
+	p_cand->queued = queued;
+
+	if (idx == p_state->cand_cnt) {
+		p_state->cand_cnt++;
+		if (!queued) {
+			p_state->fresh++;
+		}
+		if (ClientOpt.oldest_first) {
+			cand_sift_up(p_state, idx);
+		}
+	} else {
+		cand_sift_down(p_state, idx);
+	}
+
+	return 0;
+} /* end scan_add */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int scan_compact(dirstate_t *p_state, size_t len)
+
+FUNCTION DESCRIPTION
+	Used internally by scan_add to make room for a name of len bytes by
+	dropping the names of files that scan_add replaced.  This is done
+	only if it frees at least half of the names buffer, so each name is
+	copied a bounded number of times.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+	size_t			len				I	bytes needed
+
+RETURNS
+	 0	Normal return, there is room
+	-1	Not worth it, or out of memory (grow the buffer instead)
+*******************************************************************************/
+static int scan_compact(dirstate_t *p_state, size_t len)
+{
+	char *p_names;
+	size_t used;
+	int i;
+
+	for (used = len, i = 0; i < p_state->cand_cnt; i++) {
+		used += strlen(p_state->names + p_state->p_cand[i].name_off) + 1;
+	}
+	if (used > p_state->names_max / 2
+			|| !(p_names = malloc(p_state->names_max))) {
+		return -1;
+	}
+
+	for (used = 0, i = 0; i < p_state->cand_cnt; i++) {
+		len = strlen(p_state->names + p_state->p_cand[i].name_off) + 1;
+		memcpy(p_names + used, p_state->names + p_state->p_cand[i].name_off,
+				len);
+		p_state->p_cand[i].name_off = used;
+		used += len;
+	}
+	free(p_state->names);
+	p_state->names = p_names;
+	p_state->names_len = used;
+
+	return 0;
+} /* end scan_compact */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int cand_newer(dirstate_t *p_state, int i1, int i2)
+
+FUNCTION DESCRIPTION
+	Heap order of the files kept by scan_add (ClientOpt.oldest_first):
+	files that are not queued come before queued ones, newest first.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I	directory read state
+	int				i1				I	index in p_cand
+	int				i2				I	index in p_cand
+
+RETURNS
+	1 if i1 belongs above i2, else 0
+*******************************************************************************/
+static int cand_newer(dirstate_t *p_state, int i1, int i2)
+{
+	cand_t *p_c1;
+	cand_t *p_c2;
+
+	p_c1 = &p_state->p_cand[i1];
+	p_c2 = &p_state->p_cand[i2];
+	if (p_c1->queued != p_c2->queued) {
+		return p_c2->queued;
+	}
+	return p_c1->mtime > p_c2->mtime;
+} /* end cand_newer */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void cand_sift_up(dirstate_t *p_state, int idx)
+
+FUNCTION DESCRIPTION
+	Move p_cand[idx] up the heap to its place.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+	int				idx				I	index in p_cand
+
+RETURNS
+	void
+*******************************************************************************/
+static void cand_sift_up(dirstate_t *p_state, int idx)
+{
+	cand_t tmp;
+	int parent;
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (!cand_newer(p_state, idx, parent)) {
+			break;
+		}
+		tmp = p_state->p_cand[idx];
+		p_state->p_cand[idx] = p_state->p_cand[parent];
+		p_state->p_cand[parent] = tmp;
+		idx = parent;
+	}
+} /* end cand_sift_up */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void cand_sift_down(dirstate_t *p_state, int idx)
+
+FUNCTION DESCRIPTION
+	Move p_cand[idx] down the heap to its place.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+	int				idx				I	index in p_cand
+
+RETURNS
+	void
+*******************************************************************************/
+static void cand_sift_down(dirstate_t *p_state, int idx)
+{
+	cand_t tmp;
+	int child;
+
+	for (;;) {
+		child = 2 * idx + 1;
+		if (child >= p_state->cand_cnt) {
+			break;
+		}
+		if (child + 1 < p_state->cand_cnt
+				&& cand_newer(p_state, child + 1, child)) {
+			child++;
+		}
+		if (!cand_newer(p_state, child, idx)) {
+			break;
+		}
+		tmp = p_state->p_cand[idx];
+		p_state->p_cand[idx] = p_state->p_cand[child];
+		p_state->p_cand[child] = tmp;
+		idx = child;
+	}
+} /* end cand_sift_down */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int dir_open(dirstate_t *p_state, char *dir)
+
+FUNCTION DESCRIPTION
+	Start reading an input directory from its first entry, and note its
+	mtime, device and inode.  On Linux the directory stays open between
+	reads, and is opened again by name only if it was removed (or replaced,
+	see dir_reset).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+	char *			dir				I	directory path
+
+RETURNS
+	 0	Normal return
+	-1	Error (errno is set)
+*******************************************************************************/
+static int dir_open(dirstate_t *p_state, char *dir)
+{
+	struct stat stat_struct;
+	int fd;
+
+#ifdef __linux__
+	if (p_state->fd >= 0 && (fstat(p_state->fd, &stat_struct) < 0
+			|| stat_struct.st_nlink == 0)) {
+		/* removed since the last read */
+		dir_reset(p_state);
+	}
+	if (p_state->fd < 0) {
+		if ((p_state->fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+			return -1;
+		}
+	} else if (lseek(p_state->fd, 0, SEEK_SET) < 0) {
+		return -1;
+	}
+	if (!p_state->dent_buf && !(p_state->dent_buf = malloc(DENT_BUF_SIZE))) {
+		return -1;
+	}
+	p_state->dent_len = p_state->dent_pos = 0;
+	fd = p_state->fd;
+#else
+	if (!(p_state->p_dir = opendir(dir))) {
+		return -1;
+	}
+	fd = dirfd(p_state->p_dir);
+#endif
+
+	/* take the mtime first, so changes made while reading are seen later */
+	if (fstat(fd, &stat_struct) == 0) {
+		p_state->mtime = stat_struct.st_mtime;
+		p_state->dev = stat_struct.st_dev;
+		p_state->ino = stat_struct.st_ino;
+	}
+
+	return 0;
+} /* end dir_open */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int dir_read(dirstate_t *p_state, char **p_name, int *p_type,
+				ino_t *p_ino)
+
+FUNCTION DESCRIPTION
+	Get the next entry of the directory opened by dir_open.  On Linux the
+	entries are read DENT_BUF_SIZE bytes at a time with getdents64 into
+	the directory's own buffer, so directories can be read at once, and
+	their d_type tells which are not files.  The name is good until the
+	next call.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I	directory read state
+	char **			p_name			O	entry name
+	int *			p_type			O	ENTRY_UNKNOWN, ENTRY_FILE or ENTRY_OTHER
+	ino_t *			p_ino			O	entry inode
+
+RETURNS
+	 1	Entry returned
+	 0	No more entries
+	-1	Error (errno is set)
+*******************************************************************************/
+static int dir_read(dirstate_t *p_state, char **p_name, int *p_type,
+			ino_t *p_ino)
+{
+#ifdef __linux__
+	dent64_t *p_dent;
+	long len;
+
+	if (p_state->dent_pos >= p_state->dent_len) {
+		p_state->dent_pos = p_state->dent_len = 0;
+		if ((len = syscall(SYS_getdents64, p_state->fd, p_state->dent_buf,
+				DENT_BUF_SIZE)) <= 0) {
+			return len < 0 ? -1 : 0;
+		}
+		p_state->dent_len = len;
+	}
+
+	p_dent = (dent64_t *)&p_state->dent_buf[p_state->dent_pos];
+	p_state->dent_pos += p_dent->d_reclen;
+
+	*p_name = p_dent->d_name;
+	*p_ino = p_dent->d_ino;
+	switch (p_dent->d_type) {
+		case DT_UNKNOWN:
+			*p_type = ENTRY_UNKNOWN;
+			break;
+		case DT_REG:
+		case DT_LNK:
+			*p_type = ENTRY_FILE;
+			break;
+		default:
+			*p_type = ENTRY_OTHER;
+			break;
+	}
+	return 1;
+#else
+	struct dirent *p_dirent;
+
+	errno = 0;
+	if (!(p_dirent = readdir(p_state->p_dir))) {
+		return errno ? -1 : 0;
+	}
+
+	*p_name = p_dirent->d_name;
+	*p_ino = p_dirent->d_ino;
+	*p_type = ENTRY_UNKNOWN;
+	return 1;
+#endif
+} /* end dir_read */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void dir_close(dirstate_t *p_state, char *dir)
+
+FUNCTION DESCRIPTION
+	Finish reading a directory.  On Linux it is left open for the next
+	read.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+	char *			dir				I	directory path
+
+RETURNS
+	void
+*******************************************************************************/
+static void dir_close(dirstate_t *p_state, char *dir)
+{
+#ifndef __linux__
+	if (closedir(p_state->p_dir) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: Fail close directory %s, %s\n", 
+					LOG_PREFIX, dir, strerror(errno));
+		/* ignore error for now */
+	}
+	p_state->p_dir = NULL;
+#endif
+} /* end dir_close */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void dir_reset(dirstate_t *p_state)
+
+FUNCTION DESCRIPTION
+	Close a directory kept open by dir_open, so the next dir_open opens it
+	by name again.  Used when the directory was removed or replaced.  A
+	pass that was not finished (see scan_read) starts over.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I/O	directory read state
+
+RETURNS
+	void
+*******************************************************************************/
+static void dir_reset(dirstate_t *p_state)
+{
+#ifdef __linux__
+	if (p_state->fd >= 0) {
+		close(p_state->fd);
+		p_state->fd = -1;
+	}
+#else
+	if (p_state->in_pass) {
+		closedir(p_state->p_dir);
+		p_state->p_dir = NULL;
+	}
+#endif
+	p_state->in_pass = 0;
+} /* end dir_reset */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int stat_entry(dirstate_t *p_state, char *name, char *pathbuf,
+				struct stat *p_stat, int sync)
+
+FUNCTION DESCRIPTION
+	Stat a directory entry.  On Linux it is looked up relative to the open
+	directory, and unless sync is set, with statx AT_STATX_DONT_SYNC so
+	that attributes already cached by a network file system are used
+	without asking the server again.  Only st_mode, st_size, st_mtime
+	(and its nsecs), st_dev and st_ino are sure to be filled in.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	dirstate_t *	p_state			I	directory read state
+	char *			name			I	entry name
+	char *			pathbuf			I	entry path
+	struct stat *	p_stat			O	stat result
+	int				sync			I	get current attributes
+
+RETURNS
+	 0	Normal return
+	-1	Error (errno is set)
+*******************************************************************************/
+static int stat_entry(dirstate_t *p_state, char *name, char *pathbuf,
+			struct stat *p_stat, int sync)
+{
+#ifdef __linux__
+#	ifdef STATX_TYPE
+	struct statx statx_struct;
+
+	if (!StatxOff) {
+		if (statx(p_state->fd, name,
+				sync ? AT_STATX_SYNC_AS_STAT : AT_STATX_DONT_SYNC,
+				STATX_TYPE|STATX_MODE|STATX_SIZE|STATX_MTIME|STATX_INO,
+				&statx_struct) == 0) {
+			memset(p_stat, '\0', sizeof(struct stat));
+			p_stat->st_mode = statx_struct.stx_mode;
+			p_stat->st_size = statx_struct.stx_size;
+			p_stat->st_mtime = statx_struct.stx_mtime.tv_sec;
+			p_stat->st_mtim.tv_nsec = statx_struct.stx_mtime.tv_nsec;
+			p_stat->st_dev = makedev(statx_struct.stx_dev_major,
+					statx_struct.stx_dev_minor);
+			p_stat->st_ino = statx_struct.stx_ino;
+			return 0;
+		}
+		if (errno != ENOSYS) {
+			return -1;
+		}
+		/* kernel older than 4.11 */
+		StatxOff = 1;
+	}
+#	endif
+	return fstatat(p_state->fd, name, p_stat, 0);
+#else
+	return stat(pathbuf, p_stat);
+#endif
+} /* end stat_entry */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int queue_entry(prod_tbl_t *p_tbl, dirstate_t *p_state,
+				char *name, char *pathbuf, struct stat *p_stat, int priority)
+
+FUNCTION DESCRIPTION
+	Used internally by scan_merge to hand a stat'ed entry to queue_item.  If
+	it is not ready yet, it is stat'ed again with current attributes
+	first, since cached attributes may be from before it was complete.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I	address of product table
+	dirstate_t *	p_state			I	directory read state
+	char *			name			I	entry name
+	char *			pathbuf			I	entry path
+	struct stat *	p_stat			I/O	its status
+	int				priority		I	priority of the directory
+
+RETURNS
+	same as queue_item
+*******************************************************************************/
+static int queue_entry(prod_tbl_t *p_tbl, dirstate_t *p_state, char *name,
+			char *pathbuf, struct stat *p_stat, int priority)
+{
+	int rc;
+
+	rc = queue_item(p_tbl, pathbuf, p_stat, priority, 0);
+#ifdef __linux__
+	if (rc == QUEUE_WAIT && stat_entry(p_state, name, pathbuf, p_stat, 1) == 0) {
+		rc = queue_item(p_tbl, pathbuf, p_stat, priority, 0);
+	}
+#endif
+
+	return rc;
+} /* end queue_entry */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int queue_item(prod_tbl_t *p_tbl, char *pathbuf,
+				struct stat *p_stat, int priority, int closed)
+
+FUNCTION DESCRIPTION
+	Used internally by get_next_file to add a directory entry to the queue
+	if it is a readable file, is not still being created, and is not
+	already in the window.  If the file is already queued, its attributes
+	are updated.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I	address of product table
+	char *			pathbuf			I	path of entry
+	struct stat *	p_stat			I	stat of entry
+	int				priority		I	priority of entry's directory
+	int				closed			I	writer has closed the file
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char			inotify			I	watch input dirs with inotify
+	char			verbosity		I	verbosity level
+
+RETURNS
+	QUEUE_ADD	Item added or updated
+	QUEUE_SKIP	Item skipped
+	QUEUE_WAIT	Item skipped until it is ready
+	-1			Error
+*******************************************************************************/
+static int queue_item(prod_tbl_t *p_tbl, char *pathbuf, struct stat *p_stat,
+			int priority, int closed)
+{
+	qitem_t *p_item;
+
+	if (!(p_stat->st_mode & (S_IFREG|S_IFLNK))) {
+		/* not a regular file or link, skip it */
+		return QUEUE_SKIP;
+	}
+
+	/* Check if have access to file */
+	if (!(p_stat->st_mode & (PERM_MASK))) {
+		/* No one has read permission, skip it */
+		/* May want to use access() to check if can read file */
+		/*    open will fail later anyway */
+		return QUEUE_WAIT;
+	}
+
+	/* Check that size is > 0 or mtime was a while ago */
+	if (p_stat->st_size == 0) {
+		/* File is zero-length, how long has it been that way? */
+		if (p_stat->st_mtime > time(NULL) - A_FEW_SECONDS) {
+			/* give it a few seconds */
+#ifdef __linux__
+			if (ClientOpt.inotify && (!RescanTime
+					|| RescanTime > p_stat->st_mtime + A_FEW_SECONDS)) {
+				/* no event will say when it is old enough */
+				RescanTime = p_stat->st_mtime + A_FEW_SECONDS;
+			}
+#endif
+			return QUEUE_WAIT;
+		}
+		/* else pass it on so it can fail and be removed */
+	}
+
+	if ((p_item = q_find(pathbuf))) {
+		/* already queued, it may have grown */
+		p_item->queue_time = p_stat->st_mtime;
+		p_item->queue_nsec = ST_MTIME_NSEC(p_stat);
+		p_item->size = p_stat->st_size;
+		p_item->closed |= closed;
+		p_item->scan_gen = DirState[DirCount-1 - priority].scan_gen;
+		q_update(p_item);
+		return QUEUE_ADD;
+	}
+
+	/* Check if file has already been sent */
+	if (check_window(p_tbl, pathbuf, p_stat) != 0) {
+		/* file is in the window, don't queue it */
+		return QUEUE_SKIP;
+	}
+
+	if (!(p_item = q_alloc(pathbuf))) {
+		return -1;
+	}
+
+	p_item->queue_time = p_stat->st_mtime;
+	p_item->queue_nsec = ST_MTIME_NSEC(p_stat);
+	p_item->size = p_stat->st_size;
+	p_item->priority = priority;
+	p_item->closed = closed;
+	p_item->dev = p_stat->st_dev;
+	p_item->ino = p_stat->st_ino;
+	p_item->scan_gen = DirState[DirCount-1 - priority].scan_gen;
+
+	if (q_insert(p_item) < 0) {
+		return -1;
+	}
+
+	if (ClientOpt.verbosity > 2) {
+		CS_LOG_DBUG(DEBUG_FP,
+				"%s: Added item %s, cnt=%d p=%d, t=%ld\n",
+				LOG_PREFIX,
+				Q_NAME(p_item),
+				HeapCnt-1,
+				p_item->priority,
+				p_item->queue_time);
+	}
+
+	return QUEUE_ADD;
+} /* end queue_item */
+
+#ifdef __linux__
+/*******************************************************************************
+FUNCTION NAME
+	static int notify_queue(prod_tbl_t *p_tbl)
+
+FUNCTION DESCRIPTION
+	Used internally by get_next_file with the inotify option.  Decides
+	whether the input directories must be rescanned and, if not, adds the
+	files reported by notify_next to the queue.  A file that is already
+	queued only has its attributes updated.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I	address of product table
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	int 			max_queue_len	I	max number of items to add per poll
+
+RETURNS
+	 1	Rescan needed
+	 0	Queue is up to date
+	-1	Error
+*******************************************************************************/
+static int notify_queue(prod_tbl_t *p_tbl)
+{
+	struct stat stat_struct;
+	char pathbuf[FILENAME_LEN];
+	int i_dir;
+	int closed;
+	int rc;
+
+	if (NotifyRescan || (ScanFull && HeapCnt == 0)
+			|| (RescanTime > 0 && time(NULL) >= RescanTime)) {
+		return 1;
+	}
+
+	while ((rc = notify_next(pathbuf, &i_dir, &closed)) != 0) {
+		if (rc < 0) {
+			NotifyRescan = 1;
+			return 1;
+		}
+
+		if (stat(pathbuf, &stat_struct) < 0) {
+			/* it is normal for a file to be gone (e.g. moved on) */
+			if (errno != ENOENT) {
+				CS_LOG_ERR(ERROR_FP, "%s: Fail stat file %s, %s\n", 
+							LOG_PREFIX, pathbuf, strerror(errno));
+			}
+			continue;
+		}
+
+		if (ClientOpt.max_queue_len > 0 && HeapCnt >= ClientOpt.max_queue_len
+				&& !q_find(pathbuf)) {
+			/* the rescan when the queue drains will pick it up */
+			ScanFull = 1;
+			continue;
+		}
+
+		if (queue_item(p_tbl, pathbuf, &stat_struct, DirCount-1 - i_dir,
+				closed) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+} /* end notify_queue */
+#endif
+
+/*******************************************************************************
+FUNCTION NAME
+	static qitem_t *q_alloc(char *filename)
+
+FUNCTION DESCRIPTION
+	Get a cleared item with its filename in the Names arena, ready to be
+	added to the queue by q_insert.  Freed items are used again first.
+	Names are added at the end of the arena; when it is full and at least
+	half of it is names of items that are gone, the live names are copied
+	to a new arena instead of growing it.  Item addresses are good until
+	the next q_alloc.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			filename		I	path of the file
+
+RETURNS
+	address of the item
+	NULL if out of memory
+*******************************************************************************/
+static qitem_t *q_alloc(char *filename)
+{
+	qitem_t *p_items;
+	qitem_t *p_item;
+	char *p_names;
+	size_t names_max;
+	size_t len;
+	int item_max;
+	int item;
+	int i;
+
+	len = strlen(filename) + 1;
+	if (NamesLen + len > NamesMax) {
+		if (NamesDead >= NamesLen / 2 && NamesLen + len - NamesDead <= NamesMax) {
+			names_max = NamesMax;
+		} else {
+			for (names_max = NamesMax ? NamesMax : 64*1024;
+					NamesLen + len - NamesDead > names_max / 2; names_max *= 2);
+		}
+		if (!(p_names = malloc(names_max))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %lu bytes of queue names, %s\n",
+						LOG_PREFIX, (unsigned long)names_max, strerror(errno));
+			return NULL;
+		}
+		/* copy the names of the queued items, dropping the dead ones */
+		for (NamesLen = 0, i = 0; i < HeapCnt; i++) {
+			p_item = &Items[Heap[i].item];
+			strcpy(p_names + NamesLen, Names + p_item->name_off);
+			p_item->name_off = NamesLen;
+			NamesLen += strlen(p_names + NamesLen) + 1;
+		}
+		free(Names);
+		Names = p_names;
+		NamesMax = names_max;
+		NamesDead = 0;
+	}
+
+	if (ItemFree >= 0) {
+		item = ItemFree;
+		ItemFree = Items[item].heap_idx;
+	} else {
+		if (ItemCnt == ItemMax) {
+			item_max = ItemMax ? 2*ItemMax : INDEX_MIN_SIZE;
+			if (!(p_items = realloc(Items, item_max * sizeof(qitem_t)))) {
+				CS_LOG_ERR(ERROR_FP, "%s: FAIL realloc %d queue items, %s\n",
+							LOG_PREFIX, item_max, strerror(errno));
+				return NULL;
+			}
+			Items = p_items;
+			ItemMax = item_max;
+		}
+		item = ItemCnt++;
+	}
+
+	p_item = &Items[item];
+	memset(p_item, '\0', sizeof(qitem_t));
+	p_item->name_off = NamesLen;
+	memcpy(Names + NamesLen, filename, len);
+	NamesLen += len;
+
+	return p_item;
+} /* end q_alloc */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void q_free(qitem_t *p_item)
+
+FUNCTION DESCRIPTION
+	Return an item that is no longer queued (or was never added) to the
+	free items.  When the queue is empty the items and names start over.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	item to free
+
+RETURNS
+	void
+*******************************************************************************/
+static void q_free(qitem_t *p_item)
+{
+	if (HeapCnt == 0) {
+		ItemCnt = 0;
+		ItemFree = -1;
+		NamesLen = NamesDead = 0;
+		return;
+	}
+
+	NamesDead += strlen(Q_NAME(p_item)) + 1;
+	p_item->heap_idx = ItemFree;
+	ItemFree = p_item - Items;
+} /* end q_free */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void q_prod(qitem_t *p_item, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Make the prod_info_t of a queued item.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	queued item
+	prod_info_t *	p_prod			O	its product info
+
+RETURNS
+	void
+*******************************************************************************/
+static void q_prod(qitem_t *p_item, prod_info_t *p_prod)
+{
+	memset(p_prod, '\0', sizeof(prod_info_t));
+	strcpy(p_prod->filename, Q_NAME(p_item));
+	p_prod->queue_time = p_item->queue_time;
+	p_prod->queue_nsec = p_item->queue_nsec;
+	p_prod->size = p_item->size;
+	p_prod->priority = p_item->priority;
+	p_prod->closed = p_item->closed;
+	p_prod->dev = p_item->dev;
+	p_prod->ino = p_item->ino;
+} /* end q_prod */
+
+/*******************************************************************************
+FUNCTION NAME
+	static unsigned long long q_key(qitem_t *p_item)
+
+FUNCTION DESCRIPTION
+	Make the heap key of an item for the ClientOpt.sched send order: the
+	smaller key is sent first.
+
+	SCHED_PRIO:	the priority, inverted, in the top bits and the queue_time,
+				clamped to Q_TIME_BITS, below it (compare_items order).
+	SCHED_WFQ:	a virtual finish tag.  Each item of a directory is charged
+				its size plus WFQ_PROD_BYTES, divided by the directory's
+				weight, after the later of its last item's tag and the tag
+				of the last item taken (so an idle directory does not save
+				up credit).  Directories then get sends in proportion to
+				their weights.  The tag is charged to the directory, so it
+				is made once, when the item is queued.
+	SCHED_EDF:	the deadline (queue_time + queue_ttl) in the top bits and
+				the inverted priority below it.
+	SCHED_SJF:	the queue_time in usecs plus a usec for each
+				SJF_BYTES_PER_SEC / 1000000 bytes of size.  The size only
+				moves a file back behind files that arrived a little later,
+				so a big file is not kept back forever.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	queued item
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char			sched			I	send order policy
+	int *			sched_weights	I	SCHED_WFQ weight of each input dir
+	time_t			queue_ttl		I	queue time-to-live
+
+RETURNS
+	the key
+*******************************************************************************/
+static unsigned long long q_key(qitem_t *p_item)
+{
+	dirstate_t *p_state;
+	unsigned long long t;
+	unsigned long long size;
+	int i_dir;
+
+	t = p_item->queue_time < 0 ? 0 : (unsigned long long)p_item->queue_time;
+	size = p_item->size < 0 ? 0 : (unsigned long long)p_item->size;
+
+	switch (ClientOpt.sched) {
+		case SCHED_WFQ:
+			i_dir = DirCount-1 - p_item->priority;
+			p_state = &DirState[i_dir];
+			if (p_state->wfq_tag < WfqTime) {
+				p_state->wfq_tag = WfqTime;
+			}
+			p_state->wfq_tag += (size + WFQ_PROD_BYTES) * WFQ_SCALE
+					/ ClientOpt.sched_weights[i_dir];
+			return p_state->wfq_tag;
+		case SCHED_EDF:
+			if (ClientOpt.queue_ttl > 0) {
+				t += ClientOpt.queue_ttl;
+			}
+			if (t > Q_TIME_MAX) {
+				t = Q_TIME_MAX;
+			}
+			return (t << (64 - Q_TIME_BITS))
+					| (Q_PRIORITY_MAX - p_item->priority);
+		case SCHED_SJF:
+			return t * 1000000ULL + size * 1000000ULL / SJF_BYTES_PER_SEC;
+		default:
+			if (t > Q_TIME_MAX) {
+				t = Q_TIME_MAX;
+			}
+			return ((unsigned long long)(Q_PRIORITY_MAX - p_item->priority)
+					<< Q_TIME_BITS) | t;
+	}
+} /* end q_key */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int q_insert(qitem_t *p_item)
+
+FUNCTION DESCRIPTION
+	Add an item from q_alloc to the queue heap and filename index.  On
+	error the item is freed.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	item to add
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int q_insert(qitem_t *p_item)
+{
+	qkey_t *p_heap;
+	int heap_max;
+
+	if (HeapCnt == HeapMax) {
+		heap_max = HeapMax ? 2*HeapMax : INDEX_MIN_SIZE;
+		if (!(p_heap = realloc(Heap, heap_max * sizeof(qkey_t)))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL realloc %d queue items, %s\n",
+						LOG_PREFIX, heap_max, strerror(errno));
+			q_free(p_item);
+			return -1;
+		}
+		Heap = p_heap;
+		HeapMax = heap_max;
+	}
+
+	p_item->heap_idx = HeapCnt;
+	Heap[HeapCnt].key = q_key(p_item);
+	Heap[HeapCnt].item = p_item - Items;
+	HeapCnt++;
+	if (q_index_add(p_item) < 0) {
+		HeapCnt--;
+		q_free(p_item);
+		return -1;
+	}
+	q_sift_up(p_item->heap_idx);
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <dirent.h>
+	if (p_item->queue_time > NewestTime) {
+		NewestTime = p_item->queue_time;
+	}
 
-int compare_items(const void *p_v1, const void *p_v2);
-int check_window(prod_tbl_t *p_tbl, char *filename);
+	return 0;
+} /* end q_insert */
 
-#define PERM_MASK S_IRUSR|S_IRGRP|S_IROTH  /* permissions for read */
-#define A_FEW_SECONDS 3
+/*******************************************************************************
+FUNCTION NAME
+	static void q_pop(prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Take the first item off the queue (which must not be empty) and make
+	its prod_info_t.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_info_t *	p_prod			O	product info of the item
+
+RETURNS
+	void
+*******************************************************************************/
+static void q_pop(prod_info_t *p_prod)
+{
+	qitem_t *p_item;
+
+	p_item = &Items[Heap[0].item];
+	q_prod(p_item, p_prod);
+	sched_taken(p_item, Heap[0].key);
+	q_index_del(p_item);
+	if (--HeapCnt > 0) {
+		Heap[0] = Heap[HeapCnt];
+		Items[Heap[0].item].heap_idx = 0;
+		q_sift_down(0);
+	} else {
+		NewestTime = 0;
+	}
+	q_free(p_item);
+} /* end q_pop */
 
 /*******************************************************************************
 FUNCTION NAME
-	int get_next_file (prod_tbl_t *p_tbl, prod_info_t *p_prod)
+	static void q_update(qitem_t *p_item)
 
 FUNCTION DESCRIPTION
-	Gets the path, timestamp, size, and priority attributes of the next
-	file in the input queue and returns them via the p_prod argument.
+	Move an item to its place in the heap after its priority or
+	queue_time changed.  A SCHED_WFQ item keeps the tag it was queued
+	with, so a growing file is not charged again.
 
-	Files are polled from those listed in ClientOpt.indir_list.  The last
-	path in indir_list must be NULL.  The list of directories is assumed to
-	be in order of decreasing priority.  I.e. products will be taken from
-	the first directory before being taken from the other directories.  Files
-	polled from the indir_list are checked against files in the table to
-	determine whether they are already in progress.  If they are found
-	in the prod_tbl they are ignored, otherwise they are added to the queue.
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	queued item
 
-	The ClientOpt.refresh_interval is the interval at which the queue is
-	rebuilt.  A higher refresh_interval increases throughput by decreasing
-	the number of times the directories are polled for new items.  However, 
-	when there is a backlog, higher priority items may have to wait for the
-	refresh interval before they are inserted into the queue.  The queue is
-	always refreshed when it is empty, regardless of how long it has been
-	since the last refresh.
-
-	The ClientOpt.max_queue_len is the maximum number of items to read from
-	the input directories before sorting and returning the next item.  This 
-	increases throughput in severe backlogged conditions by decreasing the
-	amount of time required to poll the input directories and sort the
-	items.
-
-	The order of files returned is determied by priority then timestamp
-	(st_mtime).  If a file does not have read permission, it is assumed
-	to be in-progress and is not returned.  If a file has a size of 0,
-	it is assumed to be in-progress and is not returned unless it is more
-	than A_FEW_SECONDS old.
-	
-	If the ClientOpt.wait_last_file option is set, the most recent item to
-	arrive in the queue is not sent until another item arrives.  This option
-	is used when there is no method to determine whether a file in the input
-	queue is complete and ready to send.  This option can affect timeliness
-	of products so it should only be used when the files can not be 
-	atomically moved into the input directory, or have their mode toggled
-	to indicate that the file is complete.
+RETURNS
+	void
+*******************************************************************************/
+static void q_update(qitem_t *p_item)
+{
+	if (ClientOpt.sched != SCHED_WFQ) {
+		Heap[p_item->heap_idx].key = q_key(p_item);
+		q_sift_up(p_item->heap_idx);
+		q_sift_down(p_item->heap_idx);
+	}
+
+	if (p_item->queue_time > NewestTime) {
+		NewestTime = p_item->queue_time;
+	}
+} /* end q_update */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void q_remove_unseen(int priority, unsigned scan_gen)
+
+FUNCTION DESCRIPTION
+	Drop the queued items of a directory that the last read of it did not
+	see (the files are gone), and rebuild the heap.
 
 PARAMETERS
 	Type			Name			I/O	Description
-	prod_tbl_t *	p_tbl			O	address of prod table 
-	prod_info_t *	p_prod			O	address of prod info stucture 
+	int				priority		I	priority of the directory's items
+	unsigned		scan_gen		I	generation of the read
+
+RETURNS
+	void
+*******************************************************************************/
+static void q_remove_unseen(int priority, unsigned scan_gen)
+{
+	qitem_t *p_item;
+	int removed;
+	int i;
+	int j;
+
+	for (removed = 0, i = 0, j = 0; i < HeapCnt; i++) {
+		p_item = &Items[Heap[i].item];
+		if (p_item->priority == priority && p_item->scan_gen != scan_gen) {
+			q_index_del(p_item);
+			q_free(p_item);
+			removed++;
+		} else {
+			Heap[j] = Heap[i];
+			p_item->heap_idx = j;
+			j++;
+		}
+	}
+	HeapCnt = j;
+
+	if (removed) {
+		/* heapify from the last parent down */
+		for (i = HeapCnt/2 - 1; i >= 0; i--) {
+			q_sift_down(i);
+		}
+	}
+	if (HeapCnt == 0) {
+		NewestTime = 0;
+		ItemCnt = 0;
+		ItemFree = -1;
+		NamesLen = NamesDead = 0;
+	}
+} /* end q_remove_unseen */
+
+#ifdef INCLUDE_IO_URING
+/*******************************************************************************
+FUNCTION NAME
+	static int q_peek(qitem_t **p_next, int count)
+
+FUNCTION DESCRIPTION
+	Get up to count of the first items in the queue, in order, without
+	taking them off.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t **		p_next			O	first items
+	int				count			I	size of p_next (<= URING_PREFETCH)
+
+RETURNS
+	number of items returned
+*******************************************************************************/
+static int q_peek(qitem_t **p_next, int count)
+{
+	int cand[URING_PREFETCH+1];
+	int ncand;
+	int best;
+	int idx;
+	int n;
+	int i;
+
+	/* the next item is always a child of one already taken */
+	ncand = 0;
+	if (HeapCnt > 0) {
+		cand[ncand++] = 0;
+	}
+	for (n = 0; n < count && ncand > 0; n++) {
+		for (best = 0, i = 1; i < ncand; i++) {
+			if (Heap[cand[i]].key < Heap[cand[best]].key) {
+				best = i;
+			}
+		}
+		idx = cand[best];
+		p_next[n] = &Items[Heap[idx].item];
+		cand[best] = cand[--ncand];
+		if (2*idx + 1 < HeapCnt) {
+			cand[ncand++] = 2*idx + 1;
+		}
+		if (2*idx + 2 < HeapCnt) {
+			cand[ncand++] = 2*idx + 2;
+		}
+	}
+
+	return n;
+} /* end q_peek */
+#endif
+
+/*******************************************************************************
+FUNCTION NAME
+	static void sched_taken(qitem_t *p_item, unsigned long long key)
+
+FUNCTION DESCRIPTION
+	Count an item taken off the queue in its directory's send order
+	counters, and log them all every SCHED_STATS_COUNT items.  Under
+	SCHED_WFQ the virtual time moves on to the item's tag.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	item taken
+	unsigned long long	key			I	its heap key
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char			sched			I	send order policy
+	time_t			queue_ttl		I	queue time-to-live
+
+RETURNS
+	void
+*******************************************************************************/
+static void sched_taken(qitem_t *p_item, unsigned long long key)
+{
+	static unsigned long total_taken;
+	dirstate_t *p_state;
+	time_t wait;
+
+	p_state = &DirState[DirCount-1 - p_item->priority];
+	wait = time(NULL) - p_item->queue_time;
+	if (wait < 0) {
+		wait = 0;
+	}
+	p_state->taken++;
+	p_state->taken_bytes += p_item->size;
+	p_state->wait_sum += wait;
+	if (wait > p_state->wait_max) {
+		p_state->wait_max = wait;
+	}
+	if (ClientOpt.queue_ttl > 0 && wait > ClientOpt.queue_ttl) {
+		p_state->late++;
+	}
+
+	if (ClientOpt.sched == SCHED_WFQ) {
+		WfqTime = key;
+	}
+
+	if (!(++total_taken % SCHED_STATS_COUNT)) {
+		sched_stats();
+	}
+} /* end sched_taken */
+
+/*******************************************************************************
+FUNCTION NAME
+	void sched_stats(void)
+
+FUNCTION DESCRIPTION
+	Log the send order counters of each input directory since startup:
+	items and bytes taken off the queue, their average and longest wait
+	from mtime, and how many were past queue_ttl (and so discarded).
+	Used to compare the ClientOpt.sched policies on the same traffic.
+	With ClientOpt.reserved, also log how many times lower priority items
+	were held back to keep the reserved window slots, and how many top
+	priority items were taken while they were.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
 
 GLOBAL VARIABLES (from ClientOpt structure)
 	Type			Name			I/O	Description
 	char **			indir_list		I	null-terminated list of input dirs
-	char *			sent_dir		I	holding directory for queued files
-	time_t			refresh_interval I	queue resort/refresh interval
-	int 			max_queue_len	I	max number of items to sort
-	int				wait_last_file	I	don't send the last file
-	char			verbosity		I	verbosity level
+	char			sched			I	send order policy
+	int				reserved		I	window slots kept for the first dir
 
 RETURNS
-	 Length of queue INCLUDING the returned product
-	 0 indicates an empty queue, and no product is returned
-	-1 indicates an error
-	(If queue length is >= 0, the p_prod argument is not modified.)
+	void
 *******************************************************************************/
-int get_next_file(prod_tbl_t *p_tbl, prod_info_t *p_prod)
+void sched_stats(void)
 {
-	static prod_info_t *queue;
-	static int qcnt;
-	static int qidx;
-	static int polltime;
-	DIR *p_dir;
-	struct dirent *p_dirent;
-	struct stat stat_struct;
-	int priority;
+	dirstate_t *p_state;
 	int i_dir;
-	char *poll_dir;
-	char pathbuf[FILENAME_LEN];
 
-	if (ClientOpt.verbosity > 2) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: qlen = %d refresh timer = %ld\n",
-				LOG_PREFIX, qcnt - qidx,
-				(ClientOpt.refresh_interval>0 && polltime>0)?
-				polltime+ClientOpt.refresh_interval-time(NULL):0);
+	for (i_dir = 0; i_dir < DirCount; i_dir++) {
+		p_state = &DirState[i_dir];
+		CS_LOG_PROD(PRODUCT_FP,
+			"STATUS SCHED %s dir(%s) taken(%lu) bytes(%llu) wait(%llu %ld) late(%lu)\n",
+				SchedName[(int)ClientOpt.sched], ClientOpt.indir_list[i_dir],
+				p_state->taken, p_state->taken_bytes,
+				p_state->taken ? p_state->wait_sum / p_state->taken : 0,
+				(long)p_state->wait_max, p_state->late);
+	}
+	if (ClientOpt.reserved > 0) {
+		CS_LOG_PROD(PRODUCT_FP,
+			"STATUS RESERVE slots(%d) held(%lu) used(%lu)\n",
+				ClientOpt.reserved, ReserveHeld, ReserveUsed);
 	}
+} /* end sched_stats */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void q_sift_up(int idx)
 
-	/* check if we need to poll the directory */
-	if (qcnt - qidx == 0 ||
-			(ClientOpt.refresh_interval > 0
-			&& time(NULL) >= polltime + ClientOpt.refresh_interval)) {
+FUNCTION DESCRIPTION
+	Move Heap[idx] up toward the root until its parent comes before it.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				idx				I	heap index
 
-		if (queue) {
-			free(queue);
-			queue = NULL;
+RETURNS
+	void
+*******************************************************************************/
+static void q_sift_up(int idx)
+{
+	qkey_t entry;
+	int parent;
+
+	entry = Heap[idx];
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (entry.key >= Heap[parent].key) {
+			break;
 		}
+		Heap[idx] = Heap[parent];
+		Items[Heap[idx].item].heap_idx = idx;
+		idx = parent;
+	}
+	Heap[idx] = entry;
+	Items[entry.item].heap_idx = idx;
+} /* end q_sift_up */
 
-		qcnt = 0;
-		qidx = 0;
+/*******************************************************************************
+FUNCTION NAME
+	static void q_sift_down(int idx)
 
-		/* Assume Poll Directories are in prioritized order.  Count
-		   directories and assign a relative priority to items found
-		   in each directory.  Higher priority value items are taken 
-		   before lower priority items (see compare_items).
-		*/
+FUNCTION DESCRIPTION
+	Move Heap[idx] down toward the leaves until it comes before its
+	children.
 
-		priority = -1;
-		for (i_dir = 0; ClientOpt.indir_list[i_dir]; i_dir++) {
-			priority++;
-		}
+PARAMETERS
+	Type			Name			I/O	Description
+	int				idx				I	heap index
 
-		for (i_dir = 0; ClientOpt.indir_list[i_dir]; i_dir++, priority--) {
+RETURNS
+	void
+*******************************************************************************/
+static void q_sift_down(int idx)
+{
+	qkey_t entry;
+	int child;
 
-			poll_dir = ClientOpt.indir_list[i_dir];
+	entry = Heap[idx];
+	while ((child = 2*idx + 1) < HeapCnt) {
+		if (child + 1 < HeapCnt && Heap[child+1].key < Heap[child].key) {
+			child++;
+		}
+		if (Heap[child].key >= entry.key) {
+			break;
+		}
+		Heap[idx] = Heap[child];
+		Items[Heap[idx].item].heap_idx = idx;
+		idx = child;
+	}
+	Heap[idx] = entry;
+	Items[entry.item].heap_idx = idx;
+} /* end q_sift_down */
 
-			/* read all directory entries in from input directories */
-			if (!(p_dir = opendir(poll_dir))) {
-				CS_LOG_ERR(ERROR_FP, "%s: Fail open directory %s, %s\n", 
-							LOG_PREFIX, poll_dir, strerror(errno));
-				/* Perhaps directory was removed?
-				   Continue with next dir
-				   Poll Interval should keep us from spinning
-				 */
-				continue;
-			}
+/*******************************************************************************
+FUNCTION NAME
+	static qitem_t *q_find(char *filename)
 
-			while ((p_dirent = readdir(p_dir))) {
+FUNCTION DESCRIPTION
+	Look up a queued item by filename.
 
-				/* skip .dot files */
-				if (!strncmp(p_dirent->d_name, ".", 1)) {
-					continue;
-				}
-				sprintf (pathbuf, "%s/%s", poll_dir, p_dirent->d_name);
-				if (stat(pathbuf, &stat_struct) < 0) {
-					CS_LOG_ERR(ERROR_FP, "%s: Fail stat file %s, %s\n", 
-								LOG_PREFIX, pathbuf, strerror(errno));
-					continue;
-				}
-				if (!(stat_struct.st_mode & (S_IFREG|S_IFLNK))) {
-					/* not a regular file or link, skip it */
-					continue;
-				}
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			filename		I	path of the file
 
-				/* skip .dot files **
-				if (!strncmp(p_dirent->d_name, ".", 1)) {
-					continue;
-				}
-				*/
+RETURNS
+	address of the item
+	NULL if the file is not queued
+*******************************************************************************/
+static qitem_t *q_find(char *filename)
+{
+	unsigned i;
 
-				/* Check if have access to file */
-				if (!(stat_struct.st_mode & (PERM_MASK))) {
-					/* No one has read permission, skip it */
-					/* May want to use access() to check if can read file */
-					/*    open will fail later anyway */
-					continue;
-				}
+	if (IndexSize == 0) {
+		return NULL;
+	}
 
-				/* Check that size is > 0 or mtime was a while ago */
-				if (stat_struct.st_size == 0) {
-					/* File is zero-length, how long has it been that way? */
-					if (stat_struct.st_mtime > time(NULL) - A_FEW_SECONDS) {
-						/* give it a few seconds */
-						continue;
-					}
-					/* else pass it on so it can fail and be removed */
-				}
+	for (i = str_hash(filename) & (IndexSize - 1); Index[i];
+			i = (i + 1) & (IndexSize - 1)) {
+		if (Index[i] != INDEX_DELETED
+				&& !strcmp(Q_NAME(&Items[Index[i] - 1]), filename)) {
+			return &Items[Index[i] - 1];
+		}
+	}
 
-				/* Check if file has already been sent */
-				if (check_window(p_tbl, pathbuf) != 0) {
-					/* file is in the window, don't queue it */
-					continue;
-				}
+	return NULL;
+} /* end q_find */
 
-				qcnt++;
-				if (!(queue = realloc(queue, qcnt*sizeof(prod_info_t)))) {
-					CS_LOG_ERR(ERROR_FP,
-								"%s: FAIL realloc %d prod_info items, %s\n",
-								LOG_PREFIX, qcnt, strerror(errno));
-					return -1;
-				}
-				memset(&queue[qcnt-1], '\0', sizeof(prod_info_t));
-
-				strcpy(queue[qcnt-1].filename, pathbuf);
-				queue[qcnt-1].queue_time = stat_struct.st_mtime;
-				queue[qcnt-1].size = stat_struct.st_size;
-				queue[qcnt-1].priority = priority;
-
-				if (ClientOpt.verbosity > 2) {
-					CS_LOG_DBUG(DEBUG_FP,
-							"%s: Added item %s, cnt=%d p=%d, t=%ld\n",
-							LOG_PREFIX,
-							queue[qcnt-1].filename,
-							qcnt-1,
-							queue[qcnt-1].priority,
-							queue[qcnt-1].queue_time);
-				}
+/*******************************************************************************
+FUNCTION NAME
+	static int q_index_add(qitem_t *p_item)
 
-				if (ClientOpt.max_queue_len > 0
-						&& qcnt >= ClientOpt.max_queue_len) {
-					/* If we have read more that ClientOpt.max_queue_len
-					 * files from the polled directories quit and start
-					 * sending them so that we don't spend all our time
-					 * polling and no time processing.
-					 */
-					break;
-				}
-			}
+FUNCTION DESCRIPTION
+	Add an item, already in the heap, to the filename index.  When live
+	and deleted slots reach half of the index, it is rebuilt from the heap
+	at 1/4 full.
 
-			if (closedir(p_dir) < 0) {
-				CS_LOG_ERR(ERROR_FP, "%s: Fail close directory %s, %s\n", 
-							LOG_PREFIX, poll_dir, strerror(errno));
-				/* ignore error for now */
-			}
-			p_dir = NULL;
-		}
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	queued item
 
-		/* sort directory entries using quicksort */
-		if (qcnt > 1) {
-			qsort (queue, qcnt, sizeof(prod_info_t), compare_items);
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int q_index_add(qitem_t *p_item)
+{
+	int *p_index;
+	unsigned size;
+	unsigned i;
+	int j;
+
+	if ((IndexUsed + 1) * 2 > IndexSize) {
+		for (size = INDEX_MIN_SIZE; size < 4 * (unsigned)HeapCnt; size *= 2);
+		if (!(p_index = calloc(size, sizeof(int)))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc %d queue index slots, %s\n",
+						LOG_PREFIX, size, strerror(errno));
+			return -1;
 		}
-
-		polltime = time(NULL);
+		free(Index);
+		Index = p_index;
+		IndexSize = size;
+		IndexUsed = 0;
+
+		/* the heap holds every queued item, including this one */
+		for (j = 0; j < HeapCnt; j++) {
+			for (i = str_hash(Q_NAME(&Items[Heap[j].item])) & (IndexSize - 1);
+					Index[i]; i = (i + 1) & (IndexSize - 1));
+			Index[i] = Heap[j].item + 1;
+			IndexUsed++;
+		}
+		return 0;
 	}
 
-	/* if there is a next entry */
-	if (qcnt - qidx > 0) {
+	for (i = str_hash(Q_NAME(p_item)) & (IndexSize - 1); Index[i];
+			i = (i + 1) & (IndexSize - 1));
+	Index[i] = p_item - Items + 1;
+	IndexUsed++;
 
-		/* if wait_last_file option is on, check if item is the last one */
-		if (!ClientOpt.wait_last_file
-				|| queue[qidx].queue_time < queue[qcnt-1].queue_time) {
+	return 0;
+} /* end q_index_add */
 
-			if (ClientOpt.verbosity > 1) {
-				CS_LOG_DBUG(DEBUG_FP, "%s: Next item is %s, p=%d, t=%s",
-						LOG_PREFIX,
-						queue[qidx].filename,
-						queue[qidx].priority,
-						ctime(&queue[qidx].queue_time));
-			}
+/*******************************************************************************
+FUNCTION NAME
+	static void q_index_del(qitem_t *p_item)
 
-			memcpy(p_prod, &queue[qidx], sizeof(prod_info_t));
-			qidx++;
-			return qcnt - qidx + 1;
+FUNCTION DESCRIPTION
+	Delete an item from the filename index.  The index is cleared when the
+	last item goes.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	qitem_t *		p_item			I	queued item
+
+RETURNS
+	void
+*******************************************************************************/
+static void q_index_del(qitem_t *p_item)
+{
+	unsigned i;
+
+	for (i = str_hash(Q_NAME(p_item)) & (IndexSize - 1); Index[i];
+			i = (i + 1) & (IndexSize - 1)) {
+		if (Index[i] == p_item - Items + 1) {
+			Index[i] = INDEX_DELETED;
+			break;
 		}
 	}
 
-	if (ClientOpt.verbosity > 1) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: No items to send\n", LOG_PREFIX);
+	if (HeapCnt <= 1) {
+		/* last item is going, start over clean */
+		memset(Index, '\0', IndexSize * sizeof(int));
+		IndexUsed = 0;
 	}
-	return 0;
+} /* end q_index_del */
 
-} /* end get_next_file */
+/*******************************************************************************
+FUNCTION NAME
+	static int compare_cand(const void *p_v1, const void *p_v2)
+
+FUNCTION DESCRIPTION
+	qsort comparison of two scan_read files by mtime, oldest first.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	const void *	p_v1			I	first cand_t
+	const void *	p_v2			I	second cand_t
+
+RETURNS
+	<0, 0 or >0 as the first file is older, as old or newer
+*******************************************************************************/
+static int compare_cand(const void *p_v1, const void *p_v2)
+{
+	const cand_t *p_c1 = p_v1;
+	const cand_t *p_c2 = p_v2;
+
+	return (p_c1->mtime > p_c2->mtime) - (p_c1->mtime < p_c2->mtime);
+} /* end compare_cand */
 
 /*******************************************************************************
 FUNCTION NAME
@@ -696,16 +2844,18 @@ void retry_send(prod_info_t *p_prod)
 
 /*******************************************************************************
 FUNCTION NAME
-	int check_window(prod_tbl_t *p_tbl, char *filename)
+	int check_window(prod_tbl_t *p_tbl, char *filename, struct stat *p_stat)
 
 FUNCTION DESCRIPTION
 	Check product table to if filename has been transmitted and is still
-	awaiting acknowledgement
+	awaiting acknowledgement.  The ack and retr lists are indexed by device
+	and inode, so this does not depend on the window size.
 
 PARAMETERS
 	Type			Name			I/O	Description
 	prod_tbl_t *	p_tbl			O	address of prod table 
 	char *			filename		I	filename being checked
+	struct stat *	p_stat			I	its status
 
 GLOBAL VARIABLES (from ClientOpt structure)
 	Type			Name			I/O	Description
@@ -714,19 +2864,10 @@ RETURNS
 	1 if found (in progress)
 	0 otherwise
 *******************************************************************************/
-int check_window(prod_tbl_t *p_tbl, char *filename)
+int check_window(prod_tbl_t *p_tbl, char *filename, struct stat *p_stat)
 {
-	prod_info_t *p_prod;
-
-	for (p_prod = p_tbl->ack_list.p_head; p_prod; p_prod = p_prod->p_next) {
-		if (!strcmp(p_prod->filename, filename)) {
-			return 1;
-		}
-	}
-	for (p_prod = p_tbl->retr_list.p_head; p_prod; p_prod = p_prod->p_next) {
-		if (!strcmp(p_prod->filename, filename)) {
-			return 1;
-		}
+	if (find_prod(&p_tbl->window, filename, p_stat->st_dev, p_stat->st_ino)) {
+		return 1;
 	}
 	return 0;
 }
@@ -0,0 +1,192 @@
+/*******************************************************************************
+FILE NAME
+	client_scan.c
+
+FILE DESCRIPTION
+	Directory scanner threads for the client (Linux, -T option).  When
+	get_next_file has several input directories to read, they are read at
+	the same time by a small pool of threads, each into its own directory
+	state, and then queued by the main thread.  The main thread takes jobs
+	too, so -T 1 already reads two directories at once.
+
+FUNCTIONS
+	scan_pool_init		- start the scanner threads
+	scan_pool_run		- run a set of jobs on the scanner threads
+	scan_thread			- scanner thread entry point
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_client_scan_c[]= "@(#)client_scan.c 0.1 10/16/2026 12:00:00";
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "share.h"
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <signal.h>
+
+static void *scan_thread(void *arg);
+
+static pthread_mutex_t PoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t WorkCond = PTHREAD_COND_INITIALIZER;	/* jobs posted */
+static pthread_cond_t DoneCond = PTHREAD_COND_INITIALIZER;	/* jobs finished */
+
+/* the jobs being run, protected by PoolLock */
+static void (*JobFunc)(int job);
+static int JobCount;			/* jobs in this run */
+static int JobNext;				/* next job to take */
+static int JobsDone;			/* jobs finished */
+
+/*******************************************************************************
+FUNCTION NAME
+	int scan_pool_init(void)
+
+FUNCTION DESCRIPTION
+	Start ClientOpt.scan_threads scanner threads.  If none can be started,
+	ClientOpt.scan_threads is turned off so directories are read in turn.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	int				scan_threads	I/O	directory scanner threads
+
+RETURNS
+	 0	Normal return (threads may have been turned off)
+	-1	Error
+*******************************************************************************/
+int scan_pool_init(void)
+{
+	pthread_t tid;
+	sigset_t allsigs;
+	sigset_t oldsigs;
+	int i;
+
+	if (ClientOpt.scan_threads <= 0) {
+		return 0;
+	}
+
+	/* only the main thread takes signals */
+	sigfillset(&allsigs);
+	pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+	for (i = 0; i < ClientOpt.scan_threads; i++) {
+		if ((errno = pthread_create(&tid, NULL, scan_thread, NULL)) != 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL create scanner thread %d, %s\n",
+					LOG_PREFIX, i, strerror(errno));
+			break;
+		}
+		pthread_detach(tid);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+	if (i < ClientOpt.scan_threads) {
+		CS_LOG_ERR(ERROR_FP, "%s: Running %d of %d scanner threads\n",
+				LOG_PREFIX, i, ClientOpt.scan_threads);
+		ClientOpt.scan_threads = i;
+	}
+
+	return 0;
+} /* end scan_pool_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	void scan_pool_run(void (*func)(int job), int count)
+
+FUNCTION DESCRIPTION
+	Call func(0) through func(count-1) on the scanner threads and the
+	calling thread, and return when all of them have returned.  Jobs must
+	not depend on each other.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void (*)(int)	func			I	job function
+	int				count			I	number of jobs
+
+RETURNS
+	void
+*******************************************************************************/
+void scan_pool_run(void (*func)(int job), int count)
+{
+	int job;
+
+	pthread_mutex_lock(&PoolLock);
+	JobFunc = func;
+	JobCount = count;
+	JobNext = 0;
+	JobsDone = 0;
+	pthread_cond_broadcast(&WorkCond);
+
+	/* take jobs here too, rather than just wait */
+	while (JobNext < JobCount) {
+		job = JobNext++;
+		pthread_mutex_unlock(&PoolLock);
+		func(job);
+		pthread_mutex_lock(&PoolLock);
+		JobsDone++;
+	}
+	while (JobsDone < JobCount) {
+		pthread_cond_wait(&DoneCond, &PoolLock);
+	}
+
+	JobCount = JobNext = JobsDone = 0;
+	pthread_mutex_unlock(&PoolLock);
+} /* end scan_pool_run */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void *scan_thread(void *arg)
+
+FUNCTION DESCRIPTION
+	Scanner thread: wait for scan_pool_run to post jobs and run them.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void *			arg				I	not used
+
+RETURNS
+	never returns
+*******************************************************************************/
+static void *scan_thread(void *arg)
+{
+	void (*func)(int job);
+	int job;
+
+	pthread_mutex_lock(&PoolLock);
+	for (;;) {
+		while (JobNext >= JobCount) {
+			pthread_cond_wait(&WorkCond, &PoolLock);
+		}
+		job = JobNext++;
+		func = JobFunc;
+		pthread_mutex_unlock(&PoolLock);
+
+		func(job);
+
+		pthread_mutex_lock(&PoolLock);
+		if (++JobsDone == JobCount) {
+			pthread_cond_signal(&DoneCond);
+		}
+	}
+
+	return NULL;
+} /* end scan_thread */
+
+#endif /* __linux__ */
@@ -7,14 +7,25 @@ FILE DESCRIPTION
 
 FUNCTIONS
 	poll_and_send			- poll for next file and send it
+	discard_prod			- discard a product past its TTL
 	get_sockaddr			- create socket address from host/port
-	connect_to_server		- connect to server via socket
+	connect_to_server		- start connecting to server via socket
+	connect_done			- check whether a connect worked
 	disconnect_from_server	- disconnect from server
 	send_prod				- send a product to the server
-	check_for_ack			- check if any acknowledgements are waiting
-	recv_ack				- read and process acknowledgement
+	send_open				- open a product and set up its first block
+	send_reset				- forget the product being sent
+	send_park				- put off the product being sent (protocol 3)
+	send_unpark				- go on with a product put off
+	send_gathered			- send the whole products gathered in sendbuf
+	fill_acks				- read all the acks waiting on the socket
+	recv_ack				- take and check the next acknowledgement
 	push_prod				- push a product onto a list
 	pop_prod				- pop a product from a list
+	find_prod				- find a product in the ack and retr lists
+	index_add				- add a product to a list index
+	index_del				- remove a product from a list index
+	prod_hash				- hash a product for a list index
 	rebuild_lists			- rebuild product table lists
 	attach_acqshm			- attach to acq_table shared memory (for monitoring)
 	create_conn_msg			- create file to send as connection message
@@ -33,6 +44,10 @@ NOTICE
 *******************************************************************************/
 static char Sccsid_client_send_c[]= "@(#)client_send.c 0.15 06/20/2005 14:24:38";
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* MSG_MORE */
+#endif
+
 #include <time.h>
 #include <errno.h>
 #include <stdio.h>
@@ -46,6 +61,9 @@ static char Sccsid_client_send_c[]= "@(#)client_send.c 0.15 06/20/2005 14:24:38"
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #ifdef _XOPEN_SOURCE_EXTENDED
 #include <arpa/inet.h>
@@ -62,26 +80,84 @@ static char Sccsid_client_send_c[]= "@(#)client_send.c 0.15 06/20/2005 14:24:38"
 #	define ACQ_STATS(x) 
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0		/* the SIGPIPE handler flags the disconnect */
+#endif
+
 static int ProdSeqno = 0;
+static int Protocol = PROTOCOL_1;	/* of this connection, see connect_wmo */
 
-#define TIMEOUT_TIME(p)		(p->send_time + ClientOpt.timeout - time(NULL))
-#define NEXT_SEQNO(x)		((x+1) % (MAX_PROD_SEQNO+1))
+#define NEXT_SEQNO(x)		((x) >= (Protocol > PROTOCOL_1 \
+								? MAX_PROD_SEQNO2 : MAX_PROD_SEQNO) ? 0 : (x)+1)
+#define PROD_TIMER(t,p)		(&(t)->timer[(p) - (t)->prod])
 #define RECOVERY_SLEEP		20
+#define RESERVE_WAIT		1		/* secs to wait for an ack while held (-R) */
+#define PREEMPT_CHECK		100		/* msecs between input checks while a
+									   product is sent in chunks */
+#define MAX_PARKED			(MAX_CHUNK_PRODS - 1)
+
+/* product partly written to the socket, kept by send_prod between calls */
+typedef struct {
+	prod_info_t *	p_prod;			/* product being sent, or NULL */
+	int				prod_fd;		/* its file */
+	char *			p_out;			/* bytes in sendbuf not yet sent */
+	size_t			out_len;
+	size_t			file_left;		/* bytes of the file not yet sent */
+	int				use_sendfile;	/* send the rest with sendfile */
+	int				started;		/* some of it went to the socket */
+	size_t			chunk_left;		/* bytes of the chunk not yet sent */
+	long long		progress;		/* event_now when bytes last went out */
+	size_t			gathered;		/* bytes of whole products in sendbuf */
+	size_t			gather_off;		/* bytes of those already sent */
+	int				gather_count;	/* products in them */
+} send_state_t;
+
+static send_state_t SendState = { NULL, -1 };
+static char *SendBuf;			/* ClientOpt.bufsize bytes */
+
+/* products put off between two chunks for one of higher priority, the
+   last one on top */
+static send_state_t Parked[MAX_PARKED];
+static int ParkCount;
+
+/* send_prod is between two chunks of a product (protocol 3) */
+#define BETWEEN_CHUNKS(s)	((s).started && !(s).out_len && !(s).chunk_left \
+								&& (s).file_left > 0)
+
+/* acks read from the socket and not yet processed, a ring of whole acks
+   (a multiple of ACK_MSG_LEN and ACK2_MSG_LEN, so an ack never wraps) */
+#define ACK_BUF_LEN		(ACK_MSG_LEN * ACK2_MSG_LEN * 128)
+static char AckBuf[ACK_BUF_LEN];
+static unsigned AckHead;		/* bytes taken out */
+static unsigned AckTail;		/* bytes read in */
 
 static int get_sockaddr(char *host, unsigned int port, struct sockaddr_in *p_addr);
 static int connect_to_server(char *host);
+static int connect_done(int sock_fd, char *host);
 static void disconnect_from_server(int sock_fd);
 #ifdef INCLUDE_ACQ_STATS
 static int send_prod(int sock_fd, prod_info_t *p_prod, DIST_INFO *p_stats);
 #else
 static int send_prod(int sock_fd, prod_info_t *p_prod);
 #endif
-static int check_for_ack(int sock_fd, time_t timeout);
-static int recv_ack(int sock_fd, prod_info_t *p_ack, char * p_code);
+static int send_open(prod_info_t *p_prod, char *sendbuf, size_t bufsiz);
+static void send_reset(void);
+static void send_park(void);
+static prod_info_t *send_unpark(void);
+static int send_gathered(int sock_fd);
+#ifdef __linux__
+static int SendfileOff;		/* sendfile not supported */
+#endif
+static int fill_acks(int sock_fd);
+static int recv_ack(prod_info_t *p_ack, char * p_code);
 static void push_prod(prod_list_t *p_list, prod_info_t *p_prod);
 static prod_info_t *pop_prod(prod_list_t *p_list);
+static void index_add(prod_index_t *p_index, prod_info_t *p_prod);
+static void index_del(prod_index_t *p_index, prod_info_t *p_prod);
+static unsigned prod_hash(char *filename, dev_t dev, ino_t ino);
 static void rebuild_lists(prod_tbl_t *p_tbl);
 static prod_info_t *create_conn_msg(prod_tbl_t *p_tbl);
+static void discard_prod(prod_tbl_t *p_tbl, prod_info_t *p_prod);
 #ifdef INCLUDE_ACQ_STATS
 static DIST_INFO *attach_acqshm(void);
 #endif
@@ -93,6 +169,44 @@ FUNCTION NAME
 FUNCTION DESCRIPTION
 	Send products to receive server and process acknowledgements
 
+	Nothing in the loop blocks.  The socket is non-blocking: connect
+	finishes in the background, send_prod sends what the socket takes and
+	is called again when it is writable, and acks are read as they come.
+	When there is nothing more to do, the loop waits in event_wait for
+	the socket, the inotify descriptor (-W) or the next timer.
+
+	Small products are gathered: send_prod reads a product that fits
+	whole in what is left of sendbuf in after the ones before it, and the
+	run goes out with one send (send_gathered) once no further product
+	can join it at once.  Each keeps its own header, seqno and ack.
+
+	Deadlines are timers in the timer wheel (client_timer.c): each sent
+	product has its own ack deadline, a product waiting to be sent has
+	its TTL, and there are timers for the next input poll, reconnect or
+	connect timeout, and a send that makes no progress.  The loop acts on
+	the timers that expired, and waits until the next one.
+
+	With ClientOpt.reserved, products below the top priority (those not
+	from the first input directory) may hold at most window_size -
+	reserved slots of the ack window.  Once they do, get_next_file only
+	returns a top priority product, so one can always be sent while bulk
+	products wait for their acks.  While the next product is held back,
+	the input is checked again after RESERVE_WAIT secs or the next ack,
+	whichever comes first.
+
+	With ClientOpt.protocol 2, the connection message asks the server for
+	protocol 2, and nothing more is sent until its ack comes: ACK_PROTO2
+	switches the connection to protocol 2, any other leaves it at 1.
+
+	With protocol 3 (ClientOpt.protocol 3 and ACK_PROTO3), a product goes
+	out in chunks of sendbuf, and send_prod returns between two chunks.
+	While a product below the top priority is sent, the input is checked
+	every PREEMPT_CHECK msecs, and a product of higher priority is sent
+	ahead of the rest of it: send_park puts the one being sent off, and
+	send_unpark takes it back once the other is sent.  So an urgent
+	product waits for the chunk being sent rather than the whole of a big
+	product.  The server completes and acks them in the order they end.
+
 PARAMETERS
 	Type			Name			I/O	Description
 	void
@@ -104,8 +218,11 @@ GLOBAL VARIABLES (from ClientOpt structure)
 	char			verbosity		I	debugging verbosity level
 	time_t			timeout			I	timeout interval (on socket)
 	time_t			poll_interval	I	input polling interval (when idle)
+	char			inotify			I	wait for input with inotify
 	time_t			queue_ttl		I	queue time-to-live
 	int				window_size		I	maximum outstanding acks
+	int				reserved		I	window slots kept for the first dir
+	int				protocol		I	protocol to ask for
 	int				Flags			I	Control Flags
 
 RETURNS
@@ -118,34 +235,96 @@ int poll_and_send(void)
 	prod_tbl_t prod_tbl;
 	prod_info_t	*p_prod;
 	prod_info_t	*p_connect;
+	prod_info_t	*p_ack;
+	prod_info_t	*p_next;
+	prod_list_t done_list;	/* acked, to finish after the acks are taken */
+	wtimer_t input_timer;	/* next input poll */
+	wtimer_t connect_timer;	/* reconnect, or connect timeout */
+	wtimer_t send_timer;	/* send made no progress */
+	wtimer_t *p_timer;
 	int i;
-	int ack_ready;
-	int wait_time;
+	int rc;
+	int connecting;
+	int connect_due;
+	int connect_late;
 	int connect_failures;
+	int input_due;
 	int input_failures;
 	int	queue_len;
 	int	host_idx;
+	int	top_priority;
+	int	reserve_only;
+	int	held;
+	int	blocked;		/* socket is full */
+	int	busy;			/* more can be done without waiting */
+	int	more;			/* another product can be sent at once */
+	int	negotiating;	/* waiting for the protocol in the conn msg ack */
+	int	inotify_fd;
+	long long now;
 	char ack_code;
 	ACQ_STATS(DIST_INFO *p_stats;)
 
 	sock_fd = -1;
+	connecting = 0;
+	connect_due = 1;
+	connect_late = 0;
+	input_due = 1;
 	queue_len = 0;
 	host_idx = 0;
+	held = 0;
+	blocked = 0;
+	for (top_priority = 0; ClientOpt.indir_list[top_priority+1]; top_priority++);
 
 	/* initialize product table */
 	memset(&prod_tbl, '\0', sizeof(prod_tbl));
+	memset(&done_list, '\0', sizeof(done_list));
 	if (!(prod_tbl.prod = (prod_info_t *)
 					calloc(ClientOpt.window_size, sizeof(prod_info_t)))) {
 		CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc %d prod_info structs, %s\n",
 					LOG_PREFIX, ClientOpt.window_size, strerror(errno));
 		return -1;
 	}
+	if (!(prod_tbl.timer = (wtimer_t *)
+					calloc(ClientOpt.window_size, sizeof(wtimer_t)))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc %d timers, %s\n",
+					LOG_PREFIX, ClientOpt.window_size, strerror(errno));
+		return -1;
+	}
+
+	/* index the ack and retr lists, at most half full */
+	for (prod_tbl.window.size = 16;
+			prod_tbl.window.size < 2 * (unsigned)ClientOpt.window_size;
+			prod_tbl.window.size *= 2);
+	if (!(prod_tbl.window.slot = (prod_info_t **)
+				calloc(prod_tbl.window.size, sizeof(prod_info_t *)))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc %d index slots, %s\n",
+					LOG_PREFIX, prod_tbl.window.size, strerror(errno));
+		return -1;
+	}
+	prod_tbl.ack_list.p_index = &prod_tbl.window;
+	prod_tbl.retr_list.p_index = &prod_tbl.window;
 
 	for (i = 0; i < ClientOpt.window_size; i++) {
 		prod_tbl.prod[i].state = STATE_FREE;
+		prod_tbl.timer[i].p_arg = &prod_tbl.prod[i];
 		push_prod(&prod_tbl.free_list, &prod_tbl.prod[i]);
 	}
 
+	if (event_init() < 0) {
+		return -1;
+	}
+	inotify_fd = -1;
+#ifdef __linux__
+	if (ClientOpt.inotify) {
+		inotify_fd = notify_fd();
+	}
+#endif
+
+	timer_init(event_now());
+	memset(&input_timer, '\0', sizeof(input_timer));
+	memset(&connect_timer, '\0', sizeof(connect_timer));
+	memset(&send_timer, '\0', sizeof(send_timer));
+
 	connect_failures = 0;
 	input_failures = 0;
 	p_prod = NULL;
@@ -160,73 +339,180 @@ int poll_and_send(void)
 
 	/* read and process data */
 	while (!(Flags & SHUTDOWN_FLAG)) {
+		now = event_now();
+		busy = 0;
+
+		/* act on the timers that expired */
+		while ((p_timer = timer_expired(now))) {
+			switch (p_timer->type) {
+				case TIMER_ACK:
+					p_ack = (prod_info_t *)p_timer->p_arg;
+					if (sock_fd >= 0 && !connecting
+							&& p_ack->state == STATE_SENT) {
+						CS_LOG_ERR(ERROR_FP,
+								"%s: ERROR ack seqno %d timed out!\n",
+								LOG_PREFIX, p_ack->seqno);
+						Flags |= DISCONNECT_FLAG;
+					}
+					break;
+				case TIMER_TTL:
+					/* once some of it is sent, it has to be finished */
+					if (p_timer->p_arg == p_prod && !(SendState.p_prod == p_prod
+							&& SendState.started)) {
+						discard_prod(&prod_tbl, p_prod);
+						p_prod = NULL;
+						ACQ_STATS(p_stats->host_write_fails++;)
+					}
+					break;
+				case TIMER_INPUT:
+					input_due = 1;
+					break;
+				case TIMER_CONNECT:
+					if (connecting) {
+						connect_late = 1;
+					} else {
+						connect_due = 1;
+					}
+					break;
+				case TIMER_SEND:
+					if (p_prod && SendState.p_prod == p_prod) {
+						CS_LOG_ERR(ERROR_FP,
+								"%s: FAIL[%d] send %s, timed out\n",
+								LOG_PREFIX, p_prod->send_count,
+								p_prod->filename);
+						p_prod->state = STATE_RETRY;
+						Flags |= DISCONNECT_FLAG;
+					} else if (SendState.gathered > 0) {
+						CS_LOG_ERR(ERROR_FP,
+								"%s: FAIL send %d gathered prods, timed out\n",
+								LOG_PREFIX, SendState.gather_count);
+						Flags |= DISCONNECT_FLAG;
+					}
+					break;
+			}
+		}
 
 		/* check disconnect flag */
 		if (sock_fd >= 0 && (Flags & DISCONNECT_FLAG)) {
+			event_watch(sock_fd, 0);
 			disconnect_from_server(sock_fd);
 			sock_fd = -1;
+			connecting = 0;
+			connect_due = 1;
+			blocked = 0;
+			timer_cancel(&connect_timer);
+			timer_cancel(&send_timer);
 			ACQ_STATS(p_stats->host_socket_id = -1;)
 			if (ClientOpt.connect_wmo) {
 				/* push curr prod on retr list, unless it is a conn msg */
 				if (p_prod && p_prod != p_connect) {
+					timer_cancel(PROD_TIMER(&prod_tbl, p_prod));
 					push_prod(&prod_tbl.retr_list, p_prod);
 				}
+				/* and the ones put off for it */
+				while ((p_next = send_unpark())) {
+					send_reset();
+					timer_cancel(PROD_TIMER(&prod_tbl, p_next));
+					push_prod(&prod_tbl.retr_list, p_next);
+				}
 				/* create a connection message to send on reconnect */
 				p_prod = p_connect = create_conn_msg(&prod_tbl);
 			}
 		}
 
-		/* connect now if not already connected */
-		if (sock_fd < 0) {
+		/* connect now if not already connected, or see if it finished */
+		rc = 0;
+		if (sock_fd < 0 && connect_due) {
+			connect_due = 0;
 			ACQ_STATS(strcpy(p_stats->host_name, ClientOpt.host);)
-			if ((sock_fd =
-					connect_to_server(ClientOpt.host)) < 0) {
-				connect_failures++;
-				host_idx++;
-				if (ClientOpt.host_list[host_idx] == NULL) {
-					host_idx = 0;
-				}
-				ClientOpt.host = ClientOpt.host_list[host_idx];
-				ACQ_STATS(p_stats->host_socket_id = -1;)
-				ACQ_STATS(p_stats->host_conn_fails++;)
+			if ((sock_fd = connect_to_server(ClientOpt.host)) < 0) {
+				rc = -1;
 			} else {
-				ACQ_STATS(p_stats->host_socket_id = sock_fd;)
-				ACQ_STATS(p_stats->host_last_conn_time = time(NULL);)
-				ACQ_STATS(p_stats->host_conn_fails = 0;)
-
-				/* if acks are pending for sent items, re-queue them */
-				for (i = 0; prod_tbl.ack_list.count > 0; i++) {
-					prod_info_t *p_retr;
-					if (!(p_retr = pop_prod(&prod_tbl.ack_list))) {
-						/* This should never happen */
-						CS_LOG_ERR(ERROR_FP,
-							"%s: ERROR, ack list underflow, count = %d\n",
-							LOG_PREFIX, prod_tbl.ack_list.count);
-						rebuild_lists(&prod_tbl);
-						continue;
-					}
-					if (p_retr == p_connect) {
-						/* don't retransmit connection message */
-						continue;
-					}
-					/* send only counts against the next prod in ack list */
-					if (i > 0 && p_prod->send_count > 0) {
-						p_prod->send_count--;
-					}
-					if (ClientOpt.verbosity > 0) {
-						CS_LOG_DBUG(DEBUG_FP,
-							"%s: resend seq=%d f(%s) bytes(%d)\n",
-							LOG_PREFIX, p_retr->seqno,
-							p_retr->filename, p_retr->size); 
-					}
-					push_prod(&prod_tbl.retr_list, p_retr);
+				/* the socket is writable when the connect is done */
+				Flags &= ~(DISCONNECT_FLAG|NOPEER_FLAG);
+				connecting = 1;
+				timer_set(&connect_timer, TIMER_CONNECT,
+						now + ClientOpt.timeout * 1000);
+				event_watch(sock_fd, EVENT_WRITE);
+			}
+		} else if (connecting && (event_ready(sock_fd) & EVENT_WRITE)) {
+			rc = connect_done(sock_fd, ClientOpt.host) < 0 ? -1 : 1;
+		} else if (connecting && connect_late) {
+			CS_LOG_ERR(ERROR_FP,
+					"%s: FAIL connect to port %d on host %s, timed out\n",
+					LOG_PREFIX, ClientOpt.port, ClientOpt.host);
+			rc = -1;
+		}
+		connect_late = 0;
+
+		if (rc < 0) {
+			if (sock_fd >= 0) {
+				/* use a new socket descriptor each time */
+				event_watch(sock_fd, 0);
+				close(sock_fd);
+				sock_fd = -1;
+			}
+			connecting = 0;
+			connect_failures++;
+			timer_set(&connect_timer, TIMER_CONNECT, now + 1000
+					* (connect_failures > 3
+						? RECOVERY_SLEEP : ClientOpt.poll_interval));
+			host_idx++;
+			if (ClientOpt.host_list[host_idx] == NULL) {
+				host_idx = 0;
+			}
+			ClientOpt.host = ClientOpt.host_list[host_idx];
+			ACQ_STATS(p_stats->host_socket_id = -1;)
+			ACQ_STATS(p_stats->host_conn_fails++;)
+		} else if (rc > 0) {
+			connecting = 0;
+			timer_cancel(&connect_timer);
+			ACQ_STATS(p_stats->host_socket_id = sock_fd;)
+			ACQ_STATS(p_stats->host_last_conn_time = time(NULL);)
+			ACQ_STATS(p_stats->host_conn_fails = 0;)
+
+			/* if acks are pending for sent items, re-queue them */
+			for (i = 0; prod_tbl.ack_list.count > 0; i++) {
+				prod_info_t *p_retr;
+				if (!(p_retr = pop_prod(&prod_tbl.ack_list))) {
+					/* This should never happen */
+					CS_LOG_ERR(ERROR_FP,
+						"%s: ERROR, ack list underflow, count = %d\n",
+						LOG_PREFIX, prod_tbl.ack_list.count);
+					rebuild_lists(&prod_tbl);
+					continue;
+				}
+				timer_cancel(PROD_TIMER(&prod_tbl, p_retr));
+				if (p_retr == p_connect) {
+					/* don't retransmit connection message */
+					continue;
+				}
+				/* send only counts against the next prod in ack list */
+				if (i > 0 && p_prod && p_prod->send_count > 0) {
+					p_prod->send_count--;
 				}
-				connect_failures = 0;
+				if (ClientOpt.verbosity > 0) {
+					CS_LOG_DBUG(DEBUG_FP,
+						"%s: resend seq=%d f(%s) bytes(%d)\n",
+						LOG_PREFIX, p_retr->seqno,
+						p_retr->filename, p_retr->size); 
+				}
+				push_prod(&prod_tbl.retr_list, p_retr);
 			}
+			connect_failures = 0;
+		}
+
+		/* go on with a product put off for one of higher priority, unless
+		   another can go ahead of it too */
+		if (!p_prod && ParkCount > 0) {
+			p_prod = send_unpark();
+			index_del(&prod_tbl.window, p_prod);
+			input_due = 1;
 		}
 
-		/* get next product if we don't have one and ack window is not full */
-		if (!p_prod) {
+		/* get next product if we don't have one and input is due */
+		if (!p_prod && (prod_tbl.retr_list.count > 0 || queue_len > 0
+				|| input_due)) {
 			if (prod_tbl.ack_list.count < ClientOpt.window_size) {
 				if (prod_tbl.retr_list.count > 0) {
 					/* get a retransmission */
@@ -247,19 +533,43 @@ int poll_and_send(void)
 						rebuild_lists(&prod_tbl);
 						continue;
 					}
-					if ((queue_len = get_next_file(&prod_tbl, p_prod)) < 0) {
+					/* only a top priority product may take a reserved slot */
+					reserve_only = ClientOpt.reserved > 0
+							&& prod_tbl.ack_list.bulk + prod_tbl.retr_list.bulk
+								>= ClientOpt.window_size - ClientOpt.reserved;
+					held = 0;
+					input_due = 0;
+					if ((queue_len = get_next_file(&prod_tbl, p_prod,
+							reserve_only, -1)) == NEXT_HELD) {
+						/* wait for an ack, there is more to send */
+						push_prod(&prod_tbl.free_list, p_prod);
+						p_prod = NULL;
+						held = 1;
+						queue_len = 0;
+						timer_set(&input_timer, TIMER_INPUT,
+								now + RESERVE_WAIT * 1000);
+					} else if (queue_len < 0) {
 						input_failures++;
+						push_prod(&prod_tbl.free_list, p_prod);
+						p_prod = NULL;
+						queue_len = 0;
+						timer_set(&input_timer, TIMER_INPUT, now + 1000
+								* (input_failures > 3
+									? RECOVERY_SLEEP : ClientOpt.poll_interval));
 					} else {
 						input_failures = 0;
 						ACQ_STATS(p_stats->list_dist_hdr.count = queue_len;) 
 						if (queue_len > 0) {
 							p_prod->state = STATE_QUEUED;
+							p_prod->bulk = p_prod->priority < top_priority;
 							ACQ_STATS(p_stats->client_wait_state = WAIT_NONE;) 
 						} else {
 							ACQ_STATS(p_stats->client_wait_state = WAIT_PROD;) 
 							/* no product to send, release prod entry */
 							push_prod(&prod_tbl.free_list, p_prod);
 							p_prod = NULL;
+							timer_set(&input_timer, TIMER_INPUT,
+									now + ClientOpt.poll_interval * 1000);
 						}
 					}
 				}
@@ -277,35 +587,66 @@ int poll_and_send(void)
 			}
 		}
 
-		/* check TTL */
-		if (p_prod) {
-			if (ClientOpt.queue_ttl > 0) {
-				if (time(NULL) > p_prod->queue_time + ClientOpt.queue_ttl) {
-					CS_LOG_ERR(ERROR_FP,
-							"%s: Discarding %s, age=%d ttl=%d secs\n",
-							LOG_PREFIX, p_prod->filename, 
-							time(NULL)-p_prod->queue_time,
-							ClientOpt.queue_ttl);
-					p_prod->state = STATE_DEAD;
-					abort_send(p_prod);
-					push_prod(&prod_tbl.free_list, p_prod);
-					p_prod = NULL;
-					ACQ_STATS(p_stats->host_write_fails++;)
+		/* between two chunks of a product below the top priority, one of
+		   higher priority may be sent ahead of the rest of it */
+		if (p_prod && p_prod == SendState.p_prod && input_due
+				&& Protocol > PROTOCOL_2 && BETWEEN_CHUNKS(SendState)
+				&& p_prod->priority < top_priority && ParkCount < MAX_PARKED
+				&& prod_tbl.ack_list.count < ClientOpt.window_size
+				&& (p_next = pop_prod(&prod_tbl.free_list))) {
+			input_due = 0;
+			/* in the window index while put off, so the scan of its
+			   directory does not queue it again */
+			index_add(&prod_tbl.window, p_prod);
+			reserve_only = ClientOpt.reserved > 0
+					&& prod_tbl.ack_list.bulk + prod_tbl.retr_list.bulk
+						>= ClientOpt.window_size - ClientOpt.reserved;
+			if ((rc = get_next_file(&prod_tbl, p_next, 0, reserve_only
+					? MAX(p_prod->priority, top_priority - 1)
+					: p_prod->priority)) > 0) {
+				if (ClientOpt.verbosity > 0) {
+					CS_LOG_DBUG(DEBUG_FP, "%s: %s goes ahead of prod %d\n",
+							LOG_PREFIX, p_next->filename, p_prod->seqno);
 				}
+				send_park();
+				queue_len = rc;
+				p_next->state = STATE_QUEUED;
+				p_next->bulk = p_next->priority < top_priority;
+				p_prod = p_next;
+			} else {
+				index_del(&prod_tbl.window, p_prod);
+				push_prod(&prod_tbl.free_list, p_next);
+			}
+		}
+
+		/* check TTL of a product just taken, and time it while it waits */
+		if (p_prod && ClientOpt.queue_ttl > 0 && p_prod != SendState.p_prod
+				&& !PROD_TIMER(&prod_tbl, p_prod)->p_next) {
+			if (time(NULL) > p_prod->queue_time + ClientOpt.queue_ttl) {
+				discard_prod(&prod_tbl, p_prod);
+				p_prod = NULL;
+				ACQ_STATS(p_stats->host_write_fails++;)
+			} else {
+				timer_set(PROD_TIMER(&prod_tbl, p_prod), TIMER_TTL, now + 1000
+						* (p_prod->queue_time + ClientOpt.queue_ttl + 1
+							- time(NULL)));
 			}
 		}
 
 		/* if we are connected and have a product to send */
-		if (p_prod && sock_fd >= 0) {
-			/* send the product, disconnect if error writing to socket */
+		blocked = 0;
+		negotiating = ClientOpt.protocol > PROTOCOL_1
+				&& p_connect && p_connect != p_prod;
+		if (p_prod && sock_fd >= 0 && !connecting && !negotiating) {
+			/* send what the socket takes, disconnect if error writing */
 			ACQ_STATS(p_stats->host_xfr_status = CLIENT_XFR_INPROG;)
 			ACQ_STATS(p_stats->client_wait_state = WAIT_BUFF;) 
 #			ifdef INCLUDE_ACQ_STATS
-				if (send_prod(sock_fd, p_prod, p_stats) == 0)
+				rc = send_prod(sock_fd, p_prod, p_stats);
 #			else
-				if (send_prod(sock_fd, p_prod) == 0)
+				rc = send_prod(sock_fd, p_prod);
 #			endif
-			{
+			if (rc == 0) {
 				/* successfully sent! */
 				ACQ_STATS(p_stats->client_prod_seqno = p_prod->seqno;)
 				ACQ_STATS(p_stats->client_tot_prods++;)
@@ -313,137 +654,208 @@ int poll_and_send(void)
 				ACQ_STATS(p_stats->host_last_send_time = time(NULL);)
 				ACQ_STATS(p_stats->host_write_fails = 0;)
 				ACQ_STATS(strcpy(p_stats->host_nfs_file_name,p_prod->filename);)
+				timer_cancel(&send_timer);
+				timer_set(PROD_TIMER(&prod_tbl, p_prod), TIMER_ACK,
+						now + ClientOpt.timeout * 1000);
 				push_prod(&prod_tbl.ack_list, p_prod);
 				p_prod = NULL;
+				busy = 1;
+			} else if (rc > 1) {
+				/* between two chunks, look for input to go ahead */
+				timer_cancel(&send_timer);
+				if (p_prod->priority < top_priority && !input_timer.p_next) {
+					timer_set(&input_timer, TIMER_INPUT, now + PREEMPT_CHECK);
+				}
+				busy = 1;
+			} else if (rc > 0) {
+				/* socket is full, wait until it is writable */
+				blocked = 1;
+				timer_set(&send_timer, TIMER_SEND,
+						SendState.progress + ClientOpt.timeout * 1000);
 			} else if (p_prod->state == STATE_FAILED) {
 				/* error */
+				timer_cancel(&send_timer);
+				timer_cancel(PROD_TIMER(&prod_tbl, p_prod));
 				abort_send(p_prod);
 				push_prod(&prod_tbl.free_list, p_prod);
 				p_prod = NULL;
+				busy = 1;
 				ACQ_STATS(p_stats->host_write_fails++;)
-			} /* else retry p_prod next time through the loop */
+			} else {
+				/* retry p_prod after reconnecting */
+				timer_cancel(&send_timer);
+			}
 
 			ACQ_STATS(p_stats->client_wait_state = WAIT_NONE;) 
 			ACQ_STATS(p_stats->host_xfr_status = CLIENT_XFR_IDLE;)
 		}
 
-		/* set ack_ready if acks are pending to get into the loop */
-		ack_ready = prod_tbl.ack_list.count;
-
-		/* while we are connected and have acks ready to read, process them */
-		while (sock_fd >= 0 && prod_tbl.ack_list.p_head && ack_ready > 0) {
-			/* Block for an ack if the window is full */
-			if (prod_tbl.ack_list.count == ClientOpt.window_size) {
-				wait_time = TIMEOUT_TIME(prod_tbl.ack_list.p_head);
-				if (wait_time < 0) {
-					wait_time = 0;
-				}
-				if (ClientOpt.verbosity > 0) {
-					CS_LOG_DBUG(DEBUG_FP,
-							"%s: FULL WINDOW, blocking up to %d sec for ack\n",
-							LOG_PREFIX, wait_time);
-				}
-			} else {
-				wait_time = 0; /* don't block for acks */
+		/* another product can be sent at once */
+		more = prod_tbl.ack_list.count < ClientOpt.window_size && !negotiating
+				&& (p_prod ? !blocked
+					: prod_tbl.retr_list.count > 0 || queue_len > 0);
+
+		/* send the products gathered in sendbuf, once no more can join */
+		if (sock_fd >= 0 && !connecting && !(Flags & DISCONNECT_FLAG)
+				&& !more && !blocked) {
+			if ((rc = send_gathered(sock_fd)) > 0) {
+				blocked = 1;
+				timer_set(&send_timer, TIMER_SEND,
+						SendState.progress + ClientOpt.timeout * 1000);
+			} else if (rc == 0) {
+				timer_cancel(&send_timer);
 			}
+		}
 
-			/* now set ack_ready for real */
-			if ((ack_ready = check_for_ack(sock_fd, wait_time)) > 0) {
-				prod_info_t *p_ack;
-				if (!(p_ack = pop_prod(&prod_tbl.ack_list))) {
-					/* This should never happen */
-					CS_LOG_ERR(ERROR_FP,
-						"%s: ERROR, ack list underflow, count = %d\n",
-						LOG_PREFIX, prod_tbl.ack_list.count);
-					rebuild_lists(&prod_tbl);
-					continue; /* ack reading loop */
-				}
+		/* while we are connected, read all the acks that have come in,
+		   once there is no more to send before the window fills, so the
+		   acks of a run of products are read and taken together */
+		if (sock_fd >= 0 && !connecting && !(Flags & DISCONNECT_FLAG)
+				&& prod_tbl.ack_list.p_head && !more
+				&& fill_acks(sock_fd) < 0) {
+			Flags |= DISCONNECT_FLAG;
+		}
 
-				if (recv_ack(sock_fd, p_ack, &ack_code) < 0) {
-					ack_ready = -1;
-					Flags |= DISCONNECT_FLAG;
-					push_prod(&prod_tbl.ack_list, p_ack);
-					break; /* out of ack reading loop */
-				}
+		/* and process them */
+		while (sock_fd >= 0 && !connecting && !(Flags & DISCONNECT_FLAG)
+				&& (p_ack = prod_tbl.ack_list.p_head)) {
+			if ((rc = recv_ack(p_ack, &ack_code)) == 0) {
+				/* no more acks, the ack timers see to late ones */
+				break;
+			} else if (rc < 0) {
+				Flags |= DISCONNECT_FLAG;
+				break;
+			}
 
-				switch(ack_code) {
-					case ACK_OK:
-						p_ack->state = STATE_ACKED;
-						finish_send(p_ack);
-						/* Update filename to sent dir name when last 
-						   pending ack is received */
-						if (!prod_tbl.ack_list.p_head) {
-							ACQ_STATS(strcpy(p_stats->host_nfs_file_name,
-											p_ack->filename);)
-						}
-						prod_tbl.prod[i].state = STATE_FREE;
-						push_prod(&prod_tbl.free_list, p_ack);
-						break;
-					case ACK_FAIL:
-						p_ack->state = STATE_NACKED;
-						abort_send(p_ack);
-						prod_tbl.prod[i].state = STATE_FREE;
-						push_prod(&prod_tbl.free_list, p_ack);
-						break;
-					case ACK_RETRY:
-						if (p_ack == p_connect) {
-							/* don't retry connect msg */
-							CS_LOG_ERR(ERROR_FP,
-								"%s: ERROR, retry for conn msg aborted\n",
-								LOG_PREFIX);
-							prod_tbl.prod[i].state = STATE_FREE;
-							push_prod(&prod_tbl.free_list, p_ack);
-						} else {
-							p_ack->state = STATE_RETRY;
-							retry_send(p_ack);
-							push_prod(&prod_tbl.retr_list, p_ack);
-						}
-						break;
-					default:
+			pop_prod(&prod_tbl.ack_list);
+			timer_cancel(PROD_TIMER(&prod_tbl, p_ack));
+			busy = 1;
+			if (held) {
+				/* a slot may be free for the product held back */
+				input_due = 1;
+			}
+
+			switch(ack_code) {
+				case ACK_PROTO2:
+				case ACK_PROTO3:
+					if (p_ack != p_connect || ClientOpt.protocol
+							< (ack_code == ACK_PROTO3 ? PROTOCOL_3 : PROTOCOL_2)) {
 						CS_LOG_ERR(ERROR_FP,
-								"%s: ERROR Invalid ack code %d\n",
-								LOG_PREFIX, ack_code);
-						ack_ready = -1;
+								"%s: ERROR Unexpected protocol ack\n",
+								LOG_PREFIX);
 						push_prod(&prod_tbl.ack_list, p_ack);
 						Flags |= DISCONNECT_FLAG;
 						break;
-				}
-				if (p_ack == p_connect) {
-					p_connect = NULL;
-				}
-			} else if (ack_ready == 0) {
-				/* no acks waiting, check for ack timeout */
-				if (TIMEOUT_TIME(prod_tbl.ack_list.p_head) <= 0) {
-					CS_LOG_ERR(ERROR_FP, "%s: ERROR ack seqno %d timed out!\n",
-								LOG_PREFIX, prod_tbl.ack_list.p_head->seqno);
+					}
+					/* no other ack can follow it yet, so AckBuf is empty */
+					Protocol = ack_code == ACK_PROTO3 ? PROTOCOL_3 : PROTOCOL_2;
+					AckHead = AckTail = 0;
+					if (ClientOpt.verbosity > 0) {
+						CS_LOG_DBUG(DEBUG_FP, "%s: Using protocol %d\n",
+								LOG_PREFIX, Protocol);
+					}
+					/* FALLTHROUGH */
+				case ACK_OK:
+					p_ack->state = STATE_ACKED;
+					push_prod(&done_list, p_ack);
+					break;
+				case ACK_FAIL:
+					p_ack->state = STATE_NACKED;
+					abort_send(p_ack);
+					p_ack->state = STATE_FREE;
+					push_prod(&prod_tbl.free_list, p_ack);
+					break;
+				case ACK_RETRY:
+					if (p_ack == p_connect) {
+						/* don't retry connect msg */
+						CS_LOG_ERR(ERROR_FP,
+							"%s: ERROR, retry for conn msg aborted\n",
+							LOG_PREFIX);
+						p_ack->state = STATE_FREE;
+						push_prod(&prod_tbl.free_list, p_ack);
+					} else {
+						p_ack->state = STATE_RETRY;
+						retry_send(p_ack);
+						push_prod(&prod_tbl.retr_list, p_ack);
+					}
+					break;
+				default:
+					CS_LOG_ERR(ERROR_FP,
+							"%s: ERROR Invalid ack code %d\n",
+							LOG_PREFIX, ack_code);
+					push_prod(&prod_tbl.ack_list, p_ack);
 					Flags |= DISCONNECT_FLAG;
-				}
-			} else {
-				/* else error checking for ack */
-				Flags |= DISCONNECT_FLAG;
+					break;
+			}
+			if (p_ack == p_connect) {
+				p_connect = NULL;
 			}
 		}
 
-		if (!(Flags & DISCONNECT_FLAG) && (queue_len <= 0 || sock_fd < 0)) {
-			/* Can't send anything now, so sleep */
-			if (connect_failures > 3 || input_failures > 3) {
-				wait_time = RECOVERY_SLEEP;
-			} else if (prod_tbl.ack_list.count) {
-				wait_time = MIN(ClientOpt.poll_interval,
-								TIMEOUT_TIME(prod_tbl.ack_list.p_head));
-			} else {
-				wait_time = ClientOpt.poll_interval;
+		/* move the files acked to the sent dir, and log them */
+		while ((p_ack = pop_prod(&done_list))) {
+			finish_send(p_ack);
+			/* Update filename to sent dir name when last 
+			   pending ack is received */
+			if (!done_list.p_head && !prod_tbl.ack_list.p_head) {
+				ACQ_STATS(strcpy(p_stats->host_nfs_file_name,
+								p_ack->filename);)
 			}
-			sleep(wait_time);
+			p_ack->state = STATE_FREE;
+			push_prod(&prod_tbl.free_list, p_ack);
+		}
+
+		if (Flags & (DISCONNECT_FLAG|SHUTDOWN_FLAG)) {
+			continue;
+		}
+
+		/* go around again at once while there is more to do */
+		negotiating = ClientOpt.protocol > PROTOCOL_1
+				&& p_connect && p_connect != p_prod;
+		if (busy || (p_prod && sock_fd >= 0 && !connecting && !blocked
+					&& !negotiating)
+				|| (sock_fd < 0 && connect_due)) {
+			continue;
+		}
+		if (!p_prod && prod_tbl.ack_list.count < ClientOpt.window_size
+				&& (prod_tbl.retr_list.count > 0 || queue_len > 0
+					|| input_due)) {
+			continue;
+		}
+
+		/* wait for the socket, a new file, or the next timer */
+		if (!p_prod && prod_tbl.ack_list.count < ClientOpt.window_size) {
+			event_watch(inotify_fd, EVENT_READ);
+		} else {
+			event_watch(inotify_fd, 0);
+		}
+		if (sock_fd >= 0 && !connecting) {
+			event_watch(sock_fd, (prod_tbl.ack_list.p_head ? EVENT_READ : 0)
+					| (blocked ? EVENT_WRITE : 0));
+		}
+
+		if (ClientOpt.verbosity > 2) {
+			CS_LOG_DBUG(DEBUG_FP, "%s: Waiting until %lld msecs\n",
+					LOG_PREFIX, timer_next());
+		}
+		if (event_wait(timer_next()) < 0) {
+			break;
+		}
+		if (event_ready(inotify_fd) & EVENT_READ) {
+			/* a file has arrived */
+			input_due = 1;
+			timer_cancel(&input_timer);
 		}
 	}
 
 	/* clean up */
 	if (sock_fd >= 0) {
+		event_watch(sock_fd, 0);
 		disconnect_from_server(sock_fd);
 		sock_fd = -1;
 	}
 	free(prod_tbl.prod);
+	free(prod_tbl.timer);
 
 	ACQ_STATS(p_stats->client_id = 0;)
 	ACQ_STATS(p_stats->host_last_conn_time = 0;)
@@ -451,12 +863,52 @@ int poll_and_send(void)
 	return 0;
 } /* end poll_and_send */
 
+/*******************************************************************************
+FUNCTION NAME
+	static void discard_prod(prod_tbl_t *p_tbl, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Discard a product that has not been sent within ClientOpt.queue_ttl,
+	and free its entry.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_tbl_t *	p_tbl			I/O	product table
+	prod_info_t *	p_prod			I/O	product to discard
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	time_t			queue_ttl		I	queue time-to-live
+
+RETURNS
+	void
+*******************************************************************************/
+static void discard_prod(prod_tbl_t *p_tbl, prod_info_t *p_prod)
+{
+	CS_LOG_ERR(ERROR_FP,
+			"%s: Discarding %s, age=%d ttl=%d secs\n",
+			LOG_PREFIX, p_prod->filename, 
+			time(NULL)-p_prod->queue_time,
+			ClientOpt.queue_ttl);
+
+	if (SendState.p_prod == p_prod) {
+		/* opened but nothing sent yet */
+		send_reset();
+	}
+	timer_cancel(PROD_TIMER(p_tbl, p_prod));
+	p_prod->state = STATE_DEAD;
+	abort_send(p_prod);
+	push_prod(&p_tbl->free_list, p_prod);
+} /* end discard_prod */
+
 /*******************************************************************************
 FUNCTION NAME
 	int connect_to_server(char *host) 
 
 FUNCTION DESCRIPTION
-	Connect to server listening at socket address *p_sockaddr.
+	Start connecting to the server on host.  The socket is non-blocking,
+	so the connect goes on in the background: once the socket is writable,
+	connect_done tells whether it worked.
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -466,8 +918,6 @@ GLOBAL VARIABLES (from ClientOpt structure)
 	Type			Name			I/O	Description
 	unsigned int	port			I	port number for listen/connect
 	char			verbosity		I	debugging verbosity level
-	time_t			timeout			I	timeout interval (on socket)
-	int				ProdSeqno		O	reset prod seqno upon connection
 
 RETURNS
 	 socket descriptor or
@@ -492,50 +942,90 @@ static int connect_to_server(char *host)
 		return -1;
 	}
 
+	if (fcntl(sock_fd, F_SETFL, O_NONBLOCK) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL set socket %d non-blocking, %s\n",
+				LOG_PREFIX, sock_fd, strerror(errno));
+		close(sock_fd);
+		return -1;
+	}
+
 	if (ClientOpt.verbosity > 0) {
 		CS_LOG_DBUG(DEBUG_FP, "%s: Connecting on socket %d\n",
 				LOG_PREFIX, sock_fd);
 	}
 
-	/* set alarm for timeout on connect */
-	if (ClientOpt.timeout > 0) {
-		alarm(ClientOpt.timeout);
+	if (connect(sock_fd, (const struct sockaddr *)&sockaddr, addrlen) < 0
+			&& errno != EINPROGRESS && errno != EINTR) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL connect to port %d on host %s, %s\n",
+						LOG_PREFIX, ClientOpt.port, host, strerror(errno));
+		/* use a new socket descriptor each time */
+		close(sock_fd);
+		sock_fd = -1;
+	}
+
+	return sock_fd;
+
+} /* end connect_to_server */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int connect_done(int sock_fd, char *host)
+
+FUNCTION DESCRIPTION
+	Find out whether a connect started by connect_to_server worked, once
+	the socket is writable.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket being connected
+	char *			host			I	remote hostname
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	unsigned int	port			I	port number for listen/connect
+	char			verbosity		I	debugging verbosity level
+	int				ProdSeqno		O	reset prod seqno upon connection
+	int				Protocol		O	reset to protocol 1 upon connection
+
+RETURNS
+	 0	Connected
+	-1	Error, the caller closes the socket
+*******************************************************************************/
+static int connect_done(int sock_fd, char *host)
+{
+	int error;
+	socklen_t len;
+
+	len = sizeof(error);
+	if (getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+		error = errno;
 	}
 
-	if (connect(sock_fd, (const struct sockaddr *)&sockaddr, addrlen) < 0) {
+	if (error) {
 		CS_LOG_ERR(ERROR_FP, "%s: FAIL connect to port %d on host %s, %s\n",
-						LOG_PREFIX, ClientOpt.port, host, strerror(errno));
-		if (errno == ECONNREFUSED || errno == ETIMEDOUT) {
+						LOG_PREFIX, ClientOpt.port, host, strerror(error));
+		if (error == ECONNREFUSED || error == ETIMEDOUT) {
 			if (ClientOpt.verbosity > 0) {
 				CS_LOG_DBUG(DEBUG_FP,
 						"%s: No server listening to port %d on host %s\n",
 						LOG_PREFIX, ClientOpt.port, host);
 			}
 		}
-		/* use a new socket descriptor each time */
-		close(sock_fd);
-		sock_fd = -1;
-	} else {
-		/* success */
-
-		CS_LOG_PROD(PRODUCT_FP,
-			"STATUS CONNECT [%s] pid(%d) %s to=%s/%d dir(%s%s)\n",
-				Program, getpid(),
-				ClientOpt.source ? ClientOpt.source : "unknown",
-				ClientOpt.host, ClientOpt.port, ClientOpt.indir_list[0],
-				ClientOpt.indir_list[1]?",...":"");
-
-		ProdSeqno = 0;
+		return -1;
 	}
 
-	/* cancel alarm if set */
-	if (ClientOpt.timeout > 0) {
-		alarm(0);
-	}
+	CS_LOG_PROD(PRODUCT_FP,
+		"STATUS CONNECT [%s] pid(%d) %s to=%s/%d dir(%s%s)\n",
+			Program, getpid(),
+			ClientOpt.source ? ClientOpt.source : "unknown",
+			ClientOpt.host, ClientOpt.port, ClientOpt.indir_list[0],
+			ClientOpt.indir_list[1]?",...":"");
 
-	return sock_fd;
+	ProdSeqno = 0;
+	Protocol = PROTOCOL_1;
 
-} /* end connect_to_server */
+	return 0;
+} /* end connect_done */
 
 /*******************************************************************************
 FUNCTION NAME
@@ -580,7 +1070,9 @@ FUNCTION NAME
 	static void disconnect_from_server(int sock_fd)
 
 FUNCTION DESCRIPTION
-	Shutdown connection and close socket.
+	Shutdown connection and close socket.  A product or ack partly
+	through the socket is dropped, and so are the gathered products not
+	yet sent (they are in the ack list, and sent again on reconnect).
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -614,6 +1106,11 @@ static void disconnect_from_server(int sock_fd)
 				LOG_PREFIX, sock_fd, strerror(errno));
 	}
 
+	send_reset();
+	SendState.gathered = SendState.gather_off = 0;
+	SendState.gather_count = 0;
+	AckHead = AckTail = 0;
+
 	Flags &= ~DISCONNECT_FLAG;
 
 	return;
@@ -624,7 +1121,20 @@ FUNCTION NAME
 	static int send_prod(int sock_fd, prod_info_t *p_prod) 
 
 FUNCTION DESCRIPTION
-	Send product to server
+	Send product to server, as much of it as the socket takes without
+	blocking.  If the socket fills up, 1 is returned and what is left is
+	kept in SendState; call again with the same product when the socket
+	is writable to go on with it.
+
+	A product that fits whole in what is left of sendbuf is only read in
+	after the products gathered there, and counts as sent: send_gathered
+	sends them all later.  One that does not fit first has the gathered
+	products sent (and 1 is returned if the socket fills up doing it).
+
+	With protocol 3 each block goes out as a chunk with its own header,
+	and 2 is returned after each chunk but the last, so poll_and_send can
+	put the product off (send_park) for one of higher priority.  Products
+	gathered meanwhile are sent before the next chunk.
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -634,15 +1144,16 @@ PARAMETERS
 GLOBAL VARIABLES (from ClientOpt structure)
 	Type			Name			I/O	Description
 	size_t			bufsize			I	max size to read/write from socket
-	int				max_retry		I	max number of send retries per prod
-	time_t			timeout			I	timeout interval (on socket)
 	char			verbosity		I	debugging verbosity level
 	int				Flags			I+O	Control Flags
-	int				ProdSeqno		O	increment prod seqno after each send
+	int				ProdSeqno		O	moved on once a prod is started
+	int				Protocol		I	chunks with protocol 3
 
 RETURNS
-	 0	Success
-	-1	Error
+	 0	Success, the whole product was sent
+	 1	Socket is full, more to send
+	 2	A chunk was sent, more to send
+	-1	Error, p_prod->state is set
 *******************************************************************************/
 #ifdef INCLUDE_ACQ_STATS
 	static int send_prod(int sock_fd, prod_info_t *p_prod, DIST_INFO *p_stats) 
@@ -650,18 +1161,17 @@ RETURNS
 	static int send_prod(int sock_fd, prod_info_t *p_prod) 
 #endif
 {
-	int prod_fd;
-	int bytes_read;
-	int bytes_sent;
-	int	bytes_left;
+	ssize_t bytes_read;
+	ssize_t bytes_sent;
+	size_t whole_len;
 	size_t read_size;
-	size_t send_size;
-	static char *sendbuf;
-	char *readbuf;
-	size_t data_offset;
+	size_t hdr_len;
+	int send_flags;
+	int failed;
+	int rc;
 
-	if (!sendbuf) {
-		if (!(sendbuf = malloc(ClientOpt.bufsize))) {
+	if (!SendBuf) {
+		if (!(SendBuf = malloc(ClientOpt.bufsize))) {
 			CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d bytes for sendbuf, %s\n",
 					LOG_PREFIX, ClientOpt.bufsize, strerror(errno));
 			/* this is a fatal error */
@@ -669,278 +1179,578 @@ RETURNS
 		}
 	}
 
-	if (ClientOpt.max_retry > 0 && p_prod->send_count > ClientOpt.max_retry) {
-		CS_LOG_ERR(ERROR_FP, "%s: FAIL prod #%d (%s) after %d retries\n",
-				LOG_PREFIX, p_prod->seqno, p_prod->filename,
-				ClientOpt.max_retry);
-		p_prod->state = STATE_FAILED;
-		return -1;
+	if (SendState.p_prod != p_prod) {
+		/* start a new product with its header and first block, after the
+		   gathered products if it fits there whole */
+		send_reset();
+		whole_len = MSG_HDR_LEN + PROD_HDR_LEN + p_prod->size;
+		if (SendState.gathered > 0
+				&& whole_len > ClientOpt.bufsize - SendState.gathered) {
+			if ((rc = send_gathered(sock_fd)) != 0) {
+				if (rc < 0) {
+					p_prod->state = STATE_RETRY;
+				}
+				return rc;
+			}
+		}
+		if (send_open(p_prod, SendBuf + SendState.gathered,
+				ClientOpt.bufsize - SendState.gathered) < 0) {
+			return -1;
+		}
+		if (SendState.file_left == 0
+				&& whole_len <= ClientOpt.bufsize - SendState.gathered) {
+			/* all in sendbuf, send_gathered sends it */
+			SendState.gathered += SendState.out_len;
+			SendState.gather_count++;
+			SendState.out_len = 0;
+			ProdSeqno = NEXT_SEQNO(ProdSeqno);
+		}
+		ACQ_STATS(p_stats->client_buff_last = 0;)
+		ACQ_STATS(p_stats->client_prod_bytes_sent = 0;)
 	}
-	p_prod->send_count++;
 
-	if ((prod_fd = open(p_prod->filename, O_RDONLY)) < 0) {
-		CS_LOG_ERR(ERROR_FP, "%s: FAIL open prod file %s, %s\n",
-				LOG_PREFIX, p_prod->filename, strerror(errno));
-		p_prod->state = STATE_FAILED;
-		return -1;
-	}
+	failed = 0;
+	while (!failed) {
+		if (SendState.out_len > 0) {
+			/* hold the header and first block for the sendfile data */
+			send_flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+			if (SendState.use_sendfile && SendState.file_left > 0) {
+				send_flags |= MSG_MORE;
+			}
+#endif
+			if ((bytes_sent = send(sock_fd, SendState.p_out,
+					SendState.out_len, send_flags)) < 0) {
+				if (errno == EINTR && !(Flags & DISCONNECT_FLAG)) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return 1;
+				}
+				if (errno != EINTR) {
+					CS_LOG_ERR(ERROR_FP, "%s: FAIL[%d] send %s to socket, %s\n",
+							LOG_PREFIX, p_prod->send_count, p_prod->filename,
+							strerror(errno));
+					Flags |= (DISCONNECT_FLAG|NOPEER_FLAG);
+				}
+				p_prod->state = STATE_RETRY;
+				failed = 1;
+				break;
+			}
+			if (!SendState.started) {
+				/* its seqno is used once any of it is out */
+				ProdSeqno = NEXT_SEQNO(ProdSeqno);
+				SendState.started = 1;
+			}
+			SendState.p_out += bytes_sent;
+			SendState.out_len -= bytes_sent;
+			SendState.progress = event_now();
+			ACQ_STATS(p_stats->client_prod_bytes_sent += bytes_sent;)
+			if (SendState.out_len == 0) {
+				ACQ_STATS(p_stats->client_tot_buffs++;)
+				ACQ_STATS(p_stats->client_buff_last++;)
+				if (Protocol > PROTOCOL_2 && BETWEEN_CHUNKS(SendState)) {
+					return 2;
+				}
+			}
+			continue;
+		}
 
-	p_prod->seqno = ProdSeqno;
-	if (ClientOpt.verbosity > 1) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: Sending prod seq %d %s [%d bytes] try=%d\n",
-						LOG_PREFIX, p_prod->seqno, p_prod->filename,
-						p_prod->size, p_prod->send_count); 
-	}
+		if (SendState.file_left == 0) {
+			break; /* all sent */
+		}
 
-	/* offset readbuf in sendbuf by FIXED size of header for first block */
-	read_size = ClientOpt.bufsize - MSG_HDR_LEN - PROD_HDR_LEN;
-	readbuf = sendbuf + MSG_HDR_LEN + PROD_HDR_LEN;
+		if (SendState.gathered > 0 && !SendState.chunk_left) {
+			/* products gathered while this one was put off go first */
+			if ((rc = send_gathered(sock_fd)) > 0) {
+				return 1;
+			} else if (rc < 0) {
+				p_prod->state = STATE_RETRY;
+				failed = 1;
+				break;
+			}
+		}
 
-	bytes_left = p_prod->size;
-	bytes_sent = 0;
-	p_prod->ccb_len = 0;
-	ACQ_STATS(p_stats->client_buff_last = 0;)
-	ACQ_STATS(p_stats->client_prod_bytes_sent = 0;)
-	while (bytes_left > 0) {
-		if ((bytes_read = read(prod_fd, readbuf, read_size)) < 0) {
-			if (errno == EINTR) {
-				/* interrupted by signal, try read again */
+#ifdef __linux__
+		if (SendState.use_sendfile) {
+			if (Protocol > PROTOCOL_2 && !SendState.chunk_left) {
+				/* the header of the next chunk, then its data */
+				SendState.chunk_left = MIN(SendState.file_left,
+						ClientOpt.bufsize - MSG2_HDR_LEN);
+				if (format_chunkhdr(SendBuf, p_prod, 0,
+						SendState.chunk_left) < 0) {
+					p_prod->state = STATE_FAILED;
+					failed = 1;
+					break;
+				}
+				SendState.p_out = SendBuf;
+				SendState.out_len = MSG2_HDR_LEN;
 				continue;
-			} else {
-				CS_LOG_ERR(ERROR_FP, "%s: FAIL read prod file %s, %s\n",
-						LOG_PREFIX, p_prod->filename, strerror(errno));
+			}
+
+			/* send the rest (of the chunk) straight from the file */
+			bytes_sent = sendfile(sock_fd, SendState.prod_fd, NULL,
+					MIN(SendState.chunk_left ? SendState.chunk_left
+						: SendState.file_left, SENDFILE_BLK_SIZE));
+			if (bytes_sent < 0) {
+				if (errno == EINTR && !(Flags & DISCONNECT_FLAG)) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return 1;
+				}
+				if (errno == EINVAL || errno == ENOSYS) {
+					/* can't sendfile here, read and send the rest instead */
+					CS_LOG_ERR(ERROR_FP,
+							"%s: Can't sendfile %s, %s, sendfile off\n",
+							LOG_PREFIX, p_prod->filename, strerror(errno));
+					SendfileOff = 1;
+					SendState.use_sendfile = 0;
+					continue;
+				}
+				if (errno != EINTR) {
+					CS_LOG_ERR(ERROR_FP,
+							"%s: FAIL[%d] sendfile %s to socket, %s\n",
+							LOG_PREFIX, p_prod->send_count, p_prod->filename,
+							strerror(errno));
+					Flags |= (DISCONNECT_FLAG|NOPEER_FLAG);
+				}
+				p_prod->state = STATE_RETRY;
+				failed = 1;
+				break;
+			} else if (bytes_sent == 0) {
+				/* end of file, the product got shorter */
+				CS_LOG_ERR(ERROR_FP,
+						"%s: ERROR file %s size changed from %d to %d bytes\n",
+						LOG_PREFIX,
+						p_prod->filename, p_prod->size + p_prod->ccb_len,
+						p_prod->size + p_prod->ccb_len - SendState.file_left);
 				p_prod->state = STATE_FAILED;
+				failed = 1;
 				break;
 			}
+			SendState.file_left -= bytes_sent;
+			SendState.started = 1;
+			SendState.progress = event_now();
+			ACQ_STATS(p_stats->client_prod_bytes_sent += bytes_sent;)
+			if (SendState.chunk_left
+					&& !(SendState.chunk_left -= bytes_sent)
+					&& BETWEEN_CHUNKS(SendState)) {
+				return 2;
+			}
+			continue;
 		}
+#endif
 
-		data_offset = 0;
+		/* read the next block, after the header of its chunk with
+		   protocol 3 (unless it is the rest of one sendfile started) */
+		hdr_len = Protocol > PROTOCOL_2 && !SendState.chunk_left
+				? MSG2_HDR_LEN : 0;
+		read_size = ClientOpt.bufsize - hdr_len;
+		if (SendState.chunk_left) {
+			read_size = MIN(read_size, SendState.chunk_left);
+		}
+		if ((bytes_read = read(SendState.prod_fd, SendBuf + hdr_len,
+				read_size)) < 0) {
+			if (errno == EINTR) {
+				/* interrupted by signal, try read again */
+				continue;
+			}
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL read prod file %s, %s\n",
+					LOG_PREFIX, p_prod->filename, strerror(errno));
+			p_prod->state = STATE_FAILED;
+			failed = 1;
+			break;
+		}
 
 		/* check product size */
-		if (bytes_read == 0 || bytes_read > bytes_left) {
+		if (bytes_read == 0 || bytes_read > SendState.file_left) {
 			CS_LOG_ERR(ERROR_FP,
 					"%s: ERROR file %s size changed from %d to %d bytes\n",
 					LOG_PREFIX,
 					p_prod->filename, p_prod->size + p_prod->ccb_len,
-					p_prod->size + p_prod->ccb_len - bytes_left + bytes_read);
+					p_prod->size + p_prod->ccb_len - SendState.file_left
+						+ bytes_read);
 			p_prod->state = STATE_FAILED;
+			failed = 1;
 			break;
 		}
 
-		/* check if we are sending the first block */
-		if (bytes_left == p_prod->size) {
+		if (hdr_len > 0 && format_chunkhdr(SendBuf, p_prod, 0,
+				bytes_read) < 0) {
+			p_prod->state = STATE_FAILED;
+			failed = 1;
+			break;
+		}
 
-			/* check for CCB heading */
-			if (ClientOpt.strip_ccb &&
-					(p_prod->ccb_len = get_ccb_len(readbuf, bytes_read)) > 0) {
-				/* found ccb */
-				CS_LOG_DBUG(DEBUG_FP,
-					"%s: Found CCB len %d in file %s seqno %d\n",
-					LOG_PREFIX, p_prod->ccb_len, p_prod->filename,
-					p_prod->seqno);
-				p_prod->size -= p_prod->ccb_len;
+		if (ClientOpt.verbosity > 1) {
+			CS_LOG_DBUG(DEBUG_FP, "%s: Sending seqno %d, %d bytes\n",
+							LOG_PREFIX, p_prod->seqno, bytes_read); 
+		}
 
-				/* shift data past the CCB header */
-				memmove(readbuf,
-						readbuf + p_prod->ccb_len,
-						bytes_read - p_prod->ccb_len);
+		SendState.p_out = SendBuf;
+		SendState.out_len = hdr_len + bytes_read;
+		SendState.file_left -= bytes_read;
+		if (SendState.chunk_left) {
+			SendState.chunk_left -= bytes_read;
+		}
+	}
 
-			} else {
-				p_prod->ccb_len = 0;
-			}
+	if (failed) {
+		/* we did not finish this product, handle the error */
+		if (SendState.started) {
+			/* need to disconnect to syncronize with server */
+			Flags |= DISCONNECT_FLAG;
+		}
+		send_reset();
+		return -1;
+	}
 
-			data_offset = p_prod->ccb_len;
+	if (ClientOpt.verbosity > 0) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: Sent prod %d f(%s) bytes(%d+%d)%s\n",
+					LOG_PREFIX, p_prod->seqno, p_prod->filename,
+					p_prod->size, p_prod->ccb_len,
+					SendState.use_sendfile ? " with sendfile"
+					: !SendState.started ? " gathered" : ""); 
+	}
 
-			/* parse the wmo if we don't already have it */
-			if (p_prod->wmo_ttaaii[0] == '\0') {
-				if (parse_wmo(readbuf, bytes_read, p_prod) < 0) {
-					CS_LOG_ERR(ERROR_FP,
-							"%s: FAIL parse wmo prod %d buf [%s], ttaaii=%s\n",
-							LOG_PREFIX, p_prod->seqno,
-							debug_buf(readbuf, bytes_read>50?50:bytes_read),
-							p_prod->wmo_ttaaii);
-					/* process anyway */
-				}
-			}
+	send_reset();
+	p_prod->state = STATE_SENT;
+	time(&p_prod->send_time);
+	return 0;
+} /* end send_prod */
 
-			if (format_msghdr(sendbuf, p_prod) < 0) {
-				/* invalid product, skip to next */
-				p_prod->state = STATE_FAILED;
-				close(prod_fd);
-				return -1;
-			}
-		}
+/*******************************************************************************
+FUNCTION NAME
+	static int send_open(prod_info_t *p_prod, char *sendbuf, size_t bufsiz)
 
-		/* set alarm for timeout on send */
-		if 	(ClientOpt.timeout > 0) {
-			alarm(ClientOpt.timeout);
-		}
+FUNCTION DESCRIPTION
+	Open a product file for send_prod, read its first block and put it in
+	sendbuf after the message header, and set up SendState to send it.
+	With protocol 3 the header is that of the first chunk, which is the
+	first block.
 
-		send_size = readbuf - sendbuf + bytes_read - data_offset;
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_info_t *	p_prod			I/O	address of prod to send 
+	char *			sendbuf			O	buffer for the first block
+	size_t			bufsiz			I	its size
 
-		if (ClientOpt.verbosity > 1) {
-			CS_LOG_DBUG(DEBUG_FP, "%s: Sending seqno %d, %d bytes\n",
-							LOG_PREFIX, p_prod->seqno, send_size); 
-		}
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	size_t			bufsize			I	max size to read/write from socket
+	int				max_retry		I	max number of send retries per prod
+	char			verbosity		I	debugging verbosity level
+	size_t			sendfile_min	I	sendfile prods this big (0=never)
+	char			io_uring		I	take read-ahead files
+	char			strip_ccb		I	strip CCB heading
+	int				ProdSeqno		I	seqno of the product
+	int				Protocol		I	message header format
 
-		while ((bytes_sent = send(sock_fd, sendbuf, send_size, 0)) < 0) {
-			if (errno == EINTR) {
-				/* interrupted by signal */
-				if (Flags & DISCONNECT_FLAG) {
-					/* disconnect (SIGPIPE) detected, break out of send loop */
-					break; /* out of while-send */
-				}
-			} else {
-				/* any other error is a failure, break out of send loop */
-				CS_LOG_ERR(ERROR_FP, "%s: FAIL[%d] send %s to socket, %s\n",
-						LOG_PREFIX, p_prod->send_count, p_prod->filename,
-						strerror(errno));
-				Flags |= (DISCONNECT_FLAG|NOPEER_FLAG);
-				break; /* out of while-send */
-			}
-		}
+RETURNS
+	 0	Success
+	-1	Error, p_prod->state is set
+*******************************************************************************/
+static int send_open(prod_info_t *p_prod, char *sendbuf, size_t bufsiz)
+{
+	int prod_fd;
+	ssize_t bytes_read;
+	size_t file_size;
+	size_t read_size;
+	char *readbuf;
+	int ahead_read;
 
-		/* cancel alarm if pending */
-		if (ClientOpt.timeout > 0) {
-			alarm(0);
-		}
+	if (ClientOpt.max_retry > 0 && p_prod->send_count > ClientOpt.max_retry) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL prod #%d (%s) after %d retries\n",
+				LOG_PREFIX, p_prod->seqno, p_prod->filename,
+				ClientOpt.max_retry);
+		p_prod->state = STATE_FAILED;
+		return -1;
+	}
+	p_prod->send_count++;
 
-		/* check if we broke out of the while-send loop */
-		if (bytes_sent != send_size) {
-			p_prod->state = STATE_RETRY;
-			break; /* out of while-read */
-		}
+	/* offset readbuf in sendbuf by FIXED size of header for first block */
+	read_size = bufsiz - MSG_HDR_LEN - PROD_HDR_LEN;
+	readbuf = sendbuf + MSG_HDR_LEN + PROD_HDR_LEN;
 
-		bytes_left -= bytes_read;
-		read_size = ClientOpt.bufsize;
-		readbuf = sendbuf;
+	/* the file may already be open with its first block read */
+	prod_fd = -1;
+	ahead_read = 0;
+#ifdef INCLUDE_IO_URING
+	if (ClientOpt.io_uring) {
+		prod_fd = uring_take_file(p_prod->filename, readbuf, read_size,
+				&ahead_read);
+	}
+#endif
 
-		ACQ_STATS(p_stats->client_tot_buffs++;)
-		ACQ_STATS(p_stats->client_buff_last++;)
-		ACQ_STATS(p_stats->client_prod_bytes_sent += bytes_sent;)
+	if (prod_fd < 0 && (prod_fd = open(p_prod->filename, O_RDONLY)) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL open prod file %s, %s\n",
+				LOG_PREFIX, p_prod->filename, strerror(errno));
+		p_prod->state = STATE_FAILED;
+		return -1;
 	}
 
-	close(prod_fd);
+	p_prod->seqno = ProdSeqno;
+	if (ClientOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: Sending prod seq %d %s [%d bytes] try=%d\n",
+						LOG_PREFIX, p_prod->seqno, p_prod->filename,
+						p_prod->size, p_prod->send_count); 
+	}
 
-	if (ClientOpt.verbosity > 0) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: Sent prod %d f(%s) bytes(%d+%d)\n",
-					LOG_PREFIX, p_prod->seqno, p_prod->filename,
-					p_prod->size, p_prod->ccb_len); 
+	file_size = p_prod->size;
+	p_prod->ccb_len = 0;
+	if (ahead_read > 0) {
+		bytes_read = ahead_read;
+	} else {
+		while ((bytes_read = read(prod_fd, readbuf, read_size)) < 0
+				&& errno == EINTR);
+	}
+	if (bytes_read < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL read prod file %s, %s\n",
+				LOG_PREFIX, p_prod->filename, strerror(errno));
+		p_prod->state = STATE_FAILED;
+		close(prod_fd);
+		return -1;
 	}
 
-	if (bytes_left > 0) {
-		/* we did not finish this product, handle the error */
-		if (bytes_sent > 0) {
-			ProdSeqno = NEXT_SEQNO(ProdSeqno);
-			/* need to disconnect to syncronize with server */
-			Flags |= DISCONNECT_FLAG;
-		}
+	/* check product size */
+	if (bytes_read == 0 || (size_t)bytes_read > file_size) {
+		CS_LOG_ERR(ERROR_FP,
+				"%s: ERROR file %s size changed from %d to %d bytes\n",
+				LOG_PREFIX, p_prod->filename, file_size, bytes_read);
+		p_prod->state = STATE_FAILED;
+		close(prod_fd);
 		return -1;
+	}
+
+	/* check for CCB heading */
+	if (ClientOpt.strip_ccb &&
+			(p_prod->ccb_len = get_ccb_len(readbuf, bytes_read)) > 0) {
+		/* found ccb */
+		CS_LOG_DBUG(DEBUG_FP,
+			"%s: Found CCB len %d in file %s seqno %d\n",
+			LOG_PREFIX, p_prod->ccb_len, p_prod->filename,
+			p_prod->seqno);
+		p_prod->size -= p_prod->ccb_len;
+
+		/* shift data past the CCB header */
+		memmove(readbuf,
+				readbuf + p_prod->ccb_len,
+				bytes_read - p_prod->ccb_len);
+
 	} else {
-		ProdSeqno = NEXT_SEQNO(ProdSeqno);
-		p_prod->state = STATE_SENT;
-		time(&p_prod->send_time);
-		return 0;
+		p_prod->ccb_len = 0;
+	}
+
+	/* parse the wmo if we don't already have it */
+	if (p_prod->wmo_ttaaii[0] == '\0') {
+		if (parse_wmo(readbuf, bytes_read, p_prod) < 0) {
+			CS_LOG_ERR(ERROR_FP,
+					"%s: FAIL parse wmo prod %d buf [%s], ttaaii=%s\n",
+					LOG_PREFIX, p_prod->seqno,
+					debug_buf(readbuf, bytes_read>50?50:bytes_read),
+					p_prod->wmo_ttaaii);
+			/* process anyway */
+		}
 	}
-} /* end send_prod */
+
+	if ((Protocol > PROTOCOL_2 ? format_chunkhdr(sendbuf, p_prod,
+				CHUNK_FIRST, bytes_read - p_prod->ccb_len)
+			: Protocol > PROTOCOL_1 ? format_msghdr2(sendbuf, p_prod)
+			: format_msghdr(sendbuf, p_prod)) < 0) {
+		/* invalid product, skip to next */
+		p_prod->state = STATE_FAILED;
+		close(prod_fd);
+		return -1;
+	}
+
+	SendState.p_prod = p_prod;
+	SendState.prod_fd = prod_fd;
+	SendState.p_out = sendbuf;
+	SendState.out_len = readbuf - sendbuf + bytes_read - p_prod->ccb_len;
+	SendState.file_left = file_size - bytes_read;
+	SendState.started = 0;
+	SendState.chunk_left = 0;
+	SendState.progress = event_now();
+
+	/* big products go out with sendfile after the first block */
+	SendState.use_sendfile = 0;
+#ifdef __linux__
+	if (ClientOpt.sendfile_min > 0 && !SendfileOff
+			&& file_size >= ClientOpt.sendfile_min) {
+		SendState.use_sendfile = 1;
+	}
+#endif
+
+	if (ClientOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: Sending seqno %d, %d bytes\n",
+						LOG_PREFIX, p_prod->seqno, SendState.out_len); 
+	}
+
+	return 0;
+} /* end send_open */
 
 /*******************************************************************************
 FUNCTION NAME
-	static int check_for_ack(int sock_fd, time_t timeout)
+	static void send_reset(void)
 
 FUNCTION DESCRIPTION
-	Check socket for acknowledgements waiting.  
+	Forget the product send_prod was sending and close its file.  Called
+	when it is done, failed, or the connection is closed.
 
 PARAMETERS
 	Type			Name			I/O	Description
-	int				sock_fd			I	socket to send on
-	time_t			timeout			I	seconds to wait before timing out
+	void
 
-GLOBAL VARIABLES (from ClientOpt structure)
+RETURNS
+	void
+*******************************************************************************/
+static void send_reset(void)
+{
+	if (SendState.prod_fd >= 0) {
+		close(SendState.prod_fd);
+	}
+	SendState.p_prod = NULL;
+	SendState.prod_fd = -1;
+	SendState.out_len = 0;
+	SendState.file_left = 0;
+	SendState.started = 0;
+	SendState.chunk_left = 0;
+} /* end send_reset */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void send_park(void)
+
+FUNCTION DESCRIPTION
+	Put off the product send_prod is sending, between two of its chunks
+	(protocol 3), so another can be sent ahead of the rest of it.  Its
+	file stays open until send_unpark takes it back.
+
+PARAMETERS
 	Type			Name			I/O	Description
-	char			verbosity		I	debugging verbosity level
-	unsigned int	port			I	port number for listen/connect
+	void
 
 RETURNS
-	 1	1 or more acks are ready
-	 0	No acks are ready
-	-1	Error
+	void
 *******************************************************************************/
-static int check_for_ack(int sock_fd, time_t timeout)
+static void send_park(void)
 {
-	fd_set readfds;
-	fd_set errorfds;
-	int n_select;
-	struct timeval tvs;
+	memcpy(&Parked[ParkCount++], &SendState, sizeof(send_state_t));
+	SendState.p_prod = NULL;
+	SendState.prod_fd = -1;
+	SendState.file_left = 0;
+	SendState.started = 0;
+} /* end send_park */
 
-	if (ClientOpt.port == DISCARD_PORT) {
-		return 1; /* pretend ack is ready so we can pretend to read it */
-	}
+/*******************************************************************************
+FUNCTION NAME
+	static prod_info_t *send_unpark(void)
 
-	if (ClientOpt.verbosity > 2) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: Checking for acks with timeout=%ld secs\n",
-						LOG_PREFIX, timeout); 
-	}
+FUNCTION DESCRIPTION
+	Take back the product last put off by send_park, for send_prod to go
+	on with the rest of it.  The product send_prod was sending, if any,
+	is forgotten; the products gathered in sendbuf are kept.
 
-	tvs.tv_sec = timeout;
-	tvs.tv_usec = 0;
+PARAMETERS
+	Type			Name			I/O	Description
+	void
 
-	FD_ZERO(&readfds);
-	FD_SET(sock_fd, &readfds);
-	FD_ZERO(&errorfds);
-	FD_SET(sock_fd, &errorfds);
- 
-	while ((n_select = select(sock_fd+1, &readfds, 0, &errorfds, &tvs)) < 0) {
-		if (errno == EINTR) {
-			if (ClientOpt.verbosity > 1) {
-				CS_LOG_DBUG(DEBUG_FP, "%s: select interrupted by signal\n",
-							LOG_PREFIX); 
-			}	
-			return 0;
-		} else {
-			/* error */
-			CS_LOG_ERR(ERROR_FP, "%s: FAIL select, %s\n",
-							LOG_PREFIX, strerror(errno));
-			return -1;
-		}
+RETURNS
+	product put off, or NULL if there is none
+*******************************************************************************/
+static prod_info_t *send_unpark(void)
+{
+	send_state_t *p_parked;
+
+	if (ParkCount == 0) {
+		return NULL;
 	}
-	
-	if (n_select == 0) {
-		/* timeout */
-		if (ClientOpt.verbosity > 1) {
-			CS_LOG_DBUG(DEBUG_FP, "%s: Timeout waiting for ack\n", LOG_PREFIX); 
-		}
-		return 0;
-	} else {
-		if (FD_ISSET(sock_fd, &readfds)) {
-			if (ClientOpt.verbosity > 2) {
-				CS_LOG_DBUG(DEBUG_FP, "%s: ack socket is ready to read\n",
-								LOG_PREFIX); 
+
+	send_reset();
+	p_parked = &Parked[--ParkCount];
+	SendState.p_prod = p_parked->p_prod;
+	SendState.prod_fd = p_parked->prod_fd;
+	SendState.file_left = p_parked->file_left;
+	SendState.use_sendfile = p_parked->use_sendfile;
+	SendState.started = p_parked->started;
+	SendState.progress = event_now();
+
+	return SendState.p_prod;
+} /* end send_unpark */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int send_gathered(int sock_fd)
+
+FUNCTION DESCRIPTION
+	Send the whole products send_prod gathered in sendbuf, as much as the
+	socket takes without blocking.  They are already in the ack list, so
+	if the send fails the connection is dropped and they are sent again.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket to send on
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	int				Flags			I+O	Control Flags
+
+RETURNS
+	 0	Success, all sent (or none gathered)
+	 1	Socket is full, more to send
+	-1	Error, DISCONNECT_FLAG is set
+*******************************************************************************/
+static int send_gathered(int sock_fd)
+{
+	ssize_t bytes_sent;
+
+	while (SendState.gather_off < SendState.gathered) {
+		if ((bytes_sent = send(sock_fd, SendBuf + SendState.gather_off,
+				SendState.gathered - SendState.gather_off,
+				MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR && !(Flags & DISCONNECT_FLAG)) {
+				continue;
 			}
-			return 1;
-		} else if (FD_ISSET(sock_fd, &errorfds)) {
-			CS_LOG_ERR(ERROR_FP, "%s: Error reported on socket\n", LOG_PREFIX); 
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 1;
+			}
+			if (errno != EINTR) {
+				CS_LOG_ERR(ERROR_FP,
+						"%s: FAIL send %d gathered prods to socket, %s\n",
+						LOG_PREFIX, SendState.gather_count, strerror(errno));
+				Flags |= NOPEER_FLAG;
+			}
+			Flags |= DISCONNECT_FLAG;
 			return -1;
 		}
+		SendState.gather_off += bytes_sent;
+		SendState.progress = event_now();
 	}
 
-	CS_LOG_ERR(ERROR_FP, "%s: ERROR in select logic!\n", LOG_PREFIX); 
-	return -1;
-}
+	if (SendState.gathered > 0 && ClientOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: Sent %d gathered prods, %d bytes\n",
+				LOG_PREFIX, SendState.gather_count, SendState.gathered);
+	}
+	SendState.gathered = SendState.gather_off = 0;
+	SendState.gather_count = 0;
+
+	return 0;
+} /* end send_gathered */
 
 /*******************************************************************************
 FUNCTION NAME
-	static int recv_ack(int sock_fd, prod_info_t *p_ack, char *p_code) 
+	static int fill_acks(int sock_fd) 
 
 FUNCTION DESCRIPTION
-	Read an acknowledgement from socket and parse and check 
-	the message then return code to sender via p_code argument.
+	Read all the acks waiting on the socket into AckBuf, with one recv
+	when they fit in the space left, for recv_ack to take one at a time.
+	Does not wait: a partly read ack stays in AckBuf until the rest of it
+	comes in.
 
 PARAMETERS
 	Type			Name			I/O	Description
-	int				sock_fd			I	socket to send on
-	prod_info_t *	p_ack			I	product for which ack is expected
-	char *			p_code			O	ack-type code
+	int				sock_fd			I	socket to read from
 
 GLOBAL VARIABLES (from ClientOpt structure)
 	Type			Name			I/O	Description
@@ -948,27 +1758,29 @@ GLOBAL VARIABLES (from ClientOpt structure)
 	unsigned int	port			I	port number for listen/connect
 
 RETURNS
-	 0	Success
+	>=0	Bytes read
 	-1	Error
 *******************************************************************************/
-static int recv_ack(int sock_fd, prod_info_t *p_ack, char *p_code)
+static int fill_acks(int sock_fd)
 {
-	char recvbuf[ACK_MSG_LEN+1];
-	char *p_buf;
 	int recv_bytes;
-	size_t bytes_left;
-	char code;
-	int seqno;
+	int nbytes;
+	int room;
+	int len;
 
 	if (ClientOpt.port == DISCARD_PORT) {
-		*p_code = ACK_OK;	/* pretend we read OK */
 		return 0;
 	}
 
-	bytes_left = ACK_MSG_LEN;
-	p_buf = recvbuf;
-	while (bytes_left > 0) {
-		recv_bytes = recv(sock_fd, p_buf, bytes_left, 0);
+	if (AckHead == AckTail) {
+		/* empty, read into the whole buffer */
+		AckHead = AckTail = 0;
+	}
+
+	nbytes = 0;
+	while ((room = ACK_BUF_LEN - (AckTail - AckHead)) > 0) {
+		len = MIN(room, ACK_BUF_LEN - AckTail % ACK_BUF_LEN);
+		recv_bytes = recv(sock_fd, AckBuf + AckTail % ACK_BUF_LEN, len, 0);
 		if (recv_bytes < 0) {
 			if (errno == EINTR) {
 				if (Flags & DISCONNECT_FLAG) {
@@ -976,12 +1788,18 @@ static int recv_ack(int sock_fd, prod_info_t *p_ack, char *p_code)
 				} else {
 					continue;
 				}
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
 			} else {
 				CS_LOG_ERR(ERROR_FP, "%s: FAIL recv from socket, %s\n",
 						LOG_PREFIX, strerror(errno));
 				return -1;
 			}
 		} else if (recv_bytes == 0) {
+			if (AckTail - AckHead >= ACK_LEN(Protocol)) {
+				/* take the acks that came in first */
+				break;
+			}
 			/* this is usually just a disconnect */
 			CS_LOG_ERR(ERROR_FP,
 					"%s: Recv 0 bytes from socket, flag reconnect\n",
@@ -989,11 +1807,61 @@ static int recv_ack(int sock_fd, prod_info_t *p_ack, char *p_code)
 			Flags |= (DISCONNECT_FLAG|NOPEER_FLAG);
 			return -1;
 		}
-		bytes_left -= recv_bytes;
-		p_buf += recv_bytes;
+		AckTail += recv_bytes;
+		nbytes += recv_bytes;
+		if (recv_bytes < len) {
+			/* that was all of them */
+			break;
+		}
 	}
 
-	if (parse_ack(recvbuf, recv_bytes, &seqno, &code) < 0) {
+	return nbytes;
+}	/* end fill_acks */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int recv_ack(prod_info_t *p_ack, char *p_code) 
+
+FUNCTION DESCRIPTION
+	Take the next acknowledgement read by fill_acks, and parse and check 
+	the message then return code to sender via p_code argument.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_info_t *	p_ack			I	product for which ack is expected
+	char *			p_code			O	ack-type code
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	unsigned int	port			I	port number for listen/connect
+	int				protocol		I	protocol asked for
+	int				Protocol		I	ack format
+
+RETURNS
+	 1	Ack received
+	 0	No (whole) ack ready
+	-1	Error
+*******************************************************************************/
+static int recv_ack(prod_info_t *p_ack, char *p_code)
+{
+	char code;
+	int seqno;
+	char *p_msg;
+
+	if (ClientOpt.port == DISCARD_PORT) {
+		*p_code = ACK_OK;	/* pretend we read OK */
+		return 1;
+	}
+
+	if (AckTail - AckHead < ACK_LEN(Protocol)) {
+		return 0;
+	}
+	p_msg = AckBuf + AckHead % ACK_BUF_LEN;
+	AckHead += ACK_LEN(Protocol);
+
+	if ((Protocol > PROTOCOL_1
+			? parse_ack2(p_msg, ACK2_MSG_LEN, &seqno, &code)
+			: parse_ack(p_msg, ACK_MSG_LEN, &seqno, &code)) < 0) {
 		return -1;
 	}
 
@@ -1008,7 +1876,11 @@ static int recv_ack(int sock_fd, prod_info_t *p_ack, char *p_code)
 		return -1;
 	}
 	 
-	if (code != ACK_OK && code != ACK_RETRY && code != ACK_FAIL) {
+	if (code != ACK_OK && code != ACK_RETRY && code != ACK_FAIL
+			&& !(code == ACK_PROTO2 && Protocol == PROTOCOL_1
+				&& ClientOpt.protocol > PROTOCOL_1)
+			&& !(code == ACK_PROTO3 && Protocol == PROTOCOL_1
+				&& ClientOpt.protocol > PROTOCOL_2)) {
 		CS_LOG_ERR(ERROR_FP, "%s: ERROR Invalid ack code %d\n",
 				LOG_PREFIX, code);
 		return -1;
@@ -1016,7 +1888,7 @@ static int recv_ack(int sock_fd, prod_info_t *p_ack, char *p_code)
 
 	*p_code = code;
 
-	return 0;
+	return 1;
 }	/* end recv_ack */
 
 /*******************************************************************************
@@ -1047,6 +1919,10 @@ static void push_prod(prod_list_t *p_list, prod_info_t *p_prod)
 	p_list->p_tail = p_prod;
 	p_prod->p_next = NULL;
 	p_list->count++;
+	p_list->bulk += p_prod->bulk;
+	if (p_list->p_index) {
+		index_add(p_list->p_index, p_prod);
+	}
 }
 
 /*******************************************************************************
@@ -1077,11 +1953,203 @@ static prod_info_t *pop_prod(prod_list_t *p_list)
 			p_list->p_tail = NULL;
 		}
 		p_list->count--;
+		p_list->bulk -= p_prod->bulk;
 		p_prod->p_next = NULL;
+		if (p_list->p_index) {
+			index_del(p_list->p_index, p_prod);
+		}
 	}
 	return p_prod;
 }
 
+/*******************************************************************************
+FUNCTION NAME
+	prod_info_t *find_prod(prod_index_t *p_index, char *filename, dev_t dev,
+			ino_t ino)
+
+FUNCTION DESCRIPTION
+	Find a product in a list index by device and inode, or by filename for
+	products whose inode is not known.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_index_t *	p_index			I	list index
+	char *			filename		I	filename to find
+	dev_t			dev				I	its device
+	ino_t			ino				I	its inode (0 if not known)
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+
+RETURNS
+	product found or NULL
+*******************************************************************************/
+prod_info_t *find_prod(prod_index_t *p_index, char *filename, dev_t dev,
+			ino_t ino)
+{
+	prod_info_t *p_prod;
+	unsigned mask;
+	unsigned i;
+
+	if (!p_index->count) {
+		return NULL;
+	}
+	mask = p_index->size - 1;
+
+	if (ino) {
+		for (i = prod_hash(filename, dev, ino) & mask;
+				(p_prod = p_index->slot[i]); i = (i + 1) & mask) {
+			if (p_prod->ino == ino && p_prod->dev == dev) {
+				return p_prod;
+			}
+		}
+		if (!p_index->by_name) {
+			return NULL;
+		}
+	}
+
+	for (i = prod_hash(filename, 0, 0) & mask;
+			(p_prod = p_index->slot[i]); i = (i + 1) & mask) {
+		if (!p_prod->ino && !strcmp(p_prod->filename, filename)) {
+			return p_prod;
+		}
+	}
+
+	return NULL;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static void index_add(prod_index_t *p_index, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Add a product to a list index.  The index is sized for the whole
+	product table, so it cannot fill up.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_index_t *	p_index			I	list index
+	prod_info_t *	p_prod			I	product to add
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+
+RETURNS
+	void
+*******************************************************************************/
+static void index_add(prod_index_t *p_index, prod_info_t *p_prod)
+{
+	unsigned mask;
+	unsigned i;
+
+	if (p_index->count + 1 >= (int)p_index->size) {
+		/* This should never happen */
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR, window index full, count = %d\n",
+				LOG_PREFIX, p_index->count);
+		return;
+	}
+
+	mask = p_index->size - 1;
+	for (i = prod_hash(p_prod->filename, p_prod->dev, p_prod->ino) & mask;
+			p_index->slot[i]; i = (i + 1) & mask) {
+		if (p_index->slot[i] == p_prod) {
+			/* already there */
+			return;
+		}
+	}
+	p_index->slot[i] = p_prod;
+	p_index->count++;
+	if (!p_prod->ino) {
+		p_index->by_name++;
+	}
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static void index_del(prod_index_t *p_index, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Remove a product from a list index.  The entries after it in its probe
+	sequence are moved back to fill the gap, so no deleted markers are
+	needed.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_index_t *	p_index			I	list index
+	prod_info_t *	p_prod			I	product to remove
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+
+RETURNS
+	void
+*******************************************************************************/
+static void index_del(prod_index_t *p_index, prod_info_t *p_prod)
+{
+	prod_info_t *p_next;
+	unsigned mask;
+	unsigned home;
+	unsigned i;
+	unsigned j;
+
+	mask = p_index->size - 1;
+	for (i = prod_hash(p_prod->filename, p_prod->dev, p_prod->ino) & mask;
+			p_index->slot[i] != p_prod; i = (i + 1) & mask) {
+		if (!p_index->slot[i]) {
+			/* not there */
+			return;
+		}
+	}
+
+	for (j = (i + 1) & mask; (p_next = p_index->slot[j]); j = (j + 1) & mask) {
+		home = prod_hash(p_next->filename, p_next->dev, p_next->ino) & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			/* the gap is on its probe sequence, move it back */
+			p_index->slot[i] = p_next;
+			i = j;
+		}
+	}
+	p_index->slot[i] = NULL;
+	p_index->count--;
+	if (!p_prod->ino) {
+		p_index->by_name--;
+	}
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static unsigned prod_hash(char *filename, dev_t dev, ino_t ino)
+
+FUNCTION DESCRIPTION
+	Hash a product for a list index: by device and inode if the inode is
+	known, else by filename.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			filename		I	product filename
+	dev_t			dev				I	its device
+	ino_t			ino				I	its inode (0 if not known)
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+
+RETURNS
+	hash value
+*******************************************************************************/
+static unsigned prod_hash(char *filename, dev_t dev, ino_t ino)
+{
+	unsigned long long key;
+
+	if (!ino) {
+		return str_hash(filename);
+	}
+
+	/* mix the bits so neighbouring inodes spread out */
+	key = ((unsigned long long)ino ^ ((unsigned long long)dev << 32))
+			* 0x9e3779b97f4a7c15ULL;
+	return (unsigned)(key >> 32);
+}
+
 /*******************************************************************************
 FUNCTION NAME
 	static void rebuild_lists(prod_tbl_t *p_tbl) 
@@ -1117,6 +2185,12 @@ static void rebuild_lists(prod_tbl_t *p_tbl)
 	p_tbl->free_list.count = 0;
 	p_tbl->ack_list.count = 0;
 	p_tbl->retr_list.count = 0;
+	p_tbl->free_list.bulk = 0;
+	p_tbl->ack_list.bulk = 0;
+	p_tbl->retr_list.bulk = 0;
+	memset(p_tbl->window.slot, '\0', p_tbl->window.size * sizeof(prod_info_t *));
+	p_tbl->window.count = 0;
+	p_tbl->window.by_name = 0;
 	for (i = 0; i < ClientOpt.window_size; i++) {
 		p_tbl->prod[i].p_next = NULL;
 		switch (p_tbl->prod[i].state) {
@@ -1259,6 +2333,7 @@ GLOBAL VARIABLES (from ClientOpt structure)
 	char *			connect_wmo		I	WMO heading of connection message
 	char *			source			I	source ID string for this datastream 
 	int				link_id			I	datastream index
+	int				protocol		I	protocol to ask for
 
 RETURNS
 	Pointer to prod_info structure for connection product
@@ -1306,7 +2381,13 @@ static prod_info_t *create_conn_msg(prod_tbl_t *p_tbl)
 	p_prod->size = fprintf(fp, "%s %.2d%.2d%.2d\r\r\n",
 					ClientOpt.connect_wmo,
 					p_tms->tm_mday, p_tms->tm_hour, p_tms->tm_min);
-	p_prod->size += fprintf(fp, "\n%s\n", CONN_MSG_START);
+	p_prod->size += fprintf(fp, "\n");
+	if (ClientOpt.protocol > PROTOCOL_1) {
+		/* a server that does not know it skips it, and acks ACK_OK */
+		p_prod->size += fprintf(fp, "%s %d\n", PROTOCOL_ID,
+						ClientOpt.protocol);
+	}
+	p_prod->size += fprintf(fp, "%s\n", CONN_MSG_START);
 	p_prod->size += fprintf(fp, "%s %s\n",
 					SOURCE_ID, ClientOpt.source?ClientOpt.source:"UNKNOWN");
 	p_prod->size += fprintf(fp, "%s %d\n", LINK_ID, ClientOpt.link_id);
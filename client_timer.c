@@ -0,0 +1,381 @@
+/*******************************************************************************
+FILE NAME
+	client_timer.c
+
+FILE DESCRIPTION
+	Timer wheel for the client send loop.  Each product in the window has
+	a timer (its ack deadline, or its TTL while it waits to be sent), and
+	poll_and_send has a few more (next input poll, reconnect or connect
+	timeout, send stall).  Setting, cancelling and expiring a timer are
+	O(1) at millisecond resolution, and timer_next gives the deadline to
+	hand event_wait.
+
+	The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots.  A slot of
+	level 0 is one msec, a slot of each level above covers a whole turn
+	of the level below.  A timer goes in the lowest level that reaches
+	its expiry, and moves down a level (cascades) each time the level
+	below turns over onto its slot.  A bit map of the slots in use at
+	each level lets the wheel skip idle stretches.
+
+FUNCTIONS
+	timer_init			- start the wheel at a time
+	timer_set			- set (or reset) a timer
+	timer_cancel		- cancel a timer
+	timer_expired		- get the next expired timer
+	timer_next			- time of the next timer to expire
+	timer_place			- put a timer in its wheel slot
+	timer_tick			- cascade and expire the timers of one msec
+	next_busy			- distance to the next slot in use
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_client_timer_c[]= "@(#)client_timer.c 0.1 10/16/2026 12:00:00";
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "client.h"
+#include "share.h"
+
+#define TIMER_BITS		6
+#define TIMER_SLOTS		(1 << TIMER_BITS)		/* slots per level */
+#define TIMER_MASK		(TIMER_SLOTS - 1)
+#define TIMER_LEVELS	4						/* 1 msec to 4.6 hours */
+#define TIMER_SPAN(l)	(1LL << (TIMER_BITS * (l)))	/* msecs per slot */
+
+static void timer_place(wtimer_t *p_timer);
+static void timer_tick(long long tick);
+static int next_busy(unsigned long long map, int from);
+
+static wtimer_t Wheel[TIMER_LEVELS][TIMER_SLOTS];	/* list heads */
+static unsigned long long Busy[TIMER_LEVELS];		/* slots in use */
+static wtimer_t Expired;			/* expired, not yet returned */
+static long long WheelNow;			/* last msec the wheel has done */
+static int TimerCount;				/* timers set */
+
+/*******************************************************************************
+FUNCTION NAME
+	void timer_init(long long now)
+
+FUNCTION DESCRIPTION
+	Start the wheel, empty, at now (event_now msecs).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long long		now				I	current time
+
+RETURNS
+	void
+*******************************************************************************/
+void timer_init(long long now)
+{
+	int level;
+	int slot;
+
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		for (slot = 0; slot < TIMER_SLOTS; slot++) {
+			Wheel[level][slot].p_next = Wheel[level][slot].p_prev
+					= &Wheel[level][slot];
+		}
+		Busy[level] = 0;
+	}
+	Expired.p_next = Expired.p_prev = &Expired;
+	WheelNow = now;
+	TimerCount = 0;
+} /* end timer_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	void timer_set(wtimer_t *p_timer, int type, long long expire)
+
+FUNCTION DESCRIPTION
+	Set a timer to expire at expire (event_now msecs), cancelling it
+	first if it is set.  A time already past expires at the next
+	timer_expired.  p_timer->p_arg is left as it is.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	wtimer_t *		p_timer			I/O	timer to set
+	int				type			I	TIMER_* of what it is for
+	long long		expire			I	when it expires
+
+RETURNS
+	void
+*******************************************************************************/
+void timer_set(wtimer_t *p_timer, int type, long long expire)
+{
+	timer_cancel(p_timer);
+
+	p_timer->type = type;
+	p_timer->expire = expire;
+	timer_place(p_timer);
+	TimerCount++;
+} /* end timer_set */
+
+/*******************************************************************************
+FUNCTION NAME
+	void timer_cancel(wtimer_t *p_timer)
+
+FUNCTION DESCRIPTION
+	Cancel a timer.  Cancelling a timer that is not set does nothing.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	wtimer_t *		p_timer			I/O	timer to cancel
+
+RETURNS
+	void
+*******************************************************************************/
+void timer_cancel(wtimer_t *p_timer)
+{
+	wtimer_t *p_head;
+
+	if (!p_timer->p_next) {
+		return;
+	}
+
+	p_timer->p_prev->p_next = p_timer->p_next;
+	p_timer->p_next->p_prev = p_timer->p_prev;
+	if (p_timer->slot >= 0) {
+		p_head = &Wheel[p_timer->slot / TIMER_SLOTS][p_timer->slot % TIMER_SLOTS];
+		if (p_head->p_next == p_head) {
+			Busy[p_timer->slot / TIMER_SLOTS] &=
+					~(1ULL << (p_timer->slot % TIMER_SLOTS));
+		}
+	}
+	p_timer->p_next = p_timer->p_prev = NULL;
+	TimerCount--;
+} /* end timer_cancel */
+
+/*******************************************************************************
+FUNCTION NAME
+	wtimer_t *timer_expired(long long now)
+
+FUNCTION DESCRIPTION
+	Bring the wheel up to now and return a timer that has expired, which
+	is no longer set.  Call until it returns NULL; the caller may set
+	timers (including the one returned) in between.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long long		now				I	current time
+
+RETURNS
+	expired timer, or NULL if there are no more
+*******************************************************************************/
+wtimer_t *timer_expired(long long now)
+{
+	wtimer_t *p_timer;
+	long long tick;
+	long long lap_end;
+
+	while (WheelNow < now && TimerCount > 0) {
+		/* skip to the next msec with a timer, or to the end of the lap
+		   where the levels above cascade */
+		lap_end = (WheelNow | TIMER_MASK) + 1;
+		tick = lap_end;
+		if (Busy[0]) {
+			tick = WheelNow + 1 + next_busy(Busy[0], (WheelNow + 1) & TIMER_MASK);
+			tick = MIN(tick, lap_end);
+		}
+		if (tick > now) {
+			break;
+		}
+		WheelNow = tick;
+		timer_tick(tick);
+	}
+	if (WheelNow < now) {
+		WheelNow = now;
+	}
+
+	if ((p_timer = Expired.p_next) == &Expired) {
+		return NULL;
+	}
+	p_timer->p_prev->p_next = p_timer->p_next;
+	p_timer->p_next->p_prev = p_timer->p_prev;
+	p_timer->p_next = p_timer->p_prev = NULL;
+	TimerCount--;
+
+	return p_timer;
+} /* end timer_expired */
+
+/*******************************************************************************
+FUNCTION NAME
+	long long timer_next(void)
+
+FUNCTION DESCRIPTION
+	Get the time of the next timer to expire, for event_wait.  For a timer
+	in a level above 0 this is when its slot cascades, which may be before
+	it expires: timer_expired then returns nothing, and timer_next gives
+	a later time.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	event_now msecs, or -1 if no timer is set
+*******************************************************************************/
+long long timer_next(void)
+{
+	long long next;
+	long long when;
+	long long lap;
+	int level;
+
+	if (Expired.p_next != &Expired) {
+		return WheelNow;
+	}
+	if (TimerCount == 0) {
+		return -1;
+	}
+
+	next = -1;
+	if (Busy[0]) {
+		next = WheelNow + 1 + next_busy(Busy[0], (WheelNow + 1) & TIMER_MASK);
+	}
+	for (level = 1; level < TIMER_LEVELS; level++) {
+		if (!Busy[level]) {
+			continue;
+		}
+		/* the slots of this level cascade in turn, one each lap below */
+		lap = (WheelNow >> (TIMER_BITS * level)) + 1;
+		when = (lap + next_busy(Busy[level], lap & TIMER_MASK))
+				<< (TIMER_BITS * level);
+		if (next < 0 || when < next) {
+			next = when;
+		}
+	}
+
+	return next;
+} /* end timer_next */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void timer_place(wtimer_t *p_timer)
+
+FUNCTION DESCRIPTION
+	Put a timer in the lowest level of the wheel that reaches its expiry,
+	at the slot for its expiry, or on the expired list if it is due.  A
+	timer beyond the top level waits in the farthest slot and is placed
+	again when that cascades.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	wtimer_t *		p_timer			I/O	timer to place
+
+RETURNS
+	void
+*******************************************************************************/
+static void timer_place(wtimer_t *p_timer)
+{
+	wtimer_t *p_head;
+	long long when;
+	int level;
+	int slot;
+
+	when = p_timer->expire;
+	if (when <= WheelNow) {
+		p_head = &Expired;
+		p_timer->slot = -1;
+	} else {
+		if (when - WheelNow >= TIMER_SPAN(TIMER_LEVELS)) {
+			when = WheelNow + TIMER_SPAN(TIMER_LEVELS) - 1;
+		}
+		for (level = 0; level < TIMER_LEVELS - 1
+				&& when - WheelNow >= TIMER_SPAN(level + 1); level++);
+		slot = (when >> (TIMER_BITS * level)) & TIMER_MASK;
+		p_head = &Wheel[level][slot];
+		Busy[level] |= 1ULL << slot;
+		p_timer->slot = level * TIMER_SLOTS + slot;
+	}
+
+	p_timer->p_next = p_head;
+	p_timer->p_prev = p_head->p_prev;
+	p_head->p_prev->p_next = p_timer;
+	p_head->p_prev = p_timer;
+} /* end timer_place */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void timer_tick(long long tick)
+
+FUNCTION DESCRIPTION
+	Do one msec of the wheel: when level 0 starts a new lap, cascade the
+	slots of the levels above that come up (highest first, so a timer can
+	move down more than one level), then move the timers of the level 0
+	slot to the expired list.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long long		tick			I	msec to do (WheelNow)
+
+RETURNS
+	void
+*******************************************************************************/
+static void timer_tick(long long tick)
+{
+	wtimer_t *p_head;
+	wtimer_t *p_timer;
+	int top;
+	int level;
+	int slot;
+
+	/* levels whose slot turns over at this tick */
+	for (top = 0; top < TIMER_LEVELS - 1
+			&& ((tick >> (TIMER_BITS * top)) & TIMER_MASK) == 0; top++);
+
+	for (level = top; level >= 0; level--) {
+		slot = (tick >> (TIMER_BITS * level)) & TIMER_MASK;
+		if (!(Busy[level] & (1ULL << slot))) {
+			continue;
+		}
+		p_head = &Wheel[level][slot];
+		Busy[level] &= ~(1ULL << slot);
+		while ((p_timer = p_head->p_next) != p_head) {
+			p_timer->p_prev->p_next = p_timer->p_next;
+			p_timer->p_next->p_prev = p_timer->p_prev;
+			timer_place(p_timer);
+		}
+	}
+} /* end timer_tick */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int next_busy(unsigned long long map, int from)
+
+FUNCTION DESCRIPTION
+	Find the first slot in use at or after slot from, going round.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	unsigned long long	map			I	Busy bits of a level (not 0)
+	int				from			I	slot to start at
+
+RETURNS
+	slots from from to the one found (0 to TIMER_SLOTS-1)
+*******************************************************************************/
+static int next_busy(unsigned long long map, int from)
+{
+	int n;
+
+	if (from) {
+		map = (map >> from) | (map << (TIMER_SLOTS - from));
+	}
+#ifdef __GNUC__
+	n = __builtin_ctzll(map);
+#else
+	for (n = 0; !(map & 1); n++, map >>= 1);
+#endif
+
+	return n;
+} /* end next_busy */
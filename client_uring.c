@@ -0,0 +1,474 @@
+/*******************************************************************************
+FILE NAME
+	client_uring.c
+
+FILE DESCRIPTION
+	io_uring input routines for the client (INCLUDE_IO_URING, -U option).
+	When the input directories are on high latency storage (e.g. NFS), the
+	stat of each directory entry and the open and first read of each file
+	are what limit the send rate.  These routines put many of those
+	requests in flight at once on one ring: directory entries are stat'ed
+	in batches, and the next few queued files are opened and their first
+	block read while earlier products are being sent.
+
+FUNCTIONS
+	uring_input_init	- set up the client ring
+	uring_stat_batch	- stat a batch of directory entries at once
+	uring_prefetch		- open and read ahead the next queued files
+	uring_take_file		- get a read-ahead file for send_prod
+	uring_reap			- handle completions
+	uring_slot_free		- release a read-ahead slot
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_client_uring_c[]= "@(#)client_uring.c 0.1 10/15/2026 12:00:00";
+
+#ifdef INCLUDE_IO_URING
+#define _GNU_SOURCE		/* struct statx */
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef INCLUDE_IO_URING
+#include <sys/sysmacros.h>
+#endif
+
+#include "client.h"
+#include "share.h"
+
+#ifdef INCLUDE_IO_URING
+
+#include <linux/io_uring.h>
+
+#define URING_CLIENT_SIZE	(URING_STAT_BATCH + 2*URING_PREFETCH)
+
+/* user_data is the operation | index */
+#define URING_OP_STATX		(1<<16)
+#define URING_OP_OPEN		(2<<16)
+#define URING_OP_READ		(3<<16)
+#define URING_OP_MASK		(3<<16)
+#define URING_INDEX_MASK	0xffff
+
+/* read-ahead slot states */
+#define SLOT_FREE			0
+#define SLOT_BUSY			1		/* open or read in flight */
+#define SLOT_DONE			2		/* ready for uring_take_file */
+
+/* read-ahead slot */
+typedef struct {
+	int				state;
+	int				orphan;			/* not wanted, free when done */
+	char			filename[FILENAME_LEN];
+	int				fd;				/* open result, or -errno */
+	int				nread;			/* read result, or -errno */
+	char *			buf;
+	size_t			bufsiz;
+} slot_t;
+
+static void uring_reap(void);
+static void uring_slot_free(slot_t *p_slot);
+
+static uring_t Ring;
+static int RingUp;
+static slot_t Slots[URING_PREFETCH];
+
+/* statx batch in progress */
+static struct statx *StatxBuf;
+static int *StatxRes;
+static int StatxPending;
+
+/*******************************************************************************
+FUNCTION NAME
+	int uring_input_init(void)
+
+FUNCTION DESCRIPTION
+	Set up the client ring and read-ahead buffers.  If io_uring is not
+	available, ClientOpt.io_uring is turned off so the normal input path
+	is used.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ClientOpt structure)
+	Type			Name			I/O	Description
+	char			io_uring		I/O	use io_uring for input
+	size_t			bufsize			I	max size to read/write from socket
+
+RETURNS
+	 0	Normal return (io_uring may have been turned off)
+	-1	Error
+*******************************************************************************/
+int uring_input_init(void)
+{
+	int i;
+
+	if (!ClientOpt.io_uring || RingUp) {
+		return 0;
+	}
+
+	if (uring_init(&Ring, URING_CLIENT_SIZE) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: io_uring not available, normal input\n",
+				LOG_PREFIX);
+		ClientOpt.io_uring = 0;
+		return 0;
+	}
+
+	if (!(StatxBuf = calloc(URING_STAT_BATCH, sizeof(struct statx)))
+			|| !(StatxRes = calloc(URING_STAT_BATCH, sizeof(int)))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc statx batch, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < URING_PREFETCH; i++) {
+		Slots[i].bufsiz = ClientOpt.bufsize - MSG_HDR_LEN - PROD_HDR_LEN;
+		if (!(Slots[i].buf = malloc(Slots[i].bufsiz))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d bytes read-ahead, %s\n",
+					LOG_PREFIX, Slots[i].bufsiz, strerror(errno));
+			return -1;
+		}
+	}
+
+	RingUp = 1;
+	return 0;
+} /* end uring_input_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	int uring_stat_batch(int dir_fd, char *names[], int count,
+				struct stat *p_stats, int *p_errs)
+
+FUNCTION DESCRIPTION
+	Stat count entries (at most URING_STAT_BATCH) of the open directory
+	dir_fd with one submission and wait for all of the results.  Like
+	stat_entry, attributes already cached are used (AT_STATX_DONT_SYNC).
+	Only st_mode, st_size, st_mtime (and its nsecs), st_dev and st_ino are
+	filled in.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				dir_fd			I	directory
+	char *[]		names			I	entry names to stat
+	int				count			I	number of entries
+	struct stat *	p_stats			O	stat results
+	int *			p_errs			O	0 or errno for each path
+
+RETURNS
+	 0	Normal return
+	-1	Error (ring failed, nothing was stat'ed)
+*******************************************************************************/
+int uring_stat_batch(int dir_fd, char *names[], int count,
+				struct stat *p_stats, int *p_errs)
+{
+	struct io_uring_sqe *p_sqe;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!(p_sqe = uring_get_sqe(&Ring))
+				&& (uring_submit(&Ring, 0) < 0
+					|| !(p_sqe = uring_get_sqe(&Ring)))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL queue statx, %s\n",
+					LOG_PREFIX, strerror(errno));
+			break;
+		}
+		p_sqe->opcode = IORING_OP_STATX;
+		p_sqe->fd = dir_fd;
+		p_sqe->addr = (unsigned long)names[i];
+		p_sqe->len = STATX_TYPE|STATX_MODE|STATX_SIZE|STATX_MTIME|STATX_INO;
+		p_sqe->statx_flags = AT_STATX_DONT_SYNC;
+		p_sqe->off = (unsigned long)&StatxBuf[i];
+		p_sqe->user_data = URING_OP_STATX | i;
+		StatxPending++;
+	}
+
+	/* wait for every statx queued, even if we could not queue them all */
+	while (StatxPending > 0) {
+		if (uring_submit(&Ring, -1) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL io_uring_enter, %s\n",
+					LOG_PREFIX, strerror(errno));
+			return -1;
+		}
+		uring_reap();
+	}
+
+	if (i < count) {
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		memset(&p_stats[i], 0, sizeof(struct stat));
+		if ((p_errs[i] = StatxRes[i] < 0 ? -StatxRes[i] : 0) == 0) {
+			p_stats[i].st_mode = StatxBuf[i].stx_mode;
+			p_stats[i].st_size = StatxBuf[i].stx_size;
+			p_stats[i].st_mtime = StatxBuf[i].stx_mtime.tv_sec;
+			p_stats[i].st_mtim.tv_nsec = StatxBuf[i].stx_mtime.tv_nsec;
+			p_stats[i].st_dev = makedev(StatxBuf[i].stx_dev_major,
+					StatxBuf[i].stx_dev_minor);
+			p_stats[i].st_ino = StatxBuf[i].stx_ino;
+		}
+	}
+
+	return 0;
+} /* end uring_stat_batch */
+
+/*******************************************************************************
+FUNCTION NAME
+	void uring_prefetch(prod_info_t *p_items, int count)
+
+FUNCTION DESCRIPTION
+	Start opening and reading the first block of the products about to be
+	sent, p_items[0] (next) through p_items[count-1], and drop read-ahead
+	of files that are no longer in that list.  Does not wait.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_info_t *	p_items			I	next products in the queue
+	int				count			I	number of products
+
+RETURNS
+	void
+*******************************************************************************/
+void uring_prefetch(prod_info_t *p_items, int count)
+{
+	struct io_uring_sqe *p_sqe;
+	int i_slot;
+	int i;
+
+	if (!RingUp) {
+		return;
+	}
+
+	count = MIN(count, URING_PREFETCH);
+
+	/* drop read-ahead nobody is going to take */
+	for (i_slot = 0; i_slot < URING_PREFETCH; i_slot++) {
+		if (Slots[i_slot].state == SLOT_FREE) {
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			if (!strcmp(Slots[i_slot].filename, p_items[i].filename)) {
+				break;
+			}
+		}
+		if (i == count) {
+			if (Slots[i_slot].state == SLOT_DONE) {
+				uring_slot_free(&Slots[i_slot]);
+			} else {
+				Slots[i_slot].orphan = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		for (i_slot = 0; i_slot < URING_PREFETCH; i_slot++) {
+			if (Slots[i_slot].state != SLOT_FREE && !Slots[i_slot].orphan
+					&& !strcmp(Slots[i_slot].filename, p_items[i].filename)) {
+				break;
+			}
+		}
+		if (i_slot < URING_PREFETCH) {
+			/* already reading it */
+			continue;
+		}
+		for (i_slot = 0; i_slot < URING_PREFETCH; i_slot++) {
+			if (Slots[i_slot].state == SLOT_FREE) {
+				break;
+			}
+		}
+		if (i_slot == URING_PREFETCH || !(p_sqe = uring_get_sqe(&Ring))) {
+			break;
+		}
+
+		strcpy(Slots[i_slot].filename, p_items[i].filename);
+		Slots[i_slot].state = SLOT_BUSY;
+		Slots[i_slot].orphan = 0;
+		Slots[i_slot].fd = -1;
+		Slots[i_slot].nread = 0;
+
+		p_sqe->opcode = IORING_OP_OPENAT;
+		p_sqe->fd = AT_FDCWD;
+		p_sqe->addr = (unsigned long)Slots[i_slot].filename;
+		p_sqe->open_flags = O_RDONLY|O_CLOEXEC;
+		p_sqe->user_data = URING_OP_OPEN | i_slot;
+	}
+
+	if (uring_submit(&Ring, 0) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL io_uring_enter, %s\n",
+				LOG_PREFIX, strerror(errno));
+	}
+	uring_reap();
+} /* end uring_prefetch */
+
+/*******************************************************************************
+FUNCTION NAME
+	int uring_take_file(char *filename, char *buf, size_t bufsiz,
+				int *p_nread)
+
+FUNCTION DESCRIPTION
+	If filename has been read ahead, wait for it to finish and hand it
+	over: the first block is copied to buf and the open file (positioned
+	after the block) is returned.  Otherwise, or if the read-ahead failed,
+	-1 is returned and the caller opens and reads the file itself (and
+	reports any error).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			filename		I	file send_prod is about to send
+	char *			buf				O	first block of the file
+	size_t			bufsiz			I	size of buf
+	int *			p_nread			O	bytes in buf
+
+RETURNS
+	open file descriptor
+	-1	Not read ahead
+*******************************************************************************/
+int uring_take_file(char *filename, char *buf, size_t bufsiz, int *p_nread)
+{
+	slot_t *p_slot;
+	int fd;
+	int i;
+
+	if (!RingUp) {
+		return -1;
+	}
+
+	for (p_slot = NULL, i = 0; i < URING_PREFETCH; i++) {
+		if (Slots[i].state != SLOT_FREE && !Slots[i].orphan
+				&& !strcmp(Slots[i].filename, filename)) {
+			p_slot = &Slots[i];
+			break;
+		}
+	}
+	if (!p_slot) {
+		return -1;
+	}
+
+	while (p_slot->state == SLOT_BUSY) {
+		if (uring_submit(&Ring, -1) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL io_uring_enter, %s\n",
+					LOG_PREFIX, strerror(errno));
+			p_slot->orphan = 1;
+			return -1;
+		}
+		uring_reap();
+	}
+
+	if (p_slot->fd < 0 || p_slot->nread <= 0 || p_slot->nread > bufsiz
+			|| lseek(p_slot->fd, p_slot->nread, SEEK_SET) < 0) {
+		/* let the caller do it the normal way */
+		uring_slot_free(p_slot);
+		return -1;
+	}
+
+	memcpy(buf, p_slot->buf, p_slot->nread);
+	*p_nread = p_slot->nread;
+	fd = p_slot->fd;
+	p_slot->fd = -1;
+	uring_slot_free(p_slot);
+
+	return fd;
+} /* end uring_take_file */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void uring_reap(void)
+
+FUNCTION DESCRIPTION
+	Handle all waiting completions: record statx results, start the read
+	of a file once it is open, and mark read-ahead done (or free it if it
+	is no longer wanted).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	void
+*******************************************************************************/
+static void uring_reap(void)
+{
+	struct io_uring_cqe *p_cqe;
+	struct io_uring_sqe *p_sqe;
+	unsigned long long user_data;
+	slot_t *p_slot;
+	int res;
+
+	while ((p_cqe = uring_peek_cqe(&Ring))) {
+		user_data = p_cqe->user_data;
+		res = p_cqe->res;
+		uring_cqe_seen(&Ring);
+
+		if ((user_data & URING_OP_MASK) == URING_OP_STATX) {
+			StatxRes[user_data & URING_INDEX_MASK] = res;
+			StatxPending--;
+			continue;
+		}
+
+		p_slot = &Slots[user_data & URING_INDEX_MASK];
+		if ((user_data & URING_OP_MASK) == URING_OP_OPEN) {
+			p_slot->fd = res;
+			if (res >= 0 && !p_slot->orphan
+					&& (p_sqe = uring_get_sqe(&Ring))) {
+				p_sqe->opcode = IORING_OP_READ;
+				p_sqe->fd = res;
+				p_sqe->addr = (unsigned long)p_slot->buf;
+				p_sqe->len = p_slot->bufsiz;
+				p_sqe->off = 0;
+				p_sqe->user_data = URING_OP_READ
+						| (user_data & URING_INDEX_MASK);
+				continue;
+			}
+		} else {
+			p_slot->nread = res;
+		}
+
+		p_slot->state = SLOT_DONE;
+		if (p_slot->orphan) {
+			uring_slot_free(p_slot);
+		}
+	}
+} /* end uring_reap */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void uring_slot_free(slot_t *p_slot)
+
+FUNCTION DESCRIPTION
+	Close a finished read-ahead slot's file and make the slot free.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	slot_t *		p_slot			I/O	read-ahead slot
+
+RETURNS
+	void
+*******************************************************************************/
+static void uring_slot_free(slot_t *p_slot)
+{
+	if (p_slot->fd >= 0) {
+		close(p_slot->fd);
+	}
+	p_slot->fd = -1;
+	p_slot->state = SLOT_FREE;
+	p_slot->orphan = 0;
+	p_slot->filename[0] = '\0';
+} /* end uring_slot_free */
+
+#endif /* INCLUDE_IO_URING */
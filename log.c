@@ -33,6 +33,10 @@ static char Sccsid_log_c[] = "@(#)log.c 0.5 09/30/2003 15:42:59";
 #include <stdarg.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
 #include "share.h"
 
 #define LOG_MAX_FILE_SIZE		1024*4096  /* default max log file size */
@@ -58,6 +62,26 @@ static int check_day_change (logfile_t *p_logfile);
 static int archive_log(logfile_t *p_logfile);
 static void new_log(logfile_t *p_logfile);
 static void init_log(logfile_t *p_logfile);
+static int vwrite_log(logfile_t *p_logfile, const char *format, va_list args);
+
+/* The server receive engine logs from several threads.  The lock is
+   recursive because the signal handlers log too. */
+#ifdef __linux__
+static pthread_mutex_t LogLock;
+static pthread_once_t LogLockOnce = PTHREAD_ONCE_INIT;
+static void init_log_lock(void);
+static void new_log_lock(void);
+static void atfork_lock_log(void);
+static void atfork_unlock_log(void);
+#	define LOCK_LOG()		(pthread_once(&LogLockOnce, init_log_lock), \
+							pthread_mutex_lock(&LogLock))
+#	define UNLOCK_LOG()		pthread_mutex_unlock(&LogLock)
+#	define LOG_THREAD		__thread
+#else
+#	define LOCK_LOG()
+#	define UNLOCK_LOG()
+#	define LOG_THREAD
+#endif
 
 /*******************************************************************************
 
@@ -81,6 +105,42 @@ ERRORS REPORTED
 *******************************************************************************/
 
 int write_log(logfile_t *p_logfile, const char *format, ...)
+{
+	int rc;
+	va_list			ap;
+
+	LOCK_LOG();
+	va_start(ap, format);
+	rc = vwrite_log(p_logfile, format, ap);
+	va_end(ap);
+	UNLOCK_LOG();
+
+	return rc;
+}
+
+/*******************************************************************************
+
+FUNCTION NAME
+	vwrite_log(logfile_t *p_logfile, const char *format, va_list args)
+
+FUNCTION DESCRIPTION
+	Write log buffer to log file (write_log with the log lock held)
+
+PARAMETERS
+	Type		Name		I/O		Description
+	logfile_t *	p_logfile	I		Log file structure
+	const char *format		I		printf-style format string
+	va_list		args		I		format arguments
+
+RETURNS
+	 0: successful log write
+	-1: otherwise
+
+ERRORS REPORTED
+
+*******************************************************************************/
+
+static int vwrite_log(logfile_t *p_logfile, const char *format, va_list args)
 {
 	static int init;
 	va_list			ap;
@@ -109,7 +169,7 @@ int write_log(logfile_t *p_logfile, const char *format, ...)
 		}
 	}
 
-	va_start(ap, format);
+	va_copy(ap, args);
 	if (vfprintf(p_logfile->p_stream, format, ap) < 0) {
 		va_end(ap);
 		CS_LOG_ERR(ERROR_FP,
@@ -121,7 +181,7 @@ int write_log(logfile_t *p_logfile, const char *format, ...)
 	va_end(ap);
 
 	if (p_logfile->flags & LOG_STDERR_FLAG) {
-		va_start(ap, format);
+		va_copy(ap, args);
 		if (vfprintf(stderr, format, ap) < 0) {
 			va_end(ap);
 			CS_LOG_ERR(ERROR_FP,
@@ -133,7 +193,7 @@ int write_log(logfile_t *p_logfile, const char *format, ...)
 	}        
 
 	if (p_logfile->flags & LOG_STDOUT_FLAG) {
-		va_start(ap, format);
+		va_copy(ap, args);
 		if (vfprintf(stdout, format, ap) < 0) {
 			va_end(ap);
 			CS_LOG_ERR(ERROR_FP,
@@ -280,21 +340,26 @@ ERRORS REPORTED
 
 int flush_log(logfile_t *p_logfile)
 {
+	int rc;
 
-	if (!p_logfile->p_stream) {
-		return -1;
-	}
+	LOCK_LOG();
 
-	if (fflush(p_logfile->p_stream) < 0) {
+	if (!p_logfile->p_stream) {
+		rc = -1;
+	} else if (fflush(p_logfile->p_stream) < 0) {
 		CS_LOG_ERR(ERROR_FP,
 				"%s: Failed fflush on stream to log file %s, %s\n",
 				LOG_PREFIX, p_logfile->path, strerror(errno));
-		return -1;
+		rc = -1;
 	} else {
 		p_logfile->last_flush_time = time(NULL);
 		p_logfile->writes_since_last_flush = 0;
-		return 0;
+		rc = 0;
 	}
+
+	UNLOCK_LOG();
+
+	return rc;
 }
 
 /*******************************************************************************
@@ -320,6 +385,9 @@ ERRORS REPORTED
 int rename_log(logfile_t *p_logfile, char *newname)
 {
 	char *p_env;
+	int rc;
+
+	LOCK_LOG();
 
 	/* make sure logfile dir has been set */
 	if (p_logfile->dir[0] == '\0') {
@@ -339,14 +407,17 @@ int rename_log(logfile_t *p_logfile, char *newname)
 		close_log(&p_logfile->p_stream);
 	}
 
+	rc = 0;
 	if (open_log(p_logfile->path, &p_logfile->p_stream) < 0) {
 		CS_LOG_ERR(ERROR_FP,
 				"%s: Failed open log file %s, %s\n",
 				LOG_PREFIX, p_logfile->path, strerror(errno));
-		return -1;
+		rc = -1;
 	}
 
-	return 0;
+	UNLOCK_LOG();
+
+	return rc;
 }
 
 /*******************************************************************************
@@ -851,8 +922,9 @@ ERRORS REPORTED
 *******************************************************************************/
 char *log_prefix(char *program, char *file, int line)
 {
-	static char prefix_buf[512];
+	static LOG_THREAD char prefix_buf[512];
 	time_t now;
+	struct tm tm_buf;
 	struct tm *p_tm;
 	char *p_buf;
 
@@ -860,7 +932,7 @@ char *log_prefix(char *program, char *file, int line)
 	p_buf = prefix_buf + strlen(prefix_buf);
 
 	time(&now);
-	p_tm = localtime(&now);
+	p_tm = localtime_r(&now, &tm_buf);
 	strftime(p_buf, sizeof(prefix_buf) - (p_buf - prefix_buf), "%m/%d/%Y %T", p_tm);
 	p_buf = p_buf + strlen(p_buf);
 
@@ -869,3 +941,53 @@ char *log_prefix(char *program, char *file, int line)
 	return prefix_buf;
 }
 
+#ifdef __linux__
+/*******************************************************************************
+
+FUNCTION NAME
+	init_log_lock(void)
+
+FUNCTION DESCRIPTION
+	Initialize the recursive log lock (called once via pthread_once).  The
+	lock is held across fork so a child never starts with the lock held
+	by a thread it does not have; the child gets a fresh lock since it
+	can not unlock one owned by the parent's thread.
+
+PARAMETERS
+	Type		Name		I/O		Description
+	void
+
+RETURNS
+	void
+
+ERRORS REPORTED
+
+*******************************************************************************/
+
+static void init_log_lock(void)
+{
+	new_log_lock();
+
+	pthread_atfork(atfork_lock_log, atfork_unlock_log, new_log_lock);
+}
+
+static void new_log_lock(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&LogLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void atfork_lock_log(void)
+{
+	pthread_mutex_lock(&LogLock);
+}
+
+static void atfork_unlock_log(void)
+{
+	pthread_mutex_unlock(&LogLock);
+}
+#endif
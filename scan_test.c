@@ -0,0 +1,645 @@
+/*******************************************************************************
+FILE NAME
+	scan_test.c
+
+FILE DESCRIPTION
+	Benchmark of the two ways client_queue.c reads an input directory:
+	readdir and a stat of every entry by path, as it was, and on Linux
+	getdents64 with entries skipped by d_type, name or inode before a
+	statx AT_STATX_DONT_SYNC relative to the directory.  Built and run by
+	"make bench".
+
+	A temporary directory of count entries is made: 1% subdirectories,
+	1% files taken to be in the ack window, the rest files to send.  Each
+	way reads it for the first time (nothing queued) and again as a rescan
+	(every file already queued), best of SCAN_RUNS reads, and the times
+	and stats done are printed.  Both must find the same files.  To stand
+	in for a network file system, each stat can be made stat_usecs longer.
+
+	usage: scan_test [count [stat_usecs [parent_dir]]]
+
+FUNCTIONS
+	main			- make the directory, time the reads, remove it
+	make_dir		- fill the temporary directory
+	remove_dir		- remove it
+	time_read		- best time of SCAN_RUNS reads one way
+	old_read		- readdir and stat by path
+	new_read		- getdents64, d_type and statx relative to the dir
+	stat_delay		- stand-in for a stat round trip
+	name_add		- add a name to the name table
+	name_find		- look a name up
+	compare_ino		- bsearch/qsort compare of inodes
+	elapsed_ms		- msecs since a time
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_scan_test_c[]= "@(#)scan_test.c 0.1 10/16/2026 12:00:00";
+
+#ifdef __linux__
+#define _GNU_SOURCE		/* statx */
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+
+#define DFLT_COUNT		100000		/* entries in the directory */
+#define SCAN_RUNS		3			/* reads timed, the best is kept */
+#define DENT_BUF_SIZE	(128*1024)	/* as in client_queue.c */
+#define NAME_LEN		32
+
+/* name table flags */
+#define NAME_QUEUED		1			/* file is in the queue */
+#define NAME_WINDOW		2			/* file is in the ack window */
+
+/* kernel struct linux_dirent64, as returned by getdents64 */
+typedef struct {
+	unsigned long long	d_ino;
+	long long			d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char				d_name[1];
+} dent64_t;
+
+/* result of one read */
+typedef struct {
+	long			entries;		/* entries read */
+	long			stats;			/* entries stat'ed */
+	long			files;			/* files found to queue */
+	long long		bytes;			/* their size */
+} scan_res_t;
+
+typedef int (*read_fn_t)(char *dir, scan_res_t *p_res);
+
+static int make_dir(char *dir, long count);
+static void remove_dir(char *dir, long count);
+static double time_read(read_fn_t read_fn, char *dir, scan_res_t *p_res);
+static int old_read(char *dir, scan_res_t *p_res);
+static int new_read(char *dir, scan_res_t *p_res);
+static void stat_delay(void);
+static int name_add(char *name, int flag);
+static int name_find(char *name);
+static int compare_ino(const void *p_v1, const void *p_v2);
+static double elapsed_ms(struct timespec *p_start);
+
+static long StatUsecs;			/* added to each stat */
+static char **Names;			/* name table, linear probing */
+static int *NameFlags;
+static unsigned long NameSize;	/* a power of 2 */
+static ino_t *WindowIno;		/* sorted inodes of the window files */
+static long WindowCnt;
+
+/*******************************************************************************
+FUNCTION NAME
+	int main(int argc, char *argv[])
+
+FUNCTION DESCRIPTION
+	Make the directory, time a first read and a rescan each way, and
+	remove it.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				argc			I	argument count
+	char *			argv[]			I	[count [stat_usecs [parent_dir]]]
+
+RETURNS
+	 0	Both ways found the same files
+	 1	They did not, or the directory could not be made
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+	static const char *what[2] = {"first read", "rescan"};
+	char dir[1024];
+	scan_res_t old_res;
+	scan_res_t new_res;
+	double old_ms;
+	double new_ms;
+	char *parent;
+	long count;
+	int fails;
+	long i;
+	int pass;
+
+	count = argc > 1 ? atol(argv[1]) : DFLT_COUNT;
+	StatUsecs = argc > 2 ? atol(argv[2]) : 0;
+	if (!(parent = argc > 3 ? argv[3] : getenv("TMPDIR"))) {
+		parent = "/tmp";
+	}
+	if (count < 100 || StatUsecs < 0) {
+		fprintf(stderr, "usage: %s [count [stat_usecs [parent_dir]]]\n",
+				argv[0]);
+		return 1;
+	}
+
+	sprintf(dir, "%.900s/scan_test.XXXXXX", parent);
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "scan_test: FAIL mkdtemp %s, %s\n", dir,
+				strerror(errno));
+		return 1;
+	}
+	if (make_dir(dir, count) < 0) {
+		remove_dir(dir, count);
+		return 1;
+	}
+	printf("scan_test: %s, %ld entries, %ld usecs added to each stat\n",
+			dir, count, StatUsecs);
+
+	for (fails = 0, pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			/* queue every file the first read found */
+			for (i = 0; i < (long)NameSize; i++) {
+				if (Names[i] && !NameFlags[i]) {
+					NameFlags[i] = NAME_QUEUED;
+				}
+			}
+		}
+
+		old_ms = time_read(old_read, dir, &old_res);
+		new_ms = time_read(new_read, dir, &new_res);
+		if (old_ms < 0 || new_ms < 0) {
+			fails++;
+			break;
+		}
+
+		printf("scan_test: %-10s  readdir+stat %8.1f ms %7ld stats"
+				"   getdents64+statx %8.1f ms %7ld stats\n",
+				what[pass], old_ms, old_res.stats, new_ms, new_res.stats);
+		if (old_res.entries != new_res.entries
+				|| old_res.files != new_res.files
+				|| old_res.bytes != new_res.bytes) {
+			printf("scan_test: %s found %ld of %ld entries (%lld bytes),"
+					" was %ld of %ld (%lld bytes)\n", what[pass],
+					new_res.files, new_res.entries, new_res.bytes,
+					old_res.files, old_res.entries, old_res.bytes);
+			fails++;
+		}
+	}
+
+	remove_dir(dir, count);
+
+	return fails ? 1 : 0;
+} /* end main */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int make_dir(char *dir, long count)
+
+FUNCTION DESCRIPTION
+	Fill dir with count entries: every 100th a subdirectory, every 100th
+	(offset by 50) a file in the ack window, the rest files of a few
+	bytes.  The file names go in the name table, those of the window
+	files with NAME_WINDOW and their inodes in WindowIno.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			dir				I	empty directory
+	long			count			I	entries to make
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int make_dir(char *dir, long count)
+{
+	struct stat stat_struct;
+	char pathbuf[1024+NAME_LEN];
+	char name[NAME_LEN];
+	int fd;
+	long i;
+
+	for (NameSize = 1024; NameSize < 2*(unsigned long)count; NameSize *= 2);
+	if (!(Names = calloc(NameSize, sizeof(char *)))
+			|| !(NameFlags = calloc(NameSize, sizeof(int)))
+			|| !(WindowIno = calloc(count/100 + 1, sizeof(ino_t)))) {
+		fprintf(stderr, "scan_test: FAIL calloc name table, %s\n",
+				strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		sprintf(name, "SAUS%.2ld_KWBC_%.8ld", i % 100, i);
+		sprintf(pathbuf, "%s/%s", dir, name);
+		if (i % 100 == 0) {
+			if (mkdir(pathbuf, 0755) < 0) {
+				fprintf(stderr, "scan_test: FAIL mkdir %s, %s\n", pathbuf,
+						strerror(errno));
+				return -1;
+			}
+			continue;
+		}
+
+		if ((fd = open(pathbuf, O_WRONLY|O_CREAT|O_EXCL, 0644)) < 0
+				|| write(fd, name, 1 + i % 16) < 0 || close(fd) < 0) {
+			fprintf(stderr, "scan_test: FAIL create %s, %s\n", pathbuf,
+					strerror(errno));
+			return -1;
+		}
+
+		if (i % 100 == 50) {
+			if (stat(pathbuf, &stat_struct) < 0
+					|| name_add(name, NAME_WINDOW) < 0) {
+				return -1;
+			}
+			WindowIno[WindowCnt++] = stat_struct.st_ino;
+		} else if (name_add(name, 0) < 0) {
+			return -1;
+		}
+	}
+	qsort(WindowIno, WindowCnt, sizeof(ino_t), compare_ino);
+
+	return 0;
+} /* end make_dir */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void remove_dir(char *dir, long count)
+
+FUNCTION DESCRIPTION
+	Remove what make_dir made, and dir.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			dir				I	directory
+	long			count			I	entries made
+
+RETURNS
+	void
+*******************************************************************************/
+static void remove_dir(char *dir, long count)
+{
+	char pathbuf[1024+NAME_LEN];
+	long i;
+
+	for (i = 0; i < count; i++) {
+		sprintf(pathbuf, "%s/SAUS%.2ld_KWBC_%.8ld", dir, i % 100, i);
+		if ((i % 100 == 0 ? rmdir(pathbuf) : unlink(pathbuf)) < 0
+				&& errno == ENOENT) {
+			break;
+		}
+	}
+	if (rmdir(dir) < 0) {
+		fprintf(stderr, "scan_test: FAIL remove %s, %s\n", dir,
+				strerror(errno));
+	}
+} /* end remove_dir */
+
+/*******************************************************************************
+FUNCTION NAME
+	static double time_read(read_fn_t read_fn, char *dir, scan_res_t *p_res)
+
+FUNCTION DESCRIPTION
+	Read dir SCAN_RUNS times with read_fn and get the best time.  The
+	first run also brings the directory into the cache for the others.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	read_fn_t		read_fn			I	old_read or new_read
+	char *			dir				I	directory
+	scan_res_t *	p_res			O	result of the last read
+
+RETURNS
+	msecs of the fastest read, -1 on error
+*******************************************************************************/
+static double time_read(read_fn_t read_fn, char *dir, scan_res_t *p_res)
+{
+	struct timespec start;
+	double best;
+	double ms;
+	int run;
+
+	for (best = -1, run = 0; run < SCAN_RUNS; run++) {
+		memset(p_res, 0, sizeof(scan_res_t));
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (read_fn(dir, p_res) < 0) {
+			return -1;
+		}
+		ms = elapsed_ms(&start);
+		if (best < 0 || ms < best) {
+			best = ms;
+		}
+	}
+
+	return best;
+} /* end time_read */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int old_read(char *dir, scan_res_t *p_res)
+
+FUNCTION DESCRIPTION
+	Read dir the way scan_dir did before getdents64: readdir, skip .dot
+	files and queued names, stat the rest by path, then skip what is not
+	a file or is in the ack window.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			dir				I	directory
+	scan_res_t *	p_res			O	counts
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int old_read(char *dir, scan_res_t *p_res)
+{
+	struct stat stat_struct;
+	struct dirent *p_dirent;
+	char pathbuf[1024+NAME_LEN];
+	DIR *p_dir;
+
+	if (!(p_dir = opendir(dir))) {
+		fprintf(stderr, "scan_test: FAIL open directory %s, %s\n", dir,
+				strerror(errno));
+		return -1;
+	}
+
+	while ((p_dirent = readdir(p_dir))) {
+		if (!strncmp(p_dirent->d_name, ".", 1)) {
+			continue;
+		}
+		p_res->entries++;
+		sprintf (pathbuf, "%s/%s", dir, p_dirent->d_name);
+		if (name_find(p_dirent->d_name) == NAME_QUEUED) {
+			continue;
+		}
+
+		p_res->stats++;
+		stat_delay();
+		if (stat(pathbuf, &stat_struct) < 0) {
+			fprintf(stderr, "scan_test: FAIL stat %s, %s\n", pathbuf,
+					strerror(errno));
+			continue;
+		}
+		if (!S_ISREG(stat_struct.st_mode)
+				|| name_find(p_dirent->d_name) == NAME_WINDOW) {
+			continue;
+		}
+		p_res->files++;
+		p_res->bytes += stat_struct.st_size;
+	}
+
+	closedir(p_dir);
+	return 0;
+} /* end old_read */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int new_read(char *dir, scan_res_t *p_res)
+
+FUNCTION DESCRIPTION
+	Read dir the way dir_read and stat_entry in client_queue.c do:
+	getdents64 DENT_BUF_SIZE bytes at a time, skip .dot files, entries
+	d_type shows are not files, queued names and window inodes, and statx
+	the rest relative to the directory with AT_STATX_DONT_SYNC.  The
+	directory is opened each time, as client_queue.c does the first time.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			dir				I	directory
+	scan_res_t *	p_res			O	counts
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int new_read(char *dir, scan_res_t *p_res)
+{
+	static char *dent_buf;
+	struct stat stat_struct;
+	dent64_t *p_dent;
+	ino_t ino;
+	long pos;
+	long len;
+	int fd;
+#	ifdef STATX_TYPE
+	struct statx statx_struct;
+#	endif
+
+	if (!dent_buf && !(dent_buf = malloc(DENT_BUF_SIZE))) {
+		fprintf(stderr, "scan_test: FAIL malloc %d bytes, %s\n",
+				DENT_BUF_SIZE, strerror(errno));
+		return -1;
+	}
+	if ((fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+		fprintf(stderr, "scan_test: FAIL open directory %s, %s\n", dir,
+				strerror(errno));
+		return -1;
+	}
+
+	while ((len = syscall(SYS_getdents64, fd, dent_buf, DENT_BUF_SIZE)) > 0) {
+		for (pos = 0; pos < len; pos += p_dent->d_reclen) {
+			p_dent = (dent64_t *)&dent_buf[pos];
+			if (!strncmp(p_dent->d_name, ".", 1)) {
+				continue;
+			}
+			p_res->entries++;
+			ino = p_dent->d_ino;
+			if ((p_dent->d_type != DT_UNKNOWN && p_dent->d_type != DT_REG
+						&& p_dent->d_type != DT_LNK)
+					|| name_find(p_dent->d_name) == NAME_QUEUED
+					|| bsearch(&ino, WindowIno, WindowCnt, sizeof(ino_t),
+						compare_ino)) {
+				continue;
+			}
+
+			p_res->stats++;
+			stat_delay();
+#	ifdef STATX_TYPE
+			if (statx(fd, p_dent->d_name, AT_STATX_DONT_SYNC,
+					STATX_TYPE|STATX_MODE|STATX_SIZE|STATX_MTIME|STATX_INO,
+					&statx_struct) == 0) {
+				stat_struct.st_mode = statx_struct.stx_mode;
+				stat_struct.st_size = statx_struct.stx_size;
+			} else
+#	endif
+			if (fstatat(fd, p_dent->d_name, &stat_struct, 0) < 0) {
+				fprintf(stderr, "scan_test: FAIL stat %s/%s, %s\n", dir,
+						p_dent->d_name, strerror(errno));
+				continue;
+			}
+			if (!S_ISREG(stat_struct.st_mode)) {
+				continue;
+			}
+			p_res->files++;
+			p_res->bytes += stat_struct.st_size;
+		}
+	}
+	if (len < 0) {
+		fprintf(stderr, "scan_test: FAIL getdents64 %s, %s\n", dir,
+				strerror(errno));
+	}
+
+	close(fd);
+	return len < 0 ? -1 : 0;
+} /* end new_read */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void stat_delay(void)
+
+FUNCTION DESCRIPTION
+	Wait StatUsecs, a stand-in for the round trip a stat of a file on a
+	network file system takes.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	void
+*******************************************************************************/
+static void stat_delay(void)
+{
+	struct timespec delay;
+
+	if (StatUsecs > 0) {
+		delay.tv_sec = StatUsecs / 1000000;
+		delay.tv_nsec = StatUsecs % 1000000 * 1000;
+		nanosleep(&delay, NULL);
+	}
+} /* end stat_delay */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int name_add(char *name, int flag)
+
+FUNCTION DESCRIPTION
+	Add a name to the name table, a stand-in for the queue's filename
+	index.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			name			I	file name
+	int				flag			I	0, NAME_QUEUED or NAME_WINDOW
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int name_add(char *name, int flag)
+{
+	unsigned long h;
+	char *p_c;
+
+	for (h = 5381, p_c = name; *p_c; p_c++) {
+		h = h * 33 + (unsigned char)*p_c;
+	}
+	for (h &= NameSize-1; Names[h]; h = (h+1) & (NameSize-1));
+
+	if (!(Names[h] = strdup(name))) {
+		fprintf(stderr, "scan_test: FAIL strdup, %s\n", strerror(errno));
+		return -1;
+	}
+	NameFlags[h] = flag;
+
+	return 0;
+} /* end name_add */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int name_find(char *name)
+
+FUNCTION DESCRIPTION
+	Look a name up in the name table.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			name			I	file name
+
+RETURNS
+	its flag, or -1 if it is not in the table
+*******************************************************************************/
+static int name_find(char *name)
+{
+	unsigned long h;
+	char *p_c;
+
+	for (h = 5381, p_c = name; *p_c; p_c++) {
+		h = h * 33 + (unsigned char)*p_c;
+	}
+	for (h &= NameSize-1; Names[h]; h = (h+1) & (NameSize-1)) {
+		if (!strcmp(Names[h], name)) {
+			return NameFlags[h];
+		}
+	}
+
+	return -1;
+} /* end name_find */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int compare_ino(const void *p_v1, const void *p_v2)
+
+FUNCTION DESCRIPTION
+	Compare two inodes for qsort and bsearch.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	const void *	p_v1			I	first inode
+	const void *	p_v2			I	second inode
+
+RETURNS
+	<0, 0 or >0 as the first is below, equal to or above the second
+*******************************************************************************/
+static int compare_ino(const void *p_v1, const void *p_v2)
+{
+	ino_t ino1 = *(const ino_t *)p_v1;
+	ino_t ino2 = *(const ino_t *)p_v2;
+
+	return ino1 < ino2 ? -1 : ino1 > ino2;
+} /* end compare_ino */
+
+/*******************************************************************************
+FUNCTION NAME
+	static double elapsed_ms(struct timespec *p_start)
+
+FUNCTION DESCRIPTION
+	Get the msecs since p_start on the monotonic clock.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	struct timespec *p_start		I	start time
+
+RETURNS
+	msecs
+*******************************************************************************/
+static double elapsed_ms(struct timespec *p_start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - p_start->tv_sec) * 1e3
+			+ (now.tv_nsec - p_start->tv_nsec) / 1e6;
+} /* end elapsed_ms */
+
+#else
+
+int main(int argc, char *argv[])
+{
+	printf("scan_test: getdents64 input reading is Linux only\n");
+	return 0;
+} /* end main */
+
+#endif
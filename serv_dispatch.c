@@ -9,6 +9,10 @@ FUNCTIONS
 	dispatcher			- listen for connections and dispatch workers
 	new_listen_socket	- create a listen socket
 	fork_service		- fork a worker
+	pool_dispatcher		- keep a pool of pre-forked workers
+	fork_pool_worker	- fork a pre-forked worker
+	pool_worker			- accept and serve connections in a pre-forked worker
+	pool_count			- count pre-forked workers in a given state
 	verify_workers		- check worker table pids
 	kill_workers		- kill all workers
 	wait_for_worker		- get worker exit status
@@ -35,6 +39,9 @@ static char Sccsid_serv_dispatch_c[]= "@(#)serv_dispatch.c 0.4 04/12/2005 14:05:
 
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -49,14 +56,30 @@ static char Sccsid_serv_dispatch_c[]= "@(#)serv_dispatch.c 0.4 04/12/2005 14:05:
 #define RECOVER_SLEEP		3
 #define MAX_WORKER_SLEEP	30
 
-static int new_listen_socket(unsigned int port);
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+
+/* pre-forked worker states (PoolState) */
+#define POOL_FREE			'\0'	/* no worker in slot */
+#define POOL_IDLE			'I'		/* waiting in accept */
+#define POOL_BUSY			'B'		/* serving a connection */
+
 static int fork_service(int listen_sd, int accept_sd);
+static int pool_dispatcher(int *p_listen_sd);
+static int fork_pool_worker(int listen_sd);
+static void pool_worker(int listen_sd);
+static int pool_count(char state);
 static void verify_workers(void);
 
 /* static variables to manage workers */
 static pid_t	*WorkerPids;
 static int		WorkerCount;
 
+/* pre-forked worker pool, PoolState is shared with the workers */
+static volatile char	*PoolState;
+static int		PoolPipe[2] = {-1, -1};	/* workers wake the dispatcher */
+
 /*******************************************************************************
 FUNCTION NAME
 	int dispatcher(void) 
@@ -73,6 +96,7 @@ GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
 	unsigned int	listen_port		I	port number for listen/connect
 	int				max_worker		I	maximum number of concurrent workers
+	int				prefork			I	idle pre-forked workers to keep
 	char			verbosity		I	debugging verbosity level
 	int				Flags			I	Control Flags
 
@@ -86,7 +110,17 @@ int dispatcher(void)
 	int accept_sd = -1;
 	struct sockaddr_in accept_addr;		/* accepted remote socket address */
 	unsigned int addrlen = sizeof(struct sockaddr_in);
-	struct hostent	*p_hostent;
+	int rc;
+
+	/* host names are looked up off the accept path */
+	resolv_init();
+
+	if (ServOpt.engine_threads > 0) {
+		/* event-driven engine serves all connections in this process */
+		rc = recv_engine();
+		resolv_close();
+		return rc;
+	}
 
 	WorkerCount = 0;
 	if (ServOpt.max_worker > 0) {
@@ -99,9 +133,20 @@ int dispatcher(void)
 		}
 	}
 
+	if (ServOpt.prefork > 0) {
+		/* pre-forked workers accept their own connections */
+		if (pool_dispatcher(&listen_sd) < 0) {
+			free(WorkerPids);
+			WorkerPids = NULL;
+			resolv_close();
+			return -1;
+		}
+	}
+
 	while (!(Flags & SHUTDOWN_FLAG)) {
 		if (listen_sd < 0) {
-			if ((listen_sd = new_listen_socket(ServOpt.listen_port)) < 0) {
+			if ((listen_sd = new_listen_socket(ServOpt.listen_port, 0)) < 0) {
+				resolv_close();
 				return -1;
 			}
 			if (ServOpt.verbosity > 0) {
@@ -143,13 +188,7 @@ int dispatcher(void)
 			continue;
 		}
 
-		if ((p_hostent = gethostbyaddr(&accept_addr.sin_addr,
-									sizeof(accept_addr.sin_addr), AF_INET))
-				&& p_hostent->h_name) {
-			RemoteHost = strdup(p_hostent->h_name);
-		} else {
-			RemoteHost = strdup("unknown");
-		}
+		RemoteHost = remote_host_name(&accept_addr);
 
 		if (ServOpt.verbosity > 0) {
 			CS_LOG_DBUG(DEBUG_FP,
@@ -183,7 +222,8 @@ int dispatcher(void)
 	}
 
 	if (listen_sd >= 0) {
-		if (shutdown(listen_sd, SHUT_RDWR) < 0) {
+		/* pre-forked workers share the listen socket, just close it */
+		if (!PoolState && shutdown(listen_sd, SHUT_RDWR) < 0) {
 			CS_LOG_ERR(ERROR_FP, "%s: FAIL shutdown listen socket %d, %s\n",
 					LOG_PREFIX, listen_sd, strerror(errno));
 		}
@@ -196,30 +236,43 @@ int dispatcher(void)
 	kill_workers();
 
 	free(WorkerPids);
+	WorkerPids = NULL;
+
+	if (PoolState) {
+		munmap((void *)PoolState, ServOpt.max_worker);
+		PoolState = NULL;
+		close(PoolPipe[0]);
+		close(PoolPipe[1]);
+	}
+
+	resolv_close();
 
 	return 0;
 } /* end dispatcher */
 
 /*******************************************************************************
 FUNCTION NAME
-	int new_listen_socket(unsigned int port) 
+	int new_listen_socket(unsigned int port, int reuseport) 
 
 FUNCTION DESCRIPTION
-	Create a listen socket.
+	Create a listen socket.  If reuseport is set, the socket is created with
+	SO_REUSEPORT so that several sockets (one per engine thread) can listen
+	on the same port and have the kernel spread connections among them.
 
 PARAMETERS
 	Type			Name			I/O	Description
 	unsigned int	port			I	port to listen on
+	int				reuseport		I	set SO_REUSEPORT
 
 GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
-	none
+	int				listen_backlog	I	listen queue length
 
 RETURNS
 	listen socket file descriptor
 	-1	Error
 *******************************************************************************/
-static int new_listen_socket(unsigned int port)
+int new_listen_socket(unsigned int port, int reuseport)
 {
 	const char fname[]="new_listen_socket";
 	int	 option = 1;		/* setsockopt() option */
@@ -240,17 +293,36 @@ static int new_listen_socket(unsigned int port)
 	if (setsockopt(lsd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(int))) {
 		CS_LOG_ERR(ERROR_FP, "%s: setsockopt failed, %s\n", fname,
 							strerror(errno));
+		close(lsd);
+		return -1;
+	}
+
+#ifdef SO_REUSEPORT
+	if (reuseport && setsockopt(lsd, SOL_SOCKET, SO_REUSEPORT,
+									&option, sizeof(int))) {
+		CS_LOG_ERR(ERROR_FP, "%s: setsockopt SO_REUSEPORT failed, %s\n",
+							fname, strerror(errno));
+		close(lsd);
 		return -1;
 	}
+#else
+	if (reuseport) {
+		errno = ENOPROTOOPT;
+		close(lsd);
+		return -1;
+	}
+#endif
 
 	if (bind(lsd, (struct sockaddr *)&local, sizeof(local)) < 0) {
 		CS_LOG_ERR(ERROR_FP, "%s: bind failed, %s\n", fname, strerror(errno));
+		close(lsd);
 		return -1;
 	}
 
-	/* listen for up to 10 simutaneous connections */
-	if (listen(lsd, 10) < 0) {
+	/* queue up to listen_backlog connections waiting for accept */
+	if (listen(lsd, ServOpt.listen_backlog) < 0) {
 		CS_LOG_ERR(ERROR_FP, "%s: listen failed, %s\n", fname, strerror(errno));
+		close(lsd);
 		return -1;
 	}
 
@@ -344,6 +416,300 @@ static int fork_service(int listen_sd, int accept_sd)
 	}
 } /* end fork_service */
 
+/*******************************************************************************
+FUNCTION NAME
+	static int pool_dispatcher(int *p_listen_sd) 
+
+FUNCTION DESCRIPTION
+	Dispatcher loop for the pre-forked worker pool.  Instead of accepting
+	connections and forking a worker for each one, keep ServOpt.prefork
+	idle workers blocked in accept() on the listen socket.  A worker that
+	accepts a connection wakes the dispatcher through PoolPipe so it can
+	fork a replacement right away.  Workers that exit are reaped by
+	wait_for_worker and replaced here, up to max_worker workers in all.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int *			p_listen_sd		O	listen socket (closed by caller)
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	unsigned int	listen_port		I	port number for listen/connect
+	int				max_worker		I	maximum number of concurrent workers
+	int				prefork			I	idle pre-forked workers to keep
+	char			verbosity		I	debugging verbosity level
+	int				Flags			I	Control Flags
+
+RETURNS
+	 0	Normal exit (shutdown)
+	-1	Error
+*******************************************************************************/
+static int pool_dispatcher(int *p_listen_sd)
+{
+	char drainbuf[64];
+	struct timeval tv;
+	fd_set readfds;
+	int idle;
+
+	if ((*p_listen_sd = new_listen_socket(ServOpt.listen_port, 0)) < 0) {
+		return -1;
+	}
+
+	PoolState = mmap(NULL, ServOpt.max_worker, PROT_READ|PROT_WRITE,
+							MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (PoolState == (char *)MAP_FAILED) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL mmap %d bytes for pool, %s\n",
+				LOG_PREFIX, ServOpt.max_worker, strerror(errno));
+		PoolState = NULL;
+		return -1;
+	}
+	memset((void *)PoolState, POOL_FREE, ServOpt.max_worker);
+
+	if (pipe(PoolPipe) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL pipe, %s\n", LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+	fcntl(PoolPipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(PoolPipe[1], F_SETFL, O_NONBLOCK);
+
+	if (ServOpt.verbosity > 0) {
+		CS_LOG_DBUG(DEBUG_FP,
+				"%s: pre-forking %d workers on port %d fd %d\n",
+				LOG_PREFIX, ServOpt.prefork, ServOpt.listen_port,
+				*p_listen_sd);
+	}
+
+	while (!(Flags & SHUTDOWN_FLAG)) {
+
+		/* replenish the pool */
+		idle = pool_count(POOL_IDLE);
+		while (idle < ServOpt.prefork && WorkerCount < ServOpt.max_worker
+				&& !(Flags & SHUTDOWN_FLAG)) {
+			if (fork_pool_worker(*p_listen_sd) < 0) {
+				verify_workers();
+				break;
+			}
+			idle++;
+		}
+
+		if (idle < ServOpt.prefork && WorkerCount >= ServOpt.max_worker) {
+			verify_workers();
+		}
+
+		/* wait for a worker to go busy or exit (SIGCHLD) */
+		FD_ZERO(&readfds);
+		FD_SET(PoolPipe[0], &readfds);
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (select(PoolPipe[0]+1, &readfds, NULL, NULL, &tv) > 0) {
+			while (read(PoolPipe[0], drainbuf, sizeof(drainbuf)) > 0) {
+				/* drain */
+			}
+		}
+	}
+
+	return 0;
+} /* end pool_dispatcher */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int fork_pool_worker(int listen_sd) 
+
+FUNCTION DESCRIPTION
+	Fork a pre-forked worker into a free worker slot.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				listen_sd		I	listen socket file descriptor
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				max_worker		I	maximum number of concurrent workers
+
+RETURNS
+	 0	Normal exit
+	-1	Error
+*******************************************************************************/
+static int fork_pool_worker(int listen_sd)
+{
+	int i_wrkr;
+	char pidfile[256];
+
+	/* find an available worker slot */
+	for (i_wrkr = 0; i_wrkr < ServOpt.max_worker; i_wrkr++) {
+		if (WorkerPids[i_wrkr] <= 0) {
+			break;
+		}
+	}	
+
+	if (i_wrkr >= ServOpt.max_worker) {
+		return -1;
+	}
+
+	/* count the worker idle before it runs so we don't fork too many */
+	PoolState[i_wrkr] = POOL_IDLE;
+
+	switch (WorkerPids[i_wrkr] = fork()) {
+		case 0:		/* worker (child), successful fork */
+			WorkerIndex = i_wrkr;
+			/* Set worker's Program name to worker_# */
+			sprintf (Program+strlen(Program), "_%d", WorkerIndex);
+
+			sprintf(pidfile, "/var/run/%s-%d", Program, ServOpt.listen_port);
+			write_pidfile(pidfile);
+
+			close(PoolPipe[0]);
+
+			CS_LOG_DBUG(DEBUG_FP, "%s: Pool worker %d starting\n",
+						LOG_PREFIX, getpid());
+
+			/* does not return */
+			pool_worker(listen_sd);
+			exit(0);
+		case -1:
+			/* error */
+			CS_LOG_ERR(ERROR_FP,"%s: Fork failed, %s",
+							LOG_PREFIX, strerror(errno));
+			WorkerPids[i_wrkr] = 0;
+			PoolState[i_wrkr] = POOL_FREE;
+			return -1;
+		default:
+			/* dispatcher (parent), successful fork */
+			WorkerCount++;
+			return 0;
+	}
+} /* end fork_pool_worker */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void pool_worker(int listen_sd) 
+
+FUNCTION DESCRIPTION
+	Pre-forked worker loop: accept a connection, serve it, and go back to
+	accept.  The worker exits on shutdown, or after a connection if enough
+	other workers are idle (so a reconnect storm doesn't leave max_worker
+	idle processes behind.)
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				listen_sd		I	listen socket file descriptor
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				prefork			I	idle pre-forked workers to keep
+	char			verbosity		I	debugging verbosity level
+	int				Flags			I	Control Flags
+
+RETURNS
+	void (exits)
+*******************************************************************************/
+static void pool_worker(int listen_sd)
+{
+	struct sockaddr_in accept_addr;		/* accepted remote socket address */
+	unsigned int addrlen;
+	char program[sizeof(Program)];
+	int accept_sd;
+	int status;
+
+	strcpy(program, Program);
+	status = 0;
+
+	while (!(Flags & SHUTDOWN_FLAG)) {
+
+		PoolState[WorkerIndex] = POOL_IDLE;
+
+		addrlen = sizeof(accept_addr);
+		if ((accept_sd = accept(
+				listen_sd, (struct sockaddr *)&accept_addr, &addrlen)) < 0) {
+			if (errno != EINTR) {
+				CS_LOG_ERR(ERROR_FP, "%s: FAIL accept, %s\n",
+						LOG_PREFIX, strerror(errno));
+				status = 1;
+				break;
+			}
+			continue;
+		}
+
+		/* tell the dispatcher to replace us in the idle pool */
+		PoolState[WorkerIndex] = POOL_BUSY;
+		write(PoolPipe[1], "", 1);
+
+		RemoteHost = remote_host_name(&accept_addr);
+
+		if (ServOpt.verbosity > 0) {
+			CS_LOG_DBUG(DEBUG_FP,
+				"%s: Accepted connection on sd %d from host %s, port %d\n",
+				LOG_PREFIX, accept_sd, RemoteHost, ntohs(accept_addr.sin_port));
+		}
+
+		/* start each connection fresh */
+		memset(&ConnInfo, '\0', sizeof(ConnInfo));
+		if (strcmp(Program, program)) {
+			strcpy(Program, program);
+			if (PRODUCT_FP == &LogFile) {
+				rename_log(PRODUCT_FP, Program);
+			}
+		}
+
+		status = service(accept_sd, RemoteHost) < 0 ? 1 : 0;
+
+		if (close(accept_sd) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL close socket %d, %s\n",
+					LOG_PREFIX, accept_sd, strerror(errno));
+		}
+
+		free(RemoteHost);
+		RemoteHost = NULL;
+
+		Flags &= ~DISCONNECT_FLAG;
+		WorkerConns++;
+
+		if (pool_count(POOL_IDLE) >= ServOpt.prefork) {
+			/* enough spare workers, don't linger */
+			break;
+		}
+	}
+
+	PoolState[WorkerIndex] = POOL_BUSY;
+
+	CS_LOG_DBUG(DEBUG_FP, "%s: Worker %d exiting with status %d\n",
+				LOG_PREFIX, getpid(), status);
+
+	exit(status);
+} /* end pool_worker */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int pool_count(char state) 
+
+FUNCTION DESCRIPTION
+	Count the pre-forked workers in a given state.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char			state			I	POOL_IDLE or POOL_BUSY
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				max_worker		I	maximum number of concurrent workers
+
+RETURNS
+	number of workers in state
+*******************************************************************************/
+static int pool_count(char state)
+{
+	int i_wrkr;
+	int count;
+
+	for (count = 0, i_wrkr = 0; i_wrkr < ServOpt.max_worker; i_wrkr++) {
+		if (PoolState[i_wrkr] == state) {
+			count++;
+		}
+	}
+
+	return count;
+} /* end pool_count */
+
 /*******************************************************************************
 FUNCTION NAME
 	static int verify_workers(void) 
@@ -375,6 +741,9 @@ static void verify_workers(void)
 							LOG_PREFIX, WorkerPids[i_wrkr], strerror(errno));
 				/* assume this is not really a worker */
 				WorkerPids[i_wrkr] = 0;
+				if (PoolState) {
+					PoolState[i_wrkr] = POOL_FREE;
+				}
 			} else {
 				WorkerCount++;
 			}
@@ -409,6 +778,11 @@ void kill_workers(void)
 	   process group, but then we might send ourselves the SIGTERM signal
 	   and cause a feedback loop. */
 
+	if (!WorkerPids) {
+		/* no workers (receive engine or not dispatching yet) */
+		return;
+	}
+
 	for (i_wrkr = 0; i_wrkr < ServOpt.max_worker; i_wrkr++) {
 		if (WorkerPids[i_wrkr] > 0) {
 			if (ServOpt.verbosity > 0) {
@@ -448,35 +822,49 @@ void wait_for_worker(void)
 	int i_wrkr;
 	pid_t child_pid;
 
-	if ((child_pid = waitpid(0, &wait_stat, WNOHANG)) == -1) {
-		CS_LOG_ERR(ERROR_FP, "%s: waitpid failed, %s\n",
-						LOG_PREFIX, strerror(errno));
+	if (!WorkerPids) {
 		return;
 	}
 
-	for (i_wrkr = 0; i_wrkr < ServOpt.max_worker; i_wrkr++) {
-		if (WorkerPids[i_wrkr] == child_pid) {
-			WorkerPids[i_wrkr] = 0;
-			WorkerCount--;
-			break;
+	/* SIGCHLDs may be merged, reap every worker that has exited */
+	while ((child_pid = waitpid(0, &wait_stat, WNOHANG)) != 0) {
+		if (child_pid == -1) {
+			if (errno != ECHILD) {
+				CS_LOG_ERR(ERROR_FP, "%s: waitpid failed, %s\n",
+								LOG_PREFIX, strerror(errno));
+			}
+			return;
 		}
-	}
 
-	if (i_wrkr >= ServOpt.max_worker) {
-		CS_LOG_ERR(ERROR_FP,
-					"%s: ERROR child pid %d not found in worker table!\n",
-					LOG_PREFIX, child_pid);
-		return;
-	}
+		for (i_wrkr = 0; i_wrkr < ServOpt.max_worker; i_wrkr++) {
+			if (WorkerPids[i_wrkr] == child_pid) {
+				WorkerPids[i_wrkr] = 0;
+				WorkerCount--;
+				if (PoolState) {
+					/* dispatcher replenishes the pool */
+					PoolState[i_wrkr] = POOL_FREE;
+				}
+				break;
+			}
+		}
 
-	if (WIFEXITED(wait_stat)) {
-		if (ServOpt.verbosity > 0) {
-			CS_LOG_DBUG(DEBUG_FP, "%s: Worker pid %d exited with status %d\n",
+		if (i_wrkr >= ServOpt.max_worker) {
+			CS_LOG_ERR(ERROR_FP,
+						"%s: ERROR child pid %d not found in worker table!\n",
+						LOG_PREFIX, child_pid);
+			continue;
+		}
+
+		if (WIFEXITED(wait_stat)) {
+			if (ServOpt.verbosity > 0) {
+				CS_LOG_DBUG(DEBUG_FP,
+							"%s: Worker pid %d exited with status %d\n",
 							LOG_PREFIX, child_pid, WEXITSTATUS(wait_stat));
+			}
+		} else if (WIFSIGNALED(wait_stat)) {
+			CS_LOG_ERR(ERROR_FP, "%s: Worker pid %d killed by signal %d\n",
+							LOG_PREFIX, child_pid, WTERMSIG(wait_stat));
 		}
-	} else if (WIFSIGNALED(wait_stat)) {
-		CS_LOG_ERR(ERROR_FP, "%s: Worker pid %d killed by signal %d\n",
-						LOG_PREFIX, child_pid, WTERMSIG(wait_stat));
 	}
 
 	return;
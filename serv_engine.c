@@ -0,0 +1,1493 @@
+/*******************************************************************************
+FILE NAME
+	serv_engine.c
+
+FILE DESCRIPTION
+	Event-driven receive engine.  Instead of forking a worker for each
+	connection, a small, fixed number of threads each run an epoll loop
+	over a SO_REUSEPORT listen socket and all of the connections accepted
+	on it.  Each connection is a state machine driven by non-blocking reads,
+	so one slow client can not stall the others.  Product storage
+	(get_out_path, finish_recv, abort_recv) is serialized by store_enter
+	and store_leave, which also load the connection's ConnInfo, RemoteHost
+	and WorkerIndex globals for the storage routines.
+
+	With -U (INCLUDE_IO_URING builds) each thread drives its connections
+	through an io_uring instead of epoll: receives and ack sends for all
+	connections are queued on the ring and submitted together, and falls
+	back to epoll if the kernel has no io_uring.
+
+FUNCTIONS
+	recv_engine		- start the engine threads and wait for shutdown
+	store_enter		- lock product storage for the current connection
+	store_leave		- unlock product storage
+	engine_loop		- epoll loop of one engine thread
+	engine_thread	- pthread entry point for engine_loop
+	accept_conns	- accept new connections on a listen socket
+	conn_input		- read from a connection and advance its state
+	conn_prod_done	- finish a completely received product
+	conn_ack		- queue an ack for a connection
+	conn_flush_ack	- send pending ack bytes
+	conn_close		- close a connection and free its state
+	conn_resolve	- pick up the remote host name once it is known
+	sweep_conns		- close connections that have timed out
+	conn_open		- set up a newly accepted connection
+	conn_rbuf		- where the next read for a connection goes
+	conn_advance	- advance a connection's state with data read
+	uring_loop		- io_uring version of engine_loop
+	uring_complete	- handle one io_uring completion
+	uring_arm		- queue a connection's next ack send and receive
+	uring_accept	- queue an accept on the listen socket
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_serv_engine_c[]= "@(#)serv_engine.c 0.1 10/15/2026 12:00:00";
+
+#ifdef __linux__
+#define _GNU_SOURCE		/* accept4 */
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "share.h"
+#include "server.h"
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#ifdef INCLUDE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#define ENGINE_TICK_MS		1000	/* epoll timeout, for timeouts and shutdown */
+#define ENGINE_MAX_EVENTS	64		/* events per epoll_wait */
+#define ENGINE_READ_BUDGET	16		/* reads per connection per event */
+#define ENGINE_RING_SIZE	256		/* io_uring submission queue size */
+
+/* io_uring operations in flight, also the low bits of user_data */
+#define URING_RECV			1
+#define URING_SEND			2
+#define URING_OP_MASK		3
+
+#define CONN_HDR_LEN		(MSG_HDR_LEN+PROD_HDR_LEN)
+
+/* connection states */
+#define CONN_HDR			0		/* reading message header */
+#define CONN_FIRST			1		/* reading first block (WMO heading) */
+#define CONN_BODY			2		/* reading rest of product */
+#define CONN_CONNMSG		3		/* reading rest of connection message */
+
+/* per connection state */
+typedef struct conn_struct {
+	int				sock_fd;
+	int				state;
+	char			hdrbuf[CONN_HDR_LEN];
+	size_t			hdrlen;
+	char			firstbuf[FIRST_BLK_SIZE];
+	size_t			firstlen;
+	prod_info_t		prod;
+	int				seqno;			/* expected seqno */
+	int				proto;			/* PROTOCOL_1, or 2 once negotiated */
+	int				out_fd;
+	size_t			bytes_left;
+	char			ack_code;
+	char *			connmsg;
+	size_t			connlen;
+	char			ackbuf[MAX_ACK_LEN+1];
+	int				acklen;			/* ack bytes not yet sent */
+	int				ackoff;
+	int				wait_out;		/* waiting for EPOLLOUT to send ack */
+	char *			bodybuf;		/* io_uring: product data buffer */
+	int				busy;			/* io_uring: URING_xxx ops in flight */
+	int				closing;		/* io_uring: close once not busy */
+	time_t			last_active;
+	char *			rhost;
+	struct in_addr	addr;			/* remote address */
+	int				resolved;		/* rhost is final */
+	conn_info_t		info;
+	int				id;				/* WorkerIndex for this connection */
+	struct conn_struct *prev;
+	struct conn_struct *next;
+} conn_t;
+
+/* per thread state */
+typedef struct {
+	int				index;
+	pthread_t		tid;
+	int				epfd;
+	int				listen_sd;
+	int				own_listen;		/* listen socket is not shared */
+	char *			recvbuf;
+	conn_t *		conns;
+#ifdef INCLUDE_IO_URING
+	uring_t *		ring;			/* NULL to use epoll */
+	struct sockaddr_in accept_addr;
+	socklen_t		accept_len;
+#endif
+} engine_t;
+
+#ifdef INCLUDE_IO_URING
+#define ENGINE_RING(p_eng)	((p_eng)->ring)
+#else
+#define ENGINE_RING(p_eng)	NULL
+#endif
+
+static void engine_loop(engine_t *p_eng);
+static void *engine_thread(void *arg);
+static void accept_conns(engine_t *p_eng);
+static int conn_input(engine_t *p_eng, conn_t *p_conn);
+static void conn_prod_done(conn_t *p_conn);
+static void conn_ack(conn_t *p_conn, int seqno, char code);
+static int conn_flush_ack(engine_t *p_eng, conn_t *p_conn);
+static void conn_close(engine_t *p_eng, conn_t *p_conn);
+static void conn_resolve(conn_t *p_conn);
+static void sweep_conns(engine_t *p_eng);
+static conn_t *conn_open(engine_t *p_eng, int accept_sd,
+				struct sockaddr_in *p_addr);
+static size_t conn_rbuf(engine_t *p_eng, conn_t *p_conn, char **p_rbuf);
+static int conn_advance(conn_t *p_conn, char *rbuf, ssize_t bytes_rcvd);
+#ifdef INCLUDE_IO_URING
+static void uring_loop(engine_t *p_eng);
+static void uring_complete(engine_t *p_eng, unsigned long long user_data,
+				int res);
+static int uring_arm(engine_t *p_eng, conn_t *p_conn);
+static int uring_accept(engine_t *p_eng);
+#endif
+
+static pthread_mutex_t StoreLock = PTHREAD_MUTEX_INITIALIZER;
+static int EngineRunning;
+static __thread conn_t *CurConn;	/* connection being served by this thread */
+
+static int ConnCount;				/* open connections, all threads */
+static int ConnSerial;				/* connection id generator */
+
+#endif /* __linux__ */
+
+/*******************************************************************************
+FUNCTION NAME
+	int recv_engine(void)
+
+FUNCTION DESCRIPTION
+	Start ServOpt.engine_threads engine threads and serve connections until
+	shutdown.  The calling thread becomes engine thread 0 and is the only
+	one to receive signals.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				engine_threads	I	number of engine threads
+	char			io_uring		I	use io_uring instead of epoll
+	unsigned int	listen_port		I	port number for listen/connect
+	size_t			bufsize			I	size of read buffer
+	int				Flags			I	Control Flags
+
+RETURNS
+	 0	Normal exit
+	-1	Error
+*******************************************************************************/
+int recv_engine(void)
+{
+#ifdef __linux__
+	engine_t *engines;
+	sigset_t allsigs;
+	sigset_t oldsigs;
+	int nthreads;
+	int use_ring;
+	int i;
+	int rc;
+
+	nthreads = ServOpt.engine_threads;
+	if (!(engines = calloc(nthreads, sizeof(engine_t)))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc %d engines, %s\n",
+				LOG_PREFIX, nthreads, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		engines[i].index = i;
+		engines[i].epfd = -1;
+		engines[i].listen_sd = -1;
+	}
+
+	/* one ring per thread, or epoll for all of them */
+	use_ring = 0;
+#ifdef INCLUDE_IO_URING
+	for (use_ring = ServOpt.io_uring, i = 0; use_ring && i < nthreads; i++) {
+		if (!(engines[i].ring = malloc(sizeof(uring_t)))
+				|| uring_init(engines[i].ring, ENGINE_RING_SIZE) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: io_uring not available, using epoll\n",
+					LOG_PREFIX);
+			use_ring = 0;
+		}
+	}
+	for (i = 0; !use_ring && i < nthreads; i++) {
+		if (engines[i].ring) {
+			uring_close(engines[i].ring);
+			free(engines[i].ring);
+			engines[i].ring = NULL;
+		}
+	}
+#endif
+
+	/* set up each thread's listen socket and epoll set */
+	for (rc = 0, i = 0; i < nthreads && rc == 0; i++) {
+		if ((engines[i].listen_sd =
+				new_listen_socket(ServOpt.listen_port, 1)) >= 0) {
+			engines[i].own_listen = 1;
+		} else if (i > 0) {
+			/* no SO_REUSEPORT, share the first thread's socket */
+			engines[i].listen_sd = engines[0].listen_sd;
+		} else if ((engines[i].listen_sd =
+				new_listen_socket(ServOpt.listen_port, 0)) >= 0) {
+			engines[i].own_listen = 1;
+		} else {
+			rc = -1;
+			break;
+		}
+
+		if (use_ring) {
+			/* the ring accepts on the (blocking) listen socket */
+		} else if (engines[i].own_listen
+				&& fcntl(engines[i].listen_sd, F_SETFL, O_NONBLOCK) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL set O_NONBLOCK on socket %d, %s\n",
+					LOG_PREFIX, engines[i].listen_sd, strerror(errno));
+			rc = -1;
+		} else if ((engines[i].epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_create1, %s\n",
+					LOG_PREFIX, strerror(errno));
+			rc = -1;
+		} else {
+			struct epoll_event ev;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = NULL;		/* NULL means the listen socket */
+			if (epoll_ctl(engines[i].epfd, EPOLL_CTL_ADD,
+					engines[i].listen_sd, &ev) < 0) {
+				CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_ctl listen socket, %s\n",
+						LOG_PREFIX, strerror(errno));
+				rc = -1;
+			}
+		}
+
+		if (rc == 0 && !(engines[i].recvbuf = malloc(ServOpt.bufsize))) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d bytes for recvbuf, %s\n",
+					LOG_PREFIX, ServOpt.bufsize, strerror(errno));
+			rc = -1;
+		}
+
+		if (rc == 0 && ServOpt.verbosity > 0) {
+			CS_LOG_DBUG(DEBUG_FP,
+					"%s: Engine thread %d listening on port %d fd %d%s%s\n",
+					LOG_PREFIX, i, ServOpt.listen_port, engines[i].listen_sd,
+					engines[i].own_listen ? "" : " (shared)",
+					use_ring ? " with io_uring" : "");
+		}
+	}
+
+	if (rc == 0) {
+		EngineRunning = 1;
+
+		/* only thread 0 (this thread) takes signals */
+		sigfillset(&allsigs);
+		pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+		for (i = 1; i < nthreads; i++) {
+			if ((errno = pthread_create(&engines[i].tid, NULL,
+					engine_thread, &engines[i])) != 0) {
+				CS_LOG_ERR(ERROR_FP, "%s: FAIL create engine thread %d, %s\n",
+						LOG_PREFIX, i, strerror(errno));
+				Flags |= SHUTDOWN_FLAG;
+				break;
+			}
+		}
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		nthreads = i;
+
+		engine_loop(&engines[0]);
+
+		for (i = 1; i < nthreads; i++) {
+			pthread_join(engines[i].tid, NULL);
+		}
+
+		EngineRunning = 0;
+	}
+
+	/* clean up */
+	for (i = 0; i < ServOpt.engine_threads; i++) {
+		if (engines[i].own_listen) {
+			close(engines[i].listen_sd);
+		}
+		if (engines[i].epfd >= 0) {
+			close(engines[i].epfd);
+		}
+#ifdef INCLUDE_IO_URING
+		if (engines[i].ring) {
+			uring_close(engines[i].ring);
+			free(engines[i].ring);
+		}
+#endif
+		free(engines[i].recvbuf);
+	}
+	free(engines);
+
+	return rc;
+#else
+	CS_LOG_ERR(ERROR_FP, "%s: receive engine not available in this build\n",
+			LOG_PREFIX);
+	return -1;
+#endif
+} /* end recv_engine */
+
+/*******************************************************************************
+FUNCTION NAME
+	void store_enter(void)
+
+FUNCTION DESCRIPTION
+	Lock product storage before calling get_out_path, finish_recv,
+	abort_recv or touching ConnInfo.  When the receive engine is running,
+	the ConnInfo, RemoteHost and WorkerIndex globals are loaded from the
+	connection being served by the calling thread.  Does nothing when
+	each connection has its own process.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	struct			ConnInfo		O	Connection information
+	char *			RemoteHost		O	remote host name
+	int				WorkerIndex		O	unique index for this connection
+
+RETURNS
+	void
+*******************************************************************************/
+void store_enter(void)
+{
+#ifdef __linux__
+	if (!EngineRunning) {
+		return;
+	}
+
+	pthread_mutex_lock(&StoreLock);
+
+	if (CurConn) {
+		ConnInfo = CurConn->info;
+		RemoteHost = CurConn->rhost;
+		WorkerIndex = CurConn->id;
+	}
+#endif
+} /* end store_enter */
+
+/*******************************************************************************
+FUNCTION NAME
+	void store_leave(void)
+
+FUNCTION DESCRIPTION
+	Unlock product storage.  Changes to ConnInfo (e.g. from a connection
+	message) are saved back to the current connection.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	struct			ConnInfo		I	Connection information
+
+RETURNS
+	void
+*******************************************************************************/
+void store_leave(void)
+{
+#ifdef __linux__
+	if (!EngineRunning) {
+		return;
+	}
+
+	if (CurConn) {
+		CurConn->info = ConnInfo;
+	}
+
+	pthread_mutex_unlock(&StoreLock);
+#endif
+} /* end store_leave */
+
+#ifdef __linux__
+
+/*******************************************************************************
+FUNCTION NAME
+	static void engine_loop(engine_t *p_eng)
+
+FUNCTION DESCRIPTION
+	Wait for events on the listen socket and the connections of one engine
+	thread, and dispatch them until shutdown.  Threads with a ring run
+	uring_loop instead.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				Flags			I	Control Flags
+
+RETURNS
+	void
+*******************************************************************************/
+static void engine_loop(engine_t *p_eng)
+{
+	struct epoll_event events[ENGINE_MAX_EVENTS];
+	conn_t *p_conn;
+	time_t last_sweep;
+	int nevents;
+	int i;
+
+#ifdef INCLUDE_IO_URING
+	if (p_eng->ring) {
+		uring_loop(p_eng);
+		return;
+	}
+#endif
+
+	last_sweep = time(NULL);
+
+	while (!(Flags & SHUTDOWN_FLAG)) {
+
+		if ((nevents = epoll_wait(p_eng->epfd, events, ENGINE_MAX_EVENTS,
+				ENGINE_TICK_MS)) < 0) {
+			if (errno != EINTR) {
+				CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_wait, %s\n",
+						LOG_PREFIX, strerror(errno));
+				Flags |= SHUTDOWN_FLAG;
+			}
+			continue;
+		}
+
+		for (i = 0; i < nevents; i++) {
+			if (!(p_conn = events[i].data.ptr)) {
+				accept_conns(p_eng);
+				continue;
+			}
+
+			CurConn = p_conn;
+			if (events[i].events & EPOLLOUT) {
+				if (conn_flush_ack(p_eng, p_conn) < 0) {
+					conn_close(p_eng, p_conn);
+					CurConn = NULL;
+					continue;
+				}
+			}
+			if (events[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP)) {
+				if (conn_input(p_eng, p_conn) < 0) {
+					conn_close(p_eng, p_conn);
+				}
+			}
+			CurConn = NULL;
+		}
+
+		if (time(NULL) != last_sweep) {
+			last_sweep = time(NULL);
+			sweep_conns(p_eng);
+		}
+	}
+
+	/* shutdown, close all connections */
+	while ((p_conn = p_eng->conns)) {
+		CurConn = p_conn;
+		if (shutdown(p_conn->sock_fd, SHUT_RDWR) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL shutdown socket %d, %s\n",
+					LOG_PREFIX, p_conn->sock_fd, strerror(errno));
+		}
+		conn_close(p_eng, p_conn);
+		CurConn = NULL;
+	}
+} /* end engine_loop */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void *engine_thread(void *arg)
+
+FUNCTION DESCRIPTION
+	Thread entry point for engine threads other than thread 0.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void *			arg				I	engine thread state
+
+RETURNS
+	NULL
+*******************************************************************************/
+static void *engine_thread(void *arg)
+{
+	engine_loop((engine_t *)arg);
+	return NULL;
+} /* end engine_thread */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void accept_conns(engine_t *p_eng)
+
+FUNCTION DESCRIPTION
+	Accept all pending connections on the listen socket, set them up and
+	add them to the epoll set.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+
+RETURNS
+	void
+*******************************************************************************/
+static void accept_conns(engine_t *p_eng)
+{
+	struct sockaddr_in accept_addr;		/* accepted remote socket address */
+	socklen_t addrlen;
+	struct epoll_event ev;
+	conn_t *p_conn;
+	int accept_sd;
+
+	for (;;) {
+		addrlen = sizeof(accept_addr);
+		if ((accept_sd = accept4(p_eng->listen_sd,
+				(struct sockaddr *)&accept_addr, &addrlen,
+				SOCK_NONBLOCK|SOCK_CLOEXEC)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != ECONNABORTED) {
+				CS_LOG_ERR(ERROR_FP, "%s: FAIL accept, %s\n",
+						LOG_PREFIX, strerror(errno));
+			}
+			return;
+		}
+
+		if (!(p_conn = conn_open(p_eng, accept_sd, &accept_addr))) {
+			continue;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = p_conn;
+		if (epoll_ctl(p_eng->epfd, EPOLL_CTL_ADD, accept_sd, &ev) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_ctl socket %d, %s\n",
+					LOG_PREFIX, accept_sd, strerror(errno));
+			CurConn = p_conn;
+			conn_close(p_eng, p_conn);
+			CurConn = NULL;
+		}
+	}
+} /* end accept_conns */
+
+/*******************************************************************************
+FUNCTION NAME
+	static conn_t *conn_open(engine_t *p_eng, int accept_sd,
+				struct sockaddr_in *p_addr)
+
+FUNCTION DESCRIPTION
+	Set up the state for a newly accepted connection and link it into the
+	thread's connection list.  Connections beyond max_worker are refused
+	(the socket is closed).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	int				accept_sd		I	accepted socket
+	struct sockaddr_in * p_addr		I	remote socket address
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				max_worker		I	maximum number of connections (0=any)
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	address of the connection state
+	NULL if the connection was refused
+*******************************************************************************/
+static conn_t *conn_open(engine_t *p_eng, int accept_sd,
+				struct sockaddr_in *p_addr)
+{
+	char hostbuf[HOSTNAME_MAX_LEN+1];
+	int resolved;
+	conn_t *p_conn;
+
+	/* numeric address until the resolver finds the name */
+	resolved = resolv_name(p_addr->sin_addr, hostbuf, sizeof(hostbuf));
+
+	if (ServOpt.max_worker > 0
+			&& __sync_fetch_and_add(&ConnCount, 0) >= ServOpt.max_worker) {
+		CS_LOG_ERR(ERROR_FP,
+			"%s: WARNING: %d connections open, refuse host %s\n",
+			LOG_PREFIX, ConnCount, hostbuf);
+		close(accept_sd);
+		return NULL;
+	}
+
+	if (!(p_conn = calloc(1, sizeof(conn_t)))
+			|| !(p_conn->rhost = strdup(hostbuf))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL calloc connection, %s\n",
+				LOG_PREFIX, strerror(errno));
+		free(p_conn);
+		close(accept_sd);
+		return NULL;
+	}
+
+	p_conn->sock_fd = accept_sd;
+	p_conn->addr = p_addr->sin_addr;
+	p_conn->resolved = resolved;
+	p_conn->state = CONN_HDR;
+	p_conn->proto = PROTOCOL_1;
+	p_conn->out_fd = -1;
+	p_conn->last_active = time(NULL);
+	p_conn->id = __sync_fetch_and_add(&ConnSerial, 1);
+
+	/* link into this thread's connection list */
+	if ((p_conn->next = p_eng->conns)) {
+		p_conn->next->prev = p_conn;
+	}
+	p_eng->conns = p_conn;
+	__sync_fetch_and_add(&ConnCount, 1);
+
+	if (ServOpt.verbosity > 0) {
+		CS_LOG_DBUG(DEBUG_FP,
+			"%s: Accepted connection %d on sd %d from host %s, port %d\n",
+			LOG_PREFIX, p_conn->id, accept_sd, p_conn->rhost,
+			ntohs(p_addr->sin_port));
+	}
+
+	return p_conn;
+} /* end conn_open */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int conn_input(engine_t *p_eng, conn_t *p_conn)
+
+FUNCTION DESCRIPTION
+	Read what is available from a connection (up to ENGINE_READ_BUDGET
+	reads, to be fair to other connections) and advance its state with
+	conn_advance.  Reading stops while an ack is waiting to be sent.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	conn_t *		p_conn			I/O	connection state
+
+RETURNS
+	 0	Normal return
+	-1	Connection closed or error, caller must close the connection
+*******************************************************************************/
+static int conn_input(engine_t *p_eng, conn_t *p_conn)
+{
+	char *rbuf;
+	size_t rlen;
+	ssize_t bytes_rcvd;
+	int n;
+
+	for (n = 0; n < ENGINE_READ_BUDGET && !p_conn->acklen; n++) {
+
+		rlen = conn_rbuf(p_eng, p_conn, &rbuf);
+
+		if ((bytes_rcvd = recv(p_conn->sock_fd, rbuf, rlen, 0)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL recv from socket %d, %s\n",
+					LOG_PREFIX, p_conn->sock_fd, strerror(errno));
+			return -1;
+		}
+
+		if (conn_advance(p_conn, rbuf, bytes_rcvd) < 0) {
+			return -1;
+		}
+
+		if (p_conn->acklen && conn_flush_ack(p_eng, p_conn) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+} /* end conn_input */
+
+/*******************************************************************************
+FUNCTION NAME
+	static size_t conn_rbuf(engine_t *p_eng, conn_t *p_conn, char **p_rbuf)
+
+FUNCTION DESCRIPTION
+	Find where the next read for a connection goes and how much of it
+	there should be: the rest of the message header, the first block
+	(enough for the WMO heading), the rest of a connection message, or
+	product data (the thread's recvbuf, or the connection's bodybuf when
+	it has one).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	conn_t *		p_conn			I	connection state
+	char **			p_rbuf			O	where to read to
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	size_t			bufsize			I	size of read buffer
+
+RETURNS
+	bytes to read
+*******************************************************************************/
+static size_t conn_rbuf(engine_t *p_eng, conn_t *p_conn, char **p_rbuf)
+{
+	switch (p_conn->state) {
+		case CONN_HDR:
+			*p_rbuf = p_conn->hdrbuf + p_conn->hdrlen;
+			return CONN_HDR_LEN - p_conn->hdrlen;
+		case CONN_FIRST:
+			*p_rbuf = p_conn->firstbuf + p_conn->firstlen;
+			return MIN(p_conn->prod.size, FIRST_BLK_SIZE) - p_conn->firstlen;
+		case CONN_CONNMSG:
+			*p_rbuf = p_conn->connmsg + p_conn->connlen;
+			return p_conn->prod.size - p_conn->connlen;
+		default:
+			*p_rbuf = p_conn->bodybuf ? p_conn->bodybuf : p_eng->recvbuf;
+			return MIN(p_conn->bytes_left, ServOpt.bufsize);
+	}
+} /* end conn_rbuf */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int conn_advance(conn_t *p_conn, char *rbuf, ssize_t bytes_rcvd)
+
+FUNCTION DESCRIPTION
+	Advance a connection's state with bytes_rcvd bytes just read to the
+	place conn_rbuf gave: parse the message header, open the output file
+	once the WMO heading is in, write the product data, and queue the
+	product's ack (conn_ack) when it is complete.  0 bytes is a disconnect.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	conn_t *		p_conn			I/O	connection state
+	char *			rbuf			I	data read (from conn_rbuf)
+	ssize_t			bytes_rcvd		I	bytes read
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	 0	Normal return
+	-1	Connection closed or error, caller must close the connection
+*******************************************************************************/
+static int conn_advance(conn_t *p_conn, char *rbuf, ssize_t bytes_rcvd)
+{
+	char ack_code;
+	int rc;
+
+	if (bytes_rcvd == 0) {
+		/* remote disconnect */
+		if (ServOpt.verbosity > 0 || p_conn->state != CONN_HDR
+				|| p_conn->hdrlen) {
+			CS_LOG_DBUG(DEBUG_FP,
+					"%s: Connection %d closed by host %s\n",
+					LOG_PREFIX, p_conn->id, p_conn->rhost);
+		}
+		return -1;
+	}
+
+	p_conn->last_active = time(NULL);
+
+	switch (p_conn->state) {
+		case CONN_HDR:
+			if ((p_conn->hdrlen += bytes_rcvd) < CONN_HDR_LEN) {
+				break;
+			}
+			p_conn->hdrlen = 0;
+			conn_resolve(p_conn);
+			if (check_msghdr(p_conn->hdrbuf, CONN_HDR_LEN, p_conn->seqno,
+					p_conn->proto, &p_conn->prod) < 0) {
+				return -1;
+			}
+			p_conn->bytes_left = p_conn->prod.size;
+			p_conn->firstlen = 0;
+			p_conn->out_fd = -1;
+			p_conn->ack_code = ACK_FAIL;
+			p_conn->state = CONN_FIRST;
+			break;
+
+		case CONN_FIRST:
+			if ((p_conn->firstlen += bytes_rcvd)
+					< MIN(p_conn->prod.size, FIRST_BLK_SIZE)) {
+				break;
+			}
+			if ((rc = begin_prod(p_conn->firstbuf, p_conn->firstlen,
+					&p_conn->prod, &p_conn->out_fd,
+					&p_conn->ack_code, 0)) < 0) {
+				return -1;
+			} else if (rc > 0) {
+				/* connection message, collect the rest of it */
+				if (!(p_conn->connmsg = malloc(p_conn->prod.size+1))) {
+					CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc buflen=%d, %s\n",
+							LOG_PREFIX, p_conn->prod.size+1,
+							strerror(errno));
+					return -1;
+				}
+				memcpy(p_conn->connmsg, p_conn->firstbuf,
+						p_conn->firstlen);
+				p_conn->connlen = p_conn->firstlen;
+				p_conn->state = CONN_CONNMSG;
+			} else {
+				store_block(&p_conn->out_fd, p_conn->firstbuf,
+						p_conn->firstlen, &p_conn->prod,
+						&p_conn->ack_code, 0);
+				p_conn->bytes_left -= p_conn->firstlen;
+				p_conn->state = CONN_BODY;
+			}
+			break;
+
+		case CONN_CONNMSG:
+			p_conn->connlen += bytes_rcvd;
+			break;
+
+		default:
+			store_block(&p_conn->out_fd, rbuf, bytes_rcvd,
+					&p_conn->prod, &p_conn->ack_code, 0);
+			p_conn->bytes_left -= bytes_rcvd;
+			break;
+	}
+
+	if (p_conn->state == CONN_CONNMSG
+			&& p_conn->connlen == p_conn->prod.size) {
+		p_conn->connmsg[p_conn->prod.size] = '\0';
+		/* products are not taken in chunks here, a client asking for
+		   protocol 3 gets protocol 2 */
+		ack_code = load_conn_msg(p_conn->connmsg, &p_conn->prod,
+				PROTOCOL_2);
+		conn_ack(p_conn, p_conn->prod.seqno, ack_code);
+		if (ack_code == ACK_PROTO2) {
+			/* the ack above is the last message of protocol 1 */
+			p_conn->proto = PROTOCOL_2;
+		}
+		free(p_conn->connmsg);
+		p_conn->connmsg = NULL;
+		log_conn_msg(&p_conn->prod, 0);
+		p_conn->seqno = p_conn->prod.seqno + 1;
+		p_conn->state = CONN_HDR;
+	} else if (p_conn->state == CONN_BODY && !p_conn->bytes_left) {
+		conn_prod_done(p_conn);
+	}
+
+	return 0;
+} /* end conn_advance */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void conn_prod_done(conn_t *p_conn)
+
+FUNCTION DESCRIPTION
+	Finish a completely received product and queue its ack.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	conn_t *		p_conn			I/O	connection state
+
+RETURNS
+	void
+*******************************************************************************/
+static void conn_prod_done(conn_t *p_conn)
+{
+	if (p_conn->out_fd >= 0) {
+		p_conn->ack_code = end_prod(p_conn->out_fd, &p_conn->prod);
+		p_conn->out_fd = -1;
+	}
+
+	conn_ack(p_conn, p_conn->prod.seqno, p_conn->ack_code);
+
+	p_conn->seqno = p_conn->prod.seqno + 1;
+	p_conn->state = CONN_HDR;
+} /* end conn_prod_done */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void conn_ack(conn_t *p_conn, int seqno, char code)
+
+FUNCTION DESCRIPTION
+	Format an ack for the connection, in its protocol.  It is sent by
+	conn_flush_ack.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	conn_t *		p_conn			I/O	connection state
+	int				seqno			I	product seqno to ack
+	char			code			I	ack code (ACK, NACK, or RETRY)
+
+RETURNS
+	void
+*******************************************************************************/
+static void conn_ack(conn_t *p_conn, int seqno, char code)
+{
+	int acklen;
+
+	if ((acklen = p_conn->proto > PROTOCOL_1
+			? format_ack2(p_conn->ackbuf, seqno, code)
+			: format_ack(p_conn->ackbuf, seqno, code)) > 0) {
+		p_conn->acklen = acklen;
+		p_conn->ackoff = 0;
+	}
+} /* end conn_ack */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int conn_flush_ack(engine_t *p_eng, conn_t *p_conn)
+
+FUNCTION DESCRIPTION
+	Send pending ack bytes without blocking.  If the socket is full, wait
+	for EPOLLOUT (and stop reading) until the ack is out.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	conn_t *		p_conn			I/O	connection state
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int conn_flush_ack(engine_t *p_eng, conn_t *p_conn)
+{
+	struct epoll_event ev;
+	ssize_t bytes_sent;
+	int blocked;
+
+	blocked = 0;
+	while (p_conn->acklen > 0) {
+		if ((bytes_sent = send(p_conn->sock_fd,
+				p_conn->ackbuf + p_conn->ackoff, p_conn->acklen,
+				MSG_NOSIGNAL|MSG_DONTWAIT)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				blocked = 1;
+				break;
+			}
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL send ack for prod %d to socket, %s\n",
+					LOG_PREFIX, p_conn->prod.seqno, strerror(errno));
+			return -1;
+		}
+		p_conn->ackoff += bytes_sent;
+		p_conn->acklen -= bytes_sent;
+	}
+
+	if (blocked == p_conn->wait_out) {
+		return 0;
+	}
+
+	/* watch for writable while blocked, readable otherwise */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = blocked ? EPOLLOUT : EPOLLIN;
+	ev.data.ptr = p_conn;
+	if (epoll_ctl(p_eng->epfd, EPOLL_CTL_MOD, p_conn->sock_fd, &ev) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL epoll_ctl socket %d, %s\n",
+				LOG_PREFIX, p_conn->sock_fd, strerror(errno));
+		return -1;
+	}
+	p_conn->wait_out = blocked;
+
+	return 0;
+} /* end conn_flush_ack */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void conn_close(engine_t *p_eng, conn_t *p_conn)
+
+FUNCTION DESCRIPTION
+	Abort any product in progress, close the connection and free its state.
+	If the connection has io_uring operations in flight, it is shut down
+	and marked closing instead; the caller closes it again when they are
+	done.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	conn_t *		p_conn			I	connection state
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	void
+*******************************************************************************/
+static void conn_close(engine_t *p_eng, conn_t *p_conn)
+{
+	if (p_conn->busy) {
+		/* io_uring operations in flight, finish when they complete */
+		if (!p_conn->closing) {
+			p_conn->closing = 1;
+			shutdown(p_conn->sock_fd, SHUT_RDWR);
+		}
+		return;
+	}
+
+	if (p_conn->out_fd >= 0) {
+		/* product in progress, close and abort it */
+		close(p_conn->out_fd);
+		p_conn->out_fd = -1;
+		store_enter();
+		abort_recv(&p_conn->prod);
+		store_leave();
+	}
+
+	if (ServOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: End service for client on host %s\n",
+					LOG_PREFIX, p_conn->rhost);
+	}
+
+	/* closing the socket also removes it from the epoll set */
+	if (close(p_conn->sock_fd) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL close socket %d, %s\n",
+				LOG_PREFIX, p_conn->sock_fd, strerror(errno));
+	}
+
+	if (p_conn->prev) {
+		p_conn->prev->next = p_conn->next;
+	} else {
+		p_eng->conns = p_conn->next;
+	}
+	if (p_conn->next) {
+		p_conn->next->prev = p_conn->prev;
+	}
+	__sync_fetch_and_sub(&ConnCount, 1);
+
+	free(p_conn->connmsg);
+	free(p_conn->bodybuf);
+	free(p_conn->rhost);
+	free(p_conn);
+} /* end conn_close */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void conn_resolve(conn_t *p_conn)
+
+FUNCTION DESCRIPTION
+	If the connection's host name is still its numeric address, check
+	whether the resolver has found the name.  Also fill in
+	ConnInfo.remotehost (the connection's copy) if the client has not.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	conn_t *		p_conn			I/O	connection state
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	void
+*******************************************************************************/
+static void conn_resolve(conn_t *p_conn)
+{
+	char name[HOSTNAME_MAX_LEN+1];
+	char *p_name;
+
+	if (!p_conn->resolved
+			&& (p_conn->resolved = resolv_name(p_conn->addr,
+											name, sizeof(name)))
+			&& strcmp(name, p_conn->rhost)
+			&& (p_name = strdup(name))) {
+
+		if (ServOpt.verbosity > 0) {
+			CS_LOG_DBUG(DEBUG_FP, "%s: Remote host %s is %s\n",
+					LOG_PREFIX, p_conn->rhost, p_name);
+		}
+
+		if (!strcmp(p_conn->info.remotehost, p_conn->rhost)) {
+			p_conn->info.remotehost[0] = '\0';
+		}
+		free(p_conn->rhost);
+		p_conn->rhost = p_name;
+	}
+
+	if (!p_conn->info.remotehost[0]) {
+		sprintf(p_conn->info.remotehost, "%.*s",
+				(int)sizeof(p_conn->info.remotehost)-1, p_conn->rhost);
+	}
+} /* end conn_resolve */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void sweep_conns(engine_t *p_eng)
+
+FUNCTION DESCRIPTION
+	Close connections that have been idle longer than the timeout.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	time_t			timeout			I	idle timeout (0=none)
+
+RETURNS
+	void
+*******************************************************************************/
+static void sweep_conns(engine_t *p_eng)
+{
+	conn_t *p_conn;
+	conn_t *p_next;
+	time_t now;
+
+	if (ServOpt.timeout <= 0) {
+		return;
+	}
+
+	now = time(NULL);
+	for (p_conn = p_eng->conns; p_conn; p_conn = p_next) {
+		p_next = p_conn->next;
+		if (now - p_conn->last_active > ServOpt.timeout && !p_conn->closing) {
+			CurConn = p_conn;
+			CS_LOG_ERR(ERROR_FP,
+					"%s: Timeout on connection %d from host %s, disconnect\n",
+					LOG_PREFIX, p_conn->id, p_conn->rhost);
+			conn_close(p_eng, p_conn);
+			CurConn = NULL;
+		}
+	}
+} /* end sweep_conns */
+
+#ifdef INCLUDE_IO_URING
+
+/*******************************************************************************
+FUNCTION NAME
+	static void uring_loop(engine_t *p_eng)
+
+FUNCTION DESCRIPTION
+	io_uring version of engine_loop.  The accept on the listen socket and
+	the receives and ack sends of all of the thread's connections are
+	queued on the thread's ring and handed to the kernel together by one
+	io_uring_enter per pass, which also waits for the next completions.
+	A connection has at most one receive in flight, and its ack is linked
+	ahead of its next receive.  Product storage is still done in line
+	(begin_prod, store_block, end_prod) since get_out_path and finish_recv
+	decide the ack.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				Flags			I/O	Control Flags
+
+RETURNS
+	void
+*******************************************************************************/
+static void uring_loop(engine_t *p_eng)
+{
+	struct io_uring_cqe *p_cqe;
+	unsigned long long user_data;
+	conn_t *p_conn;
+	conn_t *p_next;
+	time_t last_sweep;
+	int res;
+	int tries;
+
+	last_sweep = time(NULL);
+
+	if (uring_accept(p_eng) < 0) {
+		Flags |= SHUTDOWN_FLAG;
+	}
+
+	while (!(Flags & SHUTDOWN_FLAG)) {
+
+		if (uring_submit(p_eng->ring, ENGINE_TICK_MS) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL io_uring_enter, %s\n",
+					LOG_PREFIX, strerror(errno));
+			Flags |= SHUTDOWN_FLAG;
+			break;
+		}
+
+		while ((p_cqe = uring_peek_cqe(p_eng->ring))) {
+			user_data = p_cqe->user_data;
+			res = p_cqe->res;
+			uring_cqe_seen(p_eng->ring);
+			uring_complete(p_eng, user_data, res);
+		}
+
+		if (time(NULL) != last_sweep) {
+			last_sweep = time(NULL);
+			sweep_conns(p_eng);
+		}
+	}
+
+	/* shutdown, close all connections and give their operations a chance
+	   to finish, then closing the ring cancels anything left */
+	for (p_conn = p_eng->conns; p_conn; p_conn = p_next) {
+		p_next = p_conn->next;
+		CurConn = p_conn;
+		if (!p_conn->busy && shutdown(p_conn->sock_fd, SHUT_RDWR) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL shutdown socket %d, %s\n",
+					LOG_PREFIX, p_conn->sock_fd, strerror(errno));
+		}
+		conn_close(p_eng, p_conn);
+		CurConn = NULL;
+	}
+
+	for (tries = 0; p_eng->conns && tries < 3; tries++) {
+		if (uring_submit(p_eng->ring, ENGINE_TICK_MS) < 0) {
+			break;
+		}
+		while ((p_cqe = uring_peek_cqe(p_eng->ring))) {
+			user_data = p_cqe->user_data;
+			res = p_cqe->res;
+			uring_cqe_seen(p_eng->ring);
+			uring_complete(p_eng, user_data, res);
+		}
+	}
+
+	uring_close(p_eng->ring);
+
+	while ((p_conn = p_eng->conns)) {
+		CurConn = p_conn;
+		p_conn->busy = 0;
+		conn_close(p_eng, p_conn);
+		CurConn = NULL;
+	}
+} /* end uring_loop */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void uring_complete(engine_t *p_eng, unsigned long long user_data,
+				int res)
+
+FUNCTION DESCRIPTION
+	Handle one completion: set up an accepted connection, advance a
+	connection with the data received, or account for ack bytes sent.
+	Then queue the connection's next operations, or finish closing it.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	unsigned long long user_data	I	connection address | URING_xxx
+										(0 for the accept)
+	int				res				I	result, -errno on error
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				Flags			I/O	Control Flags
+
+RETURNS
+	void
+*******************************************************************************/
+static void uring_complete(engine_t *p_eng, unsigned long long user_data,
+				int res)
+{
+	conn_t *p_conn;
+	char *rbuf;
+	int rc;
+
+	if (!user_data) {
+		/* accept */
+		if (res >= 0) {
+			if (Flags & SHUTDOWN_FLAG) {
+				close(res);
+			} else if ((p_conn = conn_open(p_eng, res, &p_eng->accept_addr))) {
+				CurConn = p_conn;
+				if (uring_arm(p_eng, p_conn) < 0) {
+					conn_close(p_eng, p_conn);
+				}
+				CurConn = NULL;
+			}
+		} else if (res != -EINTR && res != -EAGAIN && res != -ECONNABORTED
+				&& res != -ECANCELED) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL accept, %s\n",
+					LOG_PREFIX, strerror(-res));
+		}
+		if (!(Flags & SHUTDOWN_FLAG) && uring_accept(p_eng) < 0) {
+			Flags |= SHUTDOWN_FLAG;
+		}
+		return;
+	}
+
+	p_conn = (conn_t *)(unsigned long)(user_data & ~URING_OP_MASK);
+	CurConn = p_conn;
+	rc = 0;
+
+	if ((user_data & URING_OP_MASK) == URING_RECV) {
+		p_conn->busy &= ~URING_RECV;
+		if (p_conn->closing || res == -ECANCELED
+				|| res == -EINTR || res == -EAGAIN) {
+			/* closing, or try again */
+		} else if (res < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL recv from socket %d, %s\n",
+					LOG_PREFIX, p_conn->sock_fd, strerror(-res));
+			rc = -1;
+		} else {
+			conn_rbuf(p_eng, p_conn, &rbuf);
+			rc = conn_advance(p_conn, rbuf, res);
+		}
+	} else {
+		p_conn->busy &= ~URING_SEND;
+		if (p_conn->closing || res == -ECANCELED
+				|| res == -EINTR || res == -EAGAIN) {
+			/* closing, or try again */
+		} else if (res < 0) {
+			CS_LOG_ERR(ERROR_FP,
+					"%s: FAIL send ack for prod %d to socket, %s\n",
+					LOG_PREFIX, p_conn->prod.seqno, strerror(-res));
+			rc = -1;
+		} else {
+			p_conn->ackoff += res;
+			p_conn->acklen -= res;
+		}
+	}
+
+	if (rc < 0 || p_conn->closing || uring_arm(p_eng, p_conn) < 0) {
+		/* frees the connection once nothing is in flight */
+		conn_close(p_eng, p_conn);
+	}
+	CurConn = NULL;
+} /* end uring_complete */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int uring_arm(engine_t *p_eng, conn_t *p_conn)
+
+FUNCTION DESCRIPTION
+	Queue a connection's next operations: its pending ack (if not already
+	being sent) and a receive for its next data.  The receive is linked
+	behind the ack, so the kernel starts it once the ack is out and no new
+	ack can be made before the last one is sent.  Product data is received
+	into the connection's own bodybuf, since many receives are in flight.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I	engine thread state
+	conn_t *		p_conn			I/O	connection state
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	size_t			bufsize			I	size of read buffer
+
+RETURNS
+	 0	Normal return
+	-1	Error, caller must close the connection
+*******************************************************************************/
+static int uring_arm(engine_t *p_eng, conn_t *p_conn)
+{
+	struct io_uring_sqe *p_sqe;
+	char *rbuf;
+	size_t rlen;
+
+	if (p_conn->state == CONN_BODY && !p_conn->bodybuf
+			&& !(p_conn->bodybuf = malloc(ServOpt.bufsize))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d bytes for bodybuf, %s\n",
+				LOG_PREFIX, ServOpt.bufsize, strerror(errno));
+		return -1;
+	}
+
+	/* room for the linked pair */
+	if (uring_sq_space(p_eng->ring) < 2 && uring_submit(p_eng->ring, 0) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL io_uring_enter, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+
+	p_sqe = NULL;
+	if (p_conn->acklen > 0 && !(p_conn->busy & URING_SEND)) {
+		p_sqe = uring_get_sqe(p_eng->ring);
+		p_sqe->opcode = IORING_OP_SEND;
+		p_sqe->fd = p_conn->sock_fd;
+		p_sqe->addr = (unsigned long)(p_conn->ackbuf + p_conn->ackoff);
+		p_sqe->len = p_conn->acklen;
+		p_sqe->msg_flags = MSG_NOSIGNAL|MSG_WAITALL;
+		p_sqe->user_data = (unsigned long)p_conn | URING_SEND;
+		p_conn->busy |= URING_SEND;
+	}
+
+	if ((p_conn->busy & URING_RECV) || (p_conn->acklen > 0 && !p_sqe)) {
+		/* already reading, or an ack is still going out */
+		return 0;
+	}
+
+	if (p_sqe) {
+		p_sqe->flags |= IOSQE_IO_LINK;
+	}
+
+	rlen = conn_rbuf(p_eng, p_conn, &rbuf);
+	p_sqe = uring_get_sqe(p_eng->ring);
+	p_sqe->opcode = IORING_OP_RECV;
+	p_sqe->fd = p_conn->sock_fd;
+	p_sqe->addr = (unsigned long)rbuf;
+	p_sqe->len = rlen;
+	p_sqe->user_data = (unsigned long)p_conn | URING_RECV;
+	p_conn->busy |= URING_RECV;
+
+	return 0;
+} /* end uring_arm */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int uring_accept(engine_t *p_eng)
+
+FUNCTION DESCRIPTION
+	Queue an accept on the thread's listen socket (user_data 0).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	engine_t *		p_eng			I/O	engine thread state
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int uring_accept(engine_t *p_eng)
+{
+	struct io_uring_sqe *p_sqe;
+
+	if (!(p_sqe = uring_get_sqe(p_eng->ring))
+			&& (uring_submit(p_eng->ring, 0) < 0
+				|| !(p_sqe = uring_get_sqe(p_eng->ring)))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL queue accept, %s\n",
+				LOG_PREFIX, strerror(errno));
+		return -1;
+	}
+
+	p_eng->accept_len = sizeof(p_eng->accept_addr);
+	p_sqe->opcode = IORING_OP_ACCEPT;
+	p_sqe->fd = p_eng->listen_sd;
+	p_sqe->addr = (unsigned long)&p_eng->accept_addr;
+	p_sqe->addr2 = (unsigned long)&p_eng->accept_len;
+	p_sqe->accept_flags = SOCK_CLOEXEC;
+	p_sqe->user_data = 0;
+
+	return 0;
+} /* end uring_accept */
+
+#endif /* INCLUDE_IO_URING */
+
+#endif /* __linux__ */
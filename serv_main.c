@@ -138,6 +138,7 @@ PARAMETERS
 GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
 	unsigned int	listen_port		O	port number for listen/connect
+	int				listen_backlog	O	listen queue length
 	char			debug			O	debug flag, do not daemonize
 	char			verbosity		O	debugging verbosity level
 	int				max_worker		O	maximum concurrent workers
@@ -145,6 +146,11 @@ GLOBAL VARIABLES (from ServOpt structure)
 	size_t			bufsize			O	max size to read from socket
 	char *			out_dir			O	storage directory for received files
 	int				outfile_flags	O	outfile open flags (overwrite)
+	int				engine_threads	O	receive engine threads (0=fork)
+	int				prefork			O	idle pre-forked workers (0=none)
+	size_t			splice_min		O	splice products this big (0=never)
+	char			io_uring		O	receive engine uses io_uring
+	int				ack_delay		O	msecs an ack may be held (0=none)
 	int				LogFile.flags	O	logging options flags
 
 RETURNS
@@ -157,11 +163,13 @@ static void process_args(int argc, char *argv[])
 
 	/* default options */
 	ServOpt.listen_port = DFLT_LISTEN_PORT;
+	ServOpt.listen_backlog = DFLT_LISTEN_BACKLOG;
 	ServOpt.debug = 0;
 	ServOpt.verbosity = 0;
 	ServOpt.max_worker = DFLT_MAX_WORKER;
 	ServOpt.timeout = DFLT_TIMEOUT;
 	ServOpt.bufsize = DFLT_BUFSIZE;
+	ServOpt.ack_delay = DFLT_ACK_DELAY;
 	if (!getcwd(ServOpt.outdir, FILENAME_LEN)) {
 		fprintf(stderr, "%s: FAIL getcwd, %s\n", LOG_PREFIX, strerror(errno));
 		exit(1);
@@ -175,7 +183,7 @@ static void process_args(int argc, char *argv[])
 	
 	ServOpt.outfile_flags = O_WRONLY|O_CREAT|O_EXCL;
 
-	while ((c = getopt(argc, argv, "dv:ap:w:t:b:c:l:D:OPm:s:")) != -1) {
+	while ((c = getopt(argc, argv, "dv:ap:w:t:b:c:l:D:OPm:s:e:f:B:S:UA:")) != -1) {
 		switch (c) {
 			case 'd':
 				fprintf(stdout, "%s: Setting debug option\n", Program);
@@ -221,6 +229,17 @@ static void process_args(int argc, char *argv[])
 						Program, optarg);
 				ServOpt.listen_port = atoi(optarg);
 				break;
+			case 'B':
+				fprintf(stdout, "%s: Setting listen backlog to %s\n",
+						Program, optarg);
+				ServOpt.listen_backlog = atoi(optarg);
+				if (ServOpt.listen_backlog < 1) {
+					fprintf(stderr,
+						"%s: Invalid listen backlog %d, (min=1)\n",
+						Program, ServOpt.listen_backlog);
+					exit(1);
+				}
+				break;
 			case 't':
 				fprintf(stdout, "%s: Setting timeout interval to %s\n",
 						Program, optarg);
@@ -253,11 +272,11 @@ static void process_args(int argc, char *argv[])
 				if (dirlen > 1 && optarg[dirlen-1] == '/') {
 					dirlen--;
 				}
-				/* filename format is <outdir>/<pid>-<seqno>%10000 */
-				if (dirlen + 12 > FILENAME_LEN) {
+				/* filename format is <outdir>/<pid>[_<conn>]-<seqno>%10000 */
+				if (dirlen + 24 > FILENAME_LEN) {
 					fprintf(stderr,
 						"%s: ERROR outdir path %s is too long (%d bytes max)\n",
-						Program, optarg, FILENAME_LEN - 12);
+						Program, optarg, FILENAME_LEN - 24);
 					exit(1);
 				}
 				strncpy(ServOpt.outdir, optarg, dirlen);
@@ -281,6 +300,71 @@ static void process_args(int argc, char *argv[])
 			case 's':
 				sprintf(Program+strlen(Program), "-%s", optarg);
 				break;
+			case 'e':
+				ServOpt.engine_threads = atoi(optarg);
+				if (ServOpt.engine_threads < 0
+						|| ServOpt.engine_threads > MAX_ENGINE_THREADS) {
+					fprintf(stderr,
+						"%s: Invalid engine threads %d, (min=0, max=%d)\n",
+						Program, ServOpt.engine_threads, MAX_ENGINE_THREADS);
+					exit(1);
+				}
+#if !defined(__linux__) || defined(INCLUDE_WMO_FILE_TBL)
+				if (ServOpt.engine_threads > 0) {
+					fprintf(stderr,
+						"%s: Receive engine is not available in this build\n",
+						Program);
+					exit(1);
+				}
+#endif
+				fprintf(stdout, "%s: Setting receive engine threads to %d\n",
+						Program, ServOpt.engine_threads);
+				break;
+			case 'f':
+				fprintf(stdout, "%s: Setting pre-forked worker count to %s\n",
+						Program, optarg);
+				ServOpt.prefork = atoi(optarg);
+				if (ServOpt.prefork < 0 || ServOpt.prefork > 100000) {
+					fprintf(stderr,
+						"%s: Invalid prefork %d, (min=0, max=100000)\n",
+						Program, ServOpt.prefork);
+					exit(1);
+				}
+				break;
+			case 'S':
+				ServOpt.splice_min = atoi(optarg);
+#ifndef __linux__
+				if (ServOpt.splice_min > 0) {
+					fprintf(stderr,
+						"%s: splice receive is not available in this build\n",
+						Program);
+					exit(1);
+				}
+#endif
+				fprintf(stdout, "%s: Setting splice receive min size to %lu\n",
+						Program, (unsigned long)ServOpt.splice_min);
+				break;
+			case 'U':
+#ifndef INCLUDE_IO_URING
+				fprintf(stderr,
+					"%s: io_uring is not available in this build\n", Program);
+				exit(1);
+#endif
+				fprintf(stdout, "%s: Setting receive engine to io_uring\n",
+						Program);
+				ServOpt.io_uring = 1;
+				break;
+			case 'A':
+				ServOpt.ack_delay = atoi(optarg);
+				if (ServOpt.ack_delay < 0 || ServOpt.ack_delay > 1000) {
+					fprintf(stderr,
+						"%s: Invalid ack delay %d, (min=0, max=1000)\n",
+						Program, ServOpt.ack_delay);
+					exit(1);
+				}
+				fprintf(stdout, "%s: Setting ack delay to %d msecs\n",
+						Program, ServOpt.ack_delay);
+				break;
 			case '?':
 				usage();
 				exit(0);
@@ -292,6 +376,24 @@ static void process_args(int argc, char *argv[])
 		} /* end switch */
 	} /* end while */
 
+	if (ServOpt.io_uring && ServOpt.engine_threads == 0) {
+		fprintf(stderr, "%s: -U needs the receive engine (-e)\n", Program);
+		exit(1);
+	}
+
+	if (ServOpt.prefork > 0) {
+		if (ServOpt.engine_threads > 0 || ServOpt.max_worker == 0) {
+			fprintf(stderr,
+				"%s: -f needs forked workers (-w > 0 and no -e)\n", Program);
+			exit(1);
+		}
+		if (ServOpt.prefork > ServOpt.max_worker) {
+			ServOpt.prefork = ServOpt.max_worker;
+			fprintf(stdout, "%s: Limit pre-forked workers to max_worker %d\n",
+					Program, ServOpt.prefork);
+		}
+	}
+
 	return;
 
 } /* end process_args */
@@ -323,6 +425,9 @@ static void usage(void)
 	fprintf(stderr,
 		"         [-w max_worker]  (maximum concurrent workers, default=%d)\n",
 		DFLT_MAX_WORKER);
+	fprintf(stderr,
+		"         [-B backlog]     (listen queue length, default=%d)\n",
+		DFLT_LISTEN_BACKLOG);
 	fprintf(stderr,
 		"         [-t timeout]     (socket timeout, default=%d secs)\n",
 		DFLT_TIMEOUT);
@@ -347,6 +452,23 @@ static void usage(void)
 		"         [-O]             (Overwrite output files, default NO)\n");
 	fprintf(stderr,
 		"         [-P]             (Toggle read perms on output files, default NO)\n");
+#if defined(__linux__) && !defined(INCLUDE_WMO_FILE_TBL)
+	fprintf(stderr,
+		"         [-e threads]     (receive engine threads, default=0 (fork))\n");
+#endif
+#ifdef INCLUDE_IO_URING
+	fprintf(stderr,
+		"         [-U]             (receive engine uses io_uring, default NO)\n");
+#endif
+	fprintf(stderr,
+		"         [-f workers]     (idle pre-forked workers to keep, default=0)\n");
+#ifdef __linux__
+	fprintf(stderr,
+		"         [-S min_size]    (splice products this big to disk, default=0 (off))\n");
+#endif
+	fprintf(stderr,
+		"         [-A msecs]       (longest to hold acks to send together, default=%d)\n",
+		DFLT_ACK_DELAY);
 
 #ifdef INCLUDE_WMO_FILE_TBL
 	fprintf(stderr,
@@ -8,11 +8,26 @@ FILE DESCRIPTION
 FUNCTIONS
 	service			- read products from socket and store them
 	recv_msghdr		- read and parse a message header from the socket
+	check_msghdr	- parse and validate a message header
 	recv_prod		- get product data from socket
+	recv_chunk		- get a chunk of a product from socket (protocol 3)
+	abort_chunks	- abort the products received in chunks
+	begin_prod		- handle the first block of a product, open output file
+	store_block		- write (or discard) a block of product data
+	end_prod		- close output file and finish a product
 	recv_conn_msg	- get connection message from socket
+	load_conn_msg	- parse a complete connection message
+	log_conn_msg	- log a connection message
 	open_out_file	- open an output file
-	send_ack		- send product acknowledgement to client
+	send_ack		- queue product acknowledgement for client
+	flush_acks		- write the acks queued to the socket
+	flush_due_acks	- write the acks queued if they can not wait
+	next_prod_ready	- check whether the next product is all buffered
+	ack_clock		- msecs clock for holding acks
+	recv_ahead		- get a block of data from the read-ahead buffer
 	recv_block		- read a block of data from a socket
+	splice_prod		- move product data from socket to file via a pipe
+	splice_drain	- move spliced data from the pipe to the output file
 	write_block		- write a block of data to disk
 	parse_conn_msg	- parse a connection message
 
@@ -28,6 +43,10 @@ NOTICE
 *******************************************************************************/
 static char Sccsid_serv_recv_c[]= "@(#)serv_recv.c 0.6 05/11/2004 12:43:054";
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* splice, F_SETPIPE_SZ */
+#endif
+
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -37,30 +56,77 @@ static char Sccsid_serv_recv_c[]= "@(#)serv_recv.c 0.6 05/11/2004 12:43:054";
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
 
 #include "share.h"
 #include "server.h"
 
-/* Big enough block to always contain a complete WMO */
-#define FIRST_BLK_SIZE	1024
-
 static int recv_msghdr(int sock_fd, int seqno, prod_info_t *p_prod);
 static int recv_prod(int sock_fd, char *recvbuf, size_t bufsiz, prod_info_t *p_prod);
-static int open_out_file(prod_info_t *p_prod);
+static int recv_chunk(int sock_fd, unsigned int *p_seqno);
+static void abort_chunks(void);
+static int open_out_file(prod_info_t *p_prod, int wait);
 static int send_ack(int sock_fd, int seqno, char code);
+static int flush_acks(int sock_fd);
+static void flush_due_acks(int waiting);
+static int next_prod_ready(int sock_fd);
+static long ack_clock(void);
+static int recv_ahead(int sock_fd, size_t minsiz, size_t maxsiz, char **p_data);
 static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz);
-static int write_block(int fd, char *blkbuf, size_t blksiz);
+#ifdef __linux__
+static ssize_t splice_prod(int sock_fd, int *p_out_fd, size_t size, char *recvbuf,
+				size_t bufsiz, prod_info_t *p_prod, char *p_ack_code);
+static int splice_drain(int *p_out_fd, size_t size, int *p_copy, char *recvbuf,
+				size_t bufsiz, prod_info_t *p_prod, char *p_ack_code);
+
+static int SplicePipe[2] = {-1, -1};	/* socket to file pipe */
+static size_t SpliceChunk;				/* pipe capacity */
+static int SpliceOff;					/* splice from socket not supported */
+#endif
+static int write_block(int fd, char *blkbuf, size_t blksiz, int wait);
 static int recv_conn_msg(int sock_fd, char *recvbuf, size_t buflen, prod_info_t *p_prod);
 static int parse_conn_msg(char *buf);
 
+/* protocol of the connection, 2 or 3 once the conn msg is acked
+   ACK_PROTO2 or ACK_PROTO3 */
+static int Protocol;
+
+/* products being received in chunks (protocol 3) */
+typedef struct {
+	int				in_use;
+	int				started;		/* begin_prod has been done */
+	prod_info_t		prod;
+	size_t			left;			/* bytes still to come */
+	int				out_fd;
+	char			ack_code;
+} chunk_prod_t;
+
+static chunk_prod_t ChunkProds[MAX_CHUNK_PRODS];
+
+/* acks queued by send_ack, written together by flush_acks */
+#define ACK_QUEUE_LEN		(MAX_ACK_LEN * 256)
+static char AckQueue[ACK_QUEUE_LEN+1];	/* + null from format_ack */
+static int AckQueued;					/* bytes queued */
+static int AckSeqno;					/* seqno of the last ack queued */
+static long AckTime;					/* ack_clock of the oldest ack */
+static int AckSock = -1;				/* socket service() acks on */
+
+/* data read from the socket ahead of the product being received */
+static char *ReadBuf;
+static size_t ReadSize;					/* allocated */
+static size_t ReadOff;					/* where the data starts */
+static size_t ReadLen;					/* bytes of data */
+
 /*******************************************************************************
 FUNCTION NAME
 	int service(int sock_fd, char *rhost)
 
 FUNCTION DESCRIPTION
-	Allocate receive buffer, call routines to read product headers and
-	data from socket, update seqno.
+	Allocate receive and read-ahead buffers, call routines to read product
+	headers and data from socket, update seqno.
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -81,9 +147,19 @@ int service(int sock_fd, char *rhost)
 	prod_info_t prod;
 	unsigned int seqno;
 	char *recvbuf;
+	int option = 1;
 
 	/* initialize */
 	seqno = 0;
+	Protocol = PROTOCOL_1;
+	AckQueued = 0;
+	AckSock = sock_fd;
+
+	/* acks are gathered by send_ack, send them as soon as they are written */
+	if (setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option))) {
+		CS_LOG_ERR(ERROR_FP, "%s: setsockopt TCP_NODELAY failed, %s\n",
+				LOG_PREFIX, strerror(errno));
+	}
 
 	if (!(recvbuf = malloc(ServOpt.bufsize))) {
 		CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d bytes for recvbuf, %s\n",
@@ -91,6 +167,16 @@ int service(int sock_fd, char *rhost)
 		return -1;
 	}
 
+	/* big enough for any first block, which must be contiguous */
+	ReadSize = MAX(ServOpt.bufsize, FIRST_BLK_SIZE);
+	ReadOff = ReadLen = 0;
+	if (!(ReadBuf = malloc(ReadSize))) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc %d bytes for ReadBuf, %s\n",
+				LOG_PREFIX, ReadSize, strerror(errno));
+		free(recvbuf);
+		return -1;
+	}
+
 	if (ServOpt.verbosity > 1) {
 		CS_LOG_DBUG(DEBUG_FP, "%s: Begin service for client on host %s\n",
 					LOG_PREFIX, rhost);
@@ -99,6 +185,20 @@ int service(int sock_fd, char *rhost)
 	/* read and process data */
 	while (!(Flags & (SHUTDOWN_FLAG|DISCONNECT_FLAG))) {
 
+		if (Protocol > PROTOCOL_2) {
+			/* as below, chunks of the next product may be logged */
+			if (rhost == RemoteHost) {
+				remote_host_refresh();
+				rhost = RemoteHost;
+			}
+
+			/* products come in chunks after the conn msg */
+			if (recv_chunk(sock_fd, &seqno) < 0) {
+				break;
+			}
+			continue;
+		}
+
 		if (recv_msghdr(sock_fd, seqno, &prod) < 0) {
 			break;
 		}
@@ -107,6 +207,13 @@ int service(int sock_fd, char *rhost)
 			break;
 		}
 
+		/* pick up the remote host name if it has been resolved, this
+		   replaces RemoteHost (which is our rhost) */
+		if (rhost == RemoteHost) {
+			remote_host_refresh();
+			rhost = RemoteHost;
+		}
+
 		if (recv_prod(sock_fd, recvbuf, ServOpt.bufsize, &prod) < 0) {
 			break;
 		}
@@ -119,7 +226,16 @@ int service(int sock_fd, char *rhost)
 					LOG_PREFIX, rhost);
 	}
 
+	abort_chunks();
 	free(recvbuf);
+	free(ReadBuf);
+	ReadBuf = NULL;
+
+	if (AckQueued && !(Flags & DISCONNECT_FLAG)) {
+		/* the products are stored, let the client know */
+		flush_acks(sock_fd);
+	}
+	AckSock = -1;
 
 	if (Flags & (SHUTDOWN_FLAG|DISCONNECT_FLAG)) {
 		/* clean up */
@@ -158,24 +274,58 @@ RETURNS
 static int recv_msghdr(int sock_fd, int seqno, prod_info_t *p_prod)
 {
 	int bytes_rcvd;
-	char recvbuf[MSG_HDR_LEN+PROD_HDR_LEN];
+	char *hdrbuf;
 
 	/* read and parse the header */
-	if ((bytes_rcvd = recv_block(sock_fd, recvbuf,
-			MSG_HDR_LEN+PROD_HDR_LEN, MSG_HDR_LEN+PROD_HDR_LEN)) <= 0) {
+	if ((bytes_rcvd = recv_ahead(sock_fd, MSG_HDR_LEN+PROD_HDR_LEN,
+			MSG_HDR_LEN+PROD_HDR_LEN, &hdrbuf)) <= 0) {
 		/* fail read header */
 		return -1;
 	}
 
+	return check_msghdr(hdrbuf, bytes_rcvd, seqno, Protocol, p_prod);
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	int check_msghdr(char *buf, size_t buflen, int seqno, int proto,
+				prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Parse a complete message header of protocol proto and check the seqno
+	and size.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			buf				I	message header
+	size_t			buflen			I	bytes in buf
+	int				seqno			I	expected product sequence #
+	int				proto			I	PROTOCOL_1 or PROTOCOL_2
+	prod_info_t *	p_prod			O	address of prod info structure
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+int check_msghdr(char *buf, size_t buflen, int seqno, int proto,
+				prod_info_t *p_prod)
+{
+	size_t max_size;
+
 	/* parse the header */
-	if (parse_msghdr(recvbuf, bytes_rcvd, p_prod) < 0) {
+	if ((proto > PROTOCOL_1 ? parse_msghdr2(buf, buflen, p_prod)
+			: parse_msghdr(buf, buflen, p_prod)) < 0) {
 		/* fatal protocol error */
 		return -1;
 	}
 
 	if (ServOpt.verbosity > 1) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: prod seqno=%d size=%d time=%s",
-				LOG_PREFIX, p_prod->seqno, p_prod->size,
+		CS_LOG_DBUG(DEBUG_FP, "%s: prod seqno=%d size=%lu time=%s",
+				LOG_PREFIX, p_prod->seqno, (unsigned long)p_prod->size,
 				ctime(&p_prod->queue_time));
 	}
 	
@@ -190,9 +340,11 @@ static int recv_msghdr(int sock_fd, int seqno, prod_info_t *p_prod)
 		}
 	}
 
-	if (p_prod->size <= 0 || p_prod->size > MAX_PROD_SIZE) {
-		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid prod size %d, max %d\n",
-				LOG_PREFIX, p_prod->size, MAX_PROD_SIZE);
+	max_size = proto > PROTOCOL_1 ? MAX_PROD_SIZE2 : MAX_PROD_SIZE;
+	if (p_prod->size <= 0 || p_prod->size > max_size) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid prod size %lu, max %lu\n",
+				LOG_PREFIX, (unsigned long)p_prod->size,
+				(unsigned long)max_size);
 		return -1;
 	}
 
@@ -205,12 +357,13 @@ FUNCTION NAME
 
 FUNCTION DESCRIPTION
 	Read product data from socket, write data to file call data handler,
-	and send ack/nack.
+	and send ack/nack.  The data is taken from the read-ahead buffer
+	(recv_ahead) and stored from there.
 
 PARAMETERS
 	Type			Name			I/O	Description
 	int				sock_fd			I	socket file descriptor
-	char *			recvbuf			I	buffer for data read from socket
+	char *			recvbuf			I	buffer for copying spliced data
 	size_t			bufsiz			I	size of buffer
 	prod_info_t *	p_prod			I	address of prod info structure
 
@@ -226,24 +379,25 @@ RETURNS
 *******************************************************************************/
 static int recv_prod(int sock_fd, char *recvbuf, size_t bufsiz, prod_info_t *p_prod)
 {
-	int bytes_rcvd;
-	int bytes_left;
-	size_t recvsiz;
+	ssize_t bytes_rcvd;
+	size_t bytes_left;
 	size_t minsiz;
+	char *blkbuf;
 	int out_fd;
-	int	rc;
 	char ack_code;
+	int rc;
 
 	/* initialize */
 	out_fd = -1;
+	ack_code = ACK_FAIL;
 
 	/* make sure 1st buffer is big enough to contain the WMO */
 	minsiz = MIN(p_prod->size, FIRST_BLK_SIZE);
 
 	/* read and process the product */
 	for (bytes_left = p_prod->size; bytes_left > 0; bytes_left -= bytes_rcvd) {
-		recvsiz = MIN(bytes_left, bufsiz);	/* don't read past end of product */
-		bytes_rcvd = recv_block(sock_fd, recvbuf, minsiz, recvsiz);
+		/* don't take past end of product, the rest stays read ahead */
+		bytes_rcvd = recv_ahead(sock_fd, minsiz, bytes_left, &blkbuf);
 		if (bytes_rcvd < 0) {
 			/* fail read block, close and abort product */
 			if (out_fd >= 0) {
@@ -260,100 +414,219 @@ static int recv_prod(int sock_fd, char *recvbuf, size_t bufsiz, prod_info_t *p_p
 			continue;
 		}
 
-		/* write each block */
 		if (bytes_left == p_prod->size) {
 			/* 1st block */
 
-			/* get wmo heading */
-			if (parse_wmo(recvbuf, bytes_rcvd, p_prod) < 0) {
-				CS_LOG_ERR(ERROR_FP,
-						"%s: FAIL parse wmo prod %d buf [%s], ttaaii=%s\n",
-						LOG_PREFIX, p_prod->seqno,
-						debug_buf(recvbuf, bytes_rcvd>50?50:bytes_rcvd),
-						p_prod->wmo_ttaaii);
-				/* process anyway */
-			}
-
 			/* Only need a minimum size for the 1st block */
 			minsiz = 1;
 
-			/* check for connection message */
-			if (p_prod->seqno == 0 && ServOpt.connect_wmo &&
-					!strcmp(p_prod->wmo_ttaaii, ServOpt.connect_wmo)) {
-				return recv_conn_msg(sock_fd, recvbuf, bytes_rcvd, p_prod);
+			if ((rc = begin_prod(blkbuf, bytes_rcvd, p_prod,
+					&out_fd, &ack_code, 1)) < 0) {
+				return -1;
+			} else if (rc > 0) {
+				return recv_conn_msg(sock_fd, blkbuf, bytes_rcvd, p_prod);
 			}
+		}
 
-			/* get output file */
-			if (get_out_path(p_prod) < 0) { /* NOT connection msg */
-
-				/*  FAIL create file name... assume we want to discard */
-				CS_LOG_ERR(ERROR_FP,
-							"%s: FAIL get_out_path, discard prod %d\n",
-							LOG_PREFIX, p_prod->seqno);
-				ack_code = ACK_FAIL;
+		/* write block of data */
+		store_block(&out_fd, blkbuf, bytes_rcvd, p_prod, &ack_code, 1);
+
+#ifdef __linux__
+		/* move the rest of a big product straight from socket to file */
+		if (bytes_left == p_prod->size && bytes_left > bytes_rcvd
+				&& out_fd >= 0 && !SpliceOff && ServOpt.splice_min > 0
+				&& p_prod->size >= ServOpt.splice_min) {
+			ssize_t bytes_spliced;
+
+			/* what was read ahead of the rest goes to the file first */
+			while (ReadLen > 0 && bytes_rcvd < bytes_left) {
+				bytes_spliced = recv_ahead(sock_fd, 1,
+						bytes_left - bytes_rcvd, &blkbuf);
+				store_block(&out_fd, blkbuf, bytes_spliced, p_prod,
+						&ack_code, 1);
+				bytes_rcvd += bytes_spliced;
 			}
 
-			/* open output file */
-			if (p_prod->filename) {
-				if ((out_fd = open_out_file(p_prod)) < 0) {
-					/* can't open file, assume we want to retry later */
-					ack_code = ACK_RETRY;
+			bytes_spliced = bytes_rcvd < bytes_left ? splice_prod(sock_fd,
+					&out_fd, bytes_left - bytes_rcvd, recvbuf, bufsiz, p_prod,
+					&ack_code) : 0;
+			if (bytes_spliced < 0) {
+				/* fail socket, product is started so abort it */
+				if (out_fd >= 0) {
+					close(out_fd);
+					out_fd = -1;
 				}
+				abort_recv(p_prod);
+				return -1;
 			}
+			bytes_rcvd += bytes_spliced;
 		}
+#endif
+	}
 
-		/* write block of data */
-		if (out_fd < 0) {
-			/* assume we want to discard */
-			if (ServOpt.verbosity > 0) {
-				CS_LOG_DBUG(DEBUG_FP, "%s: discarding %d bytes\n",
-						LOG_PREFIX, p_prod->size);
+	/* close file */
+	if (out_fd >= 0) {
+		ack_code = end_prod(out_fd, p_prod);
+		out_fd = -1;
+	}
+
+	/* send acknowledgement */
+	if (send_ack(sock_fd, p_prod->seqno, ack_code) < 0) {
+		/* fatal socket error */
+		return -1;
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static int recv_chunk(int sock_fd, unsigned int *p_seqno)
+
+FUNCTION DESCRIPTION
+	Read a protocol 3 chunk header and the chunk data from the socket, and
+	store the data in the product it belongs to.  A first chunk starts a
+	product in a free slot of ChunkProds; it must have the expected seqno,
+	and hold the first block begin_prod needs.  A product is finished and
+	acked when its last chunk is in, so a product that went ahead of a big
+	one is acked before it.  Chunks are taken through the read-ahead
+	buffer, they are not spliced.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket file descriptor
+	unsigned int *	p_seqno			I/O	expected seqno of the next product
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	 0	Normal return
+	-1	Error (the products in progress are left to abort_chunks)
+*******************************************************************************/
+static int recv_chunk(int sock_fd, unsigned int *p_seqno)
+{
+	prod_info_t hdr;
+	chunk_prod_t *p_chunk;
+	chunk_prod_t *p_free;
+	ssize_t bytes_rcvd;
+	size_t bytes_left;
+	size_t chunk_len;
+	size_t minsiz;
+	char *blkbuf;
+	int flags;
+	int first;
+	int rc;
+	int i;
+
+	if ((bytes_rcvd = recv_ahead(sock_fd, MSG2_HDR_LEN, MSG2_HDR_LEN,
+			&blkbuf)) <= 0) {
+		/* fail read header */
+		return -1;
+	}
+	memset(&hdr, '\0', sizeof(hdr));
+	if (parse_chunkhdr(blkbuf, bytes_rcvd, &hdr, &flags, &chunk_len) < 0) {
+		/* fatal protocol error */
+		return -1;
+	}
+	first = flags & CHUNK_FIRST;
+
+	if (ServOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: chunk seqno=%d p=%d %lu of %lu bytes%s\n",
+				LOG_PREFIX, hdr.seqno, hdr.priority, (unsigned long)chunk_len,
+				(unsigned long)hdr.size, first ? " first" : "");
+	}
+
+	/* find the product of the chunk, or a slot for a new one */
+	p_chunk = p_free = NULL;
+	for (i = 0; i < MAX_CHUNK_PRODS; i++) {
+		if (!ChunkProds[i].in_use) {
+			if (!p_free) {
+				p_free = &ChunkProds[i];
 			}
-		} else if (write_block(out_fd, recvbuf, bytes_rcvd) < bytes_rcvd) {
-			/* can't write, close and abort product */
-			close(out_fd);
-			out_fd = -1;
-			abort_recv(p_prod);
+		} else if (ChunkProds[i].prod.seqno == hdr.seqno) {
+			p_chunk = &ChunkProds[i];
+		}
+	}
 
-			/* set nack code but keep reading socket to stay in sync */
-			ack_code = ACK_RETRY;
+	if (first) {
+		if (hdr.seqno != *p_seqno && hdr.seqno != 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: ERROR expected seqno %d but got %d\n",
+					LOG_PREFIX, *p_seqno, hdr.seqno);
+			return -1;
+		}
+		if (p_chunk || !p_free) {
+			CS_LOG_ERR(ERROR_FP,
+					"%s: ERROR can not start prod %d, %d in progress\n",
+					LOG_PREFIX, hdr.seqno, MAX_CHUNK_PRODS);
+			return -1;
 		}
+		if (chunk_len < MIN(hdr.size, FIRST_BLK_SIZE)) {
+			CS_LOG_ERR(ERROR_FP,
+					"%s: ERROR first chunk of prod %d is %lu bytes, min %d\n",
+					LOG_PREFIX, hdr.seqno, (unsigned long)chunk_len,
+					FIRST_BLK_SIZE);
+			return -1;
+		}
+		p_chunk = p_free;
+		memcpy(&p_chunk->prod, &hdr, sizeof(hdr));
+		p_chunk->in_use = 1;
+		p_chunk->started = 0;
+		p_chunk->left = hdr.size;
+		p_chunk->out_fd = -1;
+		p_chunk->ack_code = ACK_FAIL;
+		*p_seqno = hdr.seqno + 1;
+	} else if (!p_chunk || hdr.size != p_chunk->prod.size
+			|| chunk_len > p_chunk->left) {
+		CS_LOG_ERR(ERROR_FP,
+				"%s: ERROR chunk of prod %d is not of a prod in progress\n",
+				LOG_PREFIX, hdr.seqno);
+		return -1;
 	}
 
-	/* close file */
-	if (out_fd >= 0) {
-		close(out_fd);
-		out_fd = -1;
+	/* read and store the chunk, the first block all at once */
+	minsiz = first ? MIN(hdr.size, FIRST_BLK_SIZE) : 1;
+	for (bytes_left = chunk_len; bytes_left > 0; bytes_left -= bytes_rcvd) {
+		if ((bytes_rcvd = recv_ahead(sock_fd, minsiz, bytes_left,
+				&blkbuf)) < 0) {
+			return -1;
+		} else if (bytes_rcvd == 0) {
+			/* interrupted?, try again */
+			continue;
+		}
 
-		if (ServOpt.outfile_flags & TOGGLE_PERMS_FLAG) {
-			/* set permissions to rw for ugo for the output file */
-			if (chmod(p_prod->filename, DFLT_FILE_PERMS) < 0) {
-				/* perhaps file was moved/removed before completion? */
-				CS_LOG_ERR(ERROR_FP,
-					"%s: Fail change permissions of file <%s>, Error: <%s>\n",
-					LOG_PREFIX, p_prod->filename, strerror(errno));
-				abort_recv(p_prod);
-				ack_code = ACK_RETRY;
-				if (send_ack(sock_fd, p_prod->seqno, ack_code) < 0) {
-					/* fatal socket error */
-					return -1;
+		if (first) {
+			first = 0;
+			minsiz = 1;
+			if ((rc = begin_prod(blkbuf, bytes_rcvd, &p_chunk->prod,
+					&p_chunk->out_fd, &p_chunk->ack_code, 1)) != 0) {
+				if (rc > 0) {
+					CS_LOG_ERR(ERROR_FP,
+						"%s: ERROR connection message in chunk of prod %d\n",
+						LOG_PREFIX, hdr.seqno);
 				}
-				return 0;
+				return -1;
 			}
+			p_chunk->started = 1;
 		}
 
-		/* Do whatever else is required to finish this product */
-		if ((rc = finish_recv(p_prod)) < 0) {
-			ack_code = ACK_FAIL;
-		} else  if (rc > 0) {
-			ack_code = ACK_RETRY;
-		} else {
-			ack_code = ACK_OK;
-		}
+		store_block(&p_chunk->out_fd, blkbuf, bytes_rcvd, &p_chunk->prod,
+				&p_chunk->ack_code, 1);
 	}
 
-	/* send acknowledgement */
-	if (send_ack(sock_fd, p_prod->seqno, ack_code) < 0) {
+	if ((p_chunk->left -= chunk_len) > 0) {
+		return 0;
+	}
+
+	/* that was the last chunk, close the file and ack the product */
+	p_chunk->in_use = 0;
+	if (p_chunk->out_fd >= 0) {
+		p_chunk->ack_code = end_prod(p_chunk->out_fd, &p_chunk->prod);
+		p_chunk->out_fd = -1;
+	}
+
+	if (send_ack(sock_fd, p_chunk->prod.seqno, p_chunk->ack_code) < 0) {
 		/* fatal socket error */
 		return -1;
 	}
@@ -363,17 +636,249 @@ static int recv_prod(int sock_fd, char *recvbuf, size_t bufsiz, prod_info_t *p_p
 
 /*******************************************************************************
 FUNCTION NAME
-	static int open_out_file(prod_info_t *p_prod)
+	static void abort_chunks(void)
+
+FUNCTION DESCRIPTION
+	Close and abort the products whose chunks had not all come in when
+	the connection ended.  The client sends them again.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	void
+*******************************************************************************/
+static void abort_chunks(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CHUNK_PRODS; i++) {
+		if (!ChunkProds[i].in_use) {
+			continue;
+		}
+		if (ChunkProds[i].out_fd >= 0) {
+			close(ChunkProds[i].out_fd);
+			ChunkProds[i].out_fd = -1;
+		}
+		if (ChunkProds[i].started) {
+			abort_recv(&ChunkProds[i].prod);
+		}
+		ChunkProds[i].in_use = 0;
+	}
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	int begin_prod(char *blkbuf, size_t blksiz, prod_info_t *p_prod,
+					int *p_out_fd, char *p_ack_code, int wait)
+
+FUNCTION DESCRIPTION
+	Process the first block of a product.  Parse the WMO heading, check for
+	a connection message, get the output path and open the output file.
+	The first block must be big enough to contain the WMO heading
+	(FIRST_BLK_SIZE or the whole product if it is smaller.)
+
+	If the output file can not be named or opened, *p_out_fd is left at -1,
+	the product data should be discarded, and *p_ack_code is set to the ack
+	to send.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			blkbuf			I	first block of product data
+	size_t			blksiz			I	bytes in blkbuf
+	prod_info_t *	p_prod			I/O	address of prod info structure
+	int *			p_out_fd		O	output file descriptor
+	char *			p_ack_code		O	ack code if the product is discarded
+	int				wait			I	sleep-retry open errors (1) or not (0)
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char *			connect_wmo		I	expect a connection msg with this wmo
+
+RETURNS
+	 1	Product is a connection message, caller must read the rest of it
+	 0	Normal return
+	-1	Connection message too big, caller must drop the connection
+*******************************************************************************/
+int begin_prod(char *blkbuf, size_t blksiz, prod_info_t *p_prod,
+				int *p_out_fd, char *p_ack_code, int wait)
+{
+	int rc;
+
+	*p_out_fd = -1;
+
+	/* get wmo heading */
+	if (parse_wmo(blkbuf, blksiz, p_prod) < 0) {
+		CS_LOG_ERR(ERROR_FP,
+				"%s: FAIL parse wmo prod %d buf [%s], ttaaii=%s\n",
+				LOG_PREFIX, p_prod->seqno,
+				debug_buf(blkbuf, blksiz>50?50:blksiz),
+				p_prod->wmo_ttaaii);
+		/* process anyway */
+	}
+
+	/* check for connection message */
+	if (p_prod->seqno == 0 && ServOpt.connect_wmo &&
+			!strcmp(p_prod->wmo_ttaaii, ServOpt.connect_wmo)) {
+		/* it is read into memory, protocol 2 sizes are not for it */
+		if (p_prod->size > MAX_PROD_SIZE) {
+			CS_LOG_ERR(ERROR_FP,
+					"%s: ERROR connection message size %lu, max %lu\n",
+					LOG_PREFIX, (unsigned long)p_prod->size,
+					(unsigned long)MAX_PROD_SIZE);
+			return -1;
+		}
+		return 1;
+	}
+
+	/* the acks held for the products before may not wait on the disk */
+	flush_due_acks(0);
+
+	/* get output file */
+	store_enter();
+	rc = get_out_path(p_prod);
+	store_leave();
+
+	if (rc < 0) {
+		/*  FAIL create file name... assume we want to discard */
+		CS_LOG_ERR(ERROR_FP,
+					"%s: FAIL get_out_path, discard prod %d\n",
+					LOG_PREFIX, p_prod->seqno);
+		*p_ack_code = ACK_FAIL;
+	} else if ((*p_out_fd = open_out_file(p_prod, wait)) < 0) {
+		/* can't open file, assume we want to retry later */
+		*p_ack_code = ACK_RETRY;
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	int store_block(int *p_out_fd, char *blkbuf, size_t blksiz,
+					prod_info_t *p_prod, char *p_ack_code, int wait)
+
+FUNCTION DESCRIPTION
+	Write a block of product data to the output file, or discard it if
+	there is no output file.  A write error closes and aborts the product
+	and sets a retry ack, but the caller must keep reading the product
+	to stay in sync with the client.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int *			p_out_fd		I/O	output file descriptor
+	char *			blkbuf			I	block of product data
+	size_t			blksiz			I	bytes in blkbuf
+	prod_info_t *	p_prod			I	address of prod info structure
+	char *			p_ack_code		O	ack code if the product is aborted
+	int				wait			I	sleep-retry write errors (1) or not (0)
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	 0	Block written or discarded
+	-1	Write failed, product aborted
+*******************************************************************************/
+int store_block(int *p_out_fd, char *blkbuf, size_t blksiz,
+				prod_info_t *p_prod, char *p_ack_code, int wait)
+{
+	if (*p_out_fd < 0) {
+		/* assume we want to discard */
+		if (ServOpt.verbosity > 0) {
+			CS_LOG_DBUG(DEBUG_FP, "%s: discarding %d bytes\n",
+					LOG_PREFIX, blksiz);
+		}
+	} else if (write_block(*p_out_fd, blkbuf, blksiz, wait) < blksiz) {
+		/* can't write, close and abort product */
+		close(*p_out_fd);
+		*p_out_fd = -1;
+		store_enter();
+		abort_recv(p_prod);
+		store_leave();
+
+		/* set nack code but keep reading socket to stay in sync */
+		*p_ack_code = ACK_RETRY;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	char end_prod(int out_fd, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Close the output file of a completely received product, toggle its
+	permissions if requested, and call finish_recv.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				out_fd			I	output file descriptor
+	prod_info_t *	p_prod			I	address of prod info structure
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				outfile_flags	I	flags for perms toggle
+
+RETURNS
+	ack code to send for the product
+*******************************************************************************/
+char end_prod(int out_fd, prod_info_t *p_prod)
+{
+	int rc;
+	char ack_code;
+
+	close(out_fd);
+
+	store_enter();
+
+	if (ServOpt.outfile_flags & TOGGLE_PERMS_FLAG) {
+		/* set permissions to rw for ugo for the output file */
+		if (chmod(p_prod->filename, DFLT_FILE_PERMS) < 0) {
+			/* perhaps file was moved/removed before completion? */
+			CS_LOG_ERR(ERROR_FP,
+				"%s: Fail change permissions of file <%s>, Error: <%s>\n",
+				LOG_PREFIX, p_prod->filename, strerror(errno));
+			abort_recv(p_prod);
+			store_leave();
+			return ACK_RETRY;
+		}
+	}
+
+	/* Do whatever else is required to finish this product */
+	if ((rc = finish_recv(p_prod)) < 0) {
+		ack_code = ACK_FAIL;
+	} else  if (rc > 0) {
+		ack_code = ACK_RETRY;
+	} else {
+		ack_code = ACK_OK;
+	}
+
+	store_leave();
+
+	return ack_code;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static int open_out_file(prod_info_t *p_prod, int wait)
 
 FUNCTION DESCRIPTION
 	Open output file.  Handle errors by retrying when the problem appears to
 	be with the file system or output directory.   If the problem appears to
 	be file-specific, or we can't figure out what the problem is, return -1
-	and let the service nack-retry to the client.
+	and let the service nack-retry to the client.  If wait is not set, the
+	sleep-retries are skipped and the client is nack-retried instead (the
+	receive engine can not block one connection without blocking others.)
 
 PARAMETERS
 	Type			Name			I/O	Description
 	prod_info_t *	p_prod			I	address of prod info structure
+	int				wait			I	sleep-retry (1) or give up (0)
 
 GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
@@ -385,7 +890,7 @@ RETURNS
 	 output file descriptor
 	-1	Error
 *******************************************************************************/
-static int open_out_file(prod_info_t *p_prod)
+static int open_out_file(prod_info_t *p_prod, int wait)
 {
 	int out_fd;
 	int retry;
@@ -478,7 +983,7 @@ static int open_out_file(prod_info_t *p_prod)
 					/* anything else is fatal */
 					return -1;
 			}
-			if (Flags & SHUTDOWN_FLAG) {
+			if ((Flags & SHUTDOWN_FLAG) || !wait) {
 				/* don't retry if shutting down */
 				return -1;
 			}
@@ -492,6 +997,7 @@ static int open_out_file(prod_info_t *p_prod)
 				CS_LOG_DBUG(DEBUG_FP, "%s: Retry #%d in %ld seconds\n",
 					LOG_PREFIX, retry+1, sleeptime);
 			}
+			flush_due_acks(1);
 			sleep(sleeptime);
 		} else {
 			/* file is open */
@@ -513,18 +1019,24 @@ static int open_out_file(prod_info_t *p_prod)
 
 /*******************************************************************************
 FUNCTION NAME
-	static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz) 
+	static int recv_ahead(int sock_fd, size_t minsiz, size_t maxsiz,
+				char **p_data) 
 
 FUNCTION DESCRIPTION
-	Read a block at least minsiz but no larger than maxsiz from socket.  Uses
-	alarm syscall and signal handler for timeout.
+	Get a block at least minsiz but no larger than maxsiz from the socket,
+	through the read-ahead buffer ReadBuf.  When ReadBuf holds less than
+	minsiz, one recv reads all it has room for, which for small products
+	is usually several whole products, so most blocks are taken without a
+	syscall.  The block is left in ReadBuf: *p_data points to it until
+	the next call.  minsiz must be no more than ReadSize.  Uses alarm
+	syscall and signal handler for timeout.
 
 PARAMETERS
 	Type			Name			I/O	Description
 	int				sock_fd			I	socket file descriptor
-	char *			blkbuf			O	buffer for data read from socket
-	size_t			minsiz			I	minimum size to read
-	size_t			maxsiz			I	maximum size to read
+	size_t			minsiz			I	minimum size to get
+	size_t			maxsiz			I	maximum size to get
+	char **			p_data			O	where the block is
 
 GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
@@ -533,39 +1045,214 @@ GLOBAL VARIABLES (from ServOpt structure)
 	int				Flags			I	Control Flags
 
 RETURNS
-	 total bytes read into buffer
+	 bytes in the block
+	 0	Interrupted by shutdown before anything was read
 	-1	Error
 *******************************************************************************/
-static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz) 
+static int recv_ahead(int sock_fd, size_t minsiz, size_t maxsiz, char **p_data)
 {
 	int bytes_rcvd;
 	size_t bytes_total;
-	size_t recvsiz;
-	char *recvbuf;
 
-	if (ServOpt.timeout > 0) {
-		alarm(ServOpt.timeout);
-	}
+	if (ReadLen < minsiz) {
+		if (ReadOff + minsiz > ReadSize) {
+			/* make room for the whole block after what we have */
+			memmove(ReadBuf, ReadBuf + ReadOff, ReadLen);
+			ReadOff = 0;
+		}
 
-	bytes_total = 0;
-	bytes_rcvd = 0;
-	while (!(Flags & DISCONNECT_FLAG) && bytes_total < minsiz) {
-		recvbuf = blkbuf + bytes_total;
-		recvsiz = maxsiz - bytes_total;
-		if ((bytes_rcvd = recv(sock_fd, recvbuf, recvsiz, 0)) < 0) {
-			/* error, unless due to an interrupt */
-			if (errno == EINTR) {
-				CS_LOG_DBUG(DEBUG_FP, "%s: recv syscall interrupted\n",
-						LOG_PREFIX);
-				if ((Flags & SHUTDOWN_FLAG) && bytes_total == 0) {
-					/* let caller decide whether to exit or retry */
-					return 0;
-				}
-			} else {
-				CS_LOG_ERR(ERROR_FP, "%s: FAIL recv from socket, %s\n",
-						LOG_PREFIX, strerror(errno));
+		if (ServOpt.timeout > 0) {
+			alarm(ServOpt.timeout);
+		}
+
+		bytes_total = 0;
+		bytes_rcvd = 0;
+		while (!(Flags & DISCONNECT_FLAG) && ReadLen < minsiz) {
+			if ((bytes_rcvd = recv(sock_fd, ReadBuf + ReadOff + ReadLen,
+					ReadSize - ReadOff - ReadLen, 0)) < 0) {
+				/* error, unless due to an interrupt */
+				if (errno == EINTR) {
+					CS_LOG_DBUG(DEBUG_FP, "%s: recv syscall interrupted\n",
+							LOG_PREFIX);
+					if ((Flags & SHUTDOWN_FLAG) && bytes_total == 0) {
+						/* let caller decide whether to exit or retry */
+						return 0;
+					}
+				} else {
+					CS_LOG_ERR(ERROR_FP, "%s: FAIL recv from socket, %s\n",
+							LOG_PREFIX, strerror(errno));
+					break;
+				}
+			} else if (bytes_rcvd == 0) {
+				/* this is usually due to a disconnect */
+				CS_LOG_ERR(ERROR_FP,
+						"%s: Recv 0 bytes from socket, flag disconnect\n",
+						LOG_PREFIX);
+				Flags |= DISCONNECT_FLAG;
 				break;
+			} else {
+				bytes_total += bytes_rcvd;
+				ReadLen += bytes_rcvd;
 			}
+		}
+
+		if (ServOpt.timeout > 0) {
+			alarm(ServOpt.timeout);
+		}
+
+		if (bytes_rcvd <= 0) {
+			return -1;
+		}
+
+		if (ServOpt.verbosity > 2) {
+			CS_LOG_DBUG(DEBUG_FP, "%s: received %d bytes\n",
+					LOG_PREFIX, bytes_total);
+		}
+	}
+
+	bytes_total = MIN(ReadLen, maxsiz);
+	*p_data = ReadBuf + ReadOff;
+	ReadOff += bytes_total;
+	if (!(ReadLen -= bytes_total)) {
+		ReadOff = 0;
+	}
+
+	return bytes_total;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz) 
+
+FUNCTION DESCRIPTION
+	Read a block at least minsiz but no larger than maxsiz from socket
+	(through the read-ahead buffer) into blkbuf.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket file descriptor
+	char *			blkbuf			O	buffer for data read from socket
+	size_t			minsiz			I	minimum size to read
+	size_t			maxsiz			I	maximum size to read
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	time_t			timeout			I	timeout interval (on socket)
+	int				Flags			I	Control Flags
+
+RETURNS
+	 total bytes read into buffer
+	-1	Error
+*******************************************************************************/
+static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz) 
+{
+	int bytes_rcvd;
+	size_t bytes_total;
+	char *p_data;
+
+	for (bytes_total = 0; bytes_total < minsiz; bytes_total += bytes_rcvd) {
+		if ((bytes_rcvd = recv_ahead(sock_fd, 1, maxsiz - bytes_total,
+				&p_data)) <= 0) {
+			return -1;
+		}
+		memcpy(blkbuf + bytes_total, p_data, bytes_rcvd);
+	}
+
+	return bytes_total;
+}
+
+#ifdef __linux__
+/*******************************************************************************
+FUNCTION NAME
+	static ssize_t splice_prod(int sock_fd, int *p_out_fd, size_t size,
+				char *recvbuf, size_t bufsiz, prod_info_t *p_prod,
+				char *p_ack_code)
+
+FUNCTION DESCRIPTION
+	Move the rest of a product from the socket to the output file through a
+	pipe with splice(), so the data is never copied into user space.
+
+	If the socket can not be spliced at all, splicing is turned off for this
+	process and 0 is returned so the caller reads the product normally.  If
+	the output file system can not take spliced data, the pipe is copied to
+	the file through recvbuf for the rest of this product.  File errors are
+	handled like store_block (product aborted, keep reading to stay in sync).
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket file descriptor
+	int *			p_out_fd		I/O	output file descriptor (-1 if aborted)
+	size_t			size			I	bytes of product data left to read
+	char *			recvbuf			I	buffer for copying if splice fails
+	size_t			bufsiz			I	size of buffer
+	prod_info_t *	p_prod			I	address of prod info structure
+	char *			p_ack_code		O	ack code if the product is aborted
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	time_t			timeout			I	timeout interval (on socket)
+	char			verbosity		I	debugging verbosity level
+	int				Flags			I/O	Control Flags
+
+RETURNS
+	 bytes of data read from socket (may be less than size)
+	-1	Error
+*******************************************************************************/
+static ssize_t splice_prod(int sock_fd, int *p_out_fd, size_t size, char *recvbuf,
+				size_t bufsiz, prod_info_t *p_prod, char *p_ack_code)
+{
+	size_t bytes_total;
+	ssize_t bytes_rcvd;
+	int copy;
+	int pipesiz;
+
+	if (SplicePipe[0] < 0) {
+		if (pipe(SplicePipe) < 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL create splice pipe, %s\n",
+					LOG_PREFIX, strerror(errno));
+			SpliceOff = 1;
+			return 0;
+		}
+#ifdef F_SETPIPE_SZ
+		/* fewer, bigger splices, if we are allowed (pipe-max-size) */
+		fcntl(SplicePipe[1], F_SETPIPE_SZ, MAX_BUFSIZE);
+		pipesiz = fcntl(SplicePipe[1], F_GETPIPE_SZ);
+#else
+		pipesiz = -1;
+#endif
+		SpliceChunk = pipesiz > 0 ? pipesiz : 64*1024;
+	}
+
+	if (ServOpt.timeout > 0) {
+		alarm(ServOpt.timeout);
+	}
+
+	copy = 0;
+	bytes_total = 0;
+	bytes_rcvd = 0;
+	while (!(Flags & DISCONNECT_FLAG) && bytes_total < size) {
+		flush_due_acks(0);
+		bytes_rcvd = splice(sock_fd, NULL, SplicePipe[1], NULL,
+				MIN(size - bytes_total, SpliceChunk),
+				SPLICE_F_MOVE|SPLICE_F_MORE);
+		if (bytes_rcvd < 0) {
+			if (errno == EINTR) {
+				CS_LOG_DBUG(DEBUG_FP, "%s: splice syscall interrupted\n",
+						LOG_PREFIX);
+				continue;
+			}
+			if (bytes_total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+				/* can't splice this socket, read it the normal way */
+				CS_LOG_ERR(ERROR_FP,
+						"%s: Can't splice from socket, %s, splice off\n",
+						LOG_PREFIX, strerror(errno));
+				SpliceOff = 1;
+				bytes_rcvd = 1;
+				break;
+			}
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL splice from socket, %s\n",
+					LOG_PREFIX, strerror(errno));
+			break;
 		} else if (bytes_rcvd == 0) {
 			/* this is usually due to a disconnect */
 			CS_LOG_ERR(ERROR_FP,
@@ -573,8 +1260,17 @@ static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz)
 					LOG_PREFIX);
 			Flags |= DISCONNECT_FLAG;
 			break;
-		} else {
-			bytes_total += bytes_rcvd;
+		}
+
+		bytes_total += bytes_rcvd;
+		if (splice_drain(p_out_fd, bytes_rcvd, &copy, recvbuf, bufsiz,
+				p_prod, p_ack_code) < 0) {
+			bytes_rcvd = -1;
+			break;
+		}
+
+		if (ServOpt.timeout > 0) {
+			alarm(ServOpt.timeout);
 		}
 	}
 
@@ -587,7 +1283,8 @@ static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz)
 	}
 
 	if (ServOpt.verbosity > 2) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: received %d bytes\n", LOG_PREFIX, bytes_total);
+		CS_LOG_DBUG(DEBUG_FP, "%s: spliced %lu bytes\n", LOG_PREFIX,
+				(unsigned long)bytes_total);
 	}
 
 	return bytes_total;
@@ -595,17 +1292,95 @@ static int recv_block(int sock_fd, char *blkbuf, size_t minsiz, size_t maxsiz)
 
 /*******************************************************************************
 FUNCTION NAME
-	static int write_block(int fd, char *blkbuf, size_t blksiz)
+	static int splice_drain(int *p_out_fd, size_t size, int *p_copy,
+				char *recvbuf, size_t bufsiz, prod_info_t *p_prod,
+				char *p_ack_code)
+
+FUNCTION DESCRIPTION
+	Empty size bytes from the splice pipe into the output file.  Splice
+	straight to the file while that works, otherwise (file system does not
+	support it, full disk, product aborted) copy through recvbuf and let
+	store_block write or discard the data.  Once splicing to the file fails
+	*p_copy is set and the rest of the product is copied.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int *			p_out_fd		I/O	output file descriptor (-1 if aborted)
+	size_t			size			I	bytes of data in the pipe
+	int *			p_copy			I/O	copy instead of splice to the file
+	char *			recvbuf			I	buffer for copying
+	size_t			bufsiz			I	size of buffer
+	prod_info_t *	p_prod			I	address of prod info structure
+	char *			p_ack_code		O	ack code if the product is aborted
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+
+RETURNS
+	 0	Normal return
+	-1	Error (pipe is unusable)
+*******************************************************************************/
+static int splice_drain(int *p_out_fd, size_t size, int *p_copy, char *recvbuf,
+				size_t bufsiz, prod_info_t *p_prod, char *p_ack_code)
+{
+	ssize_t bytes_moved;
+
+	while (size > 0) {
+		if (*p_out_fd >= 0 && !*p_copy) {
+			bytes_moved = splice(SplicePipe[0], NULL, *p_out_fd, NULL, size,
+					SPLICE_F_MOVE|SPLICE_F_MORE);
+			if (bytes_moved > 0) {
+				size -= bytes_moved;
+				continue;
+			}
+			if (bytes_moved < 0 && errno == EINTR) {
+				continue;
+			}
+			/* copy the rest, write_block does the error handling */
+			if (ServOpt.verbosity > 0) {
+				CS_LOG_DBUG(DEBUG_FP,
+						"%s: Can't splice to file desc %d, %s, copying\n",
+						LOG_PREFIX, *p_out_fd,
+						bytes_moved < 0 ? strerror(errno) : "no progress");
+			}
+			*p_copy = 1;
+		}
+
+		if ((bytes_moved = read(SplicePipe[0], recvbuf, MIN(size, bufsiz))) < 0
+				&& errno == EINTR) {
+			continue;
+		}
+		if (bytes_moved <= 0) {
+			CS_LOG_ERR(ERROR_FP, "%s: FAIL read splice pipe, %s\n",
+					LOG_PREFIX, bytes_moved < 0 ? strerror(errno) : "EOF");
+			close(SplicePipe[0]);
+			close(SplicePipe[1]);
+			SplicePipe[0] = SplicePipe[1] = -1;
+			return -1;
+		}
+		store_block(p_out_fd, recvbuf, bytes_moved, p_prod, p_ack_code, 1);
+		size -= bytes_moved;
+	}
+
+	return 0;
+}
+#endif
+
+/*******************************************************************************
+FUNCTION NAME
+	static int write_block(int fd, char *blkbuf, size_t blksiz, int wait)
 
 FUNCTION DESCRIPTION
-	Read a block at least minsiz but no larger than maxsiz from socket.  Uses
-	alarm syscall and signal handler for timeout.
+	Write a block of data to the output file.  Sleep and retry while the
+	file system is full, unless wait is not set.
 
 PARAMETERS
 	Type			Name			I/O	Description
 	int				fd				I	output file descriptor
 	char *			blkbuf			I	buffer of data to write
 	size_t			blksiz			I	amount of data to write
+	int				wait			I	sleep-retry (1) or give up (0)
 
 GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
@@ -616,7 +1391,7 @@ RETURNS
 	 bytes of data written
 	-1	Error
 *******************************************************************************/
-static int write_block(int fd, char *blkbuf, size_t blksiz)
+static int write_block(int fd, char *blkbuf, size_t blksiz, int wait)
 {
 	size_t bytes_left;
 	int wbytes;
@@ -626,6 +1401,8 @@ static int write_block(int fd, char *blkbuf, size_t blksiz)
 	retry = 0;
 	bytes_left = blksiz;
 
+	flush_due_acks(0);
+
 	while (bytes_left > 0) {
 		if ((wbytes = write(fd, blkbuf, bytes_left)) < 0) {
 			CS_LOG_ERR(ERROR_FP,
@@ -637,7 +1414,7 @@ static int write_block(int fd, char *blkbuf, size_t blksiz)
 					break;
 				case ENOSPC:
 					/* don't retry if shutting down */
-					if (Flags & SHUTDOWN_FLAG) {
+					if ((Flags & SHUTDOWN_FLAG) || !wait) {
 						return -1;
 					}
 					/* full file system, sleep and retry */
@@ -650,6 +1427,7 @@ static int write_block(int fd, char *blkbuf, size_t blksiz)
 						CS_LOG_DBUG(DEBUG_FP, "%s: Retry #%d in %d seconds\n",
 							LOG_PREFIX, retry+1, sleeptime);
 					}
+					flush_due_acks(1);
 					sleep(sleeptime);
 					break;
 				default:
@@ -682,8 +1460,12 @@ FUNCTION NAME
 	static int send_ack(int sock_fd, int seqno, char code)
 
 FUNCTION DESCRIPTION
-	Create an ack message and write it to the socket.  Use alarm syscall
-	with sighandler to timeout to prevent infinite block.
+	Create an ack message and queue it for the socket.  The acks queued
+	are written together by flush_acks when no further complete product
+	is waiting to be read (so reading it can not block), when the oldest
+	has been held ServOpt.ack_delay msecs, or when the queue is full.
+	Until then the next product is read and its ack joins the queue;
+	flush_due_acks writes them out if storing it takes too long.
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -693,28 +1475,71 @@ PARAMETERS
 
 GLOBAL VARIABLES (from ServOpt structure)
 	Type			Name			I/O	Description
-	char			verbosity		I	debugging verbosity level
-	int				Flags			I	Control Flags
+	int				ack_delay		I	msecs an ack may be held (0=none)
 
 RETURNS
-	 bytes of data written
+	 0	Normal return
 	-1	Error
 *******************************************************************************/
 static int send_ack(int sock_fd, int seqno, char code)
 {
-	char ackbuf[ACK_MSG_LEN+1];		/* sized for ack_msg + null terminator */
 	int	acklen;
-	int bytes_sent;
 
-	if ((acklen = format_ack(ackbuf, seqno, code)) < 0) {
+	if ((acklen = Protocol > PROTOCOL_1
+			? format_ack2(AckQueue + AckQueued, seqno, code)
+			: format_ack(AckQueue + AckQueued, seqno, code)) < 0) {
 		return -1;
 	}
+	if (!AckQueued) {
+		AckTime = ack_clock();
+	}
+	AckQueued += acklen;
+	AckSeqno = seqno;
+
+	if (AckQueued + MAX_ACK_LEN > ACK_QUEUE_LEN
+			|| ack_clock() - AckTime >= ServOpt.ack_delay
+			|| !next_prod_ready(sock_fd)) {
+		return flush_acks(sock_fd);
+	}
+
+	return 0;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static int flush_acks(int sock_fd)
+
+FUNCTION DESCRIPTION
+	Write the acks queued by send_ack to the socket in one send.  Use alarm
+	syscall with sighandler to timeout to prevent infinite block.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket file descriptor
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	time_t			timeout			I	timeout interval (on socket)
+	int				Flags			I	Control Flags
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+static int flush_acks(int sock_fd)
+{
+	int bytes_sent;
+	int ackoff;
 
 	/* set alarm for timeout on send */
 	if 	(ServOpt.timeout > 0) {
 		alarm(ServOpt.timeout);
 	}
-	while ((bytes_sent = send(sock_fd, ackbuf, acklen, 0)) < 0) {
+	for (ackoff = 0; ackoff < AckQueued; ackoff += bytes_sent) {
+		if ((bytes_sent = send(sock_fd, AckQueue + ackoff,
+				AckQueued - ackoff, 0)) >= 0) {
+			continue;
+		}
 		if (errno == EINTR) {
 			/* interrupted by signal */
 			if (Flags & DISCONNECT_FLAG) {
@@ -722,13 +1547,14 @@ static int send_ack(int sock_fd, int seqno, char code)
 				break;
 			} else {
 				/* try send again */
+				bytes_sent = 0;
 				continue;
 			}
 		}
 
 		/* any other error is a failure, break out of send loop */
 		CS_LOG_ERR(ERROR_FP, "%s: FAIL send ack for prod %d to socket, %s\n",
-				LOG_PREFIX, seqno, strerror(errno));
+				LOG_PREFIX, AckSeqno, strerror(errno));
 		break;
 	}
 
@@ -737,13 +1563,135 @@ static int send_ack(int sock_fd, int seqno, char code)
 		alarm(0);
 	}
 
-	if (bytes_sent != acklen) {
+	if (ackoff < AckQueued) {
+		AckQueued = 0;
 		return -1;
 	}
+	AckQueued = 0;
 
 	return 0;
 }
 
+/*******************************************************************************
+FUNCTION NAME
+	static void flush_due_acks(int waiting)
+
+FUNCTION DESCRIPTION
+	Write the acks queued by send_ack if the oldest has been held
+	ServOpt.ack_delay msecs, or if the caller is about to sleep-retry the
+	disk.  Called before each step of storing a product that may block,
+	so the acks of products already stored are not held past the delay
+	(and the client does not time out and send them again).  The socket
+	alarm of the caller, if any, is kept.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				waiting			I	caller is about to sleep (1) or not (0)
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	int				ack_delay		I	msecs an ack may be held (0=none)
+
+RETURNS
+	void
+*******************************************************************************/
+static void flush_due_acks(int waiting)
+{
+	unsigned int alarm_left;
+
+	/* nothing held, or not in service() (engine threads ack their own) */
+	if (AckSock < 0 || !AckQueued) {
+		return;
+	}
+	if (!waiting && ack_clock() - AckTime < ServOpt.ack_delay) {
+		return;
+	}
+
+	alarm_left = alarm(0);
+	flush_acks(AckSock);
+	if (alarm_left > 0) {
+		alarm(alarm_left);
+	}
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static int next_prod_ready(int sock_fd)
+
+FUNCTION DESCRIPTION
+	Check whether the whole of the next product (message header and data)
+	is already read ahead or in the socket receive buffer.  The socket is
+	only asked when the read-ahead buffer does not have it all.  With
+	protocol 3 it is the next chunk that is checked.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				sock_fd			I	socket file descriptor
+
+RETURNS
+	 1	Next product is all there
+	 0	Not (or not known)
+*******************************************************************************/
+static int next_prod_ready(int sock_fd)
+{
+	char hdrbuf[MSG_HDR_LEN+PROD_HDR_LEN];
+	long long msglen;
+	int nbytes;
+	int peeklen;
+
+	nbytes = 0;
+	if (ReadLen < MSG_HDR_LEN+PROD_HDR_LEN) {
+		/* the rest of the header is still in the socket */
+		peeklen = MSG_HDR_LEN+PROD_HDR_LEN - ReadLen;
+		if (ioctl(sock_fd, FIONREAD, &nbytes) < 0 || nbytes < peeklen
+				|| recv(sock_fd, hdrbuf + ReadLen, peeklen,
+					MSG_PEEK|MSG_DONTWAIT) != peeklen) {
+			return 0;
+		}
+		memcpy(hdrbuf, ReadBuf + ReadOff, ReadLen);
+	} else {
+		memcpy(hdrbuf, ReadBuf + ReadOff, sizeof(hdrbuf));
+	}
+	/* only the length, a bad header is logged when it is read */
+	if ((msglen = peek_msglen(hdrbuf, Protocol)) < 0) {
+		return 0;
+	}
+	if (ReadLen >= MSG_HDR_LEN+PROD_HDR_LEN + msglen) {
+		return 1;
+	}
+	if (!nbytes && ioctl(sock_fd, FIONREAD, &nbytes) < 0) {
+		return 0;
+	}
+
+	return ReadLen + nbytes >= MSG_HDR_LEN+PROD_HDR_LEN + msglen;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	static long ack_clock(void)
+
+FUNCTION DESCRIPTION
+	Get the time in msecs, to hold acks for at most ServOpt.ack_delay.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	msecs on a clock that is not changed by setting the system time
+*******************************************************************************/
+static long ack_clock(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+#endif
+	return (long)time(NULL) * 1000;
+}
+
 /*******************************************************************************
 FUNCTION NAME
 	static int recv_conn_msg(int sock_fd, char *buf, size_t buflen, prod_info_t *p_prod)
@@ -774,20 +1722,10 @@ static int recv_conn_msg(int sock_fd, char *buf, size_t buflen, prod_info_t *p_p
 	int bytes_left;
 	int bytes_rcvd;
 	char ack_code;
-	char *p_suff;
-	struct tm *p_tm;
-	char timebuf[DATESTR_MAX_LEN];
-	time_t now;
 
-	if (ServOpt.verbosity > 1) {
-		CS_LOG_DBUG(DEBUG_FP, "%s: recv connect msg [%s %s %s] %d bytes\n",
-				LOG_PREFIX, p_prod->wmo_ttaaii, p_prod->wmo_cccc,
-				p_prod->wmo_ddhhmm, p_prod->size); 
-	}
-
-	if (!(msgbuf = malloc(p_prod->size))) {
+	if (!(msgbuf = malloc(p_prod->size+1))) {
 		CS_LOG_ERR(ERROR_FP, "%s: FAIL malloc buflen=%d, %s\n",
-				LOG_PREFIX, buflen, strerror(errno));
+				LOG_PREFIX, p_prod->size+1, strerror(errno));
 		return -1;
 	}
 
@@ -804,38 +1742,131 @@ static int recv_conn_msg(int sock_fd, char *buf, size_t buflen, prod_info_t *p_p
 	}
 	msgbuf[p_prod->size] = '\0';
 
-	if (parse_conn_msg(msgbuf) < 0) {
-		ack_code = ACK_FAIL;
-	} else {
-		ack_code = ACK_OK;
-	}
+	ack_code = load_conn_msg(msgbuf, p_prod, PROTOCOL_3);
 	free(msgbuf);
 
-	strcpy(ConnInfo.wmo_cccc, p_prod->wmo_cccc);
-
 	if (send_ack(sock_fd, p_prod->seqno, ack_code) < 0) {
 		/* fatal socket error */
 		return -1;
 	}
+	/* the ack above is the last message of protocol 1 */
+	if (ack_code == ACK_PROTO2) {
+		Protocol = PROTOCOL_2;
+	} else if (ack_code == ACK_PROTO3) {
+		Protocol = PROTOCOL_3;
+	}
+
+	log_conn_msg(p_prod, 1);
 
-	if (!(p_suff = strrchr(Program, '_'))) {
-		p_suff = Program+strlen(Program);
+	return 0;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	char load_conn_msg(char *msgbuf, prod_info_t *p_prod, int max_proto)
+
+FUNCTION DESCRIPTION
+	Parse a complete, null-terminated connection message and load the
+	ConnInfo struct.  If the client asks for protocol 2 or 3, the ack is
+	ACK_PROTO2 or ACK_PROTO3 and the connection goes over to that protocol
+	after it.  The caller gives the highest protocol it can serve; a
+	client asking for more gets that.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			msgbuf			I	null-terminated conn msg data
+	prod_info_t *	p_prod			I	address of prod info structure
+	int				max_proto		I	highest protocol to agree to
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+	struct			ConnInfo		O	Connection information
+
+RETURNS
+	ack code to send for the connection message
+*******************************************************************************/
+char load_conn_msg(char *msgbuf, prod_info_t *p_prod, int max_proto)
+{
+	char ack_code;
+
+	if (ServOpt.verbosity > 1) {
+		CS_LOG_DBUG(DEBUG_FP, "%s: recv connect msg [%s %s %s] %d bytes\n",
+				LOG_PREFIX, p_prod->wmo_ttaaii, p_prod->wmo_cccc,
+				p_prod->wmo_ddhhmm, p_prod->size); 
 	}
 
-	if (ConnInfo.source[0]) {
-		sprintf(p_suff, "-%s", ConnInfo.source);
-	} else if (ConnInfo.remotehost[0]) {
-		sprintf(p_suff, "-%s", ConnInfo.remotehost);
+	store_enter();
+
+	if (parse_conn_msg(msgbuf) < 0) {
+		ack_code = ACK_FAIL;
+	} else if (ConnInfo.protocol >= PROTOCOL_3 && max_proto >= PROTOCOL_3) {
+		ack_code = ACK_PROTO3;
+	} else if (ConnInfo.protocol >= PROTOCOL_2 && max_proto >= PROTOCOL_2) {
+		ack_code = ACK_PROTO2;
+	} else {
+		ack_code = ACK_OK;
 	}
 
-	/* update product log file name */
-	if (PRODUCT_FP == &LogFile) {
-		rename_log(PRODUCT_FP, Program);
+	strcpy(ConnInfo.wmo_cccc, p_prod->wmo_cccc);
+
+	store_leave();
+
+	return ack_code;
+}
+
+/*******************************************************************************
+FUNCTION NAME
+	void log_conn_msg(prod_info_t *p_prod, int rename)
+
+FUNCTION DESCRIPTION
+	Log the connection info loaded from a connection message.  If rename is
+	set, the Program name and product log are renamed after the source (or
+	remote host) of the connection; only a worker serving a single client
+	should do this.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	prod_info_t *	p_prod			I	address of prod info structure
+	int				rename			I	rename Program and log file
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	struct			ConnInfo		I	Connection information
+	char *			Program			I/O	Program name
+
+RETURNS
+	void
+*******************************************************************************/
+void log_conn_msg(prod_info_t *p_prod, int rename)
+{
+	char *p_suff;
+	struct tm tm_buf;
+	char timebuf[DATESTR_MAX_LEN];
+	time_t now;
+
+	store_enter();
+
+	if (rename) {
+		if (!(p_suff = strrchr(Program, '_'))) {
+			p_suff = Program+strlen(Program);
+		}
+
+		if (ConnInfo.source[0]) {
+			sprintf(p_suff, "-%s", ConnInfo.source);
+		} else if (ConnInfo.remotehost[0]) {
+			sprintf(p_suff, "-%s", ConnInfo.remotehost);
+		}
+
+		/* update product log file name */
+		if (PRODUCT_FP == &LogFile) {
+			rename_log(PRODUCT_FP, Program);
+		}
 	}
 
 	time(&now);
-	p_tm = localtime(&now);
-	strftime(timebuf, sizeof(timebuf), "%m/%d/%Y %T", p_tm);
+	strftime(timebuf, sizeof(timebuf), "%m/%d/%Y %T",
+			localtime_r(&now, &tm_buf));
 
 	CS_LOG_PROD(PRODUCT_FP,
 		"CONNECT %s WMO[%-6s %-4s %-6s %-3s] {%s} REMOTE=%s SOURCE=%s LINK=%d\n",
@@ -844,7 +1875,7 @@ static int recv_conn_msg(int sock_fd, char *buf, size_t buflen, prod_info_t *p_p
 		p_prod->wmo_bbb, p_prod->wmo_nnnxxx,
 		ConnInfo.remotehost, ConnInfo.source, ConnInfo.link_id);
 
-	return 0;
+	store_leave();
 }
 
 /*******************************************************************************
@@ -853,6 +1884,8 @@ FUNCTION NAME
 
 FUNCTION DESCRIPTION
 	Parse null-terminated connection msg data and load ConnInfo struct.
+	Lines before CONN_MSG_START are skipped, except a PROTOCOL_ID line
+	asking for a protocol.
 
 PARAMETERS
 	Type			Name			I/O	Description
@@ -885,6 +1918,9 @@ static int parse_conn_msg(char *buf)
 		if (!strcmp(line, CONN_MSG_START)) {
 			break;
 		}
+		if (!strncmp(line, PROTOCOL_ID " ", sizeof(PROTOCOL_ID))) {
+			ConnInfo.protocol = atoi(line + sizeof(PROTOCOL_ID));
+		}
 	}
 
 	if (!line) {
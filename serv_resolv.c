@@ -0,0 +1,518 @@
+/*******************************************************************************
+FILE NAME
+	serv_resolv.c
+
+FILE DESCRIPTION
+	Remote host name resolution for accepted connections.  Reverse DNS
+	lookups are done by a resolver thread in the dispatcher, never in the
+	accept path.  Results are kept in a cache in shared memory (so forked
+	workers see them) with separate TTLs for names found and not found.
+	Until its name is known a connection is served under its numeric
+	address; service() fills in RemoteHost and ConnInfo.remotehost later.
+
+	Without process-shared pthread support the lookups are synchronous,
+	as they always were.
+
+FUNCTIONS
+	resolv_init			- set up the cache and start the resolver thread
+	resolv_close		- stop the resolver thread
+	resolv_name			- get a cached name or queue a lookup
+	remote_host_name	- get the host name of an accepted connection
+	remote_host_refresh	- update RemoteHost once its name is known
+	resolv_slot			- find (or take) the cache slot for an address
+	resolv_lock			- lock the cache, recovering it from a dead holder
+	resolv_thread		- resolver thread, do queued lookups
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_serv_resolv_c[]= "@(#)serv_resolv.c 0.1 10/15/2026 12:00:00";
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "share.h"
+#include "server.h"
+
+#if defined(_POSIX_THREAD_PROCESS_SHARED) && _POSIX_THREAD_PROCESS_SHARED > 0
+#define ASYNC_RESOLV
+#endif
+
+#ifdef ASYNC_RESOLV
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+
+#define RESOLV_CACHE_SIZE	512		/* cache entries */
+#define RESOLV_PROBE		8		/* slots searched for an address */
+
+/* cache entry states */
+#define RESOLV_EMPTY		'\0'
+#define RESOLV_PENDING		'P'		/* queued for the resolver thread */
+#define RESOLV_OK			'K'		/* name found */
+#define RESOLV_FAIL			'F'		/* no name, use the numeric address */
+
+typedef struct {
+	struct in_addr	addr;
+	char			state;
+	time_t			expires;
+	char			name[HOSTNAME_MAX_LEN+1];
+} resolv_entry_t;
+
+typedef struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wakeup;			/* lookups queued or stop */
+	int				stop;
+	resolv_entry_t	entry[RESOLV_CACHE_SIZE];
+} resolv_cache_t;
+
+static resolv_entry_t *resolv_slot(struct in_addr addr, time_t now);
+static void resolv_lock(resolv_cache_t *p_cache);
+static void *resolv_thread(void *arg);
+
+static resolv_cache_t	*Cache;		/* shared with forked workers */
+
+#endif /* ASYNC_RESOLV */
+
+/* peer of the connection this process is serving (fork and pool modes) */
+static struct in_addr	PeerAddr;
+static int				PeerResolved;
+
+/*******************************************************************************
+FUNCTION NAME
+	int resolv_init(void)
+
+FUNCTION DESCRIPTION
+	Map the shared resolver cache and start the resolver thread.  Must be
+	called by the dispatcher before any workers are forked.  If this
+	fails, names are looked up synchronously.  The thread takes no
+	signals, so they still interrupt the dispatcher's accept().  The
+	cache lock is robust, so a worker that dies holding it does not
+	leave it locked for the others.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	 0	Normal return
+	-1	Error
+*******************************************************************************/
+int resolv_init(void)
+{
+#ifdef ASYNC_RESOLV
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	pthread_attr_t tattr;
+	pthread_t tid;
+	sigset_t allsigs;
+	sigset_t oldsigs;
+	resolv_cache_t *p_cache;
+
+	p_cache = mmap(NULL, sizeof(resolv_cache_t), PROT_READ|PROT_WRITE,
+							MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (p_cache == MAP_FAILED) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL mmap %d bytes for resolver, %s\n",
+				LOG_PREFIX, sizeof(resolv_cache_t), strerror(errno));
+		return -1;
+	}
+	memset(p_cache, 0, sizeof(resolv_cache_t));
+
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef EOWNERDEAD
+	pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+	pthread_mutex_init(&p_cache->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&p_cache->wakeup, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	pthread_attr_init(&tattr);
+	pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+	/* only the dispatcher thread takes signals */
+	sigfillset(&allsigs);
+	pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+	errno = pthread_create(&tid, &tattr, resolv_thread, p_cache);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	pthread_attr_destroy(&tattr);
+	if (errno != 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL create resolver thread, %s\n",
+				LOG_PREFIX, strerror(errno));
+		munmap(p_cache, sizeof(resolv_cache_t));
+		return -1;
+	}
+
+	Cache = p_cache;
+#endif
+
+	return 0;
+} /* end resolv_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	void resolv_close(void)
+
+FUNCTION DESCRIPTION
+	Tell the resolver thread to stop.  The cache stays mapped since the
+	thread may still be waiting on a lookup.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	void
+*******************************************************************************/
+void resolv_close(void)
+{
+#ifdef ASYNC_RESOLV
+	if (!Cache) {
+		return;
+	}
+
+	resolv_lock(Cache);
+	Cache->stop = 1;
+	pthread_cond_broadcast(&Cache->wakeup);
+	pthread_mutex_unlock(&Cache->lock);
+#endif
+} /* end resolv_close */
+
+/*******************************************************************************
+FUNCTION NAME
+	int resolv_name(struct in_addr addr, char *name, size_t namelen)
+
+FUNCTION DESCRIPTION
+	Get the host name of an address without blocking.  If the cache has an
+	unexpired name for it, copy the name.  Otherwise copy the numeric
+	address and, unless a lookup already failed recently, queue a lookup
+	for the resolver thread.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	struct in_addr	addr			I	remote address
+	char *			name			O	host name or numeric address
+	size_t			namelen			I	size of name buffer
+
+RETURNS
+	 1	name is final (host name, or no name within the negative TTL)
+	 0	name is the numeric address, lookup pending
+*******************************************************************************/
+int resolv_name(struct in_addr addr, char *name, size_t namelen)
+{
+	struct hostent	*p_hostent;
+#ifdef ASYNC_RESOLV
+	resolv_entry_t *p_ent;
+	time_t now;
+	int rc;
+#endif
+
+	if (!inet_ntop(AF_INET, &addr, name, namelen)) {
+		snprintf(name, namelen, "unknown");
+	}
+
+#ifdef ASYNC_RESOLV
+	if (Cache) {
+		now = time(NULL);
+		rc = 0;
+
+		resolv_lock(Cache);
+
+		p_ent = resolv_slot(addr, now);
+		if (p_ent->state == RESOLV_OK) {
+			snprintf(name, namelen, "%s", p_ent->name);
+			rc = 1;
+		} else if (p_ent->state == RESOLV_FAIL) {
+			rc = 1;
+		} else if (p_ent->state == RESOLV_EMPTY) {
+			p_ent->addr = addr;
+			p_ent->state = RESOLV_PENDING;
+			p_ent->expires = now + RESOLV_NEG_TTL;
+			pthread_cond_signal(&Cache->wakeup);
+		}
+
+		pthread_mutex_unlock(&Cache->lock);
+
+		return rc;
+	}
+#endif
+
+	/* no resolver thread, look it up now */
+	if ((p_hostent = gethostbyaddr(&addr, sizeof(addr), AF_INET))
+			&& p_hostent->h_name) {
+		snprintf(name, namelen, "%s", p_hostent->h_name);
+	}
+
+	return 1;
+} /* end resolv_name */
+
+/*******************************************************************************
+FUNCTION NAME
+	char *remote_host_name(struct sockaddr_in *p_addr)
+
+FUNCTION DESCRIPTION
+	Get the host name of an accepted connection (the numeric address if the
+	name is not known yet) and remember the address for
+	remote_host_refresh.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	struct sockaddr_in *p_addr		I	remote socket address
+
+RETURNS
+	malloc'd host name
+*******************************************************************************/
+char *remote_host_name(struct sockaddr_in *p_addr)
+{
+	char name[HOSTNAME_MAX_LEN+1];
+
+	PeerAddr = p_addr->sin_addr;
+	PeerResolved = resolv_name(PeerAddr, name, sizeof(name));
+
+	return strdup(name);
+} /* end remote_host_name */
+
+/*******************************************************************************
+FUNCTION NAME
+	void remote_host_refresh(void)
+
+FUNCTION DESCRIPTION
+	If RemoteHost is still the numeric address of the peer, check whether
+	the resolver has found its name and update RemoteHost.  Also set
+	ConnInfo.remotehost to RemoteHost if the client did not provide one
+	in a connection message.  Called by service() before each product.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+GLOBAL VARIABLES (from ServOpt structure)
+	Type			Name			I/O	Description
+	char			verbosity		I	debugging verbosity level
+	char *			RemoteHost		I/O	remote host name
+	struct			ConnInfo		I/O	Connection information
+
+RETURNS
+	void
+*******************************************************************************/
+void remote_host_refresh(void)
+{
+	char name[HOSTNAME_MAX_LEN+1];
+	char *p_name;
+
+	if (!PeerResolved && RemoteHost
+			&& (PeerResolved = resolv_name(PeerAddr, name, sizeof(name)))
+			&& strcmp(name, RemoteHost)
+			&& (p_name = strdup(name))) {
+
+		if (ServOpt.verbosity > 0) {
+			CS_LOG_DBUG(DEBUG_FP, "%s: Remote host %s is %s\n",
+					LOG_PREFIX, RemoteHost, p_name);
+		}
+
+		/* replace the numeric name, also in ConnInfo if we put it there */
+		if (!strcmp(ConnInfo.remotehost, RemoteHost)) {
+			ConnInfo.remotehost[0] = '\0';
+		}
+		free(RemoteHost);
+		RemoteHost = p_name;
+	}
+
+	if (!ConnInfo.remotehost[0] && RemoteHost) {
+		sprintf(ConnInfo.remotehost, "%.*s",
+				(int)sizeof(ConnInfo.remotehost)-1, RemoteHost);
+	}
+} /* end remote_host_refresh */
+
+#ifdef ASYNC_RESOLV
+
+/*******************************************************************************
+FUNCTION NAME
+	static resolv_entry_t *resolv_slot(struct in_addr addr, time_t now)
+
+FUNCTION DESCRIPTION
+	Find the cache entry for an address.  If there is none, return an empty
+	entry for it, reusing an expired entry or else the one closest to
+	expiring.  Entries that have expired are emptied.  Called with the
+	cache locked.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	struct in_addr	addr			I	remote address
+	time_t			now				I	current time
+
+RETURNS
+	cache entry
+*******************************************************************************/
+static resolv_entry_t *resolv_slot(struct in_addr addr, time_t now)
+{
+	resolv_entry_t *p_ent;
+	resolv_entry_t *p_victim;
+	unsigned long hash;
+	int i;
+
+	hash = ntohl(addr.s_addr);
+	hash = (hash ^ (hash >> 9) ^ (hash >> 18)) % RESOLV_CACHE_SIZE;
+
+	p_victim = NULL;
+	for (i = 0; i < RESOLV_PROBE; i++) {
+		p_ent = &Cache->entry[(hash + i) % RESOLV_CACHE_SIZE];
+
+		if (p_ent->state != RESOLV_EMPTY && p_ent->state != RESOLV_PENDING
+				&& p_ent->expires <= now) {
+			p_ent->state = RESOLV_EMPTY;
+		}
+
+		if (p_ent->state != RESOLV_EMPTY
+				&& p_ent->addr.s_addr == addr.s_addr) {
+			return p_ent;
+		}
+
+		if (!p_victim || (p_victim->state != RESOLV_EMPTY
+				&& (p_ent->state == RESOLV_EMPTY
+					|| p_ent->expires < p_victim->expires))) {
+			p_victim = p_ent;
+		}
+	}
+
+	p_victim->state = RESOLV_EMPTY;
+	return p_victim;
+} /* end resolv_slot */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void resolv_lock(resolv_cache_t *p_cache)
+
+FUNCTION DESCRIPTION
+	Lock the resolver cache.  If a worker died holding the lock, take it
+	over and mark it consistent.  The holder can only have left one entry
+	part way through being queued or filled in, which at worst costs a
+	lookup or a numeric name until the entry expires.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	resolv_cache_t *p_cache			I	resolver cache
+
+RETURNS
+	void
+*******************************************************************************/
+static void resolv_lock(resolv_cache_t *p_cache)
+{
+#ifdef EOWNERDEAD
+	if (pthread_mutex_lock(&p_cache->lock) == EOWNERDEAD) {
+		CS_LOG_ERR(ERROR_FP, "%s: Resolver cache lock holder died\n",
+				LOG_PREFIX);
+		pthread_mutex_consistent(&p_cache->lock);
+	}
+#else
+	pthread_mutex_lock(&p_cache->lock);
+#endif
+} /* end resolv_lock */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void *resolv_thread(void *arg)
+
+FUNCTION DESCRIPTION
+	Resolver thread.  Wait for queued lookups, do them with the cache
+	unlocked, and store the results with the positive or negative TTL.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void *			arg				I	resolver cache
+
+RETURNS
+	NULL
+*******************************************************************************/
+static void *resolv_thread(void *arg)
+{
+	resolv_cache_t *p_cache = (resolv_cache_t *)arg;
+	resolv_entry_t *p_ent;
+	struct sockaddr_in sin;
+	struct timespec ts;
+	char name[HOSTNAME_MAX_LEN+1];
+	int found;
+	int i;
+
+	resolv_lock(p_cache);
+
+	while (!p_cache->stop) {
+
+		for (p_ent = NULL, i = 0; i < RESOLV_CACHE_SIZE; i++) {
+			if (p_cache->entry[i].state == RESOLV_PENDING) {
+				p_ent = &p_cache->entry[i];
+				break;
+			}
+		}
+
+		if (!p_ent) {
+			/* nothing queued, the timeout lets us notice a shutdown */
+			ts.tv_sec = time(NULL) + 1;
+			ts.tv_nsec = 0;
+#ifdef EOWNERDEAD
+			if (pthread_cond_timedwait(&p_cache->wakeup, &p_cache->lock,
+					&ts) == EOWNERDEAD) {
+				pthread_mutex_consistent(&p_cache->lock);
+			}
+#else
+			pthread_cond_timedwait(&p_cache->wakeup, &p_cache->lock, &ts);
+#endif
+			continue;
+		}
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr = p_ent->addr;
+
+		pthread_mutex_unlock(&p_cache->lock);
+
+		found = !getnameinfo((struct sockaddr *)&sin, sizeof(sin),
+						name, sizeof(name), NULL, 0, NI_NAMEREQD);
+
+		resolv_lock(p_cache);
+
+		/* the entry may have been taken for another address meanwhile */
+		if (p_ent->state == RESOLV_PENDING
+				&& p_ent->addr.s_addr == sin.sin_addr.s_addr) {
+			if (found) {
+				strcpy(p_ent->name, name);
+				p_ent->state = RESOLV_OK;
+				p_ent->expires = time(NULL) + RESOLV_TTL;
+			} else {
+				p_ent->state = RESOLV_FAIL;
+				p_ent->expires = time(NULL) + RESOLV_NEG_TTL;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&p_cache->lock);
+
+	return NULL;
+} /* end resolv_thread */
+
+#endif /* ASYNC_RESOLV */
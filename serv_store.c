@@ -120,8 +120,21 @@ int get_out_path(prod_info_t *p_prod)
 
 #else
 
-	sprintf (p_prod->filename, "%s/%.5d-%.6d",
-						ServOpt.outdir, getpid(), p_prod->seqno%1000000); 
+	/* the receive engine serves every connection from one pid, so add the
+	   connection's WorkerIndex (which starts over with each run) to the
+	   pid to keep file names unique */
+	if (ServOpt.engine_threads > 0 || WorkerConns > 0) {
+		/* engine connection or pre-forked worker, seqnos restart with
+		   each connection */
+		sprintf (p_prod->filename, "%s/%.5d_%d-%.6d",
+						ServOpt.outdir, getpid(),
+						ServOpt.engine_threads > 0 ? WorkerIndex : WorkerConns,
+						p_prod->seqno%1000000); 
+	} else {
+		sprintf (p_prod->filename, "%s/%.5d-%.6d",
+						ServOpt.outdir, getpid(),
+						p_prod->seqno%1000000); 
+	}
 	/* CS_LOG_DBUG(DEBUG_FP,
 			"%s: set filename to %s\n", LOG_PREFIX, p_prod->filename); */
 #endif
@@ -23,6 +23,7 @@ static char Sccsid_server_h[] = "@(#)server.h 0.3 09/24/2003 17:05:24";
 
 #include <unistd.h>
 #include <time.h>
+#include <netinet/in.h>
 
 #include "share.h"
 
@@ -32,6 +33,9 @@ static char Sccsid_server_h[] = "@(#)server.h 0.3 09/24/2003 17:05:24";
 
 #define DFLT_TIMEOUT		(30*60)
 #define DFLT_MAX_WORKER		99
+#define DFLT_LISTEN_BACKLOG	128
+#define MAX_ENGINE_THREADS	64
+#define DFLT_ACK_DELAY		10		/* msecs */
 #define DFLT_FILE_PERMS		(S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH)
 
 #define OVER_WRITE_FLAG		1
@@ -39,8 +43,13 @@ static char Sccsid_server_h[] = "@(#)server.h 0.3 09/24/2003 17:05:24";
 
 #define OUTPUT_SUBDIR_NAME	"output"
 
+/* remote host name cache time-to-live, for names found and not found */
+#define RESOLV_TTL			(60*60)
+#define RESOLV_NEG_TTL		(5*60)
+
 struct {
 	unsigned int	listen_port;
+	int				listen_backlog;
 	char			debug;
 	char			verbosity;
 	int				max_worker;
@@ -50,23 +59,50 @@ struct {
 	int				outfile_flags;
 	int				shm_region;
 	char *			connect_wmo;	/* expect a connection msg with this wmo */
+	int				engine_threads;	/* receive engine threads (0=fork) */
+	int				prefork;		/* idle pre-forked workers (0=none) */
+	size_t			splice_min;		/* splice products this big (0=never) */
+	char			io_uring;		/* receive engine uses io_uring */
+	int				ack_delay;		/* msecs an ack may be held (0=none) */
 } ServOpt;
 
-struct {
+typedef struct {
 	char			wmo_ttaaii[WMO_TTAAII_LEN+1];
 	char			wmo_cccc[WMO_CCCC_LEN+1];
 	char			source[SOURCE_MAX_LEN+1];
 	char			remotehost[HOSTNAME_MAX_LEN+1];
 	int				link_id;
-} ConnInfo;
+	int				protocol;		/* protocol asked for (0 if none) */
+} conn_info_t;
+
+conn_info_t	ConnInfo;
 
 char *	RemoteHost;			/* (remote) host name for client process */
 int		WorkerIndex;		/* unique index for this worker */
+int		WorkerConns;		/* connections served before this one (-f) */
 
 int dispatcher(void);
+int new_listen_socket(unsigned int port, int reuseport);
 void kill_workers(void);
 void wait_for_worker(void);
 int service(int sock_sd, char *rhost);
+int check_msghdr(char *buf, size_t buflen, int seqno, int proto,
+				prod_info_t *p_prod);
+int begin_prod(char *blkbuf, size_t blksiz, prod_info_t *p_prod,
+				int *p_out_fd, char *p_ack_code, int wait);
+int store_block(int *p_out_fd, char *blkbuf, size_t blksiz,
+				prod_info_t *p_prod, char *p_ack_code, int wait);
+char end_prod(int out_fd, prod_info_t *p_prod);
+char load_conn_msg(char *msgbuf, prod_info_t *p_prod, int max_proto);
+void log_conn_msg(prod_info_t *p_prod, int rename);
+int recv_engine(void);
+int resolv_init(void);
+void resolv_close(void);
+int resolv_name(struct in_addr addr, char *name, size_t namelen);
+char *remote_host_name(struct sockaddr_in *p_addr);
+void remote_host_refresh(void);
+void store_enter(void);
+void store_leave(void);
 int get_out_path(prod_info_t *p_prod);
 int finish_recv(prod_info_t *p_prod);
 int abort_recv(prod_info_t *p_prod);
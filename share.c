@@ -10,12 +10,24 @@ FUNCTIONS
 	parse_msghdr	- parse message header
 	format_ack		- format ack message
 	parse_ack		- parse ack message
+	format_msghdr2	- format protocol 2 message header
+	parse_msghdr2	- parse protocol 2 message header
+	format_ack2		- format protocol 2 ack message
+	parse_ack2		- parse protocol 2 ack message
+	format_chunkhdr	- format protocol 3 chunk header
+	parse_chunkhdr	- parse protocol 3 chunk header
+	peek_msglen		- data length a header gives, without checking it
+	put_le			- store an integer little-endian
+	get_le			- load a little-endian integer
+	put_dec			- store a zero-padded decimal field
+	get_dec			- load a decimal field
 	daemonize		- become a daemon process
 	my_mkdir		- mkdir w/ wrapper
 	my_rename		- rename w/ wrapper
 	my_copy			- copy w/ wrapper
 	get_ccb_len		- get length of CCB heading
 	write_pidfile	- write pid to file
+	str_hash		- hash a string for a hash table
 
 HISTORY
 	Last delta date and time:  %G% %U%
@@ -44,14 +56,32 @@ static char Sccsid_share_c[]= "@(#)share.c 0.7 04/12/2005 14:02:36";
 
 #include "share.h"
 
+static void put_le(unsigned char *p, unsigned long long val, int len);
+static unsigned long long get_le(unsigned char *p, int len);
+static void put_dec(char *p, unsigned long long val, int width);
+static int get_dec(char *p, int width, unsigned long long *p_val);
+
+/* protocol 1 message header fields (see README) */
+#define HDR_SIZE_LEN	8
+#define HDR_TYPE		"BI\001\r\r\n"	/* type, SOH and line end */
+#define HDR_TYPE_OFF	8
+#define HDR_SEQNO_OFF	14
+#define HDR_SEQNO_LEN	5
+#define HDR_TIME_OFF	19
+#define HDR_TIME_LEN	10
+#define HDR_TIME_MAX	9999999999LL
+#define HDR_END			"\r\r\n"
+#define HDR_END_OFF		29
+
 /*******************************************************************************
 FUNCTION NAME
 	int format_msghdr(char *buf, prod_info_t *p_prod)
 
 FUNCTION DESCRIPTION
-	Sprintf a message message for p_prod into buf.  Buffer must be at least
-	MSG_HDR_LEN+PROD_HDR_LEN+1 bytes (sprintf appends a null to the string.)
-	Assume buf is big enough since the message header length is fixed!
+	Format a message header for p_prod into buf, the same bytes as
+	"%.8dBI\001\r\r\n%.5d%.10ld\r\r\n" but without stdio.  Buffer must be
+	at least MSG_HDR_LEN+PROD_HDR_LEN bytes, no null is added.  Assume buf
+	is big enough since the message header length is fixed!
 
 PARAMETERS
 	Type			Name		I/O		Description
@@ -65,7 +95,6 @@ RETURNS
 int format_msghdr(char *buf, prod_info_t *p_prod)
 {
 	int msg_size;
-	char scratchbuf[MSG_HDR_LEN+PROD_HDR_LEN+1024];
 
 	if (p_prod->size <= 0 || p_prod->size > MAX_PROD_SIZE) {
 		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid prod size %d, max %d\n",
@@ -79,21 +108,23 @@ int format_msghdr(char *buf, prod_info_t *p_prod)
 		return -1;
 	}
 	
-	/* note PROD_HDR_LEN does not include the 10 byte message header */
-	msg_size = PROD_HDR_LEN + p_prod->size;
-
-	sprintf (scratchbuf, "%.8dBI\001\r\r\n%.5d%.10ld\r\r\n",
-			msg_size, p_prod->seqno, p_prod->queue_time);
-
-	/* header length must always equal MSG_HDR_LEN+PROD_HDR_LEN */
-	if (strlen(scratchbuf) != MSG_HDR_LEN+PROD_HDR_LEN) {
+	/* header length must always equal MSG_HDR_LEN+PROD_HDR_LEN, so the
+	   queue time must fit its 10 digits */
+	if (p_prod->queue_time < 0
+			|| (long long)p_prod->queue_time > HDR_TIME_MAX) {
 		CS_LOG_ERR(ERROR_FP,"%s: ERROR invalid header length for prod %d, %s\n",
 				LOG_PREFIX, p_prod->seqno, p_prod->filename);
 		return -1;
 	}
 
-	/* copy header (without trailing '\0') into user buffer */
-	memcpy(buf, scratchbuf, MSG_HDR_LEN+PROD_HDR_LEN);
+	/* note PROD_HDR_LEN does not include the 10 byte message header */
+	msg_size = PROD_HDR_LEN + p_prod->size;
+
+	put_dec(buf, msg_size, HDR_SIZE_LEN);
+	memcpy(buf + HDR_TYPE_OFF, HDR_TYPE, sizeof(HDR_TYPE)-1);
+	put_dec(buf + HDR_SEQNO_OFF, p_prod->seqno, HDR_SEQNO_LEN);
+	put_dec(buf + HDR_TIME_OFF, p_prod->queue_time, HDR_TIME_LEN);
+	memcpy(buf + HDR_END_OFF, HDR_END, sizeof(HDR_END)-1);
 
 	return MSG_HDR_LEN+PROD_HDR_LEN;
 }	/* end format_msghdr */
@@ -103,8 +134,10 @@ FUNCTION NAME
 	int parse_msghdr(char *buf, prod_info_t *p_prod)
 
 FUNCTION DESCRIPTION
-	sscanf a message header for p_prod from buf.  Store seqno, queue_time,
-	and size in p_prod struct.
+	Parse a message header for p_prod from buf.  Store seqno, queue_time,
+	and size in p_prod struct.  Every field must be exactly as
+	format_msghdr puts it: all digits, any two printable characters for
+	the type, and the SOH and line ends in place.
 
 PARAMETERS
 	Type			Name		I/O		Description
@@ -117,9 +150,9 @@ RETURNS
 *******************************************************************************/
 int parse_msghdr(char *buf, size_t buflen, prod_info_t *p_prod)
 {
-	int msg_size;
-	char anbi[3];
-	char scanbuf[MSG_HDR_LEN+PROD_HDR_LEN+1];
+	unsigned long long msg_size;
+	unsigned long long seqno;
+	unsigned long long queue_time;
 
 	/* header length must always equal MSG_HDR_LEN+PROD_HDR_LEN */
 	if (buflen < MSG_HDR_LEN+PROD_HDR_LEN) {
@@ -129,18 +162,23 @@ int parse_msghdr(char *buf, size_t buflen, prod_info_t *p_prod)
 		return -1;
 	}
 
-	/* copy header into a null-terminated scan buffer */
-	memcpy(scanbuf, buf, MSG_HDR_LEN+PROD_HDR_LEN);
-	scanbuf[MSG_HDR_LEN+PROD_HDR_LEN] = '\0';
-
-	if (sscanf(scanbuf, "%8d%2s\001\r\r\n%5d%10ld\r\r\n",
-			&msg_size, anbi, &p_prod->seqno, &p_prod->queue_time) != 4) {
+	/* type is AN, BI or FX, only BI is sent */
+	if (get_dec(buf, HDR_SIZE_LEN, &msg_size) < 0
+			|| buf[HDR_TYPE_OFF] <= ' ' || buf[HDR_TYPE_OFF] > '~'
+			|| buf[HDR_TYPE_OFF+1] <= ' ' || buf[HDR_TYPE_OFF+1] > '~'
+			|| memcmp(buf + HDR_TYPE_OFF+2, HDR_TYPE+2, sizeof(HDR_TYPE)-3)
+			|| get_dec(buf + HDR_SEQNO_OFF, HDR_SEQNO_LEN, &seqno) < 0
+			|| get_dec(buf + HDR_TIME_OFF, HDR_TIME_LEN, &queue_time) < 0
+			|| memcmp(buf + HDR_END_OFF, HDR_END, sizeof(HDR_END)-1)) {
 		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid header received [%s]\n",
-				LOG_PREFIX, scanbuf);
+				LOG_PREFIX, debug_buf(buf, MSG_HDR_LEN+PROD_HDR_LEN));
 		return -1;
 	}
 
+	/* a size below PROD_HDR_LEN is left for the caller to refuse */
 	p_prod->size = msg_size - PROD_HDR_LEN;
+	p_prod->seqno = seqno;
+	p_prod->queue_time = queue_time;
 
 	return MSG_HDR_LEN+PROD_HDR_LEN;
 }	/* end parse_msghdr */
@@ -150,9 +188,10 @@ FUNCTION NAME
 	int format_ack(char *buf, int seqno, char code)
 
 FUNCTION DESCRIPTION
-	Sprintf an ack message for seqno/code into buf.  Buffer must be at least
-	ACK_MSG_LEN+1 bytes (sprintf appends a null to the string.)  Assume buf
-	is big enough since the ack message length is fixed!
+	Format an ack message for seqno/code into buf, the same bytes as
+	"%5d%c" but without stdio.  Buffer must be at least ACK_MSG_LEN+1
+	bytes (a null is appended, as sprintf did.)  Assume buf is big enough
+	since the ack message length is fixed!
 
 PARAMETERS
 	Type			Name		I/O		Description
@@ -166,15 +205,28 @@ RETURNS
 *******************************************************************************/
 int format_ack(char *buf, int seqno, char code)
 {
-	sprintf (buf, "%5d%c", seqno, code);
+	int i;
 
 	/* ack message length must always equal ACK_MSG_LEN */
-	if (strlen(buf) != ACK_MSG_LEN) {
+	if (seqno < 0 || seqno > MAX_PROD_SEQNO || !code) {
 		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid header length for ack %d\n",
 				LOG_PREFIX, seqno);
 		return -1;
 	}
 
+	/* seqno right-justified, space-padded */
+	for (i = ACK_MSG_LEN-1; i > 0; ) {
+		buf[--i] = '0' + seqno % 10;
+		if (!(seqno /= 10)) {
+			break;
+		}
+	}
+	while (i > 0) {
+		buf[--i] = ' ';
+	}
+	buf[ACK_MSG_LEN-1] = code;
+	buf[ACK_MSG_LEN] = '\0';
+
 	return ACK_MSG_LEN;
 }	/* end format_ack */
 
@@ -183,8 +235,9 @@ FUNCTION NAME
 	int parse_ack(char *buf, int * p_seqno, char *p_code)
 
 FUNCTION DESCRIPTION
-	sscanf an ack message from buf.  Store seqno and code in p_seqno
-	and p_code respectively.
+	Parse an ack message from buf.  Store seqno and code in p_seqno
+	and p_code respectively.  The seqno must be as format_ack puts it
+	(digits, right-justified with spaces) and the code printable.
 
 PARAMETERS
 	Type			Name		I/O		Description
@@ -198,7 +251,9 @@ RETURNS
 *******************************************************************************/
 int parse_ack(char *buf, size_t buflen, int *p_seqno, char *p_code)
 {
-	char scanbuf[MSG_HDR_LEN+PROD_HDR_LEN+1];
+	unsigned long long seqno;
+	char code;
+	int i;
 
 	/* ack message length must always equal ACK_MSG_LEN */
 	if (buflen < ACK_MSG_LEN) {
@@ -207,19 +262,444 @@ int parse_ack(char *buf, size_t buflen, int *p_seqno, char *p_code)
 		return -1;
 	}
 
-	/* copy ack message into a null-terminated scan buffer */
-	memcpy(scanbuf, buf, ACK_MSG_LEN);
-	scanbuf[ACK_MSG_LEN] = '\0';
-
-	if (sscanf(scanbuf, "%d%c", p_seqno, p_code) != 2) {
+	for (i = 0; i < ACK_MSG_LEN-2 && buf[i] == ' '; i++);
+	code = buf[ACK_MSG_LEN-1];
+	if (get_dec(buf + i, ACK_MSG_LEN-1 - i, &seqno) < 0
+			|| code <= ' ' || code > '~' || (code >= '0' && code <= '9')) {
 		CS_LOG_ERR(ERROR_FP, "%s: ERROR Invalid ack received [%s]\n",
-				LOG_PREFIX, scanbuf);
+				LOG_PREFIX, debug_buf(buf, ACK_MSG_LEN));
 		return -1;
 	}
 
+	*p_seqno = seqno;
+	*p_code = code;
+
 	return ACK_MSG_LEN;
 }	/* end parse_ack */
 
+/*******************************************************************************
+FUNCTION NAME
+	int format_msghdr2(char *buf, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Put a protocol 2 message header for p_prod in buf (MSG2_HDR_LEN bytes,
+	see share.h).
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			O		buffer for message header
+	prod_info_t *	p_prod		I		prod info for the header
+
+RETURNS
+	 length of message header
+	-1: otherwise
+*******************************************************************************/
+int format_msghdr2(char *buf, prod_info_t *p_prod)
+{
+	unsigned char *p = (unsigned char *)buf;
+
+	if (p_prod->size <= 0 || p_prod->size > MAX_PROD_SIZE2) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid prod size %lu\n",
+				LOG_PREFIX, (unsigned long)p_prod->size);
+		return -1;
+	}
+
+	if (p_prod->seqno < 0 || p_prod->seqno > MAX_PROD_SEQNO2) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid prod seqno %d, max %d\n",
+				LOG_PREFIX, p_prod->seqno, MAX_PROD_SEQNO2);
+		return -1;
+	}
+
+	memcpy(p, MSG2_MAGIC, 4);
+	put_le(p + 4, 0, 4);
+	put_le(p + 8, p_prod->size, 8);
+	put_le(p + 16, p_prod->seqno, 4);
+	put_le(p + 20, 0, 4);
+	put_le(p + 24, (unsigned long long)p_prod->queue_time * 1000000000
+			+ p_prod->queue_nsec, 8);
+
+	return MSG2_HDR_LEN;
+}	/* end format_msghdr2 */
+
+/*******************************************************************************
+FUNCTION NAME
+	int parse_msghdr2(char *buf, size_t buflen, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	Parse a protocol 2 message header from buf.  Store seqno, queue_time,
+	queue_nsec and size in p_prod struct.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			I		message header buffer
+	size_t			buflen		I		bytes in buf
+	prod_info_t *	p_prod		O		prod info struct for parsed info 
+
+RETURNS
+	 length of message header
+	-1: otherwise
+*******************************************************************************/
+int parse_msghdr2(char *buf, size_t buflen, prod_info_t *p_prod)
+{
+	unsigned char *p = (unsigned char *)buf;
+	unsigned long long size;
+	unsigned long long nsecs;
+	unsigned long seqno;
+
+	if (buflen < MSG2_HDR_LEN) {
+		CS_LOG_ERR(ERROR_FP,
+				"%s: can not parse header, min length is %d bytes\n",
+				LOG_PREFIX, MSG2_HDR_LEN);
+		return -1;
+	}
+
+	size = get_le(p + 8, 8);
+	seqno = get_le(p + 16, 4);
+	if (memcmp(p, MSG2_MAGIC, 4) || get_le(p + 4, 4) || get_le(p + 20, 4)
+			|| size > MAX_PROD_SIZE2 || seqno > MAX_PROD_SEQNO2) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid header received [%s]\n",
+				LOG_PREFIX, debug_buf(buf, MSG2_HDR_LEN));
+		return -1;
+	}
+
+	nsecs = get_le(p + 24, 8);
+	p_prod->size = size;
+	p_prod->seqno = seqno;
+	p_prod->queue_time = nsecs / 1000000000;
+	p_prod->queue_nsec = nsecs % 1000000000;
+
+	return MSG2_HDR_LEN;
+}	/* end parse_msghdr2 */
+
+/*******************************************************************************
+FUNCTION NAME
+	int format_ack2(char *buf, int seqno, char code)
+
+FUNCTION DESCRIPTION
+	Put a protocol 2 ack message for seqno/code in buf (ACK2_MSG_LEN bytes).
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			O		buffer for ack message
+	int				seqno		I		seqno being acked
+	char			code		I		ack status code
+
+RETURNS
+	 length of message
+*******************************************************************************/
+int format_ack2(char *buf, int seqno, char code)
+{
+	unsigned char *p = (unsigned char *)buf;
+
+	put_le(p, (unsigned)seqno, 4);
+	p[4] = code;
+	p[5] = p[6] = p[7] = 0;
+
+	return ACK2_MSG_LEN;
+}	/* end format_ack2 */
+
+/*******************************************************************************
+FUNCTION NAME
+	int parse_ack2(char *buf, size_t buflen, int *p_seqno, char *p_code)
+
+FUNCTION DESCRIPTION
+	Parse a protocol 2 ack message from buf.  Store seqno and code in
+	p_seqno and p_code respectively.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			I		ack message buffer
+	size_t			buflen		I		bytes in buf
+	int *			p_seqno		O		address for seqno 
+	char *			p_code		O		address for ack status code
+
+RETURNS
+	 length of message
+	-1: otherwise
+*******************************************************************************/
+int parse_ack2(char *buf, size_t buflen, int *p_seqno, char *p_code)
+{
+	unsigned char *p = (unsigned char *)buf;
+
+	if (buflen < ACK2_MSG_LEN) {
+		CS_LOG_ERR(ERROR_FP, "%s: can not parse ack, min length is %d bytes\n",
+				LOG_PREFIX, ACK2_MSG_LEN);
+		return -1;
+	}
+
+	if (get_le(p, 4) > MAX_PROD_SEQNO2 || p[5] || p[6] || p[7]) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR Invalid ack received [%s]\n",
+				LOG_PREFIX, debug_buf(buf, ACK2_MSG_LEN));
+		return -1;
+	}
+
+	*p_seqno = get_le(p, 4);
+	*p_code = p[4];
+
+	return ACK2_MSG_LEN;
+}	/* end parse_ack2 */
+
+/*******************************************************************************
+FUNCTION NAME
+	int format_chunkhdr(char *buf, prod_info_t *p_prod, int flags,
+				size_t chunk_len)
+
+FUNCTION DESCRIPTION
+	Put a protocol 3 chunk header for chunk_len bytes of p_prod in buf
+	(MSG2_HDR_LEN bytes, see share.h).  The priority of p_prod goes in
+	the flags, up to CHUNK_PRIO_MAX.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			O		buffer for chunk header
+	prod_info_t *	p_prod		I		prod info for the header
+	int				flags		I		CHUNK_FIRST for the first chunk
+	size_t			chunk_len	I		bytes of product in the chunk
+
+RETURNS
+	 length of chunk header
+	-1: otherwise
+*******************************************************************************/
+int format_chunkhdr(char *buf, prod_info_t *p_prod, int flags,
+			size_t chunk_len)
+{
+	unsigned char *p = (unsigned char *)buf;
+
+	if (format_msghdr2(buf, p_prod) < 0) {
+		return -1;
+	}
+
+	if (chunk_len <= 0 || chunk_len > MAX_CHUNK_LEN
+			|| chunk_len > p_prod->size) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid chunk length %lu of %lu\n",
+				LOG_PREFIX, (unsigned long)chunk_len,
+				(unsigned long)p_prod->size);
+		return -1;
+	}
+
+	memcpy(p, MSG3_MAGIC, 4);
+	put_le(p + 4, (flags & CHUNK_FIRST) | (MIN(MAX(p_prod->priority, 0),
+			CHUNK_PRIO_MAX) << CHUNK_PRIO_SHIFT), 4);
+	put_le(p + 20, chunk_len, 4);
+
+	return MSG2_HDR_LEN;
+}	/* end format_chunkhdr */
+
+/*******************************************************************************
+FUNCTION NAME
+	int parse_chunkhdr(char *buf, size_t buflen, prod_info_t *p_prod,
+				int *p_flags, size_t *p_chunk_len)
+
+FUNCTION DESCRIPTION
+	Parse a protocol 3 chunk header from buf.  Store seqno, queue_time,
+	queue_nsec, size and priority in p_prod struct, and the flags and
+	chunk length in p_flags and p_chunk_len.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			I		chunk header buffer
+	size_t			buflen		I		bytes in buf
+	prod_info_t *	p_prod		O		prod info struct for parsed info 
+	int *			p_flags		O		address for flags
+	size_t *		p_chunk_len	O		address for chunk length
+
+RETURNS
+	 length of chunk header
+	-1: otherwise
+*******************************************************************************/
+int parse_chunkhdr(char *buf, size_t buflen, prod_info_t *p_prod,
+			int *p_flags, size_t *p_chunk_len)
+{
+	unsigned char *p = (unsigned char *)buf;
+	unsigned long long size;
+	unsigned long long nsecs;
+	unsigned long seqno;
+	unsigned long flags;
+	unsigned long chunk_len;
+
+	if (buflen < MSG2_HDR_LEN) {
+		CS_LOG_ERR(ERROR_FP,
+				"%s: can not parse header, min length is %d bytes\n",
+				LOG_PREFIX, MSG2_HDR_LEN);
+		return -1;
+	}
+
+	flags = get_le(p + 4, 4);
+	size = get_le(p + 8, 8);
+	seqno = get_le(p + 16, 4);
+	chunk_len = get_le(p + 20, 4);
+	if (memcmp(p, MSG3_MAGIC, 4)
+			|| (flags & ~(CHUNK_FIRST | (CHUNK_PRIO_MAX << CHUNK_PRIO_SHIFT)))
+			|| size > MAX_PROD_SIZE2 || seqno > MAX_PROD_SEQNO2
+			|| chunk_len == 0 || chunk_len > MAX_CHUNK_LEN
+			|| chunk_len > size) {
+		CS_LOG_ERR(ERROR_FP, "%s: ERROR invalid header received [%s]\n",
+				LOG_PREFIX, debug_buf(buf, MSG2_HDR_LEN));
+		return -1;
+	}
+
+	nsecs = get_le(p + 24, 8);
+	p_prod->size = size;
+	p_prod->seqno = seqno;
+	p_prod->queue_time = nsecs / 1000000000;
+	p_prod->queue_nsec = nsecs % 1000000000;
+	p_prod->priority = flags >> CHUNK_PRIO_SHIFT;
+	*p_flags = flags & CHUNK_FIRST;
+	*p_chunk_len = chunk_len;
+
+	return MSG2_HDR_LEN;
+}	/* end parse_chunkhdr */
+
+/*******************************************************************************
+FUNCTION NAME
+	long long peek_msglen(char *buf, int proto)
+
+FUNCTION DESCRIPTION
+	Get the length of the data after a message header (a chunk header in
+	protocol 3), for a header that has only been peeked at.  Nothing else
+	is checked and nothing is logged: the header is parsed, and any error
+	logged, once it is read.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			I		MSG_HDR_LEN+PROD_HDR_LEN bytes of header
+	int				proto		I		protocol of the connection
+
+RETURNS
+	 length of data after the header
+	-1: size field is not a valid length
+*******************************************************************************/
+long long peek_msglen(char *buf, int proto)
+{
+	unsigned long long msg_size;
+
+	if (proto > PROTOCOL_2) {
+		return get_le((unsigned char *)buf + 20, 4);
+	}
+	if (proto > PROTOCOL_1) {
+		msg_size = get_le((unsigned char *)buf + 8, 8);
+		return msg_size > MAX_PROD_SIZE2 ? -1 : (long long)msg_size;
+	}
+	if (get_dec(buf, HDR_SIZE_LEN, &msg_size) < 0 || msg_size < PROD_HDR_LEN) {
+		return -1;
+	}
+
+	return msg_size - PROD_HDR_LEN;
+}	/* end peek_msglen */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void put_le(unsigned char *p, unsigned long long val, int len)
+
+FUNCTION DESCRIPTION
+	Store the low len bytes of val at p, least significant first.
+
+PARAMETERS
+	Type				Name	I/O		Description
+	unsigned char *		p		O		where to store it
+	unsigned long long	val		I		value
+	int					len		I		bytes to store
+
+RETURNS
+	void
+*******************************************************************************/
+static void put_le(unsigned char *p, unsigned long long val, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++, val >>= 8) {
+		p[i] = val & 0xff;
+	}
+}	/* end put_le */
+
+/*******************************************************************************
+FUNCTION NAME
+	static unsigned long long get_le(unsigned char *p, int len)
+
+FUNCTION DESCRIPTION
+	Load a len byte integer stored least significant byte first.
+
+PARAMETERS
+	Type				Name	I/O		Description
+	unsigned char *		p		I		where it is stored
+	int					len		I		bytes to load
+
+RETURNS
+	value
+*******************************************************************************/
+static unsigned long long get_le(unsigned char *p, int len)
+{
+	unsigned long long val;
+
+	for (val = 0; len > 0; len--) {
+		val = (val << 8) | p[len-1];
+	}
+
+	return val;
+}	/* end get_le */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void put_dec(char *p, unsigned long long val, int width)
+
+FUNCTION DESCRIPTION
+	Store val as width decimal digits, zero-padded (like "%.*d").  The
+	caller makes sure it fits.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			p			O		where to store it
+	unsigned long long	val		I		value
+	int				width		I		number of digits
+
+RETURNS
+	void
+*******************************************************************************/
+static void put_dec(char *p, unsigned long long val, int width)
+{
+	while (width > 0) {
+		p[--width] = '0' + val % 10;
+		val /= 10;
+	}
+}	/* end put_dec */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int get_dec(char *p, int width, unsigned long long *p_val)
+
+FUNCTION DESCRIPTION
+	Load a decimal field of width characters, all of which must be digits
+	(no sign, no spaces).
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			p			I		field
+	int				width		I		number of digits (1 or more)
+	unsigned long long *	p_val	O	value
+
+RETURNS
+	 0	Normal return
+	-1	Not all digits
+*******************************************************************************/
+static int get_dec(char *p, int width, unsigned long long *p_val)
+{
+	unsigned long long val;
+	int i;
+
+	if (width < 1) {
+		return -1;
+	}
+	for (val = 0, i = 0; i < width; i++) {
+		if (p[i] < '0' || p[i] > '9') {
+			return -1;
+		}
+		val = val * 10 + (p[i] - '0');
+	}
+	*p_val = val;
+
+	return 0;
+}	/* end get_dec */
+
 /*******************************************************************************
 FUNCTION NAME
 	void daemonize(void)
@@ -607,3 +1087,29 @@ static void remove_pidfile(void)
 		PidFile = NULL;
 	}
 }
+
+/*******************************************************************************
+FUNCTION NAME
+	unsigned str_hash(const char *str)
+
+FUNCTION DESCRIPTION
+	Hash a string (FNV-1a) for a hash table index.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	const char *	str			I		string to hash
+
+RETURNS
+	hash value
+*******************************************************************************/
+unsigned str_hash(const char *str)
+{
+	unsigned hash;
+
+	for (hash = 2166136261U; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
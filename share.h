@@ -24,6 +24,7 @@ static char Sccsid_share_h[]= "@(#)share.h 0.9 06/20/2005 14:15:21";
 #include <time.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 #ifndef MIN
 #define MIN(a,b)			(((b)<(a))?(b):(a))
@@ -69,10 +70,57 @@ static char Sccsid_share_h[]= "@(#)share.h 0.9 06/20/2005 14:15:21";
 /* must change seqno field in header to use higher seqno than this */
 #define MAX_PROD_SEQNO		99999
 
+/* protocol 2: binary little-endian message header and ack, used on a
+   connection once the server has acked a connection message asking for
+   it with ACK_PROTO2.  The header is the same length as a protocol 1
+   header:
+	0	4	MSG2_MAGIC
+	4	4	flags (none defined yet, must be 0)
+	8	8	product size
+	16	4	seqno
+	20	4	reserved, 0
+	24	8	queue time, nsecs since the epoch
+   and an ack is the seqno (4 bytes), the code, and 3 zero bytes. */
+#define PROTOCOL_1			1
+#define PROTOCOL_2			2
+#define MSG2_MAGIC			"\001BI2"
+#define MSG2_HDR_LEN		(MSG_HDR_LEN+PROD_HDR_LEN)
+#define ACK2_MSG_LEN		8
+#define MAX_ACK_LEN			ACK2_MSG_LEN
+#define ACK_LEN(proto)		((proto) > PROTOCOL_1 ? ACK2_MSG_LEN : ACK_MSG_LEN)
+#define MAX_PROD_SIZE2		(((size_t)-1) >> 1)
+#define MAX_PROD_SEQNO2		0x7fffffff		/* seqno is still an int */
+
+/* protocol 3: protocol 2 with each product sent in chunks, so the chunks
+   of a product of higher priority can go ahead of the rest of a big one
+   (asked for and acked with ACK_PROTO3 as for protocol 2).  A chunk is a
+   header in the protocol 2 layout and chunk length bytes of the product:
+	0	4	MSG3_MAGIC
+	4	4	flags: CHUNK_FIRST, and the priority from CHUNK_PRIO_SHIFT up
+	8	8	product size
+	16	4	seqno of the product
+	20	4	chunk length, 1 to MAX_CHUNK_LEN
+	24	8	queue time, nsecs since the epoch
+   First chunks come in seqno order, and hold at least FIRST_BLK_SIZE
+   bytes (or all of a smaller product).  At most MAX_CHUNK_PRODS products
+   are in progress at once.  Acks are protocol 2 acks, in the order the
+   products are completed. */
+#define PROTOCOL_3			3
+#define MSG3_MAGIC			"\001BI3"
+#define CHUNK_FIRST			1
+#define CHUNK_PRIO_SHIFT	8
+#define CHUNK_PRIO_MAX		255
+#define MAX_CHUNK_LEN		MAX_BUFSIZE
+#define MAX_CHUNK_PRODS		8
+
+/* Big enough block to always contain a complete WMO */
+#define FIRST_BLK_SIZE		1024
+
 #define CONN_MSG_START	"CONNECTION MESSAGE"
 #define REMOTE_ID		"REMOTE"
 #define SOURCE_ID		"SOURCE"
 #define LINK_ID			"LINK"
+#define PROTOCOL_ID		"PROTOCOL"		/* before CONN_MSG_START, see README */
 
 /* CCB definitions */
 #define CCB_FLAG_BYTE		0
@@ -96,8 +144,13 @@ typedef struct prod_info_struct {
 	char	state;
 	int  	send_count;
 	time_t	queue_time;
+	long	queue_nsec;		/* and nsecs, sent with protocol 2 */
 	time_t	send_time;
 	int		priority;
+	char	closed;			/* writer closed the file (client inotify) */
+	char	bulk;			/* below the top priority (client -R) */
+	dev_t	dev;			/* device and inode of the file, */
+	ino_t	ino;			/*   0 if unknown (client window index) */
 	struct prod_info_struct	*p_next;
 } prod_info_t;
 
@@ -115,6 +168,8 @@ typedef struct prod_info_struct {
 #define ACK_OK			'K'
 #define ACK_FAIL		'F'
 #define ACK_RETRY		'R'
+#define ACK_PROTO2		'V'		/* conn msg OK, protocol 2 from here on */
+#define ACK_PROTO3		'M'		/* conn msg OK, protocol 3 from here on */
 
 /* Bits for global Flags variable */
 #define SHUTDOWN_FLAG	1
@@ -186,6 +241,16 @@ int parse_msghdr(char *buf, size_t buflen, prod_info_t *p_prod);
 int format_ack(char *buf, int seqno, char code);
 int parse_ack(char *buf, size_t buflen, int *p_seqno, char *p_code);
 
+int format_msghdr2(char *buf, prod_info_t *p_prod);
+int parse_msghdr2(char *buf, size_t buflen, prod_info_t *p_prod);
+int format_ack2(char *buf, int seqno, char code);
+int parse_ack2(char *buf, size_t buflen, int *p_seqno, char *p_code);
+int format_chunkhdr(char *buf, prod_info_t *p_prod, int flags,
+			size_t chunk_len);
+int parse_chunkhdr(char *buf, size_t buflen, prod_info_t *p_prod,
+			int *p_flags, size_t *p_chunk_len);
+long long peek_msglen(char *buf, int proto);
+
 void daemonize(void);
 
 int my_mkdir(const char *path);
@@ -204,4 +269,40 @@ int get_ccb_len(char *buf, size_t buflen);
 
 void write_pidfile(char *path);
 
+unsigned str_hash(const char *str);
+
+#ifdef INCLUDE_IO_URING
+/* io_uring ring, driven with raw system calls (uring.c) */
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+typedef struct {
+	int					ring_fd;
+	unsigned			sq_entries;
+	unsigned			sqe_tail;	/* next entry to hand out */
+	unsigned *			sq_head;
+	unsigned *			sq_tail;
+	unsigned *			sq_mask;
+	unsigned *			sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *			cq_head;
+	unsigned *			cq_tail;
+	unsigned *			cq_mask;
+	struct io_uring_cqe *cqes;
+	void *				sq_ring;
+	void *				cq_ring;
+	size_t				sq_len;
+	size_t				cq_len;
+	size_t				sqes_len;
+} uring_t;
+
+int uring_init(uring_t *p_ring, unsigned entries);
+void uring_close(uring_t *p_ring);
+struct io_uring_sqe *uring_get_sqe(uring_t *p_ring);
+unsigned uring_sq_space(uring_t *p_ring);
+int uring_submit(uring_t *p_ring, int wait_ms);
+struct io_uring_cqe *uring_peek_cqe(uring_t *p_ring);
+void uring_cqe_seen(uring_t *p_ring);
+#endif
+
 #endif
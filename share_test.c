@@ -0,0 +1,633 @@
+/*******************************************************************************
+FILE NAME
+	share_test.c
+
+FILE DESCRIPTION
+	Differential test and benchmark of the protocol 1 message header and
+	ack codec in share.c (format_msghdr, parse_msghdr, format_ack and
+	parse_ack) against the sprintf/sscanf versions it replaced, which are
+	kept here as the reference.  Built and run by "make check".
+
+	For random valid headers and acks, including the edges of each field,
+	the bytes formatted and the values parsed must be the same.  Each is
+	then parsed again with one random byte changed: share.c may refuse
+	what sscanf took, but must never take what sscanf refused, or parse
+	other values.  Last, one header and ack round trip is timed with each.
+
+	usage: share_test [count [seed]]
+
+FUNCTIONS
+	main				- run the tests and the benchmark
+	test_msghdr			- compare header formatting and parsing
+	test_ack			- compare ack formatting and parsing
+	bench				- time a header and ack round trip
+	old_format_msghdr	- format_msghdr as it was, with sprintf
+	old_parse_msghdr	- parse_msghdr as it was, with sscanf
+	old_format_ack		- format_ack as it was, with sprintf
+	old_parse_ack		- parse_ack as it was, with sscanf
+	pick				- random field value, often an edge
+	rnd					- random number
+	elapsed_ns			- nsecs since a time
+	write_log			- count log entries instead of writing them
+	log_prefix			- log entry heading (not used)
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_share_test_c[]= "@(#)share_test.c 0.1 10/16/2026 12:00:00";
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "share.h"
+
+#define DFLT_COUNT		1000000		/* random cases of each kind */
+#define BENCH_COUNT		1000000		/* round trips timed */
+#define HDR_LEN			(MSG_HDR_LEN+PROD_HDR_LEN)
+#define TIME_MAX		9999999999LL	/* 10 digit queue time */
+
+static int test_msghdr(long count);
+static int test_ack(long count);
+static void bench(void);
+static int old_format_msghdr(char *buf, prod_info_t *p_prod);
+static int old_parse_msghdr(char *buf, size_t buflen, prod_info_t *p_prod);
+static int old_format_ack(char *buf, int seqno, char code);
+static int old_parse_ack(char *buf, size_t buflen, int *p_seqno, char *p_code);
+static long long pick(long long min, long long max);
+static unsigned long long rnd(void);
+static double elapsed_ns(struct timespec *p_start);
+
+static unsigned long long Seed = 88172645463325252ULL;
+static long LogCount;				/* log entries share.c made */
+
+/*******************************************************************************
+FUNCTION NAME
+	int main(int argc, char *argv[])
+
+FUNCTION DESCRIPTION
+	Run the header and ack tests count times each, then the benchmark.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	int				argc			I	argument count
+	char *			argv[]			I	[count [seed]]
+
+RETURNS
+	 0	All cases agree
+	 1	Some did not (each is printed)
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+	long count;
+	int fails;
+
+	strcpy(Program, "share_test");
+	count = argc > 1 ? atol(argv[1]) : DFLT_COUNT;
+	if (argc > 2) {
+		Seed = strtoull(argv[2], NULL, 10) | 1;
+	}
+	if (count < 1) {
+		fprintf(stderr, "usage: %s [count [seed]]\n", argv[0]);
+		return 1;
+	}
+
+	fails = test_msghdr(count);
+	fails += test_ack(count);
+	printf("%s: %ld headers and %ld acks, %d differ (%ld errors logged)\n",
+			Program, count, count, fails, LogCount);
+
+	bench();
+
+	return fails ? 1 : 0;
+} /* end main */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int test_msghdr(long count)
+
+FUNCTION DESCRIPTION
+	Format count random headers with both versions and compare the return
+	and the bytes.  Some are out of range, which both must refuse.  Parse
+	the valid ones with both and compare, then again with one byte
+	changed.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long			count			I	cases to run
+
+RETURNS
+	number of cases that differ
+*******************************************************************************/
+static int test_msghdr(long count)
+{
+	char new_buf[HDR_LEN+1024];
+	char old_buf[HDR_LEN+1024];
+	prod_info_t prod;
+	prod_info_t new_prod;
+	prod_info_t old_prod;
+	int new_rc;
+	int old_rc;
+	int fails;
+	int pos;
+	long i;
+
+	memset(&prod, 0, sizeof(prod));
+	for (fails = 0, i = 0; i < count && fails < 10; i++) {
+		prod.size = pick(1, MAX_PROD_SIZE);
+		prod.seqno = pick(0, MAX_PROD_SEQNO);
+		prod.queue_time = pick(0, TIME_MAX);
+		if (i % 16 == 0) {
+			/* one field out of range */
+			switch (rnd() % 3) {
+				case 0:
+					prod.size = MAX_PROD_SIZE + 1 + rnd() % 1000;
+					break;
+				case 1:
+					prod.seqno = rnd() % 2 ? -1 - (int)(rnd() % 1000)
+							: MAX_PROD_SEQNO + 1 + (int)(rnd() % 1000);
+					break;
+				default:
+					prod.queue_time = rnd() % 2 ? -1 - (long)(rnd() % 1000)
+							: TIME_MAX + 1 + (long long)(rnd() % 1000);
+					break;
+			}
+		}
+
+		new_rc = format_msghdr(new_buf, &prod);
+		old_rc = old_format_msghdr(old_buf, &prod);
+		if (new_rc != old_rc
+				|| (new_rc > 0 && memcmp(new_buf, old_buf, HDR_LEN))) {
+			printf("format header size %lu seqno %d time %ld: %d [%.*s]"
+					" was %d [%.*s]\n", (unsigned long)prod.size, prod.seqno,
+					(long)prod.queue_time, new_rc, HDR_LEN, new_buf, old_rc,
+					HDR_LEN, old_buf);
+			fails++;
+			continue;
+		}
+		if (new_rc < 0) {
+			continue;
+		}
+
+		/* valid, then with one byte changed */
+		for (pos = -1; pos < HDR_LEN; pos = HDR_LEN) {
+			if (pos >= 0) {
+				pos = rnd() % HDR_LEN;
+				new_buf[pos] = rnd() % 4 ? (char)(rnd() % 256)
+						: "0123456789 -+\r\n"[rnd() % 15];
+			}
+			memset(&new_prod, 0, sizeof(new_prod));
+			memset(&old_prod, 0, sizeof(old_prod));
+			new_rc = parse_msghdr(new_buf, HDR_LEN, &new_prod);
+			old_rc = old_parse_msghdr(new_buf, HDR_LEN, &old_prod);
+			if ((pos < 0 && (new_rc != old_rc || new_rc < 0))
+					|| (new_rc > 0 && (old_rc != new_rc
+						|| new_prod.size != old_prod.size
+						|| new_prod.seqno != old_prod.seqno
+						|| new_prod.queue_time != old_prod.queue_time))) {
+				printf("parse header [%s]: %d size %lu seqno %d time %ld,"
+						" was %d size %lu seqno %d time %ld\n",
+						debug_buf(new_buf, HDR_LEN), new_rc,
+						(unsigned long)new_prod.size, new_prod.seqno,
+						(long)new_prod.queue_time, old_rc,
+						(unsigned long)old_prod.size, old_prod.seqno,
+						(long)old_prod.queue_time);
+				fails++;
+			}
+		}
+	}
+
+	return fails;
+} /* end test_msghdr */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int test_ack(long count)
+
+FUNCTION DESCRIPTION
+	Format count random acks with both versions and compare the return
+	and the bytes (with the null after them).  Parse them with both and
+	compare, then again with one byte changed.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long			count			I	cases to run
+
+RETURNS
+	number of cases that differ
+*******************************************************************************/
+static int test_ack(long count)
+{
+	char new_buf[ACK_MSG_LEN+1];
+	char old_buf[ACK_MSG_LEN+64];
+	char code;
+	char new_code;
+	char old_code;
+	int seqno;
+	int new_seqno;
+	int old_seqno;
+	int new_rc;
+	int old_rc;
+	int fails;
+	int pos;
+	long i;
+
+	for (fails = 0, i = 0; i < count && fails < 10; i++) {
+		seqno = pick(0, MAX_PROD_SEQNO);
+		/* any printable code but digits, as parse_ack takes */
+		do {
+			code = i % 2 ? "KFR"[rnd() % 3] : '!' + rnd() % ('~' - '!' + 1);
+		} while (code >= '0' && code <= '9');
+
+		new_rc = format_ack(new_buf, seqno, code);
+		old_rc = old_format_ack(old_buf, seqno, code);
+		if (new_rc != old_rc
+				|| (new_rc > 0 && memcmp(new_buf, old_buf, ACK_MSG_LEN+1))) {
+			printf("format ack %d %c: %d [%s] was %d [%s]\n", seqno, code,
+					new_rc, new_buf, old_rc, old_buf);
+			fails++;
+			continue;
+		}
+
+		for (pos = -1; pos < ACK_MSG_LEN; pos = ACK_MSG_LEN) {
+			if (pos >= 0) {
+				pos = rnd() % ACK_MSG_LEN;
+				new_buf[pos] = rnd() % 4 ? (char)(rnd() % 256)
+						: "0123456789 -+KFR"[rnd() % 16];
+			}
+			new_seqno = old_seqno = -1;
+			new_code = old_code = '\0';
+			new_rc = parse_ack(new_buf, ACK_MSG_LEN, &new_seqno, &new_code);
+			old_rc = old_parse_ack(new_buf, ACK_MSG_LEN, &old_seqno,
+					&old_code);
+			if ((pos < 0 && (new_rc != old_rc || new_rc < 0))
+					|| (new_rc > 0 && (old_rc != new_rc
+						|| new_seqno != old_seqno || new_code != old_code))) {
+				printf("parse ack [%s]: %d %d %c, was %d %d %c\n",
+						debug_buf(new_buf, ACK_MSG_LEN), new_rc, new_seqno,
+						new_code, old_rc, old_seqno, old_code);
+				fails++;
+			}
+		}
+	}
+
+	return fails;
+} /* end test_ack */
+
+/*******************************************************************************
+FUNCTION NAME
+	static void bench(void)
+
+FUNCTION DESCRIPTION
+	Time BENCH_COUNT round trips (format and parse a header, format and
+	parse its ack) with each version, and print the nsecs per round trip.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	void
+*******************************************************************************/
+static void bench(void)
+{
+	struct timespec start;
+	char hdrbuf[HDR_LEN+1024];
+	char ackbuf[ACK_MSG_LEN+64];
+	prod_info_t prod;
+	prod_info_t parsed;
+	double new_ns;
+	double old_ns;
+	long sum;
+	char code;
+	int seqno;
+	long i;
+
+	memset(&prod, 0, sizeof(prod));
+	prod.queue_time = time(NULL);
+	prod.size = 12345;
+
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_COUNT; i++) {
+		prod.seqno = i % (MAX_PROD_SEQNO+1);
+		format_msghdr(hdrbuf, &prod);
+		parse_msghdr(hdrbuf, HDR_LEN, &parsed);
+		format_ack(ackbuf, parsed.seqno, ACK_OK);
+		parse_ack(ackbuf, ACK_MSG_LEN, &seqno, &code);
+		sum += seqno + parsed.size;
+	}
+	new_ns = elapsed_ns(&start) / BENCH_COUNT;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_COUNT; i++) {
+		prod.seqno = i % (MAX_PROD_SEQNO+1);
+		old_format_msghdr(hdrbuf, &prod);
+		old_parse_msghdr(hdrbuf, HDR_LEN, &parsed);
+		old_format_ack(ackbuf, parsed.seqno, ACK_OK);
+		old_parse_ack(ackbuf, ACK_MSG_LEN, &seqno, &code);
+		sum -= seqno + parsed.size;
+	}
+	old_ns = elapsed_ns(&start) / BENCH_COUNT;
+
+	printf("%s: header and ack round trip %.0f ns, was %.0f ns with stdio%s\n",
+			Program, new_ns, old_ns, sum ? " (results differ)" : "");
+} /* end bench */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int old_format_msghdr(char *buf, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	format_msghdr before it was written without stdio, less the logging.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			O		buffer for message header
+	prod_info_t *	p_prod		I		prod info for the header
+
+RETURNS
+	 length of message
+	-1: otherwise
+*******************************************************************************/
+static int old_format_msghdr(char *buf, prod_info_t *p_prod)
+{
+	int msg_size;
+	char scratchbuf[MSG_HDR_LEN+PROD_HDR_LEN+1024];
+
+	if (p_prod->size <= 0 || p_prod->size > MAX_PROD_SIZE) {
+		return -1;
+	}
+
+	if (p_prod->seqno < 0 || p_prod->seqno > MAX_PROD_SEQNO) {
+		return -1;
+	}
+
+	/* note PROD_HDR_LEN does not include the 10 byte message header */
+	msg_size = PROD_HDR_LEN + p_prod->size;
+
+	sprintf (scratchbuf, "%.8dBI\001\r\r\n%.5d%.10ld\r\r\n",
+			msg_size, p_prod->seqno, p_prod->queue_time);
+
+	/* header length must always equal MSG_HDR_LEN+PROD_HDR_LEN */
+	if (strlen(scratchbuf) != MSG_HDR_LEN+PROD_HDR_LEN) {
+		return -1;
+	}
+
+	/* copy header (without trailing '\0') into user buffer */
+	memcpy(buf, scratchbuf, MSG_HDR_LEN+PROD_HDR_LEN);
+
+	return MSG_HDR_LEN+PROD_HDR_LEN;
+}	/* end old_format_msghdr */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int old_parse_msghdr(char *buf, size_t buflen, prod_info_t *p_prod)
+
+FUNCTION DESCRIPTION
+	parse_msghdr before it was written without stdio, less the logging.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			I		message header buffer
+	size_t			buflen		I		bytes in buf
+	prod_info_t *	p_prod		O		prod info struct for parsed info
+
+RETURNS
+	 length of message
+	-1: otherwise
+*******************************************************************************/
+static int old_parse_msghdr(char *buf, size_t buflen, prod_info_t *p_prod)
+{
+	int msg_size;
+	char anbi[3];
+	char scanbuf[MSG_HDR_LEN+PROD_HDR_LEN+1];
+
+	/* header length must always equal MSG_HDR_LEN+PROD_HDR_LEN */
+	if (buflen < MSG_HDR_LEN+PROD_HDR_LEN) {
+		return -1;
+	}
+
+	/* copy header into a null-terminated scan buffer */
+	memcpy(scanbuf, buf, MSG_HDR_LEN+PROD_HDR_LEN);
+	scanbuf[MSG_HDR_LEN+PROD_HDR_LEN] = '\0';
+
+	if (sscanf(scanbuf, "%8d%2s\001\r\r\n%5d%10ld\r\r\n",
+			&msg_size, anbi, &p_prod->seqno, &p_prod->queue_time) != 4) {
+		return -1;
+	}
+
+	p_prod->size = msg_size - PROD_HDR_LEN;
+
+	return MSG_HDR_LEN+PROD_HDR_LEN;
+}	/* end old_parse_msghdr */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int old_format_ack(char *buf, int seqno, char code)
+
+FUNCTION DESCRIPTION
+	format_ack before it was written without stdio, less the logging.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			O		buffer for ack message
+	int				seqno		I		seqno being acked
+	char			code		I		ack status code
+
+RETURNS
+	 length of message
+	-1: otherwise
+*******************************************************************************/
+static int old_format_ack(char *buf, int seqno, char code)
+{
+	sprintf (buf, "%5d%c", seqno, code);
+
+	/* ack message length must always equal ACK_MSG_LEN */
+	if (strlen(buf) != ACK_MSG_LEN) {
+		return -1;
+	}
+
+	return ACK_MSG_LEN;
+}	/* end old_format_ack */
+
+/*******************************************************************************
+FUNCTION NAME
+	static int old_parse_ack(char *buf, size_t buflen, int *p_seqno,
+				char *p_code)
+
+FUNCTION DESCRIPTION
+	parse_ack before it was written without stdio, less the logging.
+
+PARAMETERS
+	Type			Name		I/O		Description
+	char *			buf			I		ack message buffer
+	size_t			buflen		I		bytes in buf
+	int *			p_seqno		O		address for seqno
+	char *			p_code		O		address for ack status code
+
+RETURNS
+	 length of message
+	-1: otherwise
+*******************************************************************************/
+static int old_parse_ack(char *buf, size_t buflen, int *p_seqno, char *p_code)
+{
+	char scanbuf[MSG_HDR_LEN+PROD_HDR_LEN+1];
+
+	/* ack message length must always equal ACK_MSG_LEN */
+	if (buflen < ACK_MSG_LEN) {
+		return -1;
+	}
+
+	/* copy ack message into a null-terminated scan buffer */
+	memcpy(scanbuf, buf, ACK_MSG_LEN);
+	scanbuf[ACK_MSG_LEN] = '\0';
+
+	if (sscanf(scanbuf, "%d%c", p_seqno, p_code) != 2) {
+		return -1;
+	}
+
+	return ACK_MSG_LEN;
+}	/* end old_parse_ack */
+
+/*******************************************************************************
+FUNCTION NAME
+	static long long pick(long long min, long long max)
+
+FUNCTION DESCRIPTION
+	Get a random value from min to max.  One time in four it is min, max,
+	or next to one of them, where formatting is most likely to go wrong;
+	one time in four it has a random number of digits.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	long long		min				I	smallest value
+	long long		max				I	largest value
+
+RETURNS
+	value picked
+*******************************************************************************/
+static long long pick(long long min, long long max)
+{
+	long long val;
+	long long span;
+
+	switch (rnd() % 4) {
+		case 0:
+			val = rnd() % 2 ? min + (long long)(rnd() % 2)
+					: max - (long long)(rnd() % 2);
+			break;
+		case 1:
+			/* 1 to 10 digits */
+			for (val = 1, span = 1 + rnd() % 10; span > 0; span--) {
+				val *= 10;
+			}
+			val = min + (long long)(rnd() % (unsigned long long)val);
+			break;
+		default:
+			val = min + (long long)(rnd() % (unsigned long long)(max - min + 1));
+			break;
+	}
+
+	return MAX(min, MIN(val, max));
+} /* end pick */
+
+/*******************************************************************************
+FUNCTION NAME
+	static unsigned long long rnd(void)
+
+FUNCTION DESCRIPTION
+	Next number of a xorshift generator, the same for the same seed.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	void
+
+RETURNS
+	random number
+*******************************************************************************/
+static unsigned long long rnd(void)
+{
+	Seed ^= Seed << 13;
+	Seed ^= Seed >> 7;
+	Seed ^= Seed << 17;
+
+	return Seed;
+} /* end rnd */
+
+/*******************************************************************************
+FUNCTION NAME
+	static double elapsed_ns(struct timespec *p_start)
+
+FUNCTION DESCRIPTION
+	Get the nsecs since p_start on the monotonic clock.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	struct timespec *p_start		I	start time
+
+RETURNS
+	nsecs
+*******************************************************************************/
+static double elapsed_ns(struct timespec *p_start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - p_start->tv_sec) * 1e9
+			+ (now.tv_nsec - p_start->tv_nsec);
+} /* end elapsed_ns */
+
+/*******************************************************************************
+FUNCTION NAME
+	int write_log(logfile_t *p_logfile, const char *format, ...)
+
+FUNCTION DESCRIPTION
+	Take the place of log.c: the refused cases log an error each, and
+	only how many there were is of interest.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	logfile_t *		p_logfile		I	not used
+	const char *	format			I	not used
+
+RETURNS
+	 0
+*******************************************************************************/
+int write_log(logfile_t *p_logfile, const char *format, ...)
+{
+	LogCount++;
+
+	return 0;
+} /* end write_log */
+
+/*******************************************************************************
+FUNCTION NAME
+	char *log_prefix(char *program, char *file, int line)
+
+FUNCTION DESCRIPTION
+	Take the place of log.c, the heading is not written anywhere.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	char *			program			I	not used
+	char *			file			I	not used
+	int				line			I	not used
+
+RETURNS
+	empty string
+*******************************************************************************/
+char *log_prefix(char *program, char *file, int line)
+{
+	return "";
+} /* end log_prefix */
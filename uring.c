@@ -0,0 +1,336 @@
+/*******************************************************************************
+FILE NAME
+	uring.c
+
+FILE DESCRIPTION
+	Minimal io_uring support for the io_uring backends (INCLUDE_IO_URING).
+	The ring is driven with the raw io_uring_setup and io_uring_enter
+	system calls, so no liburing is needed.  One ring belongs to one thread.
+
+FUNCTIONS
+	uring_init		- set up a ring
+	uring_close		- tear down a ring
+	uring_get_sqe	- get the next free submission queue entry
+	uring_sq_space	- number of free submission queue entries
+	uring_submit	- submit queued entries and wait for completions
+	uring_peek_cqe	- get the next completion, if any
+	uring_cqe_seen	- release a completion returned by uring_peek_cqe
+
+HISTORY
+	Last delta date and time:  %G% %U%
+	         SCCS identifier:  %I%
+
+NOTICE
+		This computer software has been developed at
+		Government expense under NOAA
+		Contract 50-SPNA-3-00001.
+
+*******************************************************************************/
+static char Sccsid_uring_c[]= "@(#)uring.c 0.1 10/15/2026 12:00:00";
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "share.h"
+
+#ifdef INCLUDE_IO_URING
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*******************************************************************************
+FUNCTION NAME
+	int uring_init(uring_t *p_ring, unsigned entries)
+
+FUNCTION DESCRIPTION
+	Create a ring with room for entries submissions and map its queues.
+	Kernels without io_uring, or too old to wait with a timeout
+	(IORING_FEAT_EXT_ARG, Linux 5.11), fail so the caller can fall back.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			O	ring to set up
+	unsigned		entries			I	submission queue size
+
+RETURNS
+	 0	Normal return
+	-1	Error (errno is set)
+*******************************************************************************/
+int uring_init(uring_t *p_ring, unsigned entries)
+{
+	struct io_uring_params params;
+	char *sq_ptr;
+	char *cq_ptr;
+	int save_errno;
+
+	memset(p_ring, 0, sizeof(*p_ring));
+	memset(&params, 0, sizeof(params));
+
+	if ((p_ring->ring_fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL io_uring_setup %d entries, %s\n",
+				LOG_PREFIX, entries, strerror(errno));
+		return -1;
+	}
+
+	if (!(params.features & IORING_FEAT_EXT_ARG)
+			|| !(params.features & IORING_FEAT_NODROP)) {
+		CS_LOG_ERR(ERROR_FP, "%s: io_uring features 0x%x too old\n",
+				LOG_PREFIX, params.features);
+		close(p_ring->ring_fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	p_ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	p_ring->cq_len = params.cq_off.cqes
+			+ params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		p_ring->sq_len = p_ring->cq_len = MAX(p_ring->sq_len, p_ring->cq_len);
+	}
+	p_ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	sq_ptr = cq_ptr = MAP_FAILED;
+	p_ring->sqes = MAP_FAILED;
+	if ((sq_ptr = mmap(NULL, p_ring->sq_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, p_ring->ring_fd,
+			IORING_OFF_SQ_RING)) == MAP_FAILED
+		|| (cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr
+			: mmap(NULL, p_ring->cq_len, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, p_ring->ring_fd,
+				IORING_OFF_CQ_RING)) == MAP_FAILED
+		|| (p_ring->sqes = mmap(NULL, p_ring->sqes_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, p_ring->ring_fd,
+			IORING_OFF_SQES)) == MAP_FAILED) {
+		save_errno = errno;
+		CS_LOG_ERR(ERROR_FP, "%s: FAIL mmap io_uring queues, %s\n",
+				LOG_PREFIX, strerror(errno));
+		if (sq_ptr != MAP_FAILED) {
+			munmap(sq_ptr, p_ring->sq_len);
+		}
+		if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+			munmap(cq_ptr, p_ring->cq_len);
+		}
+		close(p_ring->ring_fd);
+		errno = save_errno;
+		return -1;
+	}
+
+	p_ring->sq_ring = sq_ptr;
+	p_ring->cq_ring = cq_ptr;
+	p_ring->sq_entries = params.sq_entries;
+	p_ring->sq_head = (unsigned *)(sq_ptr + params.sq_off.head);
+	p_ring->sq_tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+	p_ring->sq_mask = (unsigned *)(sq_ptr + params.sq_off.ring_mask);
+	p_ring->sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+	p_ring->cq_head = (unsigned *)(cq_ptr + params.cq_off.head);
+	p_ring->cq_tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+	p_ring->cq_mask = (unsigned *)(cq_ptr + params.cq_off.ring_mask);
+	p_ring->cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+	p_ring->sqe_tail = *p_ring->sq_tail;
+
+	return 0;
+} /* end uring_init */
+
+/*******************************************************************************
+FUNCTION NAME
+	void uring_close(uring_t *p_ring)
+
+FUNCTION DESCRIPTION
+	Unmap the queues and close the ring.  Operations still in flight are
+	cancelled by the kernel.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			I	ring to tear down
+
+RETURNS
+	void
+*******************************************************************************/
+void uring_close(uring_t *p_ring)
+{
+	if (p_ring->ring_fd < 0) {
+		return;
+	}
+
+	munmap(p_ring->sqes, p_ring->sqes_len);
+	if (p_ring->cq_ring != p_ring->sq_ring) {
+		munmap(p_ring->cq_ring, p_ring->cq_len);
+	}
+	munmap(p_ring->sq_ring, p_ring->sq_len);
+	close(p_ring->ring_fd);
+	p_ring->ring_fd = -1;
+} /* end uring_close */
+
+/*******************************************************************************
+FUNCTION NAME
+	struct io_uring_sqe *uring_get_sqe(uring_t *p_ring)
+
+FUNCTION DESCRIPTION
+	Get a cleared submission queue entry.  It is handed to the kernel by
+	the next uring_submit.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			I	ring
+
+RETURNS
+	address of the entry
+	NULL if the submission queue is full (call uring_submit first)
+*******************************************************************************/
+struct io_uring_sqe *uring_get_sqe(uring_t *p_ring)
+{
+	struct io_uring_sqe *p_sqe;
+	unsigned index;
+
+	if (!uring_sq_space(p_ring)) {
+		return NULL;
+	}
+
+	index = p_ring->sqe_tail & *p_ring->sq_mask;
+	p_sqe = &p_ring->sqes[index];
+	memset(p_sqe, 0, sizeof(*p_sqe));
+	p_ring->sq_array[index] = index;
+	p_ring->sqe_tail++;
+
+	return p_sqe;
+} /* end uring_get_sqe */
+
+/*******************************************************************************
+FUNCTION NAME
+	unsigned uring_sq_space(uring_t *p_ring)
+
+FUNCTION DESCRIPTION
+	Count the submission queue entries uring_get_sqe can still hand out.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			I	ring
+
+RETURNS
+	number of free entries
+*******************************************************************************/
+unsigned uring_sq_space(uring_t *p_ring)
+{
+	return p_ring->sq_entries - (p_ring->sqe_tail
+			- __atomic_load_n(p_ring->sq_head, __ATOMIC_ACQUIRE));
+} /* end uring_sq_space */
+
+/*******************************************************************************
+FUNCTION NAME
+	int uring_submit(uring_t *p_ring, int wait_ms)
+
+FUNCTION DESCRIPTION
+	Hand all queued entries to the kernel with one io_uring_enter and, if
+	wait_ms is not 0 and no completion is already waiting, wait up to
+	wait_ms milliseconds (forever if < 0) for at least one completion.
+	A signal or the timeout is not an error.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			I	ring
+	int				wait_ms			I	completion wait (0=none, <0=forever)
+
+RETURNS
+	>=0	number of entries submitted
+	-1	Error (errno is set)
+*******************************************************************************/
+int uring_submit(uring_t *p_ring, int wait_ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned to_submit;
+	unsigned min_complete;
+	unsigned flags;
+	int rc;
+
+	/* publish new entries, and resubmit any an interrupted enter left */
+	__atomic_store_n(p_ring->sq_tail, p_ring->sqe_tail, __ATOMIC_RELEASE);
+	to_submit = p_ring->sqe_tail
+			- __atomic_load_n(p_ring->sq_head, __ATOMIC_ACQUIRE);
+
+	flags = 0;
+	min_complete = 0;
+	if (wait_ms != 0 && !uring_peek_cqe(p_ring)) {
+		flags |= IORING_ENTER_GETEVENTS;
+		min_complete = 1;
+		if (wait_ms > 0) {
+			memset(&arg, 0, sizeof(arg));
+			ts.tv_sec = wait_ms / 1000;
+			ts.tv_nsec = (wait_ms % 1000) * 1000000L;
+			arg.ts = (unsigned long)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+		}
+	}
+
+	if (!to_submit && !flags) {
+		return 0;
+	}
+
+	if ((rc = syscall(__NR_io_uring_enter, p_ring->ring_fd, to_submit,
+			min_complete, flags, (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+			sizeof(arg))) < 0) {
+		if (errno == EINTR || errno == ETIME || errno == EAGAIN
+				|| errno == EBUSY) {
+			/* signal, timeout, or reap completions and try again */
+			return 0;
+		}
+		return -1;
+	}
+
+	return rc;
+} /* end uring_submit */
+
+/*******************************************************************************
+FUNCTION NAME
+	struct io_uring_cqe *uring_peek_cqe(uring_t *p_ring)
+
+FUNCTION DESCRIPTION
+	Get the oldest completion without waiting.  Release it with
+	uring_cqe_seen once its fields have been read.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			I	ring
+
+RETURNS
+	address of the completion
+	NULL if there is none
+*******************************************************************************/
+struct io_uring_cqe *uring_peek_cqe(uring_t *p_ring)
+{
+	unsigned head;
+
+	head = *p_ring->cq_head;
+	if (head == __atomic_load_n(p_ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return &p_ring->cqes[head & *p_ring->cq_mask];
+} /* end uring_peek_cqe */
+
+/*******************************************************************************
+FUNCTION NAME
+	void uring_cqe_seen(uring_t *p_ring)
+
+FUNCTION DESCRIPTION
+	Release the completion returned by uring_peek_cqe.
+
+PARAMETERS
+	Type			Name			I/O	Description
+	uring_t *		p_ring			I	ring
+
+RETURNS
+	void
+*******************************************************************************/
+void uring_cqe_seen(uring_t *p_ring)
+{
+	__atomic_store_n(p_ring->cq_head, *p_ring->cq_head + 1, __ATOMIC_RELEASE);
+} /* end uring_cqe_seen */
+
+#endif /* INCLUDE_IO_URING */